@@ -0,0 +1,22 @@
+/**
+ * Point and spot lights, listed for each cluster of the view frustum by
+ * LightClusterer. Expects uLighting to hold the froxel grid.
+ */
+#include <Light>
+
+@group(2) @binding(0) var<storage, read> lights: array<Light>;
+// Offset and count of the lights of each cluster in lightIndices
+@group(2) @binding(1) var<storage, read> clusters: array<vec2u>;
+@group(2) @binding(2) var<storage, read> lightIndices: array<u32>;
+
+// Index of the cluster containing a fragment, with the same slicing as LightClusterer
+fn clusterIndex(fragmentPosition: vec4f) -> u32
+{
+	let near = uLighting.cameraNear;
+	let far = uLighting.cameraFar;
+	let viewDepth = near * far / (far - fragmentPosition.z * (far - near));
+	let grid = uLighting.gridSize.xyz;
+	let tile = clamp(vec2u(fragmentPosition.xy / uLighting.viewportSize * vec2f(grid.xy)), vec2u(0u), grid.xy - 1u);
+	let slice = u32(clamp(floor(log(viewDepth) * uLighting.sliceScale - uLighting.sliceBias), 0.0, f32(grid.z - 1u)));
+	return (slice * grid.y + tile.y) * grid.x + tile.x;
+}
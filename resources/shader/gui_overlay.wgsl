@@ -0,0 +1,20 @@
+/**
+ * Draw the cached GUI overlay over the frame. The overlay holds colors
+ * premultiplied by their alpha, as left by the blending of ImGui over a
+ * transparent target, and has at least the size of the frame.
+ */
+@group(0) @binding(0) var overlayTexture: texture_2d<f32>;
+
+// A single triangle covering the whole screen, without any vertex buffer
+@vertex
+fn vs_main(@builtin(vertex_index) vertexIndex: u32) -> @builtin(position) vec4f
+{
+	let uv = vec2f(f32((vertexIndex << 1u) & 2u), f32(vertexIndex & 2u));
+	return vec4f(uv.x * 2.0 - 1.0, 1.0 - uv.y * 2.0, 0.0, 1.0);
+}
+
+@fragment
+fn fs_main(@builtin(position) position: vec4f) -> @location(0) vec4f
+{
+	return textureLoad(overlayTexture, vec2i(position.xy), 0);
+}
@@ -19,7 +19,8 @@ struct VertexInput
  */
 struct VertexOutput
 {
-    @builtin(position) position: vec4f,
+    // Invariant so that the depth prepass computes the very same depth
+    @invariant @builtin(position) position: vec4f,
     @location(0) color: vec3f,
 	@location(1) normal: vec3f,
 	@location(2) uv: vec2f,
@@ -29,35 +30,99 @@ struct VertexOutput
 };
 
 /**
- * A structure holding the value of our uniforms
+ * Uniform structures, generated from their C++ declarations in Application.h
  */
-struct MyUniforms
-{
-	projectionMatrix: mat4x4f,
-	viewMatrix: mat4x4f,
-	modelMatrix: mat4x4f,
-    color: vec4f,
-	cameraWorldPosition: vec3f,
-    time: f32,
-};
-
-struct LightingUniforms
-{
-	directions: array<vec4f, 2>,
-	colors: array<vec4f, 2>,
-	hardness: f32,
-	kd: f32,
-	ks: f32,
-};
+#include <MyUniforms>
+#include <LightingUniforms>
+#include <ObjectUniforms>
 
 @group(0) @binding(0) var<uniform> uMyUniforms: MyUniforms;
-@group(0) @binding(1) var baseColorTexture: texture_2d<f32>;
-@group(0) @binding(2) var normalTexture: texture_2d<f32>;
+// Textures of all the materials, the layers of the object are in uObject.materialLayers
+@group(0) @binding(1) var materialTextures: texture_2d_array<f32>;
 @group(0) @binding(3) var textureSampler: sampler;
 @group(0) @binding(4) var<uniform> uLighting: LightingUniforms;
+// One layer per directional light, see ShadowMaps
+@group(0) @binding(5) var shadowMaps: texture_depth_2d_array;
+@group(0) @binding(6) var shadowSampler: sampler_comparison;
+// Pages of the virtual textures, see VirtualTextures: the cache holding them with their border, the page tables
+// giving (slot x, slot y, level, set) for each page of each level, and the pages asked for by this frame
+@group(0) @binding(7) var tileCache: texture_2d<f32>;
+@group(0) @binding(8) var pageTables: texture_2d_array<u32>;
+@group(0) @binding(9) var<storage, read_write> pageRequests: array<atomic<u32>>;
+
+// Uniforms of the object being drawn, selected with a dynamic offset, with the layers of its material
+@group(1) @binding(0) var<uniform> uObject: ObjectUniforms;
+
+// Layer of a material without the corresponding texture, TextureArrayPool::kInvalidLayer
+const noLayer = 0xffffffffu;
+
+// Sample a layer of the material textures no finer than its first resident mip level, see TextureStreamer
+fn sampleMaterial(layer: u32, residentLevel: u32, uv: vec2f) -> vec4f
+{
+	let texelUv = uv * vec2f(textureDimensions(materialTextures));
+	let dx = dpdx(texelUv);
+	let dy = dpdy(texelUv);
+	let level = 0.5 * log2(max(dot(dx, dx), dot(dy, dy)));
+	return textureSampleLevel(materialTextures, textureSampler, uv, layer, max(level, f32(residentLevel)));
+}
+
+// Sample a virtual texture (index, pages across, pages down, levels) from the finest cached page covering `uv`,
+// after asking for the page at the level the pixel footprint calls for
+fn sampleVirtual(vt: vec4u, uv: vec2f, fallback: vec3f) -> vec3f
+{
+	let pages = vt.yz;
+	let texelUv = uv * vec2f(pages * VT_TILE_SIZE);
+	let dx = dpdx(texelUv);
+	let dy = dpdy(texelUv);
+	let lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy)));
+	let level = u32(clamp(lod, 0.0, f32(vt.w - 1u)));
+
+	let wrappedUv = fract(uv);
+	let levelPages = max(pages >> vec2u(level), vec2u(1u));
+	let page = min(vec2u(wrappedUv * vec2f(levelPages)), levelPages - 1u);
+
+	// Most pixels find the page already marked, which saves the write
+	var offset = vt.x * VT_FEEDBACK_WORDS;
+	for (var l = 0u; l < level; l++)
+	{
+		let side = VT_MAX_PAGES >> l;
+		offset += side * side;
+	}
+	let request = offset + page.y * (VT_MAX_PAGES >> level) + page.x;
+	if (atomicLoad(&pageRequests[request]) == 0u)
+	{
+		atomicStore(&pageRequests[request], 1u);
+	}
+
+	// Missing pages point to their finest cached ancestor, whose level tells how much of it the page covers
+	let entry = textureLoad(pageTables, page, vt.x, level);
+	if (entry.a == 0u)
+	{
+		return fallback;
+	}
+	let entryPages = max(pages >> vec2u(entry.b), vec2u(1u));
+	let inPage = fract(wrappedUv * vec2f(entryPages));
+	let texel = vec2f(entry.rg * VT_SLOT_SIZE + VT_BORDER) + inPage * f32(VT_TILE_SIZE);
+	return textureSampleLevel(tileCache, textureSampler, texel / f32(VT_CACHE_SIZE), 0.0).rgb;
+}
+
+#include "clustered_lights.wgsl"
 
 const pi = 3.14159265359;
 
+/**
+ * Features of the pipeline variant, set by PipelineVariants when creating the
+ * pipeline so that the unused ones are compiled out
+ */
+override directionalLightCount: u32 = 2u;
+override useNormalMap: bool = true;
+override useSpecular: bool = true;
+override gammaCorrection: bool = true;
+override useShadows: bool = true;
+
+// Directional light whose shadow map is rendered by vs_shadow
+override shadowLight: u32 = 0u;
+
 // Build an orthographic projection matrix
 fn makeOrthographicProj(ratio: f32, near: f32, far: f32, scale: f32) -> mat4x4f {
 	return transpose(mat4x4f(
@@ -83,58 +148,165 @@ fn makePerspectiveProj(ratio: f32, near: f32, far: f32, focalLength: f32) -> mat
 fn vs_main(in: VertexInput) -> VertexOutput
 {
     var out: VertexOutput;
-	let worldPosition = uMyUniforms.modelMatrix * vec4<f32>(in.position, 1.0);
+	let modelMatrix = uMyUniforms.modelMatrix * uObject.modelMatrix;
+	let worldPosition = modelMatrix * vec4<f32>(in.position, 1.0);
 	out.position = uMyUniforms.projectionMatrix * uMyUniforms.viewMatrix * worldPosition;
-	out.tangent = (uMyUniforms.modelMatrix * vec4f(in.tangent, 0.0)).xyz;
-	out.bitangent = (uMyUniforms.modelMatrix * vec4f(in.bitangent, 0.0)).xyz;
-	out.normal = (uMyUniforms.modelMatrix * vec4f(in.normal, 0.0)).xyz;
+	out.tangent = (modelMatrix * vec4f(in.tangent, 0.0)).xyz;
+	out.bitangent = (modelMatrix * vec4f(in.bitangent, 0.0)).xyz;
+	out.normal = (modelMatrix * vec4f(in.normal, 0.0)).xyz;
 	out.color = in.color;
 	out.uv = in.uv;
 	out.viewDirection = uMyUniforms.cameraWorldPosition - worldPosition.xyz;
 	return out;
 }
 
+/**
+ * Depth prepass, the position is computed exactly like in vs_main
+ */
+@vertex
+fn vs_depth(@location(0) position: vec3f) -> @invariant @builtin(position) vec4f
+{
+	let modelMatrix = uMyUniforms.modelMatrix * uObject.modelMatrix;
+	let worldPosition = modelMatrix * vec4<f32>(position, 1.0);
+	return uMyUniforms.projectionMatrix * uMyUniforms.viewMatrix * worldPosition;
+}
+
+/**
+ * Shadow map pass of a directional light, with the projection fitted by ShadowMaps
+ */
+@vertex
+fn vs_shadow(@location(0) position: vec3f) -> @builtin(position) vec4f
+{
+	let modelMatrix = uMyUniforms.modelMatrix * uObject.modelMatrix;
+	return uLighting.shadowMatrices[shadowLight] * modelMatrix * vec4<f32>(position, 1.0);
+}
+
+// Fraction of a directional light reaching a point, filtered over 3x3 comparisons that each blend 2x2 texels
+fn shadowFactor(light: u32, worldPosition: vec3f) -> f32
+{
+	let lightPosition = uLighting.shadowMatrices[light] * vec4f(worldPosition, 1.0);
+	let uv = lightPosition.xy * vec2f(0.5, -0.5) + 0.5;
+	let depth = lightPosition.z - uLighting.shadowBias;
+	if (any(uv < vec2f(0.0)) || any(uv > vec2f(1.0)) || depth > 1.0)
+	{
+		return 1.0;
+	}
+
+	let texelSize = 1.0 / vec2f(textureDimensions(shadowMaps));
+	var lit = 0.0;
+	for (var y = -1; y <= 1; y++)
+	{
+		for (var x = -1; x <= 1; x++)
+		{
+			let offset = vec2f(f32(x), f32(y)) * texelSize;
+			lit += textureSampleCompareLevel(shadowMaps, shadowSampler, uv + offset, light, depth);
+		}
+	}
+	return lit / 9.0;
+}
+
 @fragment
 fn fs_main(in: VertexOutput) -> @location(0) vec4f
 {
-	// Sample normal
-	let normalMapStrength = 0.5; // could be a uniform
-	let encodedN = textureSample(normalTexture, textureSampler, in.uv).rgb;
-	let localN = encodedN * 2.0 - 1.0;
-	// The TBN matrix converts directions from the local space to the world space
-	let localToWorld = mat3x3f(
-		normalize(in.tangent),
-		normalize(in.bitangent),
-		normalize(in.normal),
-	);
-	let worldN = localToWorld * localN;
-	let N = normalize(mix(in.normal, worldN, normalMapStrength));
+	var N = normalize(in.normal);
+	if (useNormalMap && uObject.materialLayers.y != noLayer)
+	{
+		// Sample normal
+		let encodedN = sampleMaterial(uObject.materialLayers.y, uObject.materialLayers.w, in.uv).rgb;
+		let localN = encodedN * 2.0 - 1.0;
+		// The TBN matrix converts directions from the local space to the world space
+		let localToWorld = mat3x3f(
+			normalize(in.tangent),
+			normalize(in.bitangent),
+			normalize(in.normal),
+		);
+		let worldN = localToWorld * localN;
+		N = normalize(mix(in.normal, worldN, uLighting.normalMapStrength));
+	}
 
 	let V = normalize(in.viewDirection);
 
-	// Sample texture
-	let baseColor = textureSample(baseColorTexture, textureSampler, in.uv).rgb;
+	// Sample texture, the material falls back to its diffuse color without one
+	var baseColor = uObject.baseColor.rgb;
+	if (uObject.virtualTexture.x != noLayer)
+	{
+		baseColor = sampleVirtual(uObject.virtualTexture, in.uv, baseColor);
+	}
+	else if (uObject.materialLayers.x != noLayer)
+	{
+		baseColor = sampleMaterial(uObject.materialLayers.x, uObject.materialLayers.z, in.uv).rgb;
+	}
 	let kd = uLighting.kd; // strength of the diffuse effect
 	let ks = uLighting.ks; // strength of the specular effect
 	let hardness = uLighting.hardness;
 
+	let worldPosition = uMyUniforms.cameraWorldPosition - in.viewDirection;
+
 	var color = vec3f(0.0);
-	for (var i : i32 = 0; i < 2; i++)
+	for (var i : u32 = 0u; i < min(directionalLightCount, MAX_DIRECTIONAL_LIGHTS); i++)
 	{
-		let lightColor = uLighting.colors[i].rgb;
+		var shadow = 1.0;
+		if (useShadows)
+		{
+			shadow = shadowFactor(i, worldPosition);
+		}
+		let lightColor = uLighting.colors[i].rgb * shadow;
 		let L = normalize(uLighting.directions[i].xyz);
-		let R = reflect(-L, N);
 
 		let diffuse = max(0.0, dot(L, N)) * lightColor;
+		color += baseColor * kd * diffuse;
+
+		if (useSpecular)
+		{
+			// We clamp the dot product to 0 when it is negative
+			let R = reflect(-L, N);
+			let RoV = max(0.0, dot(R, V));
+			let specular = pow(RoV, hardness);
+			color += ks * specular * shadow;
+		}
+	}
 
-		// We clamp the dot product to 0 when it is negative
-		let RoV = max(0.0, dot(R, V));
-		let specular = pow(RoV, hardness);
+	// Only the lights whose range overlaps the cluster of the fragment
+	if (uLighting.lightCount > 0u)
+	{
+		let cluster = clusters[clusterIndex(in.position)];
+		for (var i = cluster.x; i < cluster.x + cluster.y; i++)
+		{
+			let light = lights[lightIndices[i]];
+			let toLight = light.positionRange.xyz - worldPosition;
+			let lightDistance = length(toLight);
+			let L = toLight / max(lightDistance, 1e-4);
+
+			// Inverse square falloff, smoothly brought to zero at the range of the light
+			let fade = saturate(1.0 - pow(lightDistance / light.positionRange.w, 4.0));
+			let attenuation = fade * fade / (1.0 + lightDistance * lightDistance);
+			let cone = smoothstep(light.directionCosOuter.w, light.cosInner.x, dot(-L, light.directionCosOuter.xyz));
+			let lightColor = light.colorIntensity.rgb * light.colorIntensity.a * attenuation * cone;
 
-		color += baseColor * kd * diffuse + ks * specular;
+			let diffuse = max(0.0, dot(L, N)) * lightColor;
+			color += baseColor * kd * diffuse;
+			if (useSpecular)
+			{
+				let R = reflect(-L, N);
+				color += ks * pow(max(0.0, dot(R, V)), hardness) * lightColor;
+			}
+		}
 	}
 
     // Gamma-correction
-    let corrected_color = pow(color, vec3f(2.2));
-    return vec4f(corrected_color, uMyUniforms.color.a);
+    if (gammaCorrection)
+    {
+        color = pow(color, vec3f(2.2));
+    }
+    // Only transparent materials are drawn with blending, see RenderQueue
+    return vec4f(color, uMyUniforms.color.a * uObject.baseColor.a);
+}
+
+/**
+ * Overdraw view, each shaded fragment adds the same amount to the pixel
+ */
+@fragment
+fn fs_overdraw(in: VertexOutput) -> @location(0) vec4f
+{
+	return vec4f(0.1, 0.04, 0.02, 1.0);
 }
@@ -0,0 +1,59 @@
+/**
+ * Scale the scene rendered at a lower resolution to the size of the swap
+ * chain, with an optional sharpening to compensate for the bilinear blur.
+ */
+struct UpscaleUniforms
+{
+	// Size of the rendered region, relative to the size of the source texture
+	uvScale: vec2f,
+	// Size of a texel of the source texture in uv
+	texelSize: vec2f,
+	sharpness: f32,
+};
+
+@group(0) @binding(0) var sourceTexture: texture_2d<f32>;
+@group(0) @binding(1) var sourceSampler: sampler;
+@group(0) @binding(2) var<uniform> uUpscale: UpscaleUniforms;
+
+struct VertexOutput
+{
+	@builtin(position) position: vec4f,
+	@location(0) uv: vec2f,
+};
+
+// A single triangle covering the whole screen, without any vertex buffer
+@vertex
+fn vs_main(@builtin(vertex_index) vertexIndex: u32) -> VertexOutput
+{
+	var out: VertexOutput;
+	let uv = vec2f(f32((vertexIndex << 1u) & 2u), f32(vertexIndex & 2u));
+	out.position = vec4f(uv.x * 2.0 - 1.0, 1.0 - uv.y * 2.0, 0.0, 1.0);
+	out.uv = uv;
+	return out;
+}
+
+// Sample the source without reading outside of the rendered region
+fn sampleSource(uv: vec2f) -> vec3f
+{
+	let uvMax = uUpscale.uvScale - 0.5 * uUpscale.texelSize;
+	return textureSample(sourceTexture, sourceSampler, clamp(uv, 0.5 * uUpscale.texelSize, uvMax)).rgb;
+}
+
+@fragment
+fn fs_main(in: VertexOutput) -> @location(0) vec4f
+{
+	let uv = in.uv * uUpscale.uvScale;
+	let t = uUpscale.texelSize;
+
+	let center = sampleSource(uv);
+	let north = sampleSource(uv - vec2f(0.0, t.y));
+	let south = sampleSource(uv + vec2f(0.0, t.y));
+	let west = sampleSource(uv - vec2f(t.x, 0.0));
+	let east = sampleSource(uv + vec2f(t.x, 0.0));
+
+	// Unsharp mask, clamped to the range of the neighborhood to avoid halos
+	let sharpened = center + uUpscale.sharpness * (4.0 * center - north - south - west - east);
+	let lower = min(center, min(min(north, south), min(west, east)));
+	let upper = max(center, max(max(north, south), max(west, east)));
+	return vec4f(clamp(sharpened, lower, upper), 1.0);
+}
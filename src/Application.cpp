@@ -15,19 +15,73 @@
 #include <imgui_impl_glfw.h>
 #include "backends/imgui_impl_wgpu.h"
 
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <chrono>
+#include <cmath>
 #include <filesystem>
 #include <iostream>
+#include <numeric>
+#include <random>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <utility>
 
 using namespace wgpu;
 using VertexAttributes = ResourceManager::VertexAttributes;
+using MemoryCategory   = GpuMemoryTracker::Category;
 
 constexpr float PI = 3.14159265358979323846f;
 
-TextureView GetNextSurfaceTextureView(Surface surface);
+// Longest time spent waiting for events when there is nothing to render, so that polled state is still updated
+constexpr double kIdleWaitSeconds = 1.0;
+
+// Depth range of the camera, also used to slice the view frustum into light clusters
+constexpr float kCameraNear = 0.01f;
+constexpr float kCameraFar  = 100.0f;
+
+static const TextureFormat kShadowMapFormat = TextureFormat::Depth32Float;
+
+// Material textures share one texture array of this size, with at most this many layers
+constexpr uint32_t kMaterialTextureSize = 2048;
+constexpr uint32_t kMaxMaterialLayers   = 64;
+
+TextureView GetNextSurfaceTextureView(Surface surface, SurfaceGetCurrentTextureStatus& status, Texture& texture);
+
+// Present modes, by the names used on the command line
+static const std::array<std::pair<WGPUPresentMode, const char*>, 4> kPresentModeNames = {{
+    {PresentMode::Fifo, "fifo"},
+    {PresentMode::FifoRelaxed, "fifo-relaxed"},
+    {PresentMode::Mailbox, "mailbox"},
+    {PresentMode::Immediate, "immediate"},
+}};
+
+static const char* presentModeName(PresentMode mode)
+{
+    for (const auto& [value, name] : kPresentModeNames)
+    {
+        if (value == mode)
+            return name;
+    }
+    return "unknown";
+}
+
+// Mean, 95th percentile and maximum of frame times, as a JSON object
+static void writeFrameTimes(std::ostream& out, std::vector<double> milliseconds)
+{
+    if (milliseconds.empty())
+    {
+        out << "{\"frames\": 0}";
+        return;
+    }
+    std::sort(milliseconds.begin(), milliseconds.end());
+    double mean = std::accumulate(milliseconds.begin(), milliseconds.end(), 0.0) / milliseconds.size();
+    out << "{\"frames\": " << milliseconds.size() << ", \"meanMilliseconds\": " << mean
+        << ", \"p95Milliseconds\": " << milliseconds[milliseconds.size() * 95 / 100]
+        << ", \"maxMilliseconds\": " << milliseconds.back() << "}";
+}
 
 // Custom ImGui widgets
 namespace ImGui
@@ -44,14 +98,55 @@ namespace ImGui
 ///////////////////////////////////////////////////////////////////////////////
 // Public methods
 
-bool Application::onInit()
+bool Application::onInit(const Options& options)
 {
+    m_startup.startTime = std::chrono::steady_clock::now();
+    // The window is then hidden and frames are rendered offscreen, see initSwapChain
+    m_headless.active = options.headlessFrames > 0;
+    m_headless.frames = static_cast<int>(options.headlessFrames);
     if (!initWindowAndDevice())
         return false;
+
+    if (!options.presentMode.empty())
+    {
+        auto supported = std::find_if(m_presentModes.begin(),
+                                      m_presentModes.end(),
+                                      [&](PresentMode mode) { return options.presentMode == presentModeName(mode); });
+        if (supported != m_presentModes.end())
+            m_presentMode = *supported;
+        else
+            std::cerr << "Present mode '" << options.presentMode << "' is not supported, using fifo" << std::endl;
+    }
+    m_framePacer.setTargetFps(options.targetFps);
+    m_redraw.onDemand   = options.onDemand;
+    m_guiOverlay.cached = options.guiCache;
+    m_gpuMemory.setBudget(uint64_t(options.gpuBudgetMegabytes) * 1024 * 1024);
+    m_modelPath = options.modelPath;
+    if (options.vertexChunkMegabytes > 0)
+    {
+        m_maxVertexBufferSize = std::min(m_maxVertexBufferSize, uint64_t(options.vertexChunkMegabytes) * 1024 * 1024);
+    }
+    if (options.dynamicResolutionMilliseconds > 0.0f)
+    {
+        m_dynamicResolution.enabled                = true;
+        m_resolution.settings().targetMilliseconds = options.dynamicResolutionMilliseconds;
+    }
+    if (!options.recordFormat.empty())
+    {
+        m_recordFormat = options.recordFormat == "png" ? FrameRecorder::Format::Png : FrameRecorder::Format::Rle;
+        if (options.recordFormat != "png" && options.recordFormat != "rle")
+            std::cerr << "Unknown recording format '" << options.recordFormat << "', using rle" << std::endl;
+        m_recorder.start("recordings", m_recordFormat);
+    }
+
     if (!initSwapChain())
         return false;
     if (!initDepthBuffer())
         return false;
+    if (!initShaderSources())
+        return false;
+    if (!initUpscale())
+        return false;
     if (!initBindGroupLayout())
         return false;
     if (!initRenderPipeline())
@@ -64,48 +159,151 @@ bool Application::onInit()
         return false;
     if (!initLightingUniforms())
         return false;
+    if (!initShadowMaps())
+        return false;
     if (!initBindGroup())
         return false;
+    if (!initScene())
+        return false;
+    if (!initLights())
+        return false;
+    if (!initCommandRecording())
+        return false;
     if (!initGui())
         return false;
+    if (!initGuiOverlay())
+        return false;
+
+    if (options.benchmarkEncodingDraws > 0)
+    {
+        // Replicate the model until there are enough draws, and draw all of them
+        float replicas           = std::sqrt(static_cast<float>(options.benchmarkEncodingDraws) / m_submeshes.size());
+        m_scene.replicas         = static_cast<int>(std::ceil(replicas));
+        m_scene.cullingEnabled   = false;
+        m_scene.rebuildRequested = true;
+
+        // Cached bundles would be replayed without encoding anything, the static scene never invalidates them
+        m_benchmark.active             = true;
+        m_benchmark.draws              = options.benchmarkEncodingDraws;
+        m_benchmark.bundleCacheEnabled = m_bundleCache.enabled;
+        m_bundleCache.enabled          = false;
+        m_benchmark.threadCounts.push_back(0);
+        uint32_t concurrency = m_threadPool->concurrency();
+        for (uint32_t threadCount = 1; threadCount < concurrency; threadCount *= 2)
+        {
+            m_benchmark.threadCounts.push_back(static_cast<int>(threadCount));
+        }
+        m_benchmark.threadCounts.push_back(static_cast<int>(concurrency));
+        configureBenchmarkRun();
+    }
+
+    if (options.benchmarkLightsMax > 0)
+    {
+        // Measure the frame with no light, then doubling light counts up to the maximum
+        uint32_t maxLights      = std::min(options.benchmarkLightsMax, LightClusterer::kMaxLights);
+        m_lightBenchmark.active = true;
+        m_lightBenchmark.lightCounts.push_back(0);
+        for (uint32_t lightCount = 16; lightCount < maxLights; lightCount *= 2)
+        {
+            m_lightBenchmark.lightCounts.push_back(static_cast<int>(lightCount));
+        }
+        m_lightBenchmark.lightCounts.push_back(static_cast<int>(maxLights));
+        configureLightBenchmarkRun();
+    }
+
     return true;
 }
 
 void Application::onFrame()
 {
+    // Wait before polling events so that the frame uses the most recent input
+    m_framePacer.waitForNextFrame();
+    updatePresentMode();
+
     updateLightingUniforms();
     updateDragInertia();
+    updateTextureStreaming();
+    updateVirtualTextures();
+    m_frameCapture.update();
+    m_recorder.update();
+    updateHeadless();
+
+    // Block until something happens when there is nothing to draw
+    if (isMinimized() || !needsRedraw())
+        glfwWaitEventsTimeout(kIdleWaitSeconds);
+    else
+        glfwPollEvents();
+
+    updateRenderPipeline();
+    selectPipelineVariant();
+    applyPendingResize();
+    if (isMinimized() || !needsRedraw())
+    {
+        ++m_redraw.idleWakeups;
+        return;
+    }
 
-    glfwPollEvents();
+    if (!updateScene())
+        return;
+    cullScene();
+    queueSceneDraws();
+    updateSceneTargets();
+    updateLights();
 
     // Update uniform buffer
     m_uniforms.time = static_cast<float>(glfwGetTime());
-    m_queue.writeBuffer(m_uniformBuffer, offsetof(MyUniforms, time), &m_uniforms.time, sizeof(MyUniforms::time));
+    m_uploads.writeBuffer(m_uniformBuffer, offsetof(MyUniforms, time), &m_uniforms.time, sizeof(MyUniforms::time));
 
-    wgpu::TextureView nextTexture = GetNextSurfaceTextureView(m_surface);
-    if (!nextTexture)
+    wgpu::Texture frameTexture    = nullptr;
+    wgpu::TextureView nextTexture = nullptr;
+    if (m_headless.active)
     {
-        std::cerr << "Cannot acquire next swap chain texture" << std::endl;
-        return;
+        frameTexture = m_headless.target.texture;
+        nextTexture  = m_headless.target.view;
+    }
+    else
+    {
+        SurfaceGetCurrentTextureStatus status;
+        nextTexture = GetNextSurfaceTextureView(m_surface, status, frameTexture);
+        if (!nextTexture)
+        {
+            // An outdated or lost surface recovers once reconfigured, only report the first failure in a row
+            if (m_redraw.acquireFailures++ == 0)
+                std::cerr << "Cannot acquire next swap chain texture (status " << status << ")" << std::endl;
+            if (status == SurfaceGetCurrentTextureStatus::Outdated || status == SurfaceGetCurrentTextureStatus::Lost)
+                initSwapChain();
+            requestRedraw();
+            return;
+        }
+        m_redraw.acquireFailures = 0;
     }
 
+    // Screenshots and recordings show the frame as presented, GUI included. When the swap chain cannot be copied
+    // from, a captured frame is rendered to m_frameCopyTarget instead, then drawn to the swap chain
+    m_recorder.captureFrame(m_frameCapture);
+    bool frameCopy = !m_headless.active && !m_surfaceCopySrc && m_frameCapture.pending();
+    updateFrameCopyTarget(frameCopy);
+    wgpu::TextureView frameView  = frameCopy ? m_frameCopyTarget.view : nextTexture;
+    wgpu::Texture captureTexture = frameCopy ? m_frameCopyTarget.texture : frameTexture;
+    // A screenshot requested by the GUI of this frame is then taken from the next one
+    bool canCapture = m_headless.active || m_surfaceCopySrc || frameCopy;
+
     CommandEncoderDescriptor commandEncoderDesc;
     commandEncoderDesc.label = "Command Encoder";
     CommandEncoder encoder   = m_device.createCommandEncoder(commandEncoderDesc);
 
-    RenderPassDescriptor renderPassDesc {};
+    // The scene goes either directly to the swap chain or to its own targets when its resolution is scaled
+    bool upscale = m_dynamicResolution.enabled;
 
     RenderPassColorAttachment renderPassColorAttachment {};
-    renderPassColorAttachment.view          = nextTexture;
+    renderPassColorAttachment.view          = upscale ? m_sceneColorTarget.view : frameView;
     renderPassColorAttachment.resolveTarget = nullptr;
     renderPassColorAttachment.loadOp        = LoadOp::Clear;
     renderPassColorAttachment.storeOp       = StoreOp::Store;
     renderPassColorAttachment.clearValue    = Color {0.05, 0.05, 0.05, 1.0};
-    renderPassDesc.colorAttachmentCount     = 1;
-    renderPassDesc.colorAttachments         = &renderPassColorAttachment;
 
     RenderPassDepthStencilAttachment depthStencilAttachment;
-    depthStencilAttachment.view              = m_depthTextureView;
+    depthStencilAttachment.view              = upscale ? m_sceneDepthTarget.view : m_depthTarget.view;
     depthStencilAttachment.depthClearValue   = 1.0f;
     depthStencilAttachment.depthLoadOp       = LoadOp::Clear;
     depthStencilAttachment.depthStoreOp      = StoreOp::Store;
@@ -120,54 +318,156 @@ void Application::onFrame()
 #endif
     depthStencilAttachment.stencilReadOnly = true;
 
+    m_recording.encodeMicroseconds = 0.0f;
+    m_recording.bundleCount        = 0;
+    m_drawCounters                 = {};
+
+    encodeShadowMaps(encoder);
+
+    if (m_depthPrepass.enabled)
+    {
+        // Lay down the depth of the visible surfaces first, so that the main pass shades each pixel once
+        RenderPassDescriptor prepassDesc {};
+        prepassDesc.colorAttachmentCount   = 0;
+        prepassDesc.colorAttachments       = nullptr;
+        prepassDesc.depthStencilAttachment = &depthStencilAttachment;
+        prepassDesc.timestampWrites        = nullptr;
+        RenderPassEncoder prepass          = encoder.beginRenderPass(prepassDesc);
+        setSceneViewport(prepass);
+        encodeScene(prepass, ScenePass::Depth);
+        prepass.end();
+        prepass.release();
+
+        depthStencilAttachment.depthLoadOp = LoadOp::Load;
+    }
+
+    RenderPassDescriptor renderPassDesc {};
+    renderPassDesc.colorAttachmentCount   = 1;
+    renderPassDesc.colorAttachments       = &renderPassColorAttachment;
     renderPassDesc.depthStencilAttachment = &depthStencilAttachment;
+    renderPassDesc.timestampWrites        = nullptr;
+    RenderPassEncoder renderPass          = encoder.beginRenderPass(renderPassDesc);
+
+    setSceneViewport(renderPass);
+    encodeScene(renderPass, ScenePass::Color);
+
+    renderPass.end();
+    renderPass.release();
 
-    renderPassDesc.timestampWrites = nullptr;
-    RenderPassEncoder renderPass   = encoder.beginRenderPass(renderPassDesc);
+    // The pages the color pass asked for, read back by the next frames
+    m_virtualTextures.encodeFeedback(encoder);
 
-    renderPass.setPipeline(m_pipeline);
+    updateGui();
+    encodeGuiOverlay(encoder);
 
-    renderPass.setVertexBuffer(0, m_vertexBuffer, 0, m_vertexCount * sizeof(VertexAttributes));
+    // The GUI is drawn at the resolution of the swap chain, over the upscaled scene
+    RenderPassColorAttachment overlayColorAttachment {};
+    overlayColorAttachment.view          = frameView;
+    overlayColorAttachment.resolveTarget = nullptr;
+    overlayColorAttachment.loadOp        = upscale ? LoadOp::Clear : LoadOp::Load;
+    overlayColorAttachment.storeOp       = StoreOp::Store;
+    overlayColorAttachment.clearValue    = Color {0.05, 0.05, 0.05, 1.0};
 
-    // Set binding group
-    renderPass.setBindGroup(0, m_bindGroup, 0, nullptr);
+    RenderPassDescriptor overlayPassDesc {};
+    overlayPassDesc.colorAttachmentCount   = 1;
+    overlayPassDesc.colorAttachments       = &overlayColorAttachment;
+    overlayPassDesc.depthStencilAttachment = nullptr;
+    overlayPassDesc.timestampWrites        = nullptr;
+    RenderPassEncoder overlayPass          = encoder.beginRenderPass(overlayPassDesc);
 
-    renderPass.draw(m_vertexCount, 1, 0, 0);
+    if (upscale)
+        encodeUpscale(overlayPass);
 
-    updateGui(renderPass);
+    drawGui(overlayPass);
 
-    renderPass.end();
-    renderPass.release();
+    overlayPass.end();
+    overlayPass.release();
+
+    if (frameCopy)
+    {
+        RenderPassColorAttachment copyColorAttachment {};
+        copyColorAttachment.view          = nextTexture;
+        copyColorAttachment.resolveTarget = nullptr;
+        copyColorAttachment.loadOp        = LoadOp::Clear;
+        copyColorAttachment.storeOp       = StoreOp::Store;
+        copyColorAttachment.clearValue    = Color {0.05, 0.05, 0.05, 1.0};
+
+        RenderPassDescriptor copyPassDesc {};
+        copyPassDesc.colorAttachmentCount   = 1;
+        copyPassDesc.colorAttachments       = &copyColorAttachment;
+        copyPassDesc.depthStencilAttachment = nullptr;
+        copyPassDesc.timestampWrites        = nullptr;
+        RenderPassEncoder copyPass          = encoder.beginRenderPass(copyPassDesc);
+        encodeFrameCopy(copyPass);
+        copyPass.end();
+        copyPass.release();
+    }
 
-    nextTexture.release();
+    // Bundles are kept for the next frames only when cached
+    if (!m_bundleCache.enabled)
+    {
+        invalidateSceneBundles();
+        releaseSceneBundles();
+    }
+
+    if (canCapture)
+        m_frameCapture.encodeCopy(encoder, captureTexture);
+
+    // The view of the headless target stays with the target
+    if (!m_headless.active)
+        nextTexture.release();
 
     CommandBufferDescriptor cmdBufferDescriptor {};
     cmdBufferDescriptor.label = "Command buffer";
     CommandBuffer command     = encoder.finish(cmdBufferDescriptor);
     encoder.release();
+    // The data written since the last frame, copied before the commands that read it
+    m_uploads.flush();
     m_queue.submit(command);
     command.release();
+    measureGpuTime();
+    m_virtualTextures.onSubmitted();
+    m_frameCapture.onSubmitted();
 
 #ifndef __EMSCRIPTEN__
-    m_surface.present();
+    if (!m_headless.active)
+        m_surface.present();
 #endif
+    m_framePacer.onPresent();
+    if (m_redraw.renderedFrames++ == 0)
+    {
+        m_startup.firstFrameMilliseconds =
+            std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - m_startup.startTime).count();
+        std::cout << "First frame presented " << m_startup.firstFrameMilliseconds << " ms after start" << std::endl;
+    }
+    if (m_redraw.pendingFrames > 0)
+        --m_redraw.pendingFrames;
 
 #if defined(WEBGPU_BACKEND_DAWN)
     m_device.tick();
 #elif defined(WEBGPU_BACKEND_WGPU)
     m_device.poll(false);
 #endif
+
+    updateBenchmark();
+    updateLightBenchmark();
 }
 
 void Application::onFinish()
 {
+    terminateGuiOverlay();
     terminateGui();
+    terminateCommandRecording();
+    terminateLights();
+    terminateScene();
     terminateBindGroup();
+    terminateShadowMaps();
     terminateLightingUniforms();
     terminateUniforms();
     terminateGeometry();
     terminateTexture();
     terminateRenderPipeline();
+    terminateUpscale();
     terminateDepthBuffer();
     terminateWindowAndDevice();
 }
@@ -179,18 +479,17 @@ bool Application::isRunning()
 
 void Application::onResize()
 {
-    // Terminate in reverse order
-    terminateDepthBuffer();
-
-    // Re-init
-    initSwapChain();
-    initDepthBuffer();
-
-    updateProjectionMatrix();
+    // A window drag sends many events per frame, only the last size matters
+    m_resize.pending = true;
+    ++m_resize.events;
+    requestRedraw();
 }
 
 void Application::onMouseMove(double xpos, double ypos)
 {
+    // Also redraw when not dragging, the GUI highlights what is under the cursor
+    requestRedraw();
+
     if (!m_drag.active)
         return;
 
@@ -208,6 +507,8 @@ void Application::onMouseMove(double xpos, double ypos)
 
 void Application::onMouseButton(int button, int action, int /* modifiers */)
 {
+    requestRedraw();
+
     ImGuiIO& io = ImGui::GetIO();
     if (io.WantCaptureMouse)
         return;
@@ -235,6 +536,7 @@ void Application::onMouseButton(int button, int action, int /* modifiers */)
 
 void Application::onScroll(double /* xoffset */, double yoffset)
 {
+    requestRedraw();
     m_cameraState.zoom += m_drag.scrollSensitivity * static_cast<float>(yoffset);
     m_cameraState.zoom = glm::clamp(m_cameraState.zoom, -2.0f, 2.0f);
     updateViewMatrix();
@@ -260,6 +562,7 @@ bool Application::initWindowAndDevice()
 
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
     glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+    glfwWindowHint(GLFW_VISIBLE, m_headless.active ? GLFW_FALSE : GLFW_TRUE);
     m_window = glfwCreateWindow(640, 480, "Learn WebGPU", NULL, NULL);
     if (!m_window)
     {
@@ -281,20 +584,53 @@ bool Application::initWindowAndDevice()
     RequiredLimits requiredLimits                         = Default;
     requiredLimits.limits.maxVertexAttributes             = 6;
     requiredLimits.limits.maxVertexBuffers                = 1;
-    requiredLimits.limits.maxBufferSize                   = 150000 * sizeof(VertexAttributes);
+    // Meshes larger than this are split into several vertex buffers, see initGeometry
+    requiredLimits.limits.maxBufferSize                   = supportedLimits.limits.maxBufferSize;
     requiredLimits.limits.maxVertexBufferArrayStride      = sizeof(VertexAttributes);
     requiredLimits.limits.minStorageBufferOffsetAlignment = supportedLimits.limits.minStorageBufferOffsetAlignment;
     requiredLimits.limits.minUniformBufferOffsetAlignment = supportedLimits.limits.minUniformBufferOffsetAlignment;
     requiredLimits.limits.maxInterStageShaderComponents   = 17;
-    requiredLimits.limits.maxBindGroups                   = 2;
-    requiredLimits.limits.maxUniformBuffersPerShaderStage = 2;
-    requiredLimits.limits.maxUniformBufferBindingSize     = 16 * 4 * sizeof(float);
-    // Allow textures up to 2K
-    requiredLimits.limits.maxTextureDimension1D            = 2048;
-    requiredLimits.limits.maxTextureDimension2D            = 2048;
-    requiredLimits.limits.maxTextureArrayLayers            = 1;
-    requiredLimits.limits.maxSampledTexturesPerShaderStage = 2;
-    requiredLimits.limits.maxSamplersPerShaderStage        = 1;
+    requiredLimits.limits.maxBindGroups                   = 3;
+    // Camera, lighting and object uniforms, all three read by the vertex stage of the shadow maps and by the fragment
+    // stage of the scene, which takes the material of an object from its uniforms
+    requiredLimits.limits.maxUniformBuffersPerShaderStage = 3;
+    // The largest of the uniform structs bound whole, the per-object uniforms being bound one object at a time
+    requiredLimits.limits.maxUniformBufferBindingSize =
+        std::max({sizeof(MyUniforms), sizeof(LightingUniforms), sizeof(ObjectUniforms), sizeof(UpscaleUniforms)});
+    // Lights, clusters and light indices of the clustered shading, and the feedback of the virtual textures
+    requiredLimits.limits.maxStorageBuffersPerShaderStage = 4;
+    requiredLimits.limits.maxStorageBufferBindingSize =
+        std::max<uint64_t>(LightClusterer::kMaxLightIndices * sizeof(uint32_t), VirtualTextures::feedbackBytes());
+    // Render targets follow the size of the window, material textures are resampled to kMaterialTextureSize
+    requiredLimits.limits.maxTextureDimension1D            = kMaterialTextureSize;
+    requiredLimits.limits.maxTextureDimension2D            = supportedLimits.limits.maxTextureDimension2D;
+    // As many material layers as the adapter supports, up to what the scenes of this viewer may use
+    requiredLimits.limits.maxTextureArrayLayers            =
+        std::max(ShadowMaps::kMapCount, std::min(supportedLimits.limits.maxTextureArrayLayers, kMaxMaterialLayers));
+    // Material array, shadow maps, and the cache and page tables of the virtual textures, with a filtering and a
+    // comparison sampler
+    requiredLimits.limits.maxSampledTexturesPerShaderStage = 4;
+    requiredLimits.limits.maxSamplersPerShaderStage        = 2;
+    // Per-object uniforms are selected with a dynamic offset
+    requiredLimits.limits.maxDynamicUniformBuffersPerPipelineLayout = 1;
+
+    if (supportedLimits.limits.maxUniformBuffersPerShaderStage < requiredLimits.limits.maxUniformBuffersPerShaderStage)
+    {
+        std::cerr << "The adapter only supports " << supportedLimits.limits.maxUniformBuffersPerShaderStage
+                  << " uniform buffers per shader stage, "
+                  << requiredLimits.limits.maxUniformBuffersPerShaderStage << " are needed" << std::endl;
+        return false;
+    }
+
+    m_maxMaterialLayers = std::min(requiredLimits.limits.maxTextureArrayLayers, kMaxMaterialLayers);
+
+    // Pack the per-object uniforms at the dynamic offset alignment of the device
+    uint32_t alignment    = requiredLimits.limits.minUniformBufferOffsetAlignment;
+    m_objectUniformStride = (sizeof(ObjectUniforms) + alignment - 1) / alignment * alignment;
+    m_maxVertexBufferSize = requiredLimits.limits.maxBufferSize;
+    // Dynamic offsets are 32-bit
+    uint64_t objectBytes = std::min<uint64_t>(requiredLimits.limits.maxBufferSize, UINT32_MAX);
+    m_maxObjectCount     = static_cast<uint32_t>(objectBytes / m_objectUniformStride);
 
     DeviceDescriptor deviceDesc;
     deviceDesc.label                = "My Device";
@@ -315,6 +651,10 @@ bool Application::initWindowAndDevice()
         });
 
     m_queue = m_device.getQueue();
+    m_uploads.init(m_device, &m_gpuMemory);
+    m_renderTargets.init(m_device, &m_gpuMemory);
+    m_frameCapture.init(m_device, &m_gpuMemory);
+    m_recorder.init();
 
 #ifdef WEBGPU_BACKEND_WGPU
     m_swapChainFormat = m_surface.getPreferredFormat(adapter);
@@ -322,6 +662,18 @@ bool Application::initWindowAndDevice()
     m_swapChainFormat = TextureFormat::BGRA8Unorm;
 #endif
 
+#ifdef WEBGPU_BACKEND_WGPU
+    SurfaceCapabilities capabilities;
+    m_surface.getCapabilities(adapter, &capabilities);
+    m_presentModes.assign(capabilities.presentModes, capabilities.presentModes + capabilities.presentModeCount);
+    m_surfaceCopySrc = (capabilities.usages & WGPUTextureUsage_CopySrc) != 0;
+    capabilities.freeMembers();
+#else
+    // Fifo is the only mode every surface has to support, and RenderAttachment the only usage
+    m_presentModes   = {PresentMode::Fifo};
+    m_surfaceCopySrc = false;
+#endif
+
     // Set the user pointer to be "this"
     glfwSetWindowUserPointer(m_window, this);
     // Add window callbacks
@@ -353,6 +705,35 @@ bool Application::initWindowAndDevice()
                               if (that != nullptr)
                                   that->onScroll(xoffset, yoffset);
                           });
+    // Other events only matter to the GUI, which is forwarded them by ImGui before calling these
+    glfwSetKeyCallback(m_window,
+                       [](GLFWwindow* window, int, int, int, int)
+                       {
+                           auto that = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
+                           if (that != nullptr)
+                               that->requestRedraw();
+                       });
+    glfwSetCharCallback(m_window,
+                        [](GLFWwindow* window, unsigned int)
+                        {
+                            auto that = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
+                            if (that != nullptr)
+                                that->requestRedraw();
+                        });
+    glfwSetWindowFocusCallback(m_window,
+                               [](GLFWwindow* window, int)
+                               {
+                                   auto that = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
+                                   if (that != nullptr)
+                                       that->requestRedraw();
+                               });
+    glfwSetWindowRefreshCallback(m_window,
+                                 [](GLFWwindow* window)
+                                 {
+                                     auto that = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
+                                     if (that != nullptr)
+                                         that->requestRedraw();
+                                 });
 
     adapter.release();
     return m_device != nullptr;
@@ -360,6 +741,11 @@ bool Application::initWindowAndDevice()
 
 void Application::terminateWindowAndDevice()
 {
+    m_frameCapture.terminate();
+    m_recorder.terminate();
+    m_renderTargets.release(m_headless.target);
+    m_renderTargets.terminate();
+    m_uploads.terminate();
     m_queue.release();
     m_device.release();
     m_surface.release();
@@ -375,6 +761,25 @@ bool Application::initSwapChain()
     int width, height;
     glfwGetFramebufferSize(m_window, &width, &height);
 
+    // A surface cannot be configured with a zero size, keep the previous configuration while minimized
+    if (width == 0 || height == 0)
+        return true;
+    m_surfaceWidth  = static_cast<uint32_t>(width);
+    m_surfaceHeight = static_cast<uint32_t>(height);
+
+    // Without a window to present to, frames go to a target of the same format, as if it were the swap chain
+    if (m_headless.active)
+    {
+        m_renderTargets.release(m_headless.target);
+        m_headless.target = m_renderTargets.acquire(m_surfaceWidth,
+                                                    m_surfaceHeight,
+                                                    m_swapChainFormat,
+                                                    TextureUsage::RenderAttachment | TextureUsage::CopySrc,
+                                                    true,
+                                                    "Headless frame");
+        return m_headless.target.view != nullptr;
+    }
+
     std::cout << "Creating swapchain..." << std::endl;
     SurfaceConfiguration config;
     config.width           = static_cast<uint32_t>(width);
@@ -384,107 +789,182 @@ bool Application::initSwapChain()
     config.viewFormatCount = 0;
     config.viewFormats     = nullptr;
     config.device          = m_device;
-    config.presentMode     = PresentMode::Fifo;
+    config.presentMode     = m_presentMode;
     config.alphaMode       = CompositeAlphaMode::Auto;
+    // Also copied from by screenshots when the surface allows it, otherwise they go through m_frameCopyTarget
+    if (m_surfaceCopySrc)
+        config.usage = TextureUsage::RenderAttachment | TextureUsage::CopySrc;
 
     m_surface.configure(config);
 
     return true;
 }
 
-bool Application::initDepthBuffer()
+void Application::applyPendingResize()
 {
-    // get the current size of the window's framebuffer
+    if (!m_resize.pending)
+        return;
+
     int width, height;
     glfwGetFramebufferSize(m_window, &width, &height);
+    if (width == 0 || height == 0)
+        return;
+    m_resize.pending = false;
 
-    // Create the depth texture
-    TextureDescriptor depthTextureDesc;
-    depthTextureDesc.dimension       = TextureDimension::_2D;
-    depthTextureDesc.format          = m_depthTextureFormat;
-    depthTextureDesc.mipLevelCount   = 1;
-    depthTextureDesc.sampleCount     = 1;
-    depthTextureDesc.size            = {static_cast<uint32_t>(width), static_cast<uint32_t>(height), 1};
-    depthTextureDesc.usage           = TextureUsage::RenderAttachment;
-    depthTextureDesc.viewFormatCount = 1;
-    depthTextureDesc.viewFormats     = (WGPUTextureFormat*)&m_depthTextureFormat;
-    m_depthTexture                   = m_device.createTexture(depthTextureDesc);
-    std::cout << "Depth texture: " << m_depthTexture << std::endl;
-
-    // Create the view of the depth texture manipulated by the rasterizer
-    TextureViewDescriptor depthTextureViewDesc;
-    depthTextureViewDesc.aspect          = TextureAspect::DepthOnly;
-    depthTextureViewDesc.baseArrayLayer  = 0;
-    depthTextureViewDesc.arrayLayerCount = 1;
-    depthTextureViewDesc.baseMipLevel    = 0;
-    depthTextureViewDesc.mipLevelCount   = 1;
-    depthTextureViewDesc.dimension       = TextureViewDimension::_2D;
-    depthTextureViewDesc.format          = m_depthTextureFormat;
-    m_depthTextureView                   = m_depthTexture.createView(depthTextureViewDesc);
-    std::cout << "Depth texture view: " << m_depthTextureView << std::endl;
-
-    return m_depthTextureView != nullptr;
-}
+    if (static_cast<uint32_t>(width) == m_surfaceWidth && static_cast<uint32_t>(height) == m_surfaceHeight)
+        return;
 
-void Application::terminateDepthBuffer()
-{
-    m_depthTextureView.release();
-    m_depthTexture.destroy();
-    m_depthTexture.release();
+    // Terminate in reverse order, the old targets go back to the pool
+    uint32_t allocations = m_renderTargets.stats().allocations;
+    terminateDepthBuffer();
+
+    // Re-init
+    initSwapChain();
+    initDepthBuffer();
+
+    updateProjectionMatrix();
+
+    ++m_resize.applied;
+    m_resize.allocations += m_renderTargets.stats().allocations - allocations;
 }
 
-bool Application::initRenderPipeline()
+void Application::updatePresentMode()
 {
-    std::cout << "Creating shader module..." << std::endl;
-    m_shaderModule = ResourceManager::loadShaderModule("resources/shader/sample.wgsl", m_device);
-    std::cout << "Shader module: " << m_shaderModule << std::endl;
+    // The surface is not reconfigured from the GUI since its texture is in use at that point
+    if (!m_presentModeChanged)
+        return;
+    m_presentModeChanged = false;
 
-    std::cout << "Creating render pipeline..." << std::endl;
-    RenderPipelineDescriptor pipelineDesc;
+    std::cout << "Present mode: " << presentModeName(m_presentMode) << std::endl;
+    initSwapChain();
+}
 
-    // Vertex fetch
-    std::vector<VertexAttribute> vertexAttribs(6);
+bool Application::initDepthBuffer()
+{
+    // Nothing to attach the depth buffer to until the surface has a size, and the
+    // scene has depth targets of its own when its resolution is scaled
+    if (m_surfaceWidth == 0 || m_surfaceHeight == 0 || m_dynamicResolution.enabled)
+        return true;
+
+    // The depth attachment must have exactly the size of the color attachment
+    m_depthTarget = m_renderTargets.acquire(m_surfaceWidth,
+                                            m_surfaceHeight,
+                                            m_depthTextureFormat,
+                                            TextureUsage::RenderAttachment,
+                                            true,
+                                            "Depth texture");
+
+    return m_depthTarget.view != nullptr;
+}
 
-    // Position attribute
-    vertexAttribs[0].shaderLocation = 0;
-    vertexAttribs[0].format         = VertexFormat::Float32x3;
-    vertexAttribs[0].offset         = 0;
+void Application::terminateDepthBuffer()
+{
+    m_renderTargets.release(m_depthTarget);
+}
 
-    // Normal attribute
-    vertexAttribs[1].shaderLocation = 1;
-    vertexAttribs[1].format         = VertexFormat::Float32x3;
-    vertexAttribs[1].offset         = offsetof(VertexAttributes, normal);
+bool Application::initShaderSources()
+{
+    // The shaders include these with #include <Name> rather than declaring them again
+    std::string myUniforms = WgslStruct("MyUniforms", sizeof(MyUniforms))
+                                 .field("projectionMatrix", "mat4x4f", offsetof(MyUniforms, projectionMatrix))
+                                 .field("viewMatrix", "mat4x4f", offsetof(MyUniforms, viewMatrix))
+                                 .field("modelMatrix", "mat4x4f", offsetof(MyUniforms, modelMatrix))
+                                 .field("color", "vec4f", offsetof(MyUniforms, color))
+                                 .field("cameraWorldPosition", "vec3f", offsetof(MyUniforms, cameraWorldPosition))
+                                 .field("time", "f32", offsetof(MyUniforms, time))
+                                 .declaration();
+
+    std::string lightingUniforms =
+        WgslStruct("LightingUniforms", sizeof(LightingUniforms))
+            .field("directions", "array<vec4f, 2>", offsetof(LightingUniforms, directions))
+            .field("colors", "array<vec4f, 2>", offsetof(LightingUniforms, colors))
+            .field("hardness", "f32", offsetof(LightingUniforms, hardness))
+            .field("kd", "f32", offsetof(LightingUniforms, kd))
+            .field("ks", "f32", offsetof(LightingUniforms, ks))
+            .field("lightCount", "u32", offsetof(LightingUniforms, lightCount))
+            .field("viewportSize", "vec2f", offsetof(LightingUniforms, viewportSize))
+            .field("sliceScale", "f32", offsetof(LightingUniforms, sliceScale))
+            .field("sliceBias", "f32", offsetof(LightingUniforms, sliceBias))
+            .field("gridSize", "vec4u", offsetof(LightingUniforms, gridSize))
+            .field("cameraNear", "f32", offsetof(LightingUniforms, cameraNear))
+            .field("cameraFar", "f32", offsetof(LightingUniforms, cameraFar))
+            .field("normalMapStrength", "f32", offsetof(LightingUniforms, normalMapStrength))
+            .field("shadowBias", "f32", offsetof(LightingUniforms, shadowBias))
+            .field("shadowMatrices", "array<mat4x4f, 2>", offsetof(LightingUniforms, shadowMatrices))
+            .declaration();
+
+    std::string objectUniforms = WgslStruct("ObjectUniforms", sizeof(ObjectUniforms))
+                                     .field("modelMatrix", "mat4x4f", offsetof(ObjectUniforms, modelMatrix))
+                                     .field("materialLayers", "vec4u", offsetof(ObjectUniforms, materialLayers))
+                                     .field("virtualTexture", "vec4u", offsetof(ObjectUniforms, virtualTexture))
+                                     .field("baseColor", "vec4f", offsetof(ObjectUniforms, baseColor))
+                                     .declaration();
+
+    using Light       = LightClusterer::Light;
+    std::string light = WgslStruct("Light", sizeof(Light))
+                            .field("positionRange", "vec4f", offsetof(Light, positionRange))
+                            .field("colorIntensity", "vec4f", offsetof(Light, colorIntensity))
+                            .field("directionCosOuter", "vec4f", offsetof(Light, directionCosOuter))
+                            .field("cosInner", "vec4f", offsetof(Light, cosInner))
+                            .declaration();
+
+    if (myUniforms.empty() || lightingUniforms.empty() || objectUniforms.empty() || light.empty())
+        return false;
+    m_shaderPreprocessor.setGenerated("MyUniforms", myUniforms);
+    m_shaderPreprocessor.setGenerated("LightingUniforms", lightingUniforms);
+    m_shaderPreprocessor.setGenerated("ObjectUniforms", objectUniforms);
+    m_shaderPreprocessor.setGenerated("Light", light);
+
+    // Slots of the directional lights in LightingUniforms
+    m_shaderPreprocessor.define("MAX_DIRECTIONAL_LIGHTS",
+                                std::to_string(std::tuple_size<decltype(LightingUniforms::directions)>::value) + "u");
+    // Layout of the cache, page tables and feedback of the virtual textures
+    m_shaderPreprocessor.define("VT_TILE_SIZE", std::to_string(VirtualTextures::kTileSize) + "u");
+    m_shaderPreprocessor.define("VT_BORDER", std::to_string(VirtualTextures::kBorder) + "u");
+    m_shaderPreprocessor.define("VT_SLOT_SIZE", std::to_string(VirtualTextures::kSlotSize) + "u");
+    m_shaderPreprocessor.define("VT_CACHE_SIZE", std::to_string(VirtualTextures::kCacheSize) + "u");
+    m_shaderPreprocessor.define("VT_MAX_PAGES", std::to_string(VirtualTextures::kMaxPages) + "u");
+    m_shaderPreprocessor.define("VT_FEEDBACK_WORDS", std::to_string(VirtualTextures::kFeedbackWords) + "u");
+    return true;
+}
 
-    // Color attribute
-    vertexAttribs[2].shaderLocation = 2;
-    vertexAttribs[2].format         = VertexFormat::Float32x3;
-    vertexAttribs[2].offset         = offsetof(VertexAttributes, color);
+bool Application::initUpscale()
+{
+    m_upscaleShaderModule = ResourceManager::loadShaderModule("resources/shader/upscale.wgsl", m_device, m_shaderPreprocessor);
+    if (!m_upscaleShaderModule)
+    {
+        std::cerr << "Could not load the upscale shader!" << std::endl;
+        return false;
+    }
 
-    // UV attribute
-    vertexAttribs[3].shaderLocation = 3;
-    vertexAttribs[3].format         = VertexFormat::Float32x2;
-    vertexAttribs[3].offset         = offsetof(VertexAttributes, uv);
+    std::vector<BindGroupLayoutEntry> bindingLayoutEntries(3, Default);
 
-    // Targent attribute
-    vertexAttribs[4].shaderLocation = 4;
-    vertexAttribs[4].format         = VertexFormat::Float32x3;
-    vertexAttribs[4].offset         = offsetof(VertexAttributes, tangent);
+    BindGroupLayoutEntry& textureBindingLayout = bindingLayoutEntries[0];
+    textureBindingLayout.binding               = 0;
+    textureBindingLayout.visibility            = ShaderStage::Fragment;
+    textureBindingLayout.texture.sampleType    = TextureSampleType::Float;
+    textureBindingLayout.texture.viewDimension = TextureViewDimension::_2D;
 
-    // Bitangent attribute
-    vertexAttribs[5].shaderLocation = 5;
-    vertexAttribs[5].format         = VertexFormat::Float32x3;
-    vertexAttribs[5].offset         = offsetof(VertexAttributes, bitangent);
+    BindGroupLayoutEntry& samplerBindingLayout = bindingLayoutEntries[1];
+    samplerBindingLayout.binding               = 1;
+    samplerBindingLayout.visibility            = ShaderStage::Fragment;
+    samplerBindingLayout.sampler.type          = SamplerBindingType::Filtering;
 
-    VertexBufferLayout vertexBufferLayout;
-    vertexBufferLayout.attributeCount = (uint32_t)vertexAttribs.size();
-    vertexBufferLayout.attributes     = vertexAttribs.data();
-    vertexBufferLayout.arrayStride    = sizeof(VertexAttributes);
-    vertexBufferLayout.stepMode       = VertexStepMode::Vertex;
+    BindGroupLayoutEntry& uniformBindingLayout = bindingLayoutEntries[2];
+    uniformBindingLayout.binding               = 2;
+    uniformBindingLayout.visibility            = ShaderStage::Fragment;
+    uniformBindingLayout.buffer.type           = BufferBindingType::Uniform;
+    uniformBindingLayout.buffer.minBindingSize = sizeof(UpscaleUniforms);
 
-    pipelineDesc.vertex.bufferCount = 1;
-    pipelineDesc.vertex.buffers     = &vertexBufferLayout;
+    BindGroupLayoutDescriptor bindGroupLayoutDesc {};
+    bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+    bindGroupLayoutDesc.entries    = bindingLayoutEntries.data();
+    m_upscaleBindGroupLayout       = m_device.createBindGroupLayout(bindGroupLayoutDesc);
 
-    pipelineDesc.vertex.module        = m_shaderModule;
+    RenderPipelineDescriptor pipelineDesc;
+    pipelineDesc.vertex.bufferCount   = 0;
+    pipelineDesc.vertex.buffers       = nullptr;
+    pipelineDesc.vertex.module        = m_upscaleShaderModule;
     pipelineDesc.vertex.entryPoint    = "vs_main";
     pipelineDesc.vertex.constantCount = 0;
     pipelineDesc.vertex.constants     = nullptr;
@@ -494,401 +974,2772 @@ bool Application::initRenderPipeline()
     pipelineDesc.primitive.frontFace        = FrontFace::CCW;
     pipelineDesc.primitive.cullMode         = CullMode::None;
 
-    FragmentState fragmentState;
-    pipelineDesc.fragment       = &fragmentState;
-    fragmentState.module        = m_shaderModule;
-    fragmentState.entryPoint    = "fs_main";
-    fragmentState.constantCount = 0;
-    fragmentState.constants     = nullptr;
-
-    BlendState blendState;
-    blendState.color.srcFactor = BlendFactor::SrcAlpha;
-    blendState.color.dstFactor = BlendFactor::OneMinusSrcAlpha;
-    blendState.color.operation = BlendOperation::Add;
-    blendState.alpha.srcFactor = BlendFactor::Zero;
-    blendState.alpha.dstFactor = BlendFactor::One;
-    blendState.alpha.operation = BlendOperation::Add;
-
     ColorTargetState colorTarget;
     colorTarget.format    = m_swapChainFormat;
-    colorTarget.blend     = &blendState;
+    colorTarget.blend     = nullptr;
     colorTarget.writeMask = ColorWriteMask::All;
 
-    fragmentState.targetCount = 1;
-    fragmentState.targets     = &colorTarget;
-
-    DepthStencilState depthStencilState = Default;
-    depthStencilState.depthCompare      = CompareFunction::Less;
-    depthStencilState.depthWriteEnabled = true;
-    depthStencilState.format            = m_depthTextureFormat;
-    depthStencilState.stencilReadMask   = 0;
-    depthStencilState.stencilWriteMask  = 0;
+    FragmentState fragmentState;
+    fragmentState.module        = m_upscaleShaderModule;
+    fragmentState.entryPoint    = "fs_main";
+    fragmentState.constantCount = 0;
+    fragmentState.constants     = nullptr;
+    fragmentState.targetCount   = 1;
+    fragmentState.targets       = &colorTarget;
+    pipelineDesc.fragment       = &fragmentState;
 
-    pipelineDesc.depthStencil = &depthStencilState;
+    pipelineDesc.depthStencil = nullptr;
 
     pipelineDesc.multisample.count                  = 1;
     pipelineDesc.multisample.mask                   = ~0u;
     pipelineDesc.multisample.alphaToCoverageEnabled = false;
 
-    // Create the pipeline layout
     PipelineLayoutDescriptor layoutDesc {};
     layoutDesc.bindGroupLayoutCount = 1;
-    layoutDesc.bindGroupLayouts     = (WGPUBindGroupLayout*)&m_bindGroupLayout;
+    layoutDesc.bindGroupLayouts     = (WGPUBindGroupLayout*)&m_upscaleBindGroupLayout;
     PipelineLayout layout           = m_device.createPipelineLayout(layoutDesc);
     pipelineDesc.layout             = layout;
+    m_upscalePipeline               = m_device.createRenderPipeline(pipelineDesc);
+    layout.release();
 
-    m_pipeline = m_device.createRenderPipeline(pipelineDesc);
-    std::cout << "Render pipeline: " << m_pipeline << std::endl;
-
-    return m_pipeline != nullptr;
-}
-
-void Application::terminateRenderPipeline()
-{
-    m_pipeline.release();
-    m_shaderModule.release();
-    m_bindGroupLayout.release();
-}
-
-bool Application::initTexture()
-{
-    // Create a sampler
+    // Bilinear filtering, never reading past the edges
     SamplerDescriptor samplerDesc;
-    samplerDesc.addressModeU  = AddressMode::Repeat;
-    samplerDesc.addressModeV  = AddressMode::Repeat;
-    samplerDesc.addressModeW  = AddressMode::Repeat;
+    samplerDesc.addressModeU  = AddressMode::ClampToEdge;
+    samplerDesc.addressModeV  = AddressMode::ClampToEdge;
+    samplerDesc.addressModeW  = AddressMode::ClampToEdge;
     samplerDesc.magFilter     = FilterMode::Linear;
     samplerDesc.minFilter     = FilterMode::Linear;
-    samplerDesc.mipmapFilter  = MipmapFilterMode::Linear;
+    samplerDesc.mipmapFilter  = MipmapFilterMode::Nearest;
     samplerDesc.lodMinClamp   = 0.0f;
-    samplerDesc.lodMaxClamp   = 8.0f;
+    samplerDesc.lodMaxClamp   = 1.0f;
     samplerDesc.compare       = CompareFunction::Undefined;
     samplerDesc.maxAnisotropy = 1;
-    m_sampler                 = m_device.createSampler(samplerDesc);
+    m_upscaleSampler          = m_device.createSampler(samplerDesc);
 
-    // Create a texture
-    m_baseColorTexture =
-        ResourceManager::loadTexture("resources/shader/fourareen2K_albedo.jpg", m_device, &m_baseColorTextureView);
-    m_normalTexture =
-        ResourceManager::loadTexture("resources/shader/fourareen2K_normals.png", m_device, &m_normalTextureView);
-    if (!m_baseColorTexture || !m_normalTexture)
-    {
-        std::cerr << "Could not load texture!" << std::endl;
-        return false;
-    }
-    std::cout << "Texture: " << m_baseColorTexture << std::endl;
-    std::cout << "Texture view: " << m_baseColorTextureView << std::endl;
-    std::cout << "Normal Texture: " << m_normalTexture << std::endl;
-    std::cout << "Normal Texture view: " << m_normalTextureView << std::endl;
+    BufferDescriptor bufferDesc;
+    bufferDesc.label            = "Upscale uniforms";
+    bufferDesc.size             = sizeof(UpscaleUniforms);
+    bufferDesc.usage            = BufferUsage::CopyDst | BufferUsage::Uniform;
+    bufferDesc.mappedAtCreation = false;
+    m_upscaleUniformBuffer      = m_gpuMemory.createBuffer(m_device, bufferDesc, MemoryCategory::Uniforms);
 
-    return true;
+    return m_upscalePipeline != nullptr;
 }
 
-void Application::terminateTexture()
+void Application::terminateUpscale()
 {
-    m_baseColorTextureView.release();
-    m_baseColorTexture.destroy();
-    m_baseColorTexture.release();
-    m_normalTextureView.release();
-    m_normalTexture.destroy();
-    m_normalTexture.release();
-    m_sampler.release();
+    updateFrameCopyTarget(false);
+    m_gpuMemory.destroy(m_frameCopyUniformBuffer);
+    if (m_upscaleBindGroup)
+        m_upscaleBindGroup.release();
+    m_renderTargets.release(m_sceneColorTarget);
+    m_renderTargets.release(m_sceneDepthTarget);
+    m_gpuMemory.destroy(m_upscaleUniformBuffer);
+    m_upscaleSampler.release();
+    m_upscalePipeline.release();
+    m_upscaleBindGroupLayout.release();
+    m_upscaleShaderModule.release();
 }
 
-bool Application::initGeometry()
+void Application::updateSceneTargets()
 {
-    // Load mesh data from OBJ file
-    std::vector<VertexAttributes> vertexData;
-    bool success = ResourceManager::loadGeometryFromObj("resources/shader/fourareen.obj", vertexData);
-    if (!success)
+    if (!m_dynamicResolution.enabled)
     {
-        std::cerr << "Could not load geometry!" << std::endl;
-        return false;
+        if (m_sceneColorTarget.texture)
+        {
+            m_renderTargets.release(m_sceneColorTarget);
+            m_renderTargets.release(m_sceneDepthTarget);
+            m_resolution.reset();
+        }
+        if (!m_depthTarget.texture)
+            initDepthBuffer();
+        return;
     }
 
-    // Create vertex buffer
-    BufferDescriptor bufferDesc;
-    bufferDesc.size             = vertexData.size() * sizeof(VertexAttributes);
-    bufferDesc.usage            = BufferUsage::CopyDst | BufferUsage::Vertex;
-    bufferDesc.mappedAtCreation = false;
-    m_vertexBuffer              = m_device.createBuffer(bufferDesc);
-    m_queue.writeBuffer(m_vertexBuffer, 0, vertexData.data(), bufferDesc.size);
-
-    m_vertexCount = static_cast<int>(vertexData.size());
+    // The swap chain sized depth buffer is not used when upscaling
+    terminateDepthBuffer();
 
-    return m_vertexBuffer != nullptr;
+    if (m_gpuTiming.samples != m_dynamicResolution.gpuSamples)
+    {
+        m_resolution.update(m_gpuTiming.milliseconds);
+        m_dynamicResolution.gpuSamples = m_gpuTiming.samples;
+    }
+
+    float scale     = m_resolution.scale();
+    uint32_t width  = std::max(1u, static_cast<uint32_t>(std::lround(m_surfaceWidth * scale)));
+    uint32_t height = std::max(1u, static_cast<uint32_t>(std::lround(m_surfaceHeight * scale)));
+    if (m_sceneColorTarget.texture && width == m_dynamicResolution.renderWidth
+        && height == m_dynamicResolution.renderHeight)
+        return;
+    m_dynamicResolution.renderWidth  = width;
+    m_dynamicResolution.renderHeight = height;
+
+    // Targets come from size buckets, so that small changes of scale get the same textures back
+    WGPUTexture previousTexture = m_sceneColorTarget.texture;
+    m_renderTargets.release(m_sceneColorTarget);
+    m_renderTargets.release(m_sceneDepthTarget);
+    m_sceneColorTarget = m_renderTargets.acquire(width,
+                                                 height,
+                                                 m_swapChainFormat,
+                                                 TextureUsage::RenderAttachment | TextureUsage::TextureBinding,
+                                                 false,
+                                                 "Scene color");
+    m_sceneDepthTarget = m_renderTargets.acquire(
+        width, height, m_depthTextureFormat, TextureUsage::RenderAttachment, false, "Scene depth");
+
+    UpscaleUniforms uniforms;
+    uniforms.uvScale   = vec2(width, height) / vec2(m_sceneColorTarget.width, m_sceneColorTarget.height);
+    uniforms.texelSize = 1.0f / vec2(m_sceneColorTarget.width, m_sceneColorTarget.height);
+    uniforms.sharpness = m_dynamicResolution.sharpness;
+    m_uploads.writeBuffer(m_upscaleUniformBuffer, 0, &uniforms, sizeof(UpscaleUniforms));
+
+    if (m_sceneColorTarget.texture == previousTexture && m_upscaleBindGroup)
+        return;
+
+    std::vector<BindGroupEntry> bindings(3);
+
+    bindings[0].binding     = 0;
+    bindings[0].textureView = m_sceneColorTarget.view;
+
+    bindings[1].binding = 1;
+    bindings[1].sampler = m_upscaleSampler;
+
+    bindings[2].binding = 2;
+    bindings[2].buffer  = m_upscaleUniformBuffer;
+    bindings[2].offset  = 0;
+    bindings[2].size    = sizeof(UpscaleUniforms);
+
+    BindGroupDescriptor bindGroupDesc;
+    bindGroupDesc.layout     = m_upscaleBindGroupLayout;
+    bindGroupDesc.entryCount = (uint32_t)bindings.size();
+    bindGroupDesc.entries    = bindings.data();
+    if (m_upscaleBindGroup)
+        m_upscaleBindGroup.release();
+    m_upscaleBindGroup = m_device.createBindGroup(bindGroupDesc);
+}
+
+void Application::setSceneViewport(RenderPassEncoder renderPass)
+{
+    if (!m_dynamicResolution.enabled)
+        return;
+
+    // The scene targets are rounded up to a bucket size, only their top left corner is used
+    float width  = static_cast<float>(m_dynamicResolution.renderWidth);
+    float height = static_cast<float>(m_dynamicResolution.renderHeight);
+    renderPass.setViewport(0.0f, 0.0f, width, height, 0.0f, 1.0f);
+    renderPass.setScissorRect(0, 0, m_dynamicResolution.renderWidth, m_dynamicResolution.renderHeight);
+}
+
+void Application::encodeUpscale(RenderPassEncoder renderPass)
+{
+    renderPass.setPipeline(m_upscalePipeline);
+    renderPass.setBindGroup(0, m_upscaleBindGroup, 0, nullptr);
+    renderPass.draw(3, 1, 0, 0);
+}
+
+void Application::updateFrameCopyTarget(bool needed)
+{
+    // Kept between the frames of a recording, given back to the pool otherwise
+    bool keep = needed || (m_recorder.recording() && !m_surfaceCopySrc && !m_headless.active);
+    if (!keep || m_frameCopyTarget.width != m_surfaceWidth || m_frameCopyTarget.height != m_surfaceHeight)
+    {
+        if (m_frameCopyBindGroup)
+            m_frameCopyBindGroup.release();
+        m_frameCopyBindGroup = nullptr;
+        m_renderTargets.release(m_frameCopyTarget);
+    }
+    if (!needed || m_frameCopyTarget.texture)
+        return;
+
+    // The same format and usages as the headless target, and sampled to be drawn to the swap chain
+    m_frameCopyTarget = m_renderTargets.acquire(m_surfaceWidth,
+                                                m_surfaceHeight,
+                                                m_swapChainFormat,
+                                                TextureUsage::RenderAttachment | TextureUsage::CopySrc
+                                                    | TextureUsage::TextureBinding,
+                                                true,
+                                                "Captured frame");
+
+    if (!m_frameCopyUniformBuffer)
+    {
+        BufferDescriptor bufferDesc;
+        bufferDesc.label            = "Frame copy uniforms";
+        bufferDesc.size             = sizeof(UpscaleUniforms);
+        bufferDesc.usage            = BufferUsage::CopyDst | BufferUsage::Uniform;
+        bufferDesc.mappedAtCreation = false;
+        m_frameCopyUniformBuffer    = m_gpuMemory.createBuffer(m_device, bufferDesc, MemoryCategory::Uniforms);
+    }
+
+    // Drawn through the upscale pipeline at the same size and without sharpening, each pixel samples its texel
+    UpscaleUniforms uniforms;
+    uniforms.uvScale   = vec2(1.0f);
+    uniforms.texelSize = 1.0f / vec2(m_frameCopyTarget.width, m_frameCopyTarget.height);
+    uniforms.sharpness = 0.0f;
+    m_uploads.writeBuffer(m_frameCopyUniformBuffer, 0, &uniforms, sizeof(UpscaleUniforms));
+
+    std::vector<BindGroupEntry> bindings(3);
+
+    bindings[0].binding     = 0;
+    bindings[0].textureView = m_frameCopyTarget.view;
+
+    bindings[1].binding = 1;
+    bindings[1].sampler = m_upscaleSampler;
+
+    bindings[2].binding = 2;
+    bindings[2].buffer  = m_frameCopyUniformBuffer;
+    bindings[2].offset  = 0;
+    bindings[2].size    = sizeof(UpscaleUniforms);
+
+    BindGroupDescriptor bindGroupDesc;
+    bindGroupDesc.layout     = m_upscaleBindGroupLayout;
+    bindGroupDesc.entryCount = (uint32_t)bindings.size();
+    bindGroupDesc.entries    = bindings.data();
+    m_frameCopyBindGroup     = m_device.createBindGroup(bindGroupDesc);
+}
+
+void Application::encodeFrameCopy(RenderPassEncoder renderPass)
+{
+    renderPass.setPipeline(m_upscalePipeline);
+    renderPass.setBindGroup(0, m_frameCopyBindGroup, 0, nullptr);
+    renderPass.draw(3, 1, 0, 0);
+}
+
+void Application::measureGpuTime()
+{
+    // Only one frame is measured at a time, the callback is invoked when the device is polled
+    bool needed = m_dynamicResolution.enabled || m_lightBenchmark.active;
+    if (!needed || m_gpuTiming.pending)
+        return;
+    m_gpuTiming.pending = true;
+
+    auto submitTime          = std::chrono::steady_clock::now();
+    m_workDoneCallbackHandle = m_queue.onSubmittedWorkDone(
+        [this, submitTime](QueueWorkDoneStatus status)
+        {
+            m_gpuTiming.pending = false;
+            if (status != QueueWorkDoneStatus::Success)
+                return;
+            m_gpuTiming.milliseconds =
+                std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - submitTime).count();
+            ++m_gpuTiming.samples;
+        });
+}
+
+bool Application::initRenderPipeline()
+{
+    std::cout << "Creating shader module..." << std::endl;
+    m_shaderModule = ResourceManager::loadShaderModule(m_shaderPath, m_device, m_shaderPreprocessor);
+    std::cout << "Shader module: " << m_shaderModule << std::endl;
+
+    // Create the pipeline layout, shared by all the pipelines drawing the scene
+    std::array<WGPUBindGroupLayout, 3> bindGroupLayouts = {
+        m_bindGroupLayout, m_objectBindGroupLayout, m_lightBindGroupLayout};
+    PipelineLayoutDescriptor layoutDesc {};
+    layoutDesc.bindGroupLayoutCount = (uint32_t)bindGroupLayouts.size();
+    layoutDesc.bindGroupLayouts     = bindGroupLayouts.data();
+    m_pipelineLayout                = m_device.createPipelineLayout(layoutDesc);
+
+    // The depth prepass only reads positions and has no fragment stage
+    VertexAttribute positionAttrib;
+    positionAttrib.shaderLocation = 0;
+    positionAttrib.format         = VertexFormat::Float32x3;
+    positionAttrib.offset         = 0;
+
+    VertexBufferLayout positionBufferLayout;
+    positionBufferLayout.attributeCount = 1;
+    positionBufferLayout.attributes     = &positionAttrib;
+    positionBufferLayout.arrayStride    = sizeof(VertexAttributes);
+    positionBufferLayout.stepMode       = VertexStepMode::Vertex;
+
+    RenderPipelineDescriptor pipelineDesc;
+    pipelineDesc.vertex.bufferCount   = 1;
+    pipelineDesc.vertex.buffers       = &positionBufferLayout;
+    pipelineDesc.vertex.module        = m_shaderModule;
+    pipelineDesc.vertex.entryPoint    = "vs_depth";
+    pipelineDesc.vertex.constantCount = 0;
+    pipelineDesc.vertex.constants     = nullptr;
+
+    pipelineDesc.primitive.topology         = PrimitiveTopology::TriangleList;
+    pipelineDesc.primitive.stripIndexFormat = IndexFormat::Undefined;
+    pipelineDesc.primitive.frontFace        = FrontFace::CCW;
+    pipelineDesc.primitive.cullMode         = CullMode::None;
+
+    pipelineDesc.fragment = nullptr;
+
+    DepthStencilState depthStencilState = Default;
+    depthStencilState.depthCompare      = CompareFunction::Less;
+    depthStencilState.depthWriteEnabled = true;
+    depthStencilState.format            = m_depthTextureFormat;
+    depthStencilState.stencilReadMask   = 0;
+    depthStencilState.stencilWriteMask  = 0;
+
+    pipelineDesc.depthStencil = &depthStencilState;
+
+    pipelineDesc.multisample.count                  = 1;
+    pipelineDesc.multisample.mask                   = ~0u;
+    pipelineDesc.multisample.alphaToCoverageEnabled = false;
+
+    pipelineDesc.layout = m_pipelineLayout;
+
+    m_depthPipeline = m_device.createRenderPipeline(pipelineDesc);
+    std::cout << "Depth prepass pipeline: " << m_depthPipeline << std::endl;
+
+    // The shadow maps are rendered by the same vertex stage, with the projection of their light
+    std::array<WGPUBindGroupLayout, 2> shadowBindGroupLayouts = {m_shadowBindGroupLayout, m_objectBindGroupLayout};
+    PipelineLayoutDescriptor shadowLayoutDesc {};
+    shadowLayoutDesc.bindGroupLayoutCount = (uint32_t)shadowBindGroupLayouts.size();
+    shadowLayoutDesc.bindGroupLayouts     = shadowBindGroupLayouts.data();
+    m_shadowPipelineLayout                = m_device.createPipelineLayout(shadowLayoutDesc);
+
+    // Slope scaled bias against shadow acne on surfaces at grazing angles to the light
+    depthStencilState.format              = kShadowMapFormat;
+    depthStencilState.depthBias           = 2;
+    depthStencilState.depthBiasSlopeScale = 2.0f;
+    pipelineDesc.layout                   = m_shadowPipelineLayout;
+    pipelineDesc.vertex.entryPoint        = "vs_shadow";
+
+    bool shadowPipelinesCreated = true;
+    for (uint32_t map = 0; map < ShadowMaps::kMapCount; ++map)
+    {
+        ConstantEntry lightConstant;
+        lightConstant.key                 = "shadowLight";
+        lightConstant.value               = static_cast<double>(map);
+        pipelineDesc.vertex.constantCount = 1;
+        pipelineDesc.vertex.constants     = &lightConstant;
+        m_shadowPipelines[map]            = m_device.createRenderPipeline(pipelineDesc);
+        shadowPipelinesCreated            = shadowPipelinesCreated && m_shadowPipelines[map] != nullptr;
+    }
+    std::cout << "Shadow pipelines: " << m_shadowPipelines[0] << ", " << m_shadowPipelines[1] << std::endl;
+
+    // Variants of the color pipeline are compiled when first selected, at the beginning of a frame
+    m_pipelineVariants.setBuilder([this](const PipelineVariants::Key& key, const std::vector<ConstantEntry>& constants)
+                                  { return createPipelineVariant(key, constants); });
+    m_scenePipelines.fill(nullptr);
+
+    return m_shaderModule != nullptr && m_depthPipeline != nullptr && shadowPipelinesCreated;
+}
+
+RenderPipeline Application::createPipelineVariant(const PipelineVariants::Key& key,
+                                                  const std::vector<ConstantEntry>& constants)
+{
+    RenderPipelineDescriptor pipelineDesc;
+
+    // Vertex fetch
+    std::vector<VertexAttribute> vertexAttribs(6);
+
+    // Position attribute
+    vertexAttribs[0].shaderLocation = 0;
+    vertexAttribs[0].format         = VertexFormat::Float32x3;
+    vertexAttribs[0].offset         = 0;
+
+    // Normal attribute
+    vertexAttribs[1].shaderLocation = 1;
+    vertexAttribs[1].format         = VertexFormat::Float32x3;
+    vertexAttribs[1].offset         = offsetof(VertexAttributes, normal);
+
+    // Color attribute
+    vertexAttribs[2].shaderLocation = 2;
+    vertexAttribs[2].format         = VertexFormat::Float32x3;
+    vertexAttribs[2].offset         = offsetof(VertexAttributes, color);
+
+    // UV attribute
+    vertexAttribs[3].shaderLocation = 3;
+    vertexAttribs[3].format         = VertexFormat::Float32x2;
+    vertexAttribs[3].offset         = offsetof(VertexAttributes, uv);
+
+    // Targent attribute
+    vertexAttribs[4].shaderLocation = 4;
+    vertexAttribs[4].format         = VertexFormat::Float32x3;
+    vertexAttribs[4].offset         = offsetof(VertexAttributes, tangent);
+
+    // Bitangent attribute
+    vertexAttribs[5].shaderLocation = 5;
+    vertexAttribs[5].format         = VertexFormat::Float32x3;
+    vertexAttribs[5].offset         = offsetof(VertexAttributes, bitangent);
+
+    VertexBufferLayout vertexBufferLayout;
+    vertexBufferLayout.attributeCount = (uint32_t)vertexAttribs.size();
+    vertexBufferLayout.attributes     = vertexAttribs.data();
+    vertexBufferLayout.arrayStride    = sizeof(VertexAttributes);
+    vertexBufferLayout.stepMode       = VertexStepMode::Vertex;
+
+    pipelineDesc.vertex.bufferCount = 1;
+    pipelineDesc.vertex.buffers     = &vertexBufferLayout;
+
+    pipelineDesc.vertex.module        = m_shaderModule;
+    pipelineDesc.vertex.entryPoint    = "vs_main";
+    pipelineDesc.vertex.constantCount = 0;
+    pipelineDesc.vertex.constants     = nullptr;
+
+    pipelineDesc.primitive.topology         = PrimitiveTopology::TriangleList;
+    pipelineDesc.primitive.stripIndexFormat = IndexFormat::Undefined;
+    pipelineDesc.primitive.frontFace        = FrontFace::CCW;
+    pipelineDesc.primitive.cullMode         = CullMode::None;
+
+    // The overdraw view adds up a constant for each shaded fragment instead of lighting it
+    FragmentState fragmentState;
+    pipelineDesc.fragment       = &fragmentState;
+    fragmentState.module        = m_shaderModule;
+    fragmentState.entryPoint    = key.overdraw ? "fs_overdraw" : "fs_main";
+    fragmentState.constantCount = (uint32_t)constants.size();
+    fragmentState.constants     = constants.data();
+
+    // Opaque surfaces overwrite the target, only transparent ones and the overdraw view blend
+    BlendState blendState;
+    blendState.color.srcFactor = key.overdraw ? BlendFactor::One : BlendFactor::SrcAlpha;
+    blendState.color.dstFactor = key.overdraw ? BlendFactor::One : BlendFactor::OneMinusSrcAlpha;
+    blendState.color.operation = BlendOperation::Add;
+    blendState.alpha.srcFactor = BlendFactor::Zero;
+    blendState.alpha.dstFactor = BlendFactor::One;
+    blendState.alpha.operation = BlendOperation::Add;
+
+    ColorTargetState colorTarget;
+    colorTarget.format    = m_swapChainFormat;
+    colorTarget.blend     = key.blend || key.overdraw ? &blendState : nullptr;
+    colorTarget.writeMask = ColorWriteMask::All;
+
+    fragmentState.targetCount = 1;
+    fragmentState.targets     = &colorTarget;
+
+    // After a depth prepass, only the fragments of the closest surfaces pass the test
+    // Transparent surfaces are not in the prepass, they are tested against it without hiding each other.
+    DepthStencilState depthStencilState = Default;
+    depthStencilState.depthCompare      = key.depthEqual && !key.blend ? CompareFunction::Equal : CompareFunction::Less;
+    depthStencilState.depthWriteEnabled = !key.depthEqual && !key.blend;
+    depthStencilState.format            = m_depthTextureFormat;
+    depthStencilState.stencilReadMask   = 0;
+    depthStencilState.stencilWriteMask  = 0;
+
+    pipelineDesc.depthStencil = &depthStencilState;
+
+    pipelineDesc.multisample.count                  = 1;
+    pipelineDesc.multisample.mask                   = ~0u;
+    pipelineDesc.multisample.alphaToCoverageEnabled = false;
+
+    pipelineDesc.layout = m_pipelineLayout;
+
+    return m_device.createRenderPipeline(pipelineDesc);
+}
+
+PipelineVariants::Key Application::sceneVariantKey(uint32_t pipelineIndex) const
+{
+    // Features that would not change the result are left out, e.g. specular highlights scaled by zero
+    PipelineVariants::Key key;
+    key.directionalLights = static_cast<uint32_t>(m_shading.directionalLights);
+    key.normalMap         = m_material.normalMap && m_lightingUniforms.normalMapStrength > 0.0f
+                            && !(pipelineIndex & kScenePipelineWithoutNormalMap);
+    key.specular          = m_material.specular && m_lightingUniforms.ks > 0.0f;
+    key.gammaCorrection   = m_shading.gammaCorrection;
+    key.shadows           = m_shadow.enabled && m_shading.directionalLights > 0;
+    key.overdraw          = m_depthPrepass.showOverdraw;
+    key.depthEqual        = m_depthPrepass.enabled;
+    key.blend             = (pipelineIndex & kScenePipelineTransparent) != 0;
+    return key;
+}
+
+void Application::selectPipelineVariant()
+{
+    // Only the pipelines of the loaded materials are compiled
+    std::array<bool, kScenePipelineCount> used = {};
+    for (uint32_t material = 0; material < static_cast<uint32_t>(m_materials.size()); ++material)
+    {
+        used[scenePipelineIndex(material)] = true;
+    }
+
+    bool changed = false;
+    for (uint32_t index = 0; index < kScenePipelineCount; ++index)
+    {
+        WGPURenderPipeline previousPipeline = m_scenePipelines[index];
+        m_scenePipelines[index]             = used[index] ? m_pipelineVariants.get(sceneVariantKey(index)) : nullptr;
+        changed                             = changed || m_scenePipelines[index] != previousPipeline;
+    }
+    if (changed)
+    {
+        // Bundles recorded with the previous pipelines must not be replayed
+        invalidateSceneBundles();
+        requestRedraw();
+    }
+}
+
+uint32_t Application::scenePipelineIndex(uint32_t material) const
+{
+    uint32_t index = 0;
+    if (m_materials[material].normalLayer == TextureArrayPool::kInvalidLayer)
+        index |= kScenePipelineWithoutNormalMap;
+    if (m_materials[material].opacity < 1.0f)
+        index |= kScenePipelineTransparent;
+    return index;
+}
+
+void Application::terminateRenderPipeline()
+{
+    m_pipelineVariants.clear();
+    m_scenePipelines.fill(nullptr);
+    m_depthPipeline.release();
+    m_pipelineLayout.release();
+    for (RenderPipeline& shadowPipeline : m_shadowPipelines)
+    {
+        shadowPipeline.release();
+    }
+    m_shadowPipelineLayout.release();
+    m_shaderModule.release();
+    m_bindGroupLayout.release();
+    m_objectBindGroupLayout.release();
+    m_lightBindGroupLayout.release();
+    m_shadowBindGroupLayout.release();
+}
+
+bool Application::initTexture()
+{
+    // Create a sampler
+    SamplerDescriptor samplerDesc;
+    samplerDesc.addressModeU  = AddressMode::Repeat;
+    samplerDesc.addressModeV  = AddressMode::Repeat;
+    samplerDesc.addressModeW  = AddressMode::Repeat;
+    samplerDesc.magFilter     = FilterMode::Linear;
+    samplerDesc.minFilter     = FilterMode::Linear;
+    samplerDesc.mipmapFilter  = MipmapFilterMode::Linear;
+    samplerDesc.lodMinClamp   = 0.0f;
+    samplerDesc.lodMaxClamp   = 8.0f;
+    samplerDesc.compare       = CompareFunction::Undefined;
+    samplerDesc.maxAnisotropy = 1;
+    m_sampler                 = m_device.createSampler(samplerDesc);
+
+    // All the material textures are layers of the same array, so that materials only differ by their layer indices
+    if (!m_materialTextures.init(m_device,
+                                 kMaterialTextureSize,
+                                 kMaterialTextureSize,
+                                 TextureFormat::RGBA8Unorm,
+                                 m_maxMaterialLayers,
+                                 "Material textures",
+                                 &m_gpuMemory,
+                                 &m_uploads))
+    {
+        std::cerr << "Could not create the material texture array!" << std::endl;
+        return false;
+    }
+
+    // The textures themselves are listed by the materials of the model, see initGeometry
+    m_textureStreamer.init(&m_materialTextures, &m_uploads);
+
+    // Images larger than the layers are paged through a cache of fixed size instead
+    if (!m_virtualTextures.init(m_device, &m_gpuMemory, &m_uploads))
+    {
+        std::cerr << "Could not create the virtual texture cache!" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void Application::terminateTexture()
+{
+    m_virtualTextures.terminate();
+    m_textureStreamer.terminate();
+    m_materialTextures.terminate();
+    m_sampler.release();
+}
+
+bool Application::initGeometry()
+{
+    // Load mesh data from OBJ file
+    std::vector<VertexAttributes> vertexData;
+    std::vector<ResourceManager::Material> materials;
+    bool success = ResourceManager::loadGeometryFromObj(m_modelPath, vertexData, &m_submeshes, &materials);
+    if (!success || m_submeshes.empty())
+    {
+        std::cerr << "Could not load geometry!" << std::endl;
+        return false;
+    }
+
+    // Materials without texture fall back to their diffuse color, and to the interpolated normal
+    m_materials.clear();
+    for (const ResourceManager::Material& objMaterial : materials)
+    {
+        Material material;
+        material.diffuse = objMaterial.diffuse;
+        material.opacity = objMaterial.opacity;
+        uint32_t width, height;
+        if (ResourceManager::imageSize(objMaterial.diffuseTexture, width, height)
+            && std::max(width, height) > kMaterialTextureSize)
+        {
+            material.virtualTexture = m_virtualTextures.load(objMaterial.diffuseTexture);
+        }
+        if (!objMaterial.diffuseTexture.empty() && material.virtualTexture == VirtualTextures::kInvalid)
+        {
+            material.baseColorLayer = loadMaterialTexture(objMaterial.diffuseTexture);
+        }
+        if (!objMaterial.normalTexture.empty())
+        {
+            material.normalLayer = loadMaterialTexture(objMaterial.normalTexture);
+        }
+        m_materials.push_back(material);
+    }
+    std::cout << "Materials: " << m_materials.size() << ", " << m_materialTextureLayers.size() << " textures in "
+              << m_materialTextures.stats().usedLayers << " layers, " << m_virtualTextures.stats().textures
+              << " virtual textures" << std::endl;
+
+    m_modelBounds = BoundingBox();
+    for (const ResourceManager::Submesh& submesh : m_submeshes)
+    {
+        m_modelBounds.extend(submesh.bounds);
+    }
+
+    // Create vertex buffers, as many as needed for each to stay within the buffer size limit
+    uint64_t maxVertices   = std::min<uint64_t>(m_maxVertexBufferSize / sizeof(VertexAttributes), UINT32_MAX);
+    uint32_t chunkVertices = std::max(static_cast<uint32_t>(maxVertices) / 3 * 3, 3u);
+    uint32_t chunkCount    = ResourceManager::splitIntoChunks(vertexData, chunkVertices, m_submeshes);
+
+    BufferDescriptor bufferDesc;
+    bufferDesc.label            = "Vertices";
+    bufferDesc.usage            = BufferUsage::CopyDst | BufferUsage::Vertex;
+    bufferDesc.mappedAtCreation = false;
+    for (uint32_t chunk = 0; chunk < chunkCount; ++chunk)
+    {
+        size_t first    = size_t(chunk) * chunkVertices;
+        size_t count    = std::min<size_t>(chunkVertices, vertexData.size() - first);
+        bufferDesc.size = count * sizeof(VertexAttributes);
+        Buffer buffer   = m_gpuMemory.createBuffer(m_device, bufferDesc, MemoryCategory::Geometry);
+        if (!buffer)
+            return false;
+        m_uploads.writeBuffer(buffer, 0, vertexData.data() + first, bufferDesc.size);
+        m_vertexBuffers.push_back(buffer);
+    }
+    std::cout << "Geometry: " << vertexData.size() << " vertices in " << chunkCount << " vertex buffers, "
+              << m_submeshes.size() << " submeshes" << std::endl;
+
+    m_vertexCount = vertexData.size();
+    invalidateSceneBundles();
+
+    return true;
+}
+
+void Application::terminateGeometry()
+{
+    for (Buffer& buffer : m_vertexBuffers)
+    {
+        m_gpuMemory.destroy(buffer);
+    }
+    m_vertexBuffers.clear();
+    m_vertexCount = 0;
+    m_submeshes.clear();
+
+    for (const auto& [texture, layer] : m_materialTextureLayers)
+    {
+        if (layer != TextureArrayPool::kInvalidLayer)
+            m_materialTextures.free(layer);
+    }
+    m_materialTextureLayers.clear();
+    m_materialTextureReuses = 0;
+    m_materials.clear();
+}
+
+uint32_t Application::loadMaterialTexture(const std::filesystem::path& path)
+{
+    std::string key = path.lexically_normal().string();
+    auto it         = m_materialTextureLayers.find(key);
+    if (it != m_materialTextureLayers.end())
+    {
+        ++m_materialTextureReuses;
+        return it->second;
+    }
+
+    // Failures are remembered too, so that a missing file is only reported once
+    // The image is decoded in the background, a file that exists but cannot be decoded is reported by the streamer.
+    uint32_t layer = TextureArrayPool::kInvalidLayer;
+    if (!std::filesystem::exists(path))
+        std::cerr << "Could not load texture " << path << "!" << std::endl;
+    else if ((layer = m_materialTextures.allocate()) == TextureArrayPool::kInvalidLayer)
+        std::cerr << "No layer left for texture " << path << "!" << std::endl;
+    else
+        m_textureStreamer.request(path, layer);
+    m_materialTextureLayers[key] = layer;
+    return layer;
+}
+
+glm::uvec4 Application::materialLayers(uint32_t material) const
+{
+    // The shader clamps the sampled level to the resident ones, and uses the fallbacks before any is
+    uint32_t baseColorLayer = m_materials[material].baseColorLayer;
+    uint32_t normalLayer    = m_materials[material].normalLayer;
+    return glm::uvec4(m_textureStreamer.isResident(baseColorLayer) ? baseColorLayer : TextureArrayPool::kInvalidLayer,
+                      m_textureStreamer.isResident(normalLayer) ? normalLayer : TextureArrayPool::kInvalidLayer,
+                      m_textureStreamer.residentLevel(baseColorLayer),
+                      m_textureStreamer.residentLevel(normalLayer));
+}
+
+void Application::updateTextureStreaming()
+{
+    if (m_textureStreamer.update())
+    {
+        for (uint32_t i = 0; i < static_cast<uint32_t>(m_sceneObjects.size()); ++i)
+        {
+            ObjectUniforms& uniforms =
+                *reinterpret_cast<ObjectUniforms*>(&m_objectUniformData[i * m_objectUniformStride]);
+            uniforms.materialLayers  = materialLayers(m_submeshes[m_sceneObjects[i].submesh].material);
+        }
+        m_uploads.writeBuffer(m_objectUniformBuffer, 0, m_objectUniformData.data(), m_objectUniformData.size());
+        requestRedraw();
+    }
+    else if (m_textureStreamer.busy())
+    {
+        // Images being decoded in the background are uploaded by the next frames
+        requestRedraw();
+    }
+    else if (m_startup.texturesMilliseconds == 0.0f && m_redraw.renderedFrames > 0)
+    {
+        m_startup.texturesMilliseconds =
+            std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - m_startup.startTime).count();
+        std::cout << "Textures streamed " << m_startup.texturesMilliseconds << " ms after start" << std::endl;
+    }
+}
+
+void Application::updateVirtualTextures()
+{
+    // The page tables are bound as they are, new pages only need a frame to show up, which sends more feedback
+    if (m_virtualTextures.update() || m_virtualTextures.busy())
+        requestRedraw();
+}
+
+bool Application::initUniforms()
+{
+    // Create uniform buffer
+    BufferDescriptor bufferDesc;
+    bufferDesc.label            = "Uniforms";
+    bufferDesc.size             = sizeof(MyUniforms);
+    bufferDesc.usage            = BufferUsage::CopyDst | BufferUsage::Uniform;
+    bufferDesc.mappedAtCreation = false;
+    m_uniformBuffer             = m_gpuMemory.createBuffer(m_device, bufferDesc, MemoryCategory::Uniforms);
+
+    // Upload the initial value of the uniforms
+    m_uniforms.modelMatrix      = mat4x4(1.0);
+    m_uniforms.viewMatrix       = glm::lookAt(vec3(-2.0f, -3.0f, 2.0f), vec3(0.0f), vec3(0, 0, 1));
+    m_uniforms.projectionMatrix = glm::perspective(45 * PI / 180, 640.0f / 480.0f, kCameraNear, kCameraFar);
+    m_uniforms.time             = 1.0f;
+    m_uniforms.color            = {0.0f, 1.0f, 0.4f, 1.0f};
+    m_uploads.writeBuffer(m_uniformBuffer, 0, &m_uniforms, sizeof(MyUniforms));
+
+    updateViewMatrix();
+
+    return m_uniformBuffer != nullptr;
+}
+
+void Application::terminateUniforms()
+{
+    m_gpuMemory.destroy(m_uniformBuffer);
+}
+
+bool Application::initBindGroupLayout()
+{
+    std::vector<BindGroupLayoutEntry> bindingLayoutEntries(9, Default);
+
+    // The uniform buffer binding that we already had
+    BindGroupLayoutEntry& bindingLayout = bindingLayoutEntries[0];
+    bindingLayout.binding               = 0;
+    bindingLayout.visibility            = ShaderStage::Vertex | ShaderStage::Fragment;
+    bindingLayout.buffer.type           = BufferBindingType::Uniform;
+    bindingLayout.buffer.minBindingSize = sizeof(MyUniforms);
+
+    // The material textures, base colors and normal maps alike, one per layer
+    BindGroupLayoutEntry& textureBindingLayout = bindingLayoutEntries[1];
+    textureBindingLayout.binding               = 1;
+    textureBindingLayout.visibility            = ShaderStage::Fragment;
+    textureBindingLayout.texture.sampleType    = TextureSampleType::Float;
+    textureBindingLayout.texture.viewDimension = TextureViewDimension::_2DArray;
+
+    // The texture sampler binding
+    BindGroupLayoutEntry& samplerBindingLayout = bindingLayoutEntries[2];
+    samplerBindingLayout.binding               = 3;
+    samplerBindingLayout.visibility            = ShaderStage::Fragment;
+    samplerBindingLayout.sampler.type          = SamplerBindingType::Filtering;
+
+    // The texture sampler binding
+    BindGroupLayoutEntry& lightingUniformLayout = bindingLayoutEntries[3];
+    lightingUniformLayout.binding               = 4;
+    lightingUniformLayout.visibility            = ShaderStage::Fragment;
+    lightingUniformLayout.buffer.type           = BufferBindingType::Uniform;
+    lightingUniformLayout.buffer.minBindingSize = sizeof(LightingUniforms);
+
+    // The shadow maps of the directional lights, one per layer
+    BindGroupLayoutEntry& shadowMapBindingLayout = bindingLayoutEntries[4];
+    shadowMapBindingLayout.binding               = 5;
+    shadowMapBindingLayout.visibility            = ShaderStage::Fragment;
+    shadowMapBindingLayout.texture.sampleType    = TextureSampleType::Depth;
+    shadowMapBindingLayout.texture.viewDimension = TextureViewDimension::_2DArray;
+
+    // The sampler comparing depths with the shadow maps
+    BindGroupLayoutEntry& shadowSamplerBindingLayout = bindingLayoutEntries[5];
+    shadowSamplerBindingLayout.binding               = 6;
+    shadowSamplerBindingLayout.visibility            = ShaderStage::Fragment;
+    shadowSamplerBindingLayout.sampler.type          = SamplerBindingType::Comparison;
+
+    // The tiles of the virtual textures, and where each page is found among them
+    BindGroupLayoutEntry& tileCacheBindingLayout = bindingLayoutEntries[6];
+    tileCacheBindingLayout.binding               = 7;
+    tileCacheBindingLayout.visibility            = ShaderStage::Fragment;
+    tileCacheBindingLayout.texture.sampleType    = TextureSampleType::Float;
+    tileCacheBindingLayout.texture.viewDimension = TextureViewDimension::_2D;
+
+    BindGroupLayoutEntry& pageTableBindingLayout = bindingLayoutEntries[7];
+    pageTableBindingLayout.binding               = 8;
+    pageTableBindingLayout.visibility            = ShaderStage::Fragment;
+    pageTableBindingLayout.texture.sampleType    = TextureSampleType::Uint;
+    pageTableBindingLayout.texture.viewDimension = TextureViewDimension::_2DArray;
+
+    // The pages the fragments would like to sample, marked by the shader
+    BindGroupLayoutEntry& feedbackBindingLayout = bindingLayoutEntries[8];
+    feedbackBindingLayout.binding               = 9;
+    feedbackBindingLayout.visibility            = ShaderStage::Fragment;
+    feedbackBindingLayout.buffer.type           = BufferBindingType::Storage;
+    feedbackBindingLayout.buffer.minBindingSize = VirtualTextures::feedbackBytes();
+
+    // Create a bind group layout
+    BindGroupLayoutDescriptor bindGroupLayoutDesc {};
+    bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+    bindGroupLayoutDesc.entries    = bindingLayoutEntries.data();
+    m_bindGroupLayout              = m_device.createBindGroupLayout(bindGroupLayoutDesc);
+
+    // The per-object uniforms, selected by a dynamic offset for each draw, with the material layers of the object
+    BindGroupLayoutEntry objectBindingLayout    = Default;
+    objectBindingLayout.binding                 = 0;
+    objectBindingLayout.visibility              = ShaderStage::Vertex | ShaderStage::Fragment;
+    objectBindingLayout.buffer.type             = BufferBindingType::Uniform;
+    objectBindingLayout.buffer.hasDynamicOffset = true;
+    objectBindingLayout.buffer.minBindingSize   = sizeof(ObjectUniforms);
+
+    BindGroupLayoutDescriptor objectBindGroupLayoutDesc {};
+    objectBindGroupLayoutDesc.entryCount = 1;
+    objectBindGroupLayoutDesc.entries    = &objectBindingLayout;
+    m_objectBindGroupLayout              = m_device.createBindGroupLayout(objectBindGroupLayoutDesc);
+
+    // The clustered lights, read by the fragment shader
+    std::vector<BindGroupLayoutEntry> lightBindingLayouts(3, Default);
+    std::array<uint64_t, 3> lightElementSizes = {
+        sizeof(LightClusterer::Light), sizeof(LightClusterer::Cluster), sizeof(uint32_t)};
+    for (uint32_t i = 0; i < lightBindingLayouts.size(); ++i)
+    {
+        BindGroupLayoutEntry& lightBindingLayout = lightBindingLayouts[i];
+        lightBindingLayout.binding               = i;
+        lightBindingLayout.visibility            = ShaderStage::Fragment;
+        lightBindingLayout.buffer.type           = BufferBindingType::ReadOnlyStorage;
+        lightBindingLayout.buffer.minBindingSize = lightElementSizes[i];
+    }
+
+    BindGroupLayoutDescriptor lightBindGroupLayoutDesc {};
+    lightBindGroupLayoutDesc.entryCount = (uint32_t)lightBindingLayouts.size();
+    lightBindGroupLayoutDesc.entries    = lightBindingLayouts.data();
+    m_lightBindGroupLayout              = m_device.createBindGroupLayout(lightBindGroupLayoutDesc);
+
+    // The shadow passes only read the uniforms, at the same bindings as in the scene layout. The shadow maps cannot
+    // be part of the bind group of a pass that renders into them.
+    std::vector<BindGroupLayoutEntry> shadowBindingLayouts(2, Default);
+    shadowBindingLayouts[0].binding               = 0;
+    shadowBindingLayouts[0].visibility            = ShaderStage::Vertex;
+    shadowBindingLayouts[0].buffer.type           = BufferBindingType::Uniform;
+    shadowBindingLayouts[0].buffer.minBindingSize = sizeof(MyUniforms);
+    shadowBindingLayouts[1].binding               = 4;
+    shadowBindingLayouts[1].visibility            = ShaderStage::Vertex;
+    shadowBindingLayouts[1].buffer.type           = BufferBindingType::Uniform;
+    shadowBindingLayouts[1].buffer.minBindingSize = sizeof(LightingUniforms);
+
+    BindGroupLayoutDescriptor shadowBindGroupLayoutDesc {};
+    shadowBindGroupLayoutDesc.entryCount = (uint32_t)shadowBindingLayouts.size();
+    shadowBindGroupLayoutDesc.entries    = shadowBindingLayouts.data();
+    m_shadowBindGroupLayout              = m_device.createBindGroupLayout(shadowBindGroupLayoutDesc);
+
+    return m_bindGroupLayout != nullptr && m_objectBindGroupLayout != nullptr && m_lightBindGroupLayout != nullptr
+           && m_shadowBindGroupLayout != nullptr;
+}
+
+void Application::terminateBindGroupLayout()
+{
+    m_bindGroupLayout.release();
+    m_objectBindGroupLayout.release();
+    m_lightBindGroupLayout.release();
+    m_shadowBindGroupLayout.release();
+}
+
+bool Application::initBindGroup()
+{
+    // Create a binding
+    std::vector<BindGroupEntry> bindings(9);
+
+    bindings[0].binding = 0;
+    bindings[0].buffer  = m_uniformBuffer;
+    bindings[0].offset  = 0;
+    bindings[0].size    = sizeof(MyUniforms);
+
+    // Every material is drawn with this bind group, the array must not grow afterwards
+    bindings[1].binding     = 1;
+    bindings[1].textureView = m_materialTextures.view();
+
+    bindings[2].binding = 3;
+    bindings[2].sampler = m_sampler;
+
+    bindings[3].binding = 4;
+    bindings[3].buffer  = m_lightingUniformBuffer;
+    bindings[3].offset  = 0;
+    bindings[3].size    = sizeof(LightingUniforms);
+
+    bindings[4].binding     = 5;
+    bindings[4].textureView = m_shadowArrayView;
+
+    bindings[5].binding = 6;
+    bindings[5].sampler = m_shadowSampler;
+
+    // Fixed size resources, pages are moved in and out without touching the bind group
+    bindings[6].binding     = 7;
+    bindings[6].textureView = m_virtualTextures.cacheView();
+
+    bindings[7].binding     = 8;
+    bindings[7].textureView = m_virtualTextures.pageTableView();
+
+    bindings[8].binding = 9;
+    bindings[8].buffer  = m_virtualTextures.feedbackBuffer();
+    bindings[8].offset  = 0;
+    bindings[8].size    = VirtualTextures::feedbackBytes();
+
+    BindGroupDescriptor bindGroupDesc;
+    bindGroupDesc.layout     = m_bindGroupLayout;
+    bindGroupDesc.entryCount = (uint32_t)bindings.size();
+    bindGroupDesc.entries    = bindings.data();
+    m_bindGroup              = m_device.createBindGroup(bindGroupDesc);
+    invalidateSceneBundles();
+
+    return m_bindGroup != nullptr;
+}
+
+void Application::terminateBindGroup()
+{
+    m_bindGroup.release();
+}
+
+void Application::updateProjectionMatrix()
+{
+    // Follow the configured surface, whose size is kept while minimized
+    float ratio                 = m_surfaceHeight > 0 ? m_surfaceWidth / (float)m_surfaceHeight : 1.0f;
+    m_uniforms.projectionMatrix = glm::perspective(45 * PI / 180, ratio, kCameraNear, kCameraFar);
+    m_uploads.writeBuffer(m_uniformBuffer,
+                          offsetof(MyUniforms, projectionMatrix),
+                          &m_uniforms.projectionMatrix,
+                          sizeof(MyUniforms::projectionMatrix));
+
+    // The froxels follow the frustum, the new slicing is uploaded with the lights of the next frame
+    m_clusterer.setProjection(m_uniforms.projectionMatrix, kCameraNear, kCameraFar);
+    m_lightingUniforms.sliceScale = m_clusterer.sliceScale();
+    m_lightingUniforms.sliceBias  = m_clusterer.sliceBias();
+    m_lightingUniformsChanged     = true;
+}
+
+void Application::updateViewMatrix()
+{
+    float cx              = cos(m_cameraState.angles.x);
+    float sx              = sin(m_cameraState.angles.x);
+    float cy              = cos(m_cameraState.angles.y);
+    float sy              = sin(m_cameraState.angles.y);
+    vec3 position         = vec3(cx * cy, sx * cy, sy) * std::exp(-m_cameraState.zoom);
+    m_uniforms.viewMatrix = glm::lookAt(position, vec3(0.0f), vec3(0, 0, 1));
+    m_uploads.writeBuffer(m_uniformBuffer,
+                          offsetof(MyUniforms, viewMatrix),
+                          &m_uniforms.viewMatrix,
+                          sizeof(MyUniforms::viewMatrix));
+
+    m_uniforms.cameraWorldPosition = position;
+    m_uploads.writeBuffer(m_uniformBuffer,
+                          offsetof(MyUniforms, cameraWorldPosition),
+                          &m_uniforms.cameraWorldPosition,
+                          sizeof(MyUniforms::cameraWorldPosition));
+}
+
+void Application::updateDragInertia()
+{
+    constexpr float eps = 1e-4f;
+
+    if (m_drag.active)
+        return;
+
+    if (std::abs(m_drag.velocity.x) < eps && std::abs(m_drag.velocity.y) < eps)
+        return;
+
+    m_cameraState.angles += m_drag.velocity;
+    m_cameraState.angles.y = glm::clamp(m_cameraState.angles.y, -PI / 2 + 1e-5f, PI / 2 - 1e-5f);
+    m_drag.velocity *= m_drag.intertia;
+    updateViewMatrix();
+    requestRedraw();
+}
+
+void Application::requestRedraw()
+{
+    constexpr int guiSettleFrames = 3;
+    m_redraw.pendingFrames        = guiSettleFrames;
+}
+
+bool Application::needsRedraw() const
+{
+    if (!m_redraw.onDemand || m_redraw.pendingFrames > 0)
+        return true;
+
+    // Things that change on their own
+    bool lightsMove = m_lightState.animate && m_lightState.count > 0;
+    return m_scene.animate || m_scene.rebuildRequested || lightsMove || m_benchmark.active || m_lightBenchmark.active;
+}
+
+bool Application::isMinimized() const
+{
+    int width, height;
+    glfwGetFramebufferSize(m_window, &width, &height);
+    return width == 0 || height == 0 || glfwGetWindowAttrib(m_window, GLFW_ICONIFIED);
+}
+
+bool Application::initGui()
+{
+    // Setup ImGui context
+    IMGUI_CHECKVERSION();
+    ImGui::CreateContext();
+    ImGui::GetIO();
+
+    // Setup Platform/Renderer backends
+    ImGui_ImplGlfw_InitForOther(m_window, true);
+
+    ImGui_ImplWGPU_InitInfo wgpuInfo;
+    wgpuInfo.Device             = m_device;
+    wgpuInfo.NumFramesInFlight  = 3;
+    wgpuInfo.RenderTargetFormat = m_swapChainFormat;
+    wgpuInfo.DepthStencilFormat = TextureFormat::Undefined;  // drawn in a pass of its own, without depth
+    ImGui_ImplWGPU_Init(&wgpuInfo);
+
+    return true;
+}
+
+void Application::terminateGui()
+{
+    m_gpuMemory.untrack(ImGui::GetIO().BackendRendererUserData);
+    ImGui_ImplGlfw_Shutdown();
+    ImGui_ImplWGPU_Shutdown();
+}
+
+bool Application::initGuiOverlay()
+{
+    m_guiOverlayShaderModule =
+        ResourceManager::loadShaderModule("resources/shader/gui_overlay.wgsl", m_device, m_shaderPreprocessor);
+    if (!m_guiOverlayShaderModule)
+    {
+        std::cerr << "Could not load the GUI overlay shader!" << std::endl;
+        return false;
+    }
+
+    BindGroupLayoutEntry textureBindingLayout  = Default;
+    textureBindingLayout.binding               = 0;
+    textureBindingLayout.visibility            = ShaderStage::Fragment;
+    textureBindingLayout.texture.sampleType    = TextureSampleType::Float;
+    textureBindingLayout.texture.viewDimension = TextureViewDimension::_2D;
+
+    BindGroupLayoutDescriptor bindGroupLayoutDesc {};
+    bindGroupLayoutDesc.entryCount = 1;
+    bindGroupLayoutDesc.entries    = &textureBindingLayout;
+    m_guiOverlayBindGroupLayout    = m_device.createBindGroupLayout(bindGroupLayoutDesc);
+
+    RenderPipelineDescriptor pipelineDesc;
+    pipelineDesc.vertex.bufferCount   = 0;
+    pipelineDesc.vertex.buffers       = nullptr;
+    pipelineDesc.vertex.module        = m_guiOverlayShaderModule;
+    pipelineDesc.vertex.entryPoint    = "vs_main";
+    pipelineDesc.vertex.constantCount = 0;
+    pipelineDesc.vertex.constants     = nullptr;
+
+    pipelineDesc.primitive.topology         = PrimitiveTopology::TriangleList;
+    pipelineDesc.primitive.stripIndexFormat = IndexFormat::Undefined;
+    pipelineDesc.primitive.frontFace        = FrontFace::CCW;
+    pipelineDesc.primitive.cullMode         = CullMode::None;
+
+    // The overlay is premultiplied by its alpha
+    BlendState blendState;
+    blendState.color.srcFactor = BlendFactor::One;
+    blendState.color.dstFactor = BlendFactor::OneMinusSrcAlpha;
+    blendState.color.operation = BlendOperation::Add;
+    blendState.alpha.srcFactor = BlendFactor::One;
+    blendState.alpha.dstFactor = BlendFactor::OneMinusSrcAlpha;
+    blendState.alpha.operation = BlendOperation::Add;
+
+    ColorTargetState colorTarget;
+    colorTarget.format    = m_swapChainFormat;
+    colorTarget.blend     = &blendState;
+    colorTarget.writeMask = ColorWriteMask::All;
+
+    FragmentState fragmentState;
+    fragmentState.module        = m_guiOverlayShaderModule;
+    fragmentState.entryPoint    = "fs_main";
+    fragmentState.constantCount = 0;
+    fragmentState.constants     = nullptr;
+    fragmentState.targetCount   = 1;
+    fragmentState.targets       = &colorTarget;
+    pipelineDesc.fragment       = &fragmentState;
+
+    pipelineDesc.depthStencil = nullptr;
+
+    pipelineDesc.multisample.count                  = 1;
+    pipelineDesc.multisample.mask                   = ~0u;
+    pipelineDesc.multisample.alphaToCoverageEnabled = false;
+
+    PipelineLayoutDescriptor layoutDesc {};
+    layoutDesc.bindGroupLayoutCount = 1;
+    layoutDesc.bindGroupLayouts     = (WGPUBindGroupLayout*)&m_guiOverlayBindGroupLayout;
+    PipelineLayout layout           = m_device.createPipelineLayout(layoutDesc);
+    pipelineDesc.layout             = layout;
+    m_guiOverlayPipeline            = m_device.createRenderPipeline(pipelineDesc);
+    layout.release();
+
+    return m_guiOverlayPipeline != nullptr;
+}
+
+void Application::terminateGuiOverlay()
+{
+    if (m_guiOverlayBindGroup)
+        m_guiOverlayBindGroup.release();
+    m_renderTargets.release(m_guiOverlayTarget);
+    m_guiOverlayPipeline.release();
+    m_guiOverlayBindGroupLayout.release();
+    m_guiOverlayShaderModule.release();
+}
+
+void Application::encodeGuiOverlay(CommandEncoder encoder)
+{
+    auto startTime = std::chrono::steady_clock::now();
+
+    bool resized = m_guiOverlay.width != m_surfaceWidth || m_guiOverlay.height != m_surfaceHeight;
+    if (m_guiOverlayTarget.texture && (!m_guiOverlay.cached || resized))
+    {
+        m_guiOverlayBindGroup.release();
+        m_guiOverlayBindGroup = nullptr;
+        m_renderTargets.release(m_guiOverlayTarget);
+    }
+    if (!m_guiOverlay.cached)
+    {
+        m_guiOverlay.drawMicroseconds = 0.0f;
+        return;
+    }
+
+    if (!m_guiOverlayTarget.texture)
+    {
+        // The overlay is read pixel for pixel, so a target from a larger size bucket does as well
+        m_guiOverlayTarget  = m_renderTargets.acquire(m_surfaceWidth,
+                                                      m_surfaceHeight,
+                                                      m_swapChainFormat,
+                                                      TextureUsage::RenderAttachment | TextureUsage::TextureBinding,
+                                                      false,
+                                                      "GUI overlay");
+        m_guiOverlay.width  = m_surfaceWidth;
+        m_guiOverlay.height = m_surfaceHeight;
+
+        BindGroupEntry binding;
+        binding.binding     = 0;
+        binding.textureView = m_guiOverlayTarget.view;
+
+        BindGroupDescriptor bindGroupDesc;
+        bindGroupDesc.layout     = m_guiOverlayBindGroupLayout;
+        bindGroupDesc.entryCount = 1;
+        bindGroupDesc.entries    = &binding;
+        m_guiOverlayBindGroup    = m_device.createBindGroup(bindGroupDesc);
+        m_guiCache.invalidate();
+    }
+
+    ImDrawData* drawData = ImGui::GetDrawData();
+    if (m_guiCache.update(*drawData))
+    {
+        RenderPassColorAttachment overlayColorAttachment {};
+        overlayColorAttachment.view          = m_guiOverlayTarget.view;
+        overlayColorAttachment.resolveTarget = nullptr;
+        overlayColorAttachment.loadOp        = LoadOp::Clear;
+        overlayColorAttachment.storeOp       = StoreOp::Store;
+        overlayColorAttachment.clearValue    = Color {0.0, 0.0, 0.0, 0.0};
+
+        RenderPassDescriptor overlayPassDesc {};
+        overlayPassDesc.colorAttachmentCount   = 1;
+        overlayPassDesc.colorAttachments       = &overlayColorAttachment;
+        overlayPassDesc.depthStencilAttachment = nullptr;
+        overlayPassDesc.timestampWrites        = nullptr;
+        RenderPassEncoder overlayPass          = encoder.beginRenderPass(overlayPassDesc);
+        ImGui_ImplWGPU_RenderDrawData(drawData, overlayPass);
+        overlayPass.end();
+        overlayPass.release();
+    }
+
+    m_guiOverlay.drawMicroseconds =
+        std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void Application::drawGui(RenderPassEncoder renderPass)
+{
+    auto startTime = std::chrono::steady_clock::now();
+
+    if (m_guiOverlay.cached && m_guiOverlayBindGroup)
+    {
+        renderPass.setPipeline(m_guiOverlayPipeline);
+        renderPass.setBindGroup(0, m_guiOverlayBindGroup, 0, nullptr);
+        renderPass.draw(3, 1, 0, 0);
+    }
+    else
+    {
+        ImGui_ImplWGPU_RenderDrawData(ImGui::GetDrawData(), renderPass);
+    }
+
+    m_guiOverlay.drawMicroseconds +=
+        std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void Application::updateGui()
+{
+    // Start the ImGui frame
+    ImGui_ImplWGPU_NewFrame();
+    ImGui_ImplGlfw_NewFrame();
+    ImGui::NewFrame();
+    // Figures changing at every frame would have the cached overlay rendered again at every frame
+    m_guiCache.beginFrame(m_guiOverlay.cached);
+
+    // Build our UI
+    {
+        bool changed = false;
+        ImGui::Begin("Lighting");
+        changed = ImGui::ColorEdit3("Color #0", glm::value_ptr(m_lightingUniforms.colors[0])) || changed;
+        changed = ImGui::DragDirection("Direction #0", m_lightingUniforms.directions[0]) || changed;
+        changed = ImGui::ColorEdit3("Color #1", glm::value_ptr(m_lightingUniforms.colors[1])) || changed;
+        changed = ImGui::DragDirection("Direction #1", m_lightingUniforms.directions[1]) || changed;
+        changed = ImGui::SliderFloat("Hardness", &m_lightingUniforms.hardness, 1.0f, 100.0f) || changed;
+        changed = ImGui::SliderFloat("K Diffuse", &m_lightingUniforms.kd, 0.0f, 1.0f) || changed;
+        changed = ImGui::SliderFloat("K Specular", &m_lightingUniforms.ks, 0.0f, 1.0f) || changed;
+        changed = ImGui::SliderFloat("Normal map", &m_lightingUniforms.normalMapStrength, 0.0f, 1.0f) || changed;
+
+        // Features of the material and of the shading, each combination is drawn by its own pipeline variant
+        ImGui::Separator();
+        ImGui::SliderInt("Directional lights", &m_shading.directionalLights, 0, 2);
+        ImGui::Checkbox("Normal mapping", &m_material.normalMap);
+        ImGui::Checkbox("Specular", &m_material.specular);
+        const TextureArrayPool::Stats& materialStats = m_materialTextures.stats();
+        ImGui::Text("Material layers: %u/%u used (%.0f%%, max %u), %.1f MiB unused",
+                    materialStats.usedLayers,
+                    materialStats.capacityLayers,
+                    100.0f * m_materialTextures.occupancy(),
+                    m_materialTextures.maxLayers(),
+                    m_materialTextures.wastedBytes() / (1024.0f * 1024.0f));
+        ImGui::Text("Materials: %zu, %zu textures (%u shared loads)",
+                    m_materials.size(),
+                    m_materialTextureLayers.size(),
+                    m_materialTextureReuses);
+        const TextureStreamer::Stats& streamStats = m_textureStreamer.stats();
+        m_guiCache.text("Streaming: %u/%u decoded (%.0f ms), %u complete, %.1f MiB uploaded",
+                        streamStats.decoded,
+                        streamStats.requests,
+                        streamStats.decodeMilliseconds,
+                        streamStats.completeLayers,
+                        streamStats.uploadedBytes / (1024.0f * 1024.0f));
+        m_guiCache.text("Last frame: %u levels, %.2f MiB",
+                        streamStats.frameUploads,
+                        streamStats.frameBytes / (1024.0f * 1024.0f));
+        ImGui::Text("Startup: first frame %.0f ms, textures %.0f ms",
+                    m_startup.firstFrameMilliseconds,
+                    m_startup.texturesMilliseconds);
+        const UploadManager::Stats& uploadStats = m_uploads.stats();
+        m_guiCache.text("Uploads: %u copies, %.2f MiB last frame, %.1f MiB/s",
+                        uploadStats.frameCopies,
+                        uploadStats.frameBytes / (1024.0f * 1024.0f),
+                        uploadStats.megabytesPerSecond);
+        m_guiCache.text("Staging: %u buffers, %u stalls, %u direct writes",
+                        uploadStats.stagingBuffers,
+                        uploadStats.stalls,
+                        uploadStats.directWrites);
+        int uploadBudget = static_cast<int>(m_uploads.frameBudget() / 1024);
+        if (ImGui::SliderInt("Upload budget (KiB/frame)", &uploadBudget, 256, 32768))
+        {
+            m_uploads.setFrameBudget(uint64_t(uploadBudget) * 1024);
+        }
+        const VirtualTextures::Stats& virtualStats = m_virtualTextures.stats();
+        m_guiCache.text("Virtual textures: %u, %u/%u pages resident, %u requested",
+                        virtualStats.textures,
+                        virtualStats.residentTiles,
+                        virtualStats.capacity,
+                        virtualStats.requestedTiles);
+        m_guiCache.text("Pages: %u uploaded (%u last frame), %u evicted, %u readbacks",
+                        virtualStats.uploads,
+                        virtualStats.frameUploads,
+                        virtualStats.evictions,
+                        virtualStats.readbacks);
+        int pageUploads = static_cast<int>(m_virtualTextures.maxUploadsPerFrame());
+        if (ImGui::SliderInt("Page uploads per frame", &pageUploads, 1, 64))
+        {
+            m_virtualTextures.setMaxUploadsPerFrame(static_cast<uint32_t>(pageUploads));
+        }
+        ImGui::Checkbox("Gamma correction", &m_shading.gammaCorrection);
+        ImGui::Checkbox("Shadows", &m_shadow.enabled);
+        changed = ImGui::SliderFloat("Shadow bias", &m_lightingUniforms.shadowBias, 0.0f, 0.01f, "%.4f") || changed;
+        const ShadowMaps::Stats& shadowStats = m_shadowMaps.stats();
+        m_guiCache.text(
+            "Shadow passes: %u rendered, %u skipped", shadowStats.renderedPasses, shadowStats.skippedPasses);
+        const PipelineVariants::Stats& variantStats = m_pipelineVariants.stats();
+        ImGui::Text("Pipeline variants: %u compiled in %.1f ms (last %.1f ms)",
+                    variantStats.variants,
+                    variantStats.compileMilliseconds,
+                    variantStats.lastCompileMilliseconds);
+        ImGui::Text("Opaque variant: 0x%x", sceneVariantKey(0).packed());
+        const ShaderPreprocessor::Stats& sourceStats = m_shaderPreprocessor.stats();
+        ImGui::Text("Shader sources: %u expanded, %u cached, %u file reads",
+                    sourceStats.expansions,
+                    sourceStats.cacheHits,
+                    sourceStats.fileReads);
+
+        ImGui::Separator();
+        if (ImGui::SliderInt("Lights", &m_lightState.count, 0, static_cast<int>(LightClusterer::kMaxLights)))
+            m_lightState.regenerate = true;
+        if (ImGui::SliderFloat("Spot lights", &m_lightState.spotFraction, 0.0f, 1.0f))
+            m_lightState.regenerate = true;
+        ImGui::Checkbox("Animate lights", &m_lightState.animate);
+        const LightClusterer::Stats& lightStats = m_clusterer.stats();
+        m_guiCache.text("Assignment: %.1f us, %u indices", lightStats.microseconds, lightStats.indices);
+        m_guiCache.text("Lights per cluster: %.2f average, %u max",
+                        static_cast<float>(lightStats.indices) / LightClusterer::kClusterCount,
+                        lightStats.maxPerCluster);
+        if (lightStats.dropped > 0)
+            ImGui::Text("Dropped: %u", lightStats.dropped);
+        ImGui::End();
+        // Other changes may be waiting for the next upload
+        if (changed)
+        {
+            m_lightingUniformsChanged = true;
+            requestRedraw();
+        }
+    }
+
+    {
+        ImGui::Begin("Scene");
+        if (ImGui::SliderInt("Replicas", &m_scene.replicas, 1, 100))
+        {
+            m_scene.rebuildRequested = true;
+        }
+        ImGui::Checkbox("Animate", &m_scene.animate);
+        ImGui::Checkbox("Frustum culling", &m_scene.cullingEnabled);
+        // Each combination selects its own pipeline variant at the beginning of the next frame
+        ImGui::Checkbox("Depth prepass", &m_depthPrepass.enabled);
+        ImGui::Checkbox("Show overdraw", &m_depthPrepass.showOverdraw);
+
+        size_t objectCount  = m_sceneObjects.size();
+        size_t visibleCount = m_visibleObjects.size();
+        m_guiCache.text(
+            "Objects: %zu (visible %zu, culled %zu)", objectCount, visibleCount, objectCount - visibleCount);
+        if (m_scene.cullingEnabled)
+        {
+            const FrustumCuller::Stats& stats = m_culler.stats();
+            m_guiCache.text("Culling: %.1f us, %u nodes visited", stats.microseconds, stats.nodesVisited);
+        }
+        ImGui::Text("BVH: %zu nodes, SAH cost %.1f", m_bvh.nodes().size(), m_bvh.cost());
+        m_guiCache.text("Refit: %.1f us, %d rebuilds", m_scene.refitMicroseconds, m_scene.bvhRebuilds);
+        const RenderQueue::Stats& queueStats     = m_renderQueue.stats();
+        const RenderQueue::Counters& colorCounts = m_drawCounters[static_cast<size_t>(ScenePass::Color)];
+        const RenderQueue::Counters& depthCounts = m_drawCounters[static_cast<size_t>(ScenePass::Depth)];
+        m_guiCache.text("Render queue: %u opaque, %u transparent, sorted in %.1f us (%u radix passes)",
+                        queueStats.opaqueItems,
+                        queueStats.items - queueStats.opaqueItems,
+                        queueStats.sortMicroseconds,
+                        queueStats.radixPasses);
+        ImGui::Text("Color pass: %u draws, %u pipeline and %u material changes",
+                    colorCounts.draws,
+                    colorCounts.pipelineChanges,
+                    colorCounts.materialChanges);
+        ImGui::Text("Geometry: %zu vertices in %zu buffers (%u binds), %zu submeshes",
+                    m_vertexCount,
+                    m_vertexBuffers.size(),
+                    colorCounts.vertexBufferChanges,
+                    m_submeshes.size());
+        if (m_depthPrepass.enabled)
+        {
+            ImGui::Text("Depth pass: %u draws, %u pipeline changes", depthCounts.draws, depthCounts.pipelineChanges);
+        }
+
+        ImGui::Separator();
+        ImGui::BeginDisabled(!m_recording.supported);
+        ImGui::Checkbox("Parallel recording", &m_recording.parallel);
+        ImGui::SliderInt("Threads", &m_recording.threadCount, 1, static_cast<int>(m_threadPool->concurrency()));
+        ImGui::EndDisabled();
+        ImGui::BeginDisabled(m_benchmark.active);
+        ImGui::Checkbox("Cache bundles", &m_bundleCache.enabled);
+        ImGui::EndDisabled();
+        m_guiCache.text("Encoding: %.1f us, %u bundles", m_recording.encodeMicroseconds, m_recording.bundleCount);
+        if (m_bundleCache.enabled)
+        {
+            m_guiCache.text("Bundle cache: %u replays, %u recordings (last %.1f us)",
+                            m_bundleCache.replayCount,
+                            m_bundleCache.recordCount,
+                            m_bundleCache.recordMicroseconds);
+        }
+        ImGui::End();
+    }
+
+    {
+        ImGui::Begin("Resolution");
+        ImGui::Checkbox("Dynamic resolution", &m_dynamicResolution.enabled);
+        ResolutionController::Settings& settings = m_resolution.settings();
+        ImGui::SliderFloat("Target (ms)", &settings.targetMilliseconds, 4.0f, 50.0f);
+        ImGui::DragFloatRange2("Scale", &settings.minScale, &settings.maxScale, 0.01f, 0.25f, 1.0f);
+        if (ImGui::SliderFloat("Sharpness", &m_dynamicResolution.sharpness, 0.0f, 1.0f))
+        {
+            // Have the uniforms written again
+            m_dynamicResolution.renderWidth = 0;
+        }
+        if (m_dynamicResolution.enabled)
+        {
+            m_guiCache.text("Scale: %.0f%% (%u x %u), %u adjustments",
+                            100.0f * m_resolution.scale(),
+                            m_dynamicResolution.renderWidth,
+                            m_dynamicResolution.renderHeight,
+                            m_resolution.adjustments());
+            m_guiCache.text(
+                "GPU: %.2f ms (average %.2f ms)", m_gpuTiming.milliseconds, m_resolution.averageMilliseconds());
+        }
+        ImGui::End();
+    }
+
+    {
+        ImGui::Begin("Frame pacing");
+        ImGui::Checkbox("Render on demand", &m_redraw.onDemand);
+        if (m_redraw.onDemand)
+        {
+            m_guiCache.text("Rendered %u frames, %u idle wakeups", m_redraw.renderedFrames, m_redraw.idleWakeups);
+        }
+        if (ImGui::BeginCombo("Present mode", presentModeName(m_presentMode)))
+        {
+            for (PresentMode mode : m_presentModes)
+            {
+                if (ImGui::Selectable(presentModeName(mode), mode == m_presentMode) && mode != m_presentMode)
+                {
+                    m_presentMode        = mode;
+                    m_presentModeChanged = true;
+                }
+            }
+            ImGui::EndCombo();
+        }
+        int targetFps = static_cast<int>(m_framePacer.targetFps());
+        if (ImGui::SliderInt("Target FPS", &targetFps, 0, 240, targetFps == 0 ? "Unlimited" : "%d"))
+        {
+            m_framePacer.setTargetFps(targetFps);
+        }
+
+        const FramePacer::Stats& stats = m_framePacer.stats();
+        m_guiCache.text("%.1f FPS, %.2f ms (min %.2f, max %.2f)",
+                        stats.fps,
+                        stats.averageMilliseconds,
+                        stats.minMilliseconds,
+                        stats.maxMilliseconds);
+        m_guiCache.text("Jitter: %.3f ms", stats.jitterMilliseconds);
+        m_guiCache.text("Limiter wait: %.2f ms (spin %.2f ms)", stats.waitMilliseconds, stats.spinMilliseconds);
+        const RenderTargetPool::Stats& targetStats = m_renderTargets.stats();
+        ImGui::Text("Resizes: %u events, %u applied, %u allocations",
+                    m_resize.events,
+                    m_resize.applied,
+                    m_resize.allocations);
+        ImGui::Text("Render targets: %u allocated, %u reused, %u pooled",
+                    targetStats.allocations,
+                    targetStats.reuses,
+                    targetStats.pooled);
+        // Figures of the previous frame, this one is uploaded once the UI is complete
+        ImGui_ImplWGPU_FrameStats guiStats = ImGui_ImplWGPU_GetFrameStats();
+        m_guiCache.text("GUI upload: %zu bytes, %d reallocations (%d total)",
+                        guiStats.UploadedBytes,
+                        guiStats.Reallocations,
+                        guiStats.TotalReallocations);
+        ImGui::Text("GUI buffers: %zu KiB vertices, %zu KiB indices",
+                    guiStats.VertexCapacity / 1024,
+                    guiStats.IndexCapacity / 1024);
+        m_guiCache.text("GUI images: %d bind groups, %d hits, %d misses, %d evictions",
+                        guiStats.ImageBindGroups,
+                        guiStats.ImageBindGroupHits,
+                        guiStats.ImageBindGroupMisses,
+                        guiStats.ImageBindGroupEvictions);
+        // The backend allocates its buffers and font atlas itself, its state is their key
+        m_gpuMemory.track(ImGui::GetIO().BackendRendererUserData,
+                          guiStats.VertexCapacity + guiStats.IndexCapacity + guiStats.FontTextureBytes,
+                          MemoryCategory::Gui,
+                          "ImGui buffers and font atlas");
+        ImGui::Checkbox("Cache GUI overlay", &m_guiOverlay.cached);
+        ImGui::SliderInt("GUI load", &m_guiOverlay.loadLines, 0, 5000);
+        m_guiCache.text("GUI draw: %.1f us", m_guiOverlay.drawMicroseconds);
+        if (m_guiOverlay.cached)
+        {
+            const GuiCache::Stats& cacheStats = m_guiCache.stats();
+            uint32_t updates = std::max(cacheStats.renders + cacheStats.reuses, 1u);
+            m_guiCache.text("GUI overlay: %u renders, %u reuses (%.0f%% reused, hash %.1f us)",
+                            cacheStats.renders,
+                            cacheStats.reuses,
+                            100.0f * cacheStats.reuses / updates,
+                            cacheStats.hashMicroseconds);
+        }
+        // Plotted as of the last refresh of the figures
+        if (m_guiCache.refreshing())
+        {
+            std::copy_n(m_framePacer.history(), FramePacer::kHistorySize, m_guiOverlay.intervals.begin());
+            m_guiOverlay.intervalsOffset = m_framePacer.historyOffset();
+            m_guiOverlay.intervalsMax    = 2.0f * stats.averageMilliseconds;
+        }
+        ImGui::PlotLines("Intervals",
+                         m_guiOverlay.intervals.data(),
+                         FramePacer::kHistorySize,
+                         m_guiOverlay.intervalsOffset,
+                         nullptr,
+                         0.0f,
+                         m_guiOverlay.intervalsMax,
+                         ImVec2(0, 60));
+        ImGui::End();
+    }
+
+    {
+        ImGui::Begin("Capture");
+        if (ImGui::Button("Save screenshot"))
+            requestScreenshot();
+        const FrameCapture::Stats& captureStats = m_frameCapture.stats();
+        ImGui::Text("Screenshots: %u saved, %u failed, %u frames deferred",
+                    captureStats.saved,
+                    captureStats.failures,
+                    captureStats.deferred);
+        m_guiCache.text("Readback: %u frames late, PNG encoded in %.1f ms",
+                        captureStats.latencyFrames,
+                        captureStats.encodeMilliseconds);
+
+        // Every frame, with what the frame loop could not wait for dropped or throttled
+        ImGui::Separator();
+        bool recording = m_recorder.recording();
+        if (ImGui::Checkbox("Record frames", &recording))
+        {
+            if (recording)
+                m_recorder.start("recordings", m_recordFormat);
+            else
+                m_recorder.stop();
+        }
+        ImGui::BeginDisabled(m_recorder.recording());
+        int recordFormat = static_cast<int>(m_recordFormat);
+        if (ImGui::Combo("Format", &recordFormat, "PNG sequence\0Run-length encoded\0"))
+            m_recordFormat = static_cast<FrameRecorder::Format>(recordFormat);
+        ImGui::EndDisabled();
+        int overflow = static_cast<int>(m_recorder.overflow());
+        if (ImGui::Combo("When full", &overflow, "Drop frames\0Throttle\0"))
+            m_recorder.setOverflow(static_cast<FrameRecorder::Overflow>(overflow));
+        const FrameRecorder::Stats& recordStats = m_recorder.stats();
+        m_guiCache.text("Queue: %u/%u frames, %u encoder threads",
+                        recordStats.queueDepth,
+                        recordStats.queueCapacity,
+                        recordStats.encoderThreads);
+        m_guiCache.text("Recorded: %u frames written, %u failed", recordStats.written, recordStats.failures);
+        m_guiCache.text("Dropped: %u readback busy, %u queue full, %u throttled (1 in %u frames)",
+                        recordStats.droppedReadback,
+                        recordStats.droppedQueue,
+                        recordStats.throttled,
+                        recordStats.frameInterval);
+        m_guiCache.text("Writing: %.1f MiB/s, %.1f MiB total",
+                        recordStats.megabytesPerSecond,
+                        recordStats.bytesWritten / (1024.0f * 1024.0f));
+        ImGui::End();
+    }
+
+    {
+        constexpr float mebibyte = 1024.0f * 1024.0f;
+        ImGui::Begin("GPU memory");
+        const GpuMemoryTracker::Stats& memoryStats = m_gpuMemory.stats();
+        if (m_gpuMemory.budget() > 0)
+        {
+            ImGui::Text("%.1f MiB of %.0f MiB budget (peak %.1f MiB)",
+                        memoryStats.bytes / mebibyte,
+                        m_gpuMemory.budget() / mebibyte,
+                        memoryStats.peakBytes / mebibyte);
+            ImGui::ProgressBar(static_cast<float>(memoryStats.bytes) / m_gpuMemory.budget());
+        }
+        else
+        {
+            ImGui::Text("%.1f MiB (peak %.1f MiB), no budget",
+                        memoryStats.bytes / mebibyte,
+                        memoryStats.peakBytes / mebibyte);
+        }
+        ImGui::Text("%u allocations, %u over budget, %u growths refused",
+                    memoryStats.allocations,
+                    memoryStats.budgetWarnings,
+                    memoryStats.refusals);
+        ImGui::Separator();
+        for (size_t index = 0; index < static_cast<size_t>(MemoryCategory::Count); ++index)
+        {
+            MemoryCategory category                       = static_cast<MemoryCategory>(index);
+            const GpuMemoryTracker::CategoryStats& counts = m_gpuMemory.categoryStats(category);
+            ImGui::Text("%-14s %8.2f MiB (peak %.2f), %u allocations",
+                        GpuMemoryTracker::categoryName(category),
+                        counts.bytes / mebibyte,
+                        counts.peakBytes / mebibyte,
+                        counts.allocations);
+        }
+        ImGui::Separator();
+        for (const GpuMemoryTracker::Allocation& allocation : m_gpuMemory.largest(5))
+        {
+            ImGui::Text("%8.2f MiB  %s", allocation.bytes / mebibyte, allocation.label.c_str());
+        }
+        ImGui::End();
+    }
+
+    if (m_guiOverlay.loadLines > 0)
+    {
+        ImGui::SetNextWindowSize(ImVec2(400, 600), ImGuiCond_FirstUseEver);
+        ImGui::Begin("GUI load");
+        for (int line = 0; line < m_guiOverlay.loadLines; ++line)
+        {
+            ImGui::Text("Line %d of static text, only here to weigh on the GUI", line);
+        }
+        ImGui::End();
+    }
+
+    // Build the draw data, drawn once the scene is encoded
+    ImGui::EndFrame();
+    ImGui::Render();
+}
+
+bool Application::initLightingUniforms()
+{
+    BufferDescriptor bufferDesc;
+    bufferDesc.label            = "Lighting uniforms";
+    bufferDesc.size             = sizeof(LightingUniforms);
+    bufferDesc.usage            = BufferUsage::CopyDst | BufferUsage::Uniform;
+    bufferDesc.mappedAtCreation = false;
+    m_lightingUniformBuffer     = m_gpuMemory.createBuffer(m_device, bufferDesc, MemoryCategory::Uniforms);
+
+    // Initial values
+    m_lightingUniforms.directions[0] = {0.5f, -0.9f, 0.1f, 0.0f};
+    m_lightingUniforms.directions[1] = {0.2f, 0.4f, 0.3f, 0.0f};
+    m_lightingUniforms.colors[0]     = {1.0f, 0.9f, 0.6f, 1.0f};
+    m_lightingUniforms.colors[1]     = {0.6f, 0.9f, 1.0f, 1.0f};
+    m_lightingUniforms.lightCount    = 0;
+    m_lightingUniforms.viewportSize  = vec2(0.0f);
+    m_lightingUniforms.gridSize      = {LightClusterer::kGridX, LightClusterer::kGridY, LightClusterer::kGridZ, 0};
+    m_lightingUniforms.cameraNear    = kCameraNear;
+    m_lightingUniforms.cameraFar     = kCameraFar;
+    m_lightingUniforms.shadowBias    = 0.001f;
+
+    // Material
+    m_lightingUniforms.hardness          = 32.0f;
+    m_lightingUniforms.kd                = 1.0f;
+    m_lightingUniforms.ks                = 0.5f;
+    m_lightingUniforms.normalMapStrength = 0.5f;
+
+    updateLightingUniforms();
+
+    return m_lightingUniformBuffer != nullptr;
+}
+
+void Application::terminateLightingUniforms()
+{
+    m_gpuMemory.destroy(m_lightingUniformBuffer);
+}
+
+void Application::updateLightingUniforms()
+{
+    if (m_lightingUniformsChanged)
+    {
+        updateShadowMatrices();
+        m_uploads.writeBuffer(m_lightingUniformBuffer, 0, &m_lightingUniforms, sizeof(LightingUniforms));
+        m_lightingUniformsChanged = false;
+    }
+}
+
+bool Application::initShadowMaps()
+{
+    // One layer per directional light
+    TextureDescriptor textureDesc;
+    textureDesc.label           = "Shadow maps";
+    textureDesc.dimension       = TextureDimension::_2D;
+    textureDesc.format          = kShadowMapFormat;
+    textureDesc.size            = {ShadowMaps::kResolution, ShadowMaps::kResolution, ShadowMaps::kMapCount};
+    textureDesc.mipLevelCount   = 1;
+    textureDesc.sampleCount     = 1;
+    textureDesc.usage           = TextureUsage::RenderAttachment | TextureUsage::TextureBinding;
+    textureDesc.viewFormatCount = 0;
+    textureDesc.viewFormats     = nullptr;
+    m_shadowTexture             = m_gpuMemory.createTexture(m_device, textureDesc, MemoryCategory::ShadowMaps);
+
+    TextureViewDescriptor viewDesc;
+    viewDesc.aspect          = TextureAspect::DepthOnly;
+    viewDesc.baseMipLevel    = 0;
+    viewDesc.mipLevelCount   = 1;
+    viewDesc.baseArrayLayer  = 0;
+    viewDesc.arrayLayerCount = ShadowMaps::kMapCount;
+    viewDesc.dimension       = TextureViewDimension::_2DArray;
+    viewDesc.format          = kShadowMapFormat;
+    m_shadowArrayView        = m_shadowTexture.createView(viewDesc);
+
+    // Each map is rendered through a view of its own layer
+    viewDesc.arrayLayerCount = 1;
+    viewDesc.dimension       = TextureViewDimension::_2D;
+    for (uint32_t map = 0; map < ShadowMaps::kMapCount; ++map)
+    {
+        viewDesc.baseArrayLayer = map;
+        m_shadowLayerViews[map] = m_shadowTexture.createView(viewDesc);
+    }
+
+    // Filtered comparisons give a 2x2 percentage closer filter in each tap
+    SamplerDescriptor samplerDesc;
+    samplerDesc.addressModeU  = AddressMode::ClampToEdge;
+    samplerDesc.addressModeV  = AddressMode::ClampToEdge;
+    samplerDesc.addressModeW  = AddressMode::ClampToEdge;
+    samplerDesc.magFilter     = FilterMode::Linear;
+    samplerDesc.minFilter     = FilterMode::Linear;
+    samplerDesc.mipmapFilter  = MipmapFilterMode::Nearest;
+    samplerDesc.lodMinClamp   = 0.0f;
+    samplerDesc.lodMaxClamp   = 1.0f;
+    samplerDesc.compare       = CompareFunction::LessEqual;
+    samplerDesc.maxAnisotropy = 1;
+    m_shadowSampler           = m_device.createSampler(samplerDesc);
+
+    std::vector<BindGroupEntry> bindings(2);
+    bindings[0].binding = 0;
+    bindings[0].buffer  = m_uniformBuffer;
+    bindings[0].offset  = 0;
+    bindings[0].size    = sizeof(MyUniforms);
+    bindings[1].binding = 4;
+    bindings[1].buffer  = m_lightingUniformBuffer;
+    bindings[1].offset  = 0;
+    bindings[1].size    = sizeof(LightingUniforms);
+
+    BindGroupDescriptor bindGroupDesc;
+    bindGroupDesc.layout     = m_shadowBindGroupLayout;
+    bindGroupDesc.entryCount = (uint32_t)bindings.size();
+    bindGroupDesc.entries    = bindings.data();
+    m_shadowBindGroup        = m_device.createBindGroup(bindGroupDesc);
+
+    m_shadowMaps.invalidate();
+    return m_shadowTexture != nullptr && m_shadowSampler != nullptr && m_shadowBindGroup != nullptr;
+}
+
+void Application::terminateShadowMaps()
+{
+    m_shadowBindGroup.release();
+    m_shadowSampler.release();
+    for (TextureView& view : m_shadowLayerViews)
+    {
+        view.release();
+    }
+    m_shadowArrayView.release();
+    m_gpuMemory.destroy(m_shadowTexture);
+}
+
+void Application::updateShadowMatrices()
+{
+    if (m_bvh.nodes().empty())
+        return;
+
+    // Only a new light direction or new scene bounds change the projections, the other lighting settings keep the
+    // maps as they are
+    const Bvh::Node& root = m_bvh.nodes()[0];
+    BoundingBox sceneBounds;
+    sceneBounds.min = root.boundsMin;
+    sceneBounds.max = root.boundsMax;
+    for (uint32_t map = 0; map < ShadowMaps::kMapCount; ++map)
+    {
+        if (m_shadowMaps.update(map, vec3(m_lightingUniforms.directions[map]), sceneBounds))
+            m_lightingUniforms.shadowMatrices[map] = m_shadowMaps.viewProjection(map);
+    }
+}
+
+void Application::encodeShadowMaps(CommandEncoder encoder)
+{
+    if (!sceneVariantKey(0).shadows)
+        return;
+
+    // Only the maps of the lights in use, and only when their content changed
+    uint32_t mapCount = std::min<uint32_t>(m_shading.directionalLights, ShadowMaps::kMapCount);
+    for (uint32_t map = 0; map < mapCount; ++map)
+    {
+        if (!m_shadowMaps.shouldRender(map))
+            continue;
+
+        RenderPassDepthStencilAttachment depthAttachment;
+        depthAttachment.view              = m_shadowLayerViews[map];
+        depthAttachment.depthClearValue   = 1.0f;
+        depthAttachment.depthLoadOp       = LoadOp::Clear;
+        depthAttachment.depthStoreOp      = StoreOp::Store;
+        depthAttachment.depthReadOnly     = false;
+        depthAttachment.stencilClearValue = 0;
+#ifdef WEBGPU_BACKEND_WGPU
+        depthAttachment.stencilLoadOp  = LoadOp::Clear;
+        depthAttachment.stencilStoreOp = StoreOp::Store;
+#else
+        depthAttachment.stencilLoadOp  = LoadOp::Undefined;
+        depthAttachment.stencilStoreOp = StoreOp::Undefined;
+#endif
+        depthAttachment.stencilReadOnly = true;
+
+        RenderPassDescriptor shadowPassDesc {};
+        shadowPassDesc.colorAttachmentCount   = 0;
+        shadowPassDesc.colorAttachments       = nullptr;
+        shadowPassDesc.depthStencilAttachment = &depthAttachment;
+        shadowPassDesc.timestampWrites        = nullptr;
+        RenderPassEncoder shadowPass          = encoder.beginRenderPass(shadowPassDesc);
+        encodeShadowDraws(shadowPass, map);
+        shadowPass.end();
+        shadowPass.release();
+    }
+}
+
+void Application::encodeShadowDraws(RenderPassEncoder renderPass, uint32_t map)
+{
+    renderPass.setPipeline(m_shadowPipelines[map]);
+    renderPass.setBindGroup(0, m_shadowBindGroup, 0, nullptr);
+
+    // Objects outside of the view frustum still cast shadows into it, so all of them are drawn
+    uint32_t currentChunk = UINT32_MAX;
+    for (uint32_t objectIndex = 0; objectIndex < static_cast<uint32_t>(m_sceneObjects.size()); ++objectIndex)
+    {
+        const ResourceManager::Submesh& submesh = m_submeshes[m_sceneObjects[objectIndex].submesh];
+        if (submesh.chunk != currentChunk)
+        {
+            currentChunk = submesh.chunk;
+            renderPass.setVertexBuffer(0, m_vertexBuffers[currentChunk], 0, m_vertexBuffers[currentChunk].getSize());
+        }
+        uint32_t dynamicOffset = objectIndex * m_objectUniformStride;
+        renderPass.setBindGroup(1, m_objectBindGroup, 1, &dynamicOffset);
+        renderPass.draw(submesh.vertexCount, 1, submesh.firstVertex, 0);
+    }
+}
+
+bool Application::initLights()
+{
+    // Sized for the largest light count, so that the bind group never changes
+    BufferDescriptor bufferDesc;
+    bufferDesc.usage            = BufferUsage::CopyDst | BufferUsage::Storage;
+    bufferDesc.mappedAtCreation = false;
+    bufferDesc.label            = "Lights";
+    bufferDesc.size             = LightClusterer::kMaxLights * sizeof(LightClusterer::Light);
+    m_lightBuffer               = m_gpuMemory.createBuffer(m_device, bufferDesc, MemoryCategory::Storage);
+    bufferDesc.label            = "Light clusters";
+    bufferDesc.size             = LightClusterer::kClusterCount * sizeof(LightClusterer::Cluster);
+    m_clusterBuffer             = m_gpuMemory.createBuffer(m_device, bufferDesc, MemoryCategory::Storage);
+    bufferDesc.label            = "Light indices";
+    bufferDesc.size             = LightClusterer::kMaxLightIndices * sizeof(uint32_t);
+    m_lightIndexBuffer          = m_gpuMemory.createBuffer(m_device, bufferDesc, MemoryCategory::Storage);
+
+    std::vector<BindGroupEntry> bindings(3);
+
+    bindings[0].binding = 0;
+    bindings[0].buffer  = m_lightBuffer;
+    bindings[0].offset  = 0;
+    bindings[0].size    = LightClusterer::kMaxLights * sizeof(LightClusterer::Light);
+
+    bindings[1].binding = 1;
+    bindings[1].buffer  = m_clusterBuffer;
+    bindings[1].offset  = 0;
+    bindings[1].size    = LightClusterer::kClusterCount * sizeof(LightClusterer::Cluster);
+
+    bindings[2].binding = 2;
+    bindings[2].buffer  = m_lightIndexBuffer;
+    bindings[2].offset  = 0;
+    bindings[2].size    = LightClusterer::kMaxLightIndices * sizeof(uint32_t);
+
+    BindGroupDescriptor bindGroupDesc;
+    bindGroupDesc.layout     = m_lightBindGroupLayout;
+    bindGroupDesc.entryCount = (uint32_t)bindings.size();
+    bindGroupDesc.entries    = bindings.data();
+    m_lightBindGroup         = m_device.createBindGroup(bindGroupDesc);
+    invalidateSceneBundles();
+
+    m_lightState.regenerate = true;
+    return m_lightBindGroup != nullptr;
+}
+
+void Application::terminateLights()
+{
+    invalidateSceneBundles();
+    m_lightBindGroup.release();
+    for (Buffer* buffer : {&m_lightBuffer, &m_clusterBuffer, &m_lightIndexBuffer})
+    {
+        m_gpuMemory.destroy(*buffer);
+    }
+    m_lights.clear();
+    m_lightOrbits.clear();
+}
+
+void Application::generateLights()
+{
+    // Scatter the lights over the replicas of the model, with a fixed seed so that runs are comparable
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    vec3 modelSize = m_modelBounds.max - m_modelBounds.min;
+    float spacing  = 1.2f * std::max(modelSize.x, modelSize.y);
+    float extent   = 0.5f * m_scene.replicas * spacing;
+
+    int maxLights = static_cast<int>(LightClusterer::kMaxLights);
+    m_lights.resize(static_cast<size_t>(std::clamp(m_lightState.count, 0, maxLights)));
+    m_lightOrbits.resize(m_lights.size());
+    auto randomVec3 = [&]()
+    {
+        // Drawn one after the other, the evaluation order of function arguments is unspecified
+        float x = unit(random);
+        float y = unit(random);
+        float z = unit(random);
+        return vec3(x, y, z);
+    };
+    for (size_t i = 0; i < m_lights.size(); ++i)
+    {
+        vec3 placement   = randomVec3();
+        vec3 center      = vec3((2.0f * placement.x - 1.0f) * extent,
+                                (2.0f * placement.y - 1.0f) * extent,
+                                m_modelBounds.min.z + (0.2f + placement.z) * modelSize.z);
+        m_lightOrbits[i] = vec4(center, 2.0f * PI * unit(random));
+
+        // Saturated colors, so that the contribution of each light is visible
+        vec3 color = randomVec3();
+        color      = color / std::max(std::max(color.x, color.y), std::max(color.z, 1e-3f));
+
+        LightClusterer::Light& light = m_lights[i];
+        float range                  = (0.25f + 0.25f * unit(random)) * spacing;
+        light.positionRange          = vec4(center, range);
+        light.colorIntensity         = vec4(color, 1.0f + unit(random));
+        if (unit(random) < m_lightState.spotFraction)
+        {
+            // Pointing down, slightly tilted
+            vec3 tilt               = randomVec3() - vec3(0.5f);
+            vec3 direction          = glm::normalize(vec3(tilt.x, tilt.y, -1.0f));
+            light.directionCosOuter = vec4(direction, std::cos(35.0f * PI / 180));
+            light.cosInner          = vec4(std::cos(25.0f * PI / 180), 0.0f, 0.0f, 0.0f);
+        }
+        else
+        {
+            light.directionCosOuter = vec4(0.0f, 0.0f, -1.0f, -2.0f);
+            light.cosInner          = vec4(-1.0f, 0.0f, 0.0f, 0.0f);
+        }
+    }
+}
+
+void Application::updateLights()
+{
+    if (m_lightState.regenerate)
+    {
+        generateLights();
+        m_lightState.regenerate = false;
+    }
+
+    if (m_lightState.animate)
+    {
+        // Each light goes around a small circle
+        float time = static_cast<float>(glfwGetTime());
+        for (size_t i = 0; i < m_lights.size(); ++i)
+        {
+            const vec4& orbit         = m_lightOrbits[i];
+            float range               = m_lights[i].positionRange.w;
+            float angle               = 0.5f * time + orbit.w;
+            vec3 position             = vec3(orbit) + 0.3f * range * vec3(std::cos(angle), std::sin(angle), 0.0f);
+            m_lights[i].positionRange = vec4(position, range);
+        }
+    }
+
+    m_clusterer.assign(m_lights, m_uniforms.viewMatrix);
+
+    // The shader finds the cluster of a fragment from its position in the rendered region
+    vec2 viewportSize = m_dynamicResolution.enabled
+                            ? vec2(m_dynamicResolution.renderWidth, m_dynamicResolution.renderHeight)
+                            : vec2(m_surfaceWidth, m_surfaceHeight);
+    uint32_t lightCount = static_cast<uint32_t>(m_lights.size());
+    if (viewportSize != m_lightingUniforms.viewportSize || lightCount != m_lightingUniforms.lightCount)
+    {
+        m_lightingUniforms.viewportSize = viewportSize;
+        m_lightingUniforms.lightCount   = lightCount;
+        m_lightingUniformsChanged       = true;
+    }
+    updateLightingUniforms();
+
+    const std::vector<LightClusterer::Cluster>& clusters = m_clusterer.clusters();
+    const std::vector<uint32_t>& lightIndices            = m_clusterer.lightIndices();
+    if (!m_lights.empty())
+        m_uploads.writeBuffer(m_lightBuffer, 0, m_lights.data(), m_lights.size() * sizeof(LightClusterer::Light));
+    m_uploads.writeBuffer(m_clusterBuffer, 0, clusters.data(), clusters.size() * sizeof(LightClusterer::Cluster));
+    if (!lightIndices.empty())
+        m_uploads.writeBuffer(m_lightIndexBuffer, 0, lightIndices.data(), lightIndices.size() * sizeof(uint32_t));
 }
 
-void Application::terminateGeometry()
-{
-    m_vertexBuffer.destroy();
-    m_vertexBuffer.release();
-    m_vertexCount = 0;
+void Application::updateRenderPipeline()
+{
+    // Polling the file once per second is enough for interactive edits
+    double time = glfwGetTime();
+    if (time - m_lastShaderCheckTime >= 1.0)
+    {
+        m_lastShaderCheckTime = time;
+        if (m_shaderPreprocessor.hasChanged(m_shaderPath))
+        {
+            std::cout << "Reloading " << m_shaderPath << "..." << std::endl;
+            m_pipelineOutdated = true;
+        }
+    }
+
+    if (!m_pipelineOutdated)
+        return;
+    m_pipelineOutdated = false;
+
+    // The new pipelines are built next to the current ones, which are kept when the shader does not compile
+    ShaderModule shaderModule                                         = nullptr;
+    PipelineLayout pipelineLayout                                     = nullptr;
+    RenderPipeline depthPipeline                                      = nullptr;
+    PipelineLayout shadowPipelineLayout                               = nullptr;
+    std::array<RenderPipeline, ShadowMaps::kMapCount> shadowPipelines = {};
+    PipelineVariants pipelineVariants;
+    auto swapPipelines = [&]()
+    {
+        std::swap(shaderModule, m_shaderModule);
+        std::swap(pipelineLayout, m_pipelineLayout);
+        std::swap(depthPipeline, m_depthPipeline);
+        std::swap(shadowPipelineLayout, m_shadowPipelineLayout);
+        std::swap(shadowPipelines, m_shadowPipelines);
+        std::swap(pipelineVariants, m_pipelineVariants);
+    };
+    swapPipelines();
+
+    // Errors of invalid objects are not reported through null handles, catch them all
+    m_device.pushErrorScope(ErrorFilter::Validation);
+    bool created = initRenderPipeline();
+    // Compile the variants in use now rather than at the next frame, they are part of what must work
+    selectPipelineVariant();
+    for (uint32_t material = 0; material < static_cast<uint32_t>(m_materials.size()); ++material)
+    {
+        created = created && m_scenePipelines[scenePipelineIndex(material)] != nullptr;
+    }
+
+    // Left to the callback to delete when it was given up on
+    struct ErrorScope
+    {
+        bool popped    = false;
+        bool valid     = true;
+        bool abandoned = false;
+    };
+    auto* errorScope = new ErrorScope;
+    wgpuDevicePopErrorScope(
+        m_device,
+        [](WGPUErrorType type, char const* message, void* userdata)
+        {
+            if (type != WGPUErrorType_NoError && message)
+                std::cerr << "Pipeline error: " << message << std::endl;
+            auto* result = static_cast<ErrorScope*>(userdata);
+            if (result->abandoned)
+            {
+                delete result;
+                return;
+            }
+            result->valid  = type == WGPUErrorType_NoError;
+            result->popped = true;
+        },
+        errorScope);
+
+    // The callback runs while the device is polled, a device that never answers counts as a failed reload
+    constexpr std::chrono::seconds kErrorScopeTimeout {2};
+    auto deadline = std::chrono::steady_clock::now() + kErrorScopeTimeout;
+    while (!errorScope->popped && std::chrono::steady_clock::now() < deadline)
+    {
+#if defined(WEBGPU_BACKEND_DAWN)
+        m_device.tick();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#elif defined(WEBGPU_BACKEND_WGPU)
+        m_device.poll(true);
+#endif
+    }
+    bool valid = errorScope->popped && errorScope->valid;
+    if (errorScope->popped)
+    {
+        delete errorScope;
+    }
+    else
+    {
+        std::cerr << "No answer from the device about the new pipelines" << std::endl;
+        errorScope->abandoned = true;
+    }
+
+    bool reloaded = created && valid;
+    if (!reloaded)
+    {
+        std::cerr << "Could not reload " << m_shaderPath << ", keeping the previous shader" << std::endl;
+        swapPipelines();
+    }
+
+    // Release whichever set is not used
+    pipelineVariants.clear();
+    if (depthPipeline)
+        depthPipeline.release();
+    if (pipelineLayout)
+        pipelineLayout.release();
+    for (RenderPipeline& shadowPipeline : shadowPipelines)
+    {
+        if (shadowPipeline)
+            shadowPipeline.release();
+    }
+    if (shadowPipelineLayout)
+        shadowPipelineLayout.release();
+    if (shaderModule)
+        shaderModule.release();
+
+    // Back to the previous variants, or the new ones are now in use
+    selectPipelineVariant();
+    if (!reloaded)
+        return;
+
+    // The shadow maps were rendered by the previous shader, they are only rendered again with their matrices
+    m_shadowMaps.invalidate();
+    m_lightingUniformsChanged = true;
+    requestRedraw();
 }
 
-bool Application::initUniforms()
+bool Application::initScene()
 {
-    // Create uniform buffer
+    // Lay the replicas of the model out on a grid centered on the origin, each
+    // submesh becoming an object that is culled on its own
+    uint32_t submeshCount = static_cast<uint32_t>(m_submeshes.size());
+    int maxReplicas       = static_cast<int>(std::sqrt(static_cast<float>(m_maxObjectCount / submeshCount)));
+    m_scene.replicas      = glm::clamp(m_scene.replicas, 1, std::max(maxReplicas, 1));
+
+    vec3 modelSize = m_modelBounds.max - m_modelBounds.min;
+    float spacing  = 1.2f * std::max(modelSize.x, modelSize.y);
+    float origin   = 0.5f * (m_scene.replicas - 1) * spacing;
+
+    m_sceneObjects.clear();
+    for (int y = 0; y < m_scene.replicas; ++y)
+    {
+        for (int x = 0; x < m_scene.replicas; ++x)
+        {
+            vec3 position = vec3(x * spacing - origin, y * spacing - origin, 0.0f);
+            for (uint32_t submesh = 0; submesh < submeshCount; ++submesh)
+            {
+                m_sceneObjects.push_back({submesh, position, 0.0f, BoundingBox()});
+            }
+        }
+    }
+
+    // Compute the world bounds of the objects and build the hierarchy over them
+    uint32_t objectCount = static_cast<uint32_t>(m_sceneObjects.size());
+    m_objectUniformData.assign(objectCount * m_objectUniformStride, 0);
+    std::vector<BoundingBox> objectBounds(objectCount);
+    for (uint32_t i = 0; i < objectCount; ++i)
+    {
+        SceneObject& object = m_sceneObjects[i];
+        mat4x4 transform    = computeObjectTransform(object);
+        object.worldBounds  = m_submeshes[object.submesh].bounds.transformed(m_uniforms.modelMatrix * transform);
+        objectBounds[i]     = object.worldBounds;
+
+        uint32_t material        = m_submeshes[object.submesh].material;
+        ObjectUniforms* uniforms = reinterpret_cast<ObjectUniforms*>(&m_objectUniformData[i * m_objectUniformStride]);
+        uniforms->modelMatrix    = transform;
+        uniforms->materialLayers = materialLayers(material);
+        uniforms->virtualTexture = m_virtualTextures.shaderParams(m_materials[material].virtualTexture);
+        uniforms->baseColor      = vec4(m_materials[material].diffuse, m_materials[material].opacity);
+    }
+    m_bvh.build(objectBounds);
+
+    // Create the per-object uniform buffer
     BufferDescriptor bufferDesc;
-    bufferDesc.size             = sizeof(MyUniforms);
+    bufferDesc.label            = "Object uniforms";
+    bufferDesc.size             = m_objectUniformData.size();
     bufferDesc.usage            = BufferUsage::CopyDst | BufferUsage::Uniform;
     bufferDesc.mappedAtCreation = false;
-    m_uniformBuffer             = m_device.createBuffer(bufferDesc);
+    m_objectUniformBuffer       = m_gpuMemory.createBuffer(m_device, bufferDesc, MemoryCategory::Uniforms);
+    if (!m_objectUniformBuffer)
+        return false;
+    m_uploads.writeBuffer(m_objectUniformBuffer, 0, m_objectUniformData.data(), bufferDesc.size);
 
-    // Upload the initial value of the uniforms
-    m_uniforms.modelMatrix      = mat4x4(1.0);
-    m_uniforms.viewMatrix       = glm::lookAt(vec3(-2.0f, -3.0f, 2.0f), vec3(0.0f), vec3(0, 0, 1));
-    m_uniforms.projectionMatrix = glm::perspective(45 * PI / 180, 640.0f / 480.0f, 0.01f, 100.0f);
-    m_uniforms.time             = 1.0f;
-    m_uniforms.color            = {0.0f, 1.0f, 0.4f, 1.0f};
-    m_queue.writeBuffer(m_uniformBuffer, 0, &m_uniforms, sizeof(MyUniforms));
+    BindGroupEntry binding;
+    binding.binding = 0;
+    binding.buffer  = m_objectUniformBuffer;
+    binding.offset  = 0;
+    binding.size    = sizeof(ObjectUniforms);
 
-    updateViewMatrix();
+    BindGroupDescriptor bindGroupDesc;
+    bindGroupDesc.layout     = m_objectBindGroupLayout;
+    bindGroupDesc.entryCount = 1;
+    bindGroupDesc.entries    = &binding;
+    m_objectBindGroup        = m_device.createBindGroup(bindGroupDesc);
+    invalidateSceneBundles();
 
-    return m_uniformBuffer != nullptr;
+    // The shadows of the previous layout are outdated, and so may be the light projections
+    m_shadowMaps.invalidate();
+    m_lightingUniformsChanged = true;
+
+    if (!m_objectBindGroup)
+        return false;
+    m_scene.builtReplicas = m_scene.replicas;
+    return true;
 }
 
-void Application::terminateUniforms()
+void Application::terminateScene()
 {
-    m_uniformBuffer.destroy();
-    m_uniformBuffer.release();
+    invalidateSceneBundles();
+    if (m_objectBindGroup)
+        m_objectBindGroup.release();
+    m_objectBindGroup = nullptr;
+    m_gpuMemory.destroy(m_objectUniformBuffer);
+    m_sceneObjects.clear();
+    m_visibleObjects.clear();
+    m_bvh.clear();
 }
 
-bool Application::initBindGroupLayout()
+bool Application::updateScene()
 {
-    std::vector<BindGroupLayoutEntry> bindingLayoutEntries(5, Default);
+    if (m_scene.rebuildRequested)
+    {
+        m_scene.rebuildRequested = false;
+        m_lightState.regenerate  = true;
+        int previousReplicas     = m_scene.builtReplicas;
+        terminateScene();
+        if (!initScene())
+        {
+            // Fall back to the layout that worked, the frame cannot go on without an object bind group
+            std::cerr << "Could not build a scene of " << m_scene.replicas << "x" << m_scene.replicas
+                      << " replicas, keeping " << previousReplicas << "x" << previousReplicas << std::endl;
+            terminateScene();
+            m_scene.replicas = previousReplicas;
+            if (!initScene())
+            {
+                std::cerr << "Could not rebuild the scene" << std::endl;
+                glfwSetWindowShouldClose(m_window, GLFW_TRUE);
+                return false;
+            }
+        }
+    }
 
-    // The uniform buffer binding that we already had
-    BindGroupLayoutEntry& bindingLayout = bindingLayoutEntries[0];
-    bindingLayout.binding               = 0;
-    bindingLayout.visibility            = ShaderStage::Vertex | ShaderStage::Fragment;
-    bindingLayout.buffer.type           = BufferBindingType::Uniform;
-    bindingLayout.buffer.minBindingSize = sizeof(MyUniforms);
+    if (!m_scene.animate)
+    {
+        m_scene.refitMicroseconds = 0.0f;
+        return true;
+    }
 
-    // The texture binding
-    BindGroupLayoutEntry& textureBindingLayout = bindingLayoutEntries[1];
-    textureBindingLayout.binding               = 1;
-    textureBindingLayout.visibility            = ShaderStage::Fragment;
-    textureBindingLayout.texture.sampleType    = TextureSampleType::Float;
-    textureBindingLayout.texture.viewDimension = TextureViewDimension::_2D;
+    auto startTime = std::chrono::steady_clock::now();
 
-    // The normal texture binding
-    BindGroupLayoutEntry& normalBindingLayout = bindingLayoutEntries[2];
-    normalBindingLayout.binding               = 2;
-    normalBindingLayout.visibility            = ShaderStage::Fragment;
-    normalBindingLayout.texture.sampleType    = TextureSampleType::Float;
-    normalBindingLayout.texture.viewDimension = TextureViewDimension::_2D;
+    // Spin every replica around its own vertical axis, which changes the bounds of all objects
+    float angle = static_cast<float>(glfwGetTime());
+    for (uint32_t i = 0; i < static_cast<uint32_t>(m_sceneObjects.size()); ++i)
+    {
+        SceneObject& object = m_sceneObjects[i];
+        object.angle        = angle;
+        mat4x4 transform    = computeObjectTransform(object);
+        object.worldBounds  = m_submeshes[object.submesh].bounds.transformed(m_uniforms.modelMatrix * transform);
+        m_bvh.updateObject(i, object.worldBounds);
+
+        ObjectUniforms* uniforms = reinterpret_cast<ObjectUniforms*>(&m_objectUniformData[i * m_objectUniformStride]);
+        uniforms->modelMatrix    = transform;
+    }
 
-    // The texture sampler binding
-    BindGroupLayoutEntry& samplerBindingLayout = bindingLayoutEntries[3];
-    samplerBindingLayout.binding               = 3;
-    samplerBindingLayout.visibility            = ShaderStage::Fragment;
-    samplerBindingLayout.sampler.type          = SamplerBindingType::Filtering;
+    m_bvh.refit();
+    if (m_bvh.needsRebuild())
+    {
+        std::vector<BoundingBox> objectBounds(m_sceneObjects.size());
+        for (size_t i = 0; i < m_sceneObjects.size(); ++i)
+        {
+            objectBounds[i] = m_sceneObjects[i].worldBounds;
+        }
+        m_bvh.build(objectBounds);
+        ++m_scene.bvhRebuilds;
+    }
 
-    // The texture sampler binding
-    BindGroupLayoutEntry& lightingUniformLayout = bindingLayoutEntries[4];
-    lightingUniformLayout.binding               = 4;
-    lightingUniformLayout.visibility            = ShaderStage::Fragment;
-    lightingUniformLayout.buffer.type           = BufferBindingType::Uniform;
-    lightingUniformLayout.buffer.minBindingSize = sizeof(LightingUniforms);
+    m_scene.refitMicroseconds =
+        std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - startTime).count();
 
-    // Create a bind group layout
-    BindGroupLayoutDescriptor bindGroupLayoutDesc {};
-    bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
-    bindGroupLayoutDesc.entries    = bindingLayoutEntries.data();
-    m_bindGroupLayout              = m_device.createBindGroupLayout(bindGroupLayoutDesc);
+    // Moving objects cast moving shadows
+    m_shadowMaps.invalidate();
+    m_lightingUniformsChanged = true;
 
-    return m_bindGroupLayout != nullptr;
+    m_uploads.writeBuffer(m_objectUniformBuffer, 0, m_objectUniformData.data(), m_objectUniformData.size());
+    return true;
 }
 
-void Application::terminateBindGroupLayout()
+void Application::cullScene()
 {
-    m_bindGroupLayout.release();
+    if (!m_scene.cullingEnabled)
+    {
+        m_visibleObjects.resize(m_sceneObjects.size());
+        for (uint32_t i = 0; i < static_cast<uint32_t>(m_visibleObjects.size()); ++i)
+        {
+            m_visibleObjects[i] = i;
+        }
+    }
+    else
+    {
+        m_culler.setViewProjection(m_uniforms.projectionMatrix * m_uniforms.viewMatrix);
+        m_culler.cull(m_bvh, m_visibleObjects);
+    }
 }
 
-bool Application::initBindGroup()
+void Application::queueSceneDraws()
 {
-    // Create a binding
-    std::vector<BindGroupEntry> bindings(5);
+    // The depth of an object is the distance from the camera to the center of its bounds
+    m_renderQueue.clear();
+    // Pixels covered by a unit length at unit depth, to tell the texture streamer the screen size of the objects
+    float pixelsPerUnit = 0.5f * m_uniforms.projectionMatrix[1][1] * m_surfaceHeight;
+    for (uint32_t objectIndex : m_visibleObjects)
+    {
+        const SceneObject& object = m_sceneObjects[objectIndex];
+        uint32_t material         = m_submeshes[object.submesh].material;
+        uint32_t pipelineIndex    = scenePipelineIndex(material);
+        float depth               = glm::distance(object.worldBounds.center(), m_uniforms.cameraWorldPosition);
+        RenderQueue::Phase phase  = (pipelineIndex & kScenePipelineTransparent) ? RenderQueue::Phase::Transparent
+                                                                                : RenderQueue::Phase::Opaque;
+        m_renderQueue.push(RenderQueue::makeKey(phase, pipelineIndex, material, depth / kCameraFar), objectIndex);
+
+        float screenPixels = pixelsPerUnit * glm::length(object.worldBounds.max - object.worldBounds.min)
+                           / std::max(depth, kCameraNear);
+        m_textureStreamer.setScreenSize(m_materials[material].baseColorLayer, screenPixels);
+        m_textureStreamer.setScreenSize(m_materials[material].normalLayer, screenPixels);
+    }
+    m_renderQueue.sort();
+}
 
-    bindings[0].binding = 0;
-    bindings[0].buffer  = m_uniformBuffer;
-    bindings[0].offset  = 0;
-    bindings[0].size    = sizeof(MyUniforms);
+bool Application::initCommandRecording()
+{
+#ifdef WEBGPU_BACKEND_WGPU
+    // wgpu-native objects may be used from any thread, so bundles can be recorded by workers
+    m_recording.supported = true;
+#else
+    m_recording.supported = false;
+#endif
 
-    bindings[1].binding     = 1;
-    bindings[1].textureView = m_baseColorTextureView;
+    uint32_t hardwareThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    m_threadPool             = std::make_unique<ThreadPool>(m_recording.supported ? hardwareThreads - 1 : 0);
+    m_recording.threadCount  = static_cast<int>(m_threadPool->concurrency());
+
+    return true;
+}
+
+void Application::terminateCommandRecording()
+{
+    invalidateSceneBundles();
+    releaseSceneBundles();
+    m_threadPool.reset();
+}
 
-    bindings[2].binding     = 2;
-    bindings[2].textureView = m_normalTextureView;
+void Application::encodeScene(RenderPassEncoder renderPass, ScenePass pass)
+{
+    auto startTime = std::chrono::steady_clock::now();
 
-    bindings[3].binding = 3;
-    bindings[3].sampler = m_sampler;
+    const RenderQueue::Item* items = m_renderQueue.items().data();
+    size_t itemCount               = queuedItemCount(pass);
 
-    bindings[4].binding = 4;
-    bindings[4].buffer  = m_lightingUniformBuffer;
-    bindings[4].offset  = 0;
-    bindings[4].size    = sizeof(LightingUniforms);
+    SceneBundles& sceneBundles      = m_sceneBundles[static_cast<size_t>(pass)];
+    RenderQueue::Counters& counters = m_drawCounters[static_cast<size_t>(pass)];
+    TextureFormat colorFormat       = pass == ScenePass::Depth ? TextureFormat::Undefined : m_swapChainFormat;
 
-    BindGroupDescriptor bindGroupDesc;
-    bindGroupDesc.layout     = m_bindGroupLayout;
-    bindGroupDesc.entryCount = (uint32_t)bindings.size();
-    bindGroupDesc.entries    = bindings.data();
-    m_bindGroup              = m_device.createBindGroup(bindGroupDesc);
+    bool parallel   = m_recording.parallel && m_recording.supported;
+    bool useBundles = m_bundleCache.enabled || parallel;
+    if (!useBundles || itemCount == 0)
+    {
+        counters = encodeObjectDraws(renderPass, pass, items, itemCount);
+    }
+    else
+    {
+        // Cached bundles hold the opaque draws, a set that only changes with the scene and the culling; their order
+        // follows the view, the bundles keep the one of the frame they were recorded at. Transparent draws must be
+        // sorted back to front at every frame, they are encoded directly after the bundles
+        size_t bundledCount = m_bundleCache.enabled ? std::min(itemCount, m_renderQueue.opaqueCount()) : itemCount;
+
+        // The cached bundles stay valid as long as they would record the very same draws
+        bool cacheHit = m_bundleCache.enabled && sceneBundles.valid && sceneBundles.colorFormat == colorFormat
+                        && sceneBundles.depthFormat == m_depthTextureFormat
+                        && sceneBundles.recordedCount == bundledCount;
+        for (size_t i = 0; cacheHit && i < bundledCount; ++i)
+        {
+            uint32_t object = items[i].object;
+            uint64_t key    = RenderQueue::withoutDepth(items[i].key) + 1;
+            cacheHit        = object < sceneBundles.recordedKeys.size() && sceneBundles.recordedKeys[object] == key;
+        }
 
-    return m_bindGroup != nullptr;
+        if (cacheHit)
+        {
+            ++m_bundleCache.replayCount;
+        }
+        else
+        {
+            auto recordStartTime = std::chrono::steady_clock::now();
+            recordSceneBundles(pass, bundledCount, parallel);
+            if (m_bundleCache.enabled)
+            {
+                sceneBundles.valid       = true;
+                sceneBundles.colorFormat = colorFormat;
+                sceneBundles.depthFormat = m_depthTextureFormat;
+                sceneBundles.recordedKeys.assign(m_sceneObjects.size(), 0);
+                for (size_t i = 0; i < bundledCount; ++i)
+                {
+                    sceneBundles.recordedKeys[items[i].object] = RenderQueue::withoutDepth(items[i].key) + 1;
+                }
+                sceneBundles.recordedCount = bundledCount;
+                ++m_bundleCache.recordCount;
+                m_bundleCache.recordMicroseconds =
+                    std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - recordStartTime)
+                        .count();
+            }
+        }
+
+        wgpuRenderPassEncoderExecuteBundles(renderPass, sceneBundles.bundles.size(), sceneBundles.bundles.data());
+        m_recording.bundleCount += static_cast<uint32_t>(sceneBundles.bundles.size());
+        counters = sceneBundles.counters;
+        // Executing bundles resets the state of the pass, the draws after them set it again
+        counters += encodeObjectDraws(renderPass, pass, items + bundledCount, itemCount - bundledCount);
+    }
+
+    // Accumulated over the scene passes of the frame
+    m_recording.encodeMicroseconds +=
+        std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - startTime).count();
 }
 
-void Application::terminateBindGroup()
+size_t Application::queuedItemCount(ScenePass pass) const
 {
-    m_bindGroup.release();
+    // The depth prepass only lays down the opaque surfaces, transparent ones are tested against them
+    return pass == ScenePass::Depth ? m_renderQueue.opaqueCount() : m_renderQueue.items().size();
 }
 
-void Application::updateProjectionMatrix()
+void Application::recordSceneBundles(ScenePass pass, size_t itemCount, bool parallel)
 {
-    int width, height;
-    glfwGetFramebufferSize(m_window, &width, &height);
-    float ratio                 = width / (float)height;
-    m_uniforms.projectionMatrix = glm::perspective(45 * PI / 180, ratio, 0.01f, 100.0f);
-    m_queue.writeBuffer(m_uniformBuffer,
-                        offsetof(MyUniforms, projectionMatrix),
-                        &m_uniforms.projectionMatrix,
-                        sizeof(MyUniforms::projectionMatrix));
+    SceneBundles& sceneBundles             = m_sceneBundles[static_cast<size_t>(pass)];
+    std::vector<WGPURenderBundle>& bundles = sceneBundles.bundles;
+    releaseSceneBundles(pass);
+
+    const RenderQueue::Item* items = m_renderQueue.items().data();
+    sceneBundles.counters          = {};
+    if (itemCount == 0)
+        return;
+    if (!parallel)
+    {
+        bundles.push_back(recordSceneBundle(pass, items, itemCount, sceneBundles.counters));
+        return;
+    }
+
+    // One chunk per thread, unless chunks get too small to be worth a bundle
+    // Each bundle starts without state, so the first draw of a chunk sets its pipeline again.
+    constexpr size_t minDrawsPerBundle = 64;
+    size_t threadCount = std::min<size_t>(m_recording.threadCount, m_threadPool->concurrency());
+    size_t chunkCount  = std::min((itemCount + minDrawsPerBundle - 1) / minDrawsPerBundle, threadCount);
+    size_t chunkSize   = (itemCount + chunkCount - 1) / chunkCount;
+    chunkCount         = (itemCount + chunkSize - 1) / chunkSize;
+
+    bundles.assign(chunkCount, nullptr);
+    std::vector<RenderQueue::Counters> chunkCounters(chunkCount);
+    m_threadPool->parallelFor(static_cast<uint32_t>(chunkCount),
+                              [&](uint32_t chunk)
+                              {
+                                  size_t first   = chunk * chunkSize;
+                                  size_t count   = std::min(chunkSize, itemCount - first);
+                                  bundles[chunk] = recordSceneBundle(pass, items + first, count, chunkCounters[chunk]);
+                              });
+    for (const RenderQueue::Counters& counters : chunkCounters)
+    {
+        sceneBundles.counters += counters;
+    }
 }
 
-void Application::updateViewMatrix()
+void Application::releaseSceneBundles(ScenePass pass)
 {
-    float cx              = cos(m_cameraState.angles.x);
-    float sx              = sin(m_cameraState.angles.x);
-    float cy              = cos(m_cameraState.angles.y);
-    float sy              = sin(m_cameraState.angles.y);
-    vec3 position         = vec3(cx * cy, sx * cy, sy) * std::exp(-m_cameraState.zoom);
-    m_uniforms.viewMatrix = glm::lookAt(position, vec3(0.0f), vec3(0, 0, 1));
-    m_queue.writeBuffer(m_uniformBuffer,
-                        offsetof(MyUniforms, viewMatrix),
-                        &m_uniforms.viewMatrix,
-                        sizeof(MyUniforms::viewMatrix));
+    std::vector<WGPURenderBundle>& bundles = m_sceneBundles[static_cast<size_t>(pass)].bundles;
+    for (WGPURenderBundle bundle : bundles)
+    {
+        wgpuRenderBundleRelease(bundle);
+    }
+    bundles.clear();
+}
 
-    m_uniforms.cameraWorldPosition = position;
-    m_queue.writeBuffer(m_uniformBuffer,
-                        offsetof(MyUniforms, cameraWorldPosition),
-                        &m_uniforms.cameraWorldPosition,
-                        sizeof(MyUniforms::cameraWorldPosition));
+void Application::releaseSceneBundles()
+{
+    releaseSceneBundles(ScenePass::Depth);
+    releaseSceneBundles(ScenePass::Color);
 }
 
-void Application::updateDragInertia()
+void Application::invalidateSceneBundles()
 {
-    constexpr float eps = 1e-4f;
+    for (SceneBundles& sceneBundles : m_sceneBundles)
+    {
+        sceneBundles.valid = false;
+        sceneBundles.recordedKeys.clear();
+        sceneBundles.recordedCount = 0;
+    }
+}
 
-    if (m_drag.active)
-        return;
+RenderBundle Application::recordSceneBundle(ScenePass pass,
+                                            const RenderQueue::Item* items,
+                                            size_t itemCount,
+                                            RenderQueue::Counters& counters)
+{
+    // Bundles must be compatible with the attachments of the pass that executes them
+    bool depthOnly = pass == ScenePass::Depth;
+    RenderBundleEncoderDescriptor bundleEncoderDesc;
+    bundleEncoderDesc.label              = depthOnly ? "Depth bundle encoder" : "Scene bundle encoder";
+    bundleEncoderDesc.colorFormatCount   = depthOnly ? 0 : 1;
+    bundleEncoderDesc.colorFormats       = depthOnly ? nullptr : (WGPUTextureFormat*)&m_swapChainFormat;
+    bundleEncoderDesc.depthStencilFormat = m_depthTextureFormat;
+    bundleEncoderDesc.sampleCount        = 1;
+    bundleEncoderDesc.depthReadOnly      = false;
+    bundleEncoderDesc.stencilReadOnly    = true;
+    RenderBundleEncoder bundleEncoder    = m_device.createRenderBundleEncoder(bundleEncoderDesc);
+
+    counters = encodeObjectDraws(bundleEncoder, pass, items, itemCount);
+
+    RenderBundleDescriptor bundleDesc;
+    bundleDesc.label    = depthOnly ? "Depth bundle" : "Scene bundle";
+    RenderBundle bundle = bundleEncoder.finish(bundleDesc);
+    bundleEncoder.release();
+    return bundle;
+}
 
-    if (std::abs(m_drag.velocity.x) < eps && std::abs(m_drag.velocity.y) < eps)
-        return;
+template <typename Encoder>
+RenderQueue::Counters Application::encodeObjectDraws(Encoder& encoder,
+                                                     ScenePass pass,
+                                                     const RenderQueue::Item* items,
+                                                     size_t itemCount)
+{
+    RenderQueue::Counters counters;
+    if (itemCount == 0)
+        return counters;
 
-    m_cameraState.angles += m_drag.velocity;
-    m_cameraState.angles.y = glm::clamp(m_cameraState.angles.y, -PI / 2 + 1e-5f, PI / 2 - 1e-5f);
-    m_drag.velocity *= m_drag.intertia;
-    updateViewMatrix();
+    // Set binding group
+    encoder.setBindGroup(0, m_bindGroup, 0, nullptr);
+    encoder.setBindGroup(2, m_lightBindGroup, 0, nullptr);
+
+    // Draw the objects that survived culling in the order of their keys, each with its own uniforms
+    // Materials only differ by the layers and factors in the object uniforms, so a new material changes no state.
+    uint32_t currentPipeline = UINT32_MAX;
+    uint32_t currentMaterial = UINT32_MAX;
+    uint32_t currentChunk    = UINT32_MAX;
+    for (size_t i = 0; i < itemCount; ++i)
+    {
+        uint64_t key          = items[i].key;
+        uint32_t pipelineSlot = pass == ScenePass::Depth ? 0 : RenderQueue::pipeline(key);
+        if (pipelineSlot != currentPipeline)
+        {
+            encoder.setPipeline(pass == ScenePass::Depth ? m_depthPipeline : m_scenePipelines[pipelineSlot]);
+            currentPipeline = pipelineSlot;
+            ++counters.pipelineChanges;
+        }
+        if (RenderQueue::material(key) != currentMaterial)
+        {
+            currentMaterial = RenderQueue::material(key);
+            ++counters.materialChanges;
+        }
+
+        uint32_t objectIndex                    = items[i].object;
+        const ResourceManager::Submesh& submesh = m_submeshes[m_sceneObjects[objectIndex].submesh];
+        if (submesh.chunk != currentChunk)
+        {
+            currentChunk = submesh.chunk;
+            encoder.setVertexBuffer(0, m_vertexBuffers[currentChunk], 0, m_vertexBuffers[currentChunk].getSize());
+            ++counters.vertexBufferChanges;
+        }
+
+        uint32_t dynamicOffset = objectIndex * m_objectUniformStride;
+        encoder.setBindGroup(1, m_objectBindGroup, 1, &dynamicOffset);
+        encoder.draw(submesh.vertexCount, 1, submesh.firstVertex, 0);
+        ++counters.draws;
+    }
+    return counters;
 }
 
-bool Application::initGui()
+void Application::configureBenchmarkRun()
 {
-    // Setup ImGui context
-    IMGUI_CHECKVERSION();
-    ImGui::CreateContext();
-    ImGui::GetIO();
+    int threadCount                     = m_benchmark.threadCounts[m_benchmark.run];
+    m_recording.parallel                = threadCount > 0;
+    m_recording.threadCount             = std::max(threadCount, 1);
+    m_benchmark.frame                   = 0;
+    m_benchmark.accumulatedMicroseconds = 0.0;
+}
 
-    // Setup Platform/Renderer backends
-    ImGui_ImplGlfw_InitForOther(m_window, true);
+void Application::updateBenchmark()
+{
+    constexpr int warmupFrames   = 10;
+    constexpr int measuredFrames = 100;
 
-    ImGui_ImplWGPU_InitInfo wgpuInfo;
-    wgpuInfo.Device             = m_device;
-    wgpuInfo.NumFramesInFlight  = 3;
-    wgpuInfo.RenderTargetFormat = m_swapChainFormat;
-    wgpuInfo.DepthStencilFormat = m_depthTextureFormat;
-    ImGui_ImplWGPU_Init(&wgpuInfo);
+    if (!m_benchmark.active)
+        return;
 
-    return true;
+    ++m_benchmark.frame;
+    if (m_benchmark.frame > warmupFrames)
+        m_benchmark.accumulatedMicroseconds += m_recording.encodeMicroseconds;
+    if (m_benchmark.frame < warmupFrames + measuredFrames)
+        return;
+
+    m_benchmark.encodeMicroseconds.push_back(m_benchmark.accumulatedMicroseconds / measuredFrames);
+    ++m_benchmark.run;
+    if (m_benchmark.run < m_benchmark.threadCounts.size())
+    {
+        configureBenchmarkRun();
+        return;
+    }
+
+    std::cout << "{\n"
+              << "  \"benchmark\": \"encoding\",\n"
+              << "  \"draws\": " << m_visibleObjects.size() << ",\n"
+              << "  \"gpuMemory\": ";
+    m_gpuMemory.writeJson(std::cout);
+    std::cout << ",\n"
+              << "  \"runs\": [\n";
+    for (size_t run = 0; run < m_benchmark.threadCounts.size(); ++run)
+    {
+        int threadCount = m_benchmark.threadCounts[run];
+        std::cout << "    {\"mode\": \"" << (threadCount > 0 ? "bundles" : "direct")
+                  << "\", \"threads\": " << std::max(threadCount, 1)
+                  << ", \"encodeMicroseconds\": " << m_benchmark.encodeMicroseconds[run] << "}"
+                  << (run + 1 < m_benchmark.threadCounts.size() ? "," : "") << "\n";
+    }
+    std::cout << "  ]\n"
+              << "}" << std::endl;
+
+    m_benchmark.active    = false;
+    m_bundleCache.enabled = m_benchmark.bundleCacheEnabled;
+    glfwSetWindowShouldClose(m_window, GLFW_TRUE);
 }
 
-void Application::terminateGui()
+void Application::configureLightBenchmarkRun()
 {
-    ImGui_ImplGlfw_Shutdown();
-    ImGui_ImplWGPU_Shutdown();
+    m_lightState.count                             = m_lightBenchmark.lightCounts[m_lightBenchmark.run];
+    m_lightState.regenerate                        = true;
+    m_lightBenchmark.frame                         = 0;
+    m_lightBenchmark.accumulatedGpuMilliseconds    = 0.0;
+    m_lightBenchmark.accumulatedAssignMicroseconds = 0.0;
+    m_lightBenchmark.gpuSamples                    = 0;
 }
 
-void Application::updateGui(wgpu::RenderPassEncoder renderPass)
+void Application::updateLightBenchmark()
 {
-    // Start the ImGui frame
-    ImGui_ImplWGPU_NewFrame();
-    ImGui_ImplGlfw_NewFrame();
-    ImGui::NewFrame();
+    constexpr int warmupFrames   = 10;
+    constexpr int measuredFrames = 100;
 
-    // Build our UI
+    if (!m_lightBenchmark.active)
+        return;
+
+    // GPU times arrive a few frames late and only for some of the frames, the warmup skips those of the previous run
+    ++m_lightBenchmark.frame;
+    if (m_lightBenchmark.frame > warmupFrames)
     {
-        bool changed = false;
-        ImGui::Begin("Lighting");
-        changed = ImGui::ColorEdit3("Color #0", glm::value_ptr(m_lightingUniforms.colors[0])) || changed;
-        changed = ImGui::DragDirection("Direction #0", m_lightingUniforms.directions[0]) || changed;
-        changed = ImGui::ColorEdit3("Color #1", glm::value_ptr(m_lightingUniforms.colors[1])) || changed;
-        changed = ImGui::DragDirection("Direction #1", m_lightingUniforms.directions[1]) || changed;
-        changed = ImGui::SliderFloat("Hardness", &m_lightingUniforms.hardness, 1.0f, 100.0f) || changed;
-        changed = ImGui::SliderFloat("K Diffuse", &m_lightingUniforms.kd, 0.0f, 1.0f) || changed;
-        changed = ImGui::SliderFloat("K Specular", &m_lightingUniforms.ks, 0.0f, 1.0f) || changed;
-        ImGui::End();
-        m_lightingUniformsChanged = changed;
+        m_lightBenchmark.accumulatedAssignMicroseconds += m_clusterer.stats().microseconds;
+        if (m_gpuTiming.samples != m_lightBenchmark.lastGpuSample)
+        {
+            m_lightBenchmark.accumulatedGpuMilliseconds += m_gpuTiming.milliseconds;
+            ++m_lightBenchmark.gpuSamples;
+        }
     }
+    m_lightBenchmark.lastGpuSample = m_gpuTiming.samples;
+    if (m_lightBenchmark.frame < warmupFrames + measuredFrames)
+        return;
 
-    // Draw the UI
-    ImGui::EndFrame();
-    ImGui::Render();
-    ImGui_ImplWGPU_RenderDrawData(ImGui::GetDrawData(), renderPass);
+    uint32_t gpuSamples = std::max(m_lightBenchmark.gpuSamples, 1u);
+    m_lightBenchmark.gpuMilliseconds.push_back(m_lightBenchmark.accumulatedGpuMilliseconds / gpuSamples);
+    m_lightBenchmark.assignMicroseconds.push_back(m_lightBenchmark.accumulatedAssignMicroseconds / measuredFrames);
+    ++m_lightBenchmark.run;
+    if (m_lightBenchmark.run < m_lightBenchmark.lightCounts.size())
+    {
+        configureLightBenchmarkRun();
+        return;
+    }
+
+    std::cout << "{\n"
+              << "  \"benchmark\": \"lights\",\n"
+              << "  \"clusters\": [" << LightClusterer::kGridX << ", " << LightClusterer::kGridY << ", "
+              << LightClusterer::kGridZ << "],\n"
+              << "  \"resolution\": [" << m_surfaceWidth << ", " << m_surfaceHeight << "],\n"
+              << "  \"gpuMemory\": ";
+    m_gpuMemory.writeJson(std::cout);
+    std::cout << ",\n"
+              << "  \"runs\": [\n";
+    for (size_t run = 0; run < m_lightBenchmark.lightCounts.size(); ++run)
+    {
+        std::cout << "    {\"lights\": " << m_lightBenchmark.lightCounts[run]
+                  << ", \"gpuMilliseconds\": " << m_lightBenchmark.gpuMilliseconds[run]
+                  << ", \"assignMicroseconds\": " << m_lightBenchmark.assignMicroseconds[run] << "}"
+                  << (run + 1 < m_lightBenchmark.lightCounts.size() ? "," : "") << "\n";
+    }
+    std::cout << "  ]\n"
+              << "}" << std::endl;
+
+    m_lightBenchmark.active = false;
+    glfwSetWindowShouldClose(m_window, GLFW_TRUE);
 }
 
-bool Application::initLightingUniforms()
+void Application::updateHeadless()
 {
-    BufferDescriptor bufferDesc;
-    bufferDesc.size             = sizeof(LightingUniforms);
-    bufferDesc.usage            = BufferUsage::CopyDst | BufferUsage::Uniform;
-    bufferDesc.mappedAtCreation = false;
-    m_lightingUniformBuffer     = m_device.createBuffer(bufferDesc);
+    constexpr int warmupFrames = 10;
 
-    // Initial values
-    m_lightingUniforms.directions[0] = {0.5f, -0.9f, 0.1f, 0.0f};
-    m_lightingUniforms.directions[1] = {0.2f, 0.4f, 0.3f, 0.0f};
-    m_lightingUniforms.colors[0]     = {1.0f, 0.9f, 0.6f, 1.0f};
-    m_lightingUniforms.colors[1]     = {0.6f, 0.9f, 1.0f, 1.0f};
+    if (!m_headless.active)
+        return;
 
-    updateLightingUniforms();
+    if (m_headless.frame <= m_headless.frames)
+    {
+        // Time of the frame that just ended, which was captured when in the second half
+        auto now = std::chrono::steady_clock::now();
+        if (m_headless.frame > warmupFrames)
+        {
+            double milliseconds = std::chrono::duration<double, std::milli>(now - m_headless.frameStart).count();
+            if (m_headless.frame > m_headless.frames / 2)
+                m_headless.captureMilliseconds.push_back(milliseconds);
+            else
+                m_headless.milliseconds.push_back(milliseconds);
+        }
+        m_headless.frameStart = now;
+        ++m_headless.frame;
 
-    return m_lightingUniformBuffer != nullptr;
+        if (m_headless.frame <= m_headless.frames)
+        {
+            // Every frame of the second half, unless no readback buffer is free yet for the previous request
+            if (m_headless.frame > m_headless.frames / 2 && !m_frameCapture.pending())
+            {
+                std::string name = "headless-" + std::to_string(m_headless.frame) + ".png";
+                m_frameCapture.request(std::filesystem::path("screenshots") / name);
+            }
+            requestRedraw();
+            return;
+        }
+    }
+
+    // The last captures are still mapped or encoded
+    if (m_frameCapture.busy())
+    {
+        requestRedraw();
+        return;
+    }
+
+    const FrameCapture::Stats& captureStats = m_frameCapture.stats();
+    std::cout << "{\n"
+              << "  \"benchmark\": \"capture\",\n"
+              << "  \"resolution\": [" << m_surfaceWidth << ", " << m_surfaceHeight << "],\n"
+              << "  \"gpuMemory\": ";
+    m_gpuMemory.writeJson(std::cout);
+    std::cout << ",\n"
+              << "  \"withoutCapture\": ";
+    writeFrameTimes(std::cout, m_headless.milliseconds);
+    std::cout << ",\n"
+              << "  \"withCapture\": ";
+    writeFrameTimes(std::cout, m_headless.captureMilliseconds);
+    std::cout << ",\n"
+              << "  \"captures\": {\"saved\": " << captureStats.saved << ", \"failures\": " << captureStats.failures
+              << ", \"deferred\": " << captureStats.deferred << ", \"latencyFrames\": " << captureStats.latencyFrames
+              << ", \"encodeMilliseconds\": " << captureStats.encodeMilliseconds << "}\n"
+              << "}" << std::endl;
+
+    glfwSetWindowShouldClose(m_window, GLFW_TRUE);
 }
 
-void Application::terminateLightingUniforms()
+void Application::requestScreenshot()
 {
-    m_lightingUniformBuffer.destroy();
-    m_lightingUniformBuffer.release();
+    // Named after the time of the request, so that those of earlier runs are kept
+    auto now          = std::chrono::system_clock::now().time_since_epoch();
+    long long seconds = std::chrono::duration_cast<std::chrono::seconds>(now).count();
+    std::string name  = "screenshot-" + std::to_string(seconds) + "-" + std::to_string(++m_screenshots) + ".png";
+    m_frameCapture.request(std::filesystem::path("screenshots") / name);
+    requestRedraw();
 }
 
-void Application::updateLightingUniforms()
+Application::mat4x4 Application::computeObjectTransform(const SceneObject& object) const
 {
-    if (m_lightingUniformsChanged)
-    {
-        m_queue.writeBuffer(m_lightingUniformBuffer, 0, &m_lightingUniforms, sizeof(LightingUniforms));
-        m_lightingUniformsChanged = false;
-    }
+    // Rotate around the vertical axis going through the center of the model, then move to the grid cell
+    vec3 pivot       = m_modelBounds.center();
+    mat4x4 transform = glm::translate(mat4x4(1.0f), object.position + pivot);
+    transform        = glm::rotate(transform, object.angle, vec3(0.0f, 0.0f, 1.0f));
+    transform        = glm::translate(transform, -pivot);
+    return transform;
 }
 
-TextureView GetNextSurfaceTextureView(Surface surface)
+TextureView GetNextSurfaceTextureView(Surface surface, SurfaceGetCurrentTextureStatus& status, Texture& texture)
 {
     SurfaceTexture surfaceTexture;
     surface.getCurrentTexture(&surfaceTexture);
+    status = surfaceTexture.status;
     if (surfaceTexture.status != SurfaceGetCurrentTextureStatus::Success)
     {
         return nullptr;
     }
-    Texture texture = surfaceTexture.texture;
+    texture = surfaceTexture.texture;
 
     // Create a view for this surface texture
     TextureViewDescriptor viewDescriptor;
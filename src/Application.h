@@ -1,7 +1,34 @@
 #pragma once
 
+#include "Bvh.h"
+#include "FrameCapture.h"
+#include "FramePacer.h"
+#include "FrameRecorder.h"
+#include "FrustumCuller.h"
+#include "GpuMemoryTracker.h"
+#include "GuiCache.h"
+#include "LightClusterer.h"
+#include "PipelineVariants.h"
+#include "RenderQueue.h"
+#include "RenderTargetPool.h"
+#include "ResolutionController.h"
+#include "ResourceManager.h"
+#include "ShaderPreprocessor.h"
+#include "ShadowMaps.h"
+#include "TextureArrayPool.h"
+#include "TextureStreamer.h"
+#include "ThreadPool.h"
+#include "UploadManager.h"
+#include "VirtualTextures.h"
+
 #include <array>
+#include <chrono>
+#include <filesystem>
 #include <glm/glm.hpp>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include <webgpu/webgpu.hpp>
 
 // Forward declare
@@ -10,8 +37,37 @@ struct GLFWwindow;
 class Application
 {
 public:
+    // Settings given on the command line
+    struct Options
+    {
+        // When non-zero, run the command recording benchmark with at least this many draws, then quit
+        uint32_t benchmarkEncodingDraws = 0;
+        // Name of the present mode (fifo, fifo-relaxed, mailbox or immediate), empty for the default
+        std::string presentMode;
+        // Frame rate limit, 0 for none
+        double targetFps = 0.0;
+        // Render only when something changed
+        bool onDemand = false;
+        // When non-zero, scale the resolution of the scene to render frames in this many milliseconds
+        float dynamicResolutionMilliseconds = 0.0f;
+        // When non-zero, run the clustered lighting benchmark with up to this many lights, then quit
+        uint32_t benchmarkLightsMax = 0;
+        // Render the GUI into an overlay that is reused as long as the GUI does not change
+        bool guiCache = false;
+        // Device memory budget in MiB, 0 for none; going over it is reported and stops the caches from growing
+        uint32_t gpuBudgetMegabytes = 0;
+        // OBJ file of the model, with its .mtl library and textures next to it
+        std::string modelPath = "resources/shader/fourareen.obj";
+        // When non-zero, split the vertex data into buffers of at most this many MiB instead of the device limit
+        uint32_t vertexChunkMegabytes = 0;
+        // When non-zero, render this many frames offscreen in a hidden window, capturing the second half, then quit
+        uint32_t headlessFrames = 0;
+        // Record every rendered frame from the start under recordings/, "png" or "rle"; empty for none
+        std::string recordFormat;
+    };
+
     // A function called only once at the beginning. Returns false is init failed.
-    bool onInit();
+    bool onInit(const Options& options);
 
     // A function called at each frame, guaranteed never to be called before `onInit`.
     void onFrame();
@@ -22,7 +78,7 @@ public:
     // A function that tells if the application is still running.
     bool isRunning();
 
-    // A function called when the window is resized
+    // A function called when the window is resized, the resize itself is applied at the next frame
     void onResize();
 
     // Mouse events
@@ -35,18 +91,45 @@ private:
     void terminateWindowAndDevice();
 
     bool initSwapChain();
+    void applyPendingResize();  // called in onFrame, once all the resize events of the frame are received
+    void updatePresentMode();  // called in onFrame, reconfigures the surface when the present mode changed
 
     bool initDepthBuffer();
     void terminateDepthBuffer();
 
+    bool initShaderSources();  // called in onInit(), generates the declarations shared with the shaders
+
+    bool initUpscale();         // called in onInit()
+    void terminateUpscale();    // called in onFinish()
+    void updateSceneTargets();  // called in onFrame, picks the resolution of the scene
+    void encodeUpscale(wgpu::RenderPassEncoder renderPass);
+    // Called in onFrame, holds the target of captured frames while the swap chain cannot be copied from
+    void updateFrameCopyTarget(bool needed);
+    // Draw the captured frame from its target to the swap chain
+    void encodeFrameCopy(wgpu::RenderPassEncoder renderPass);
+    void measureGpuTime();  // called in onFrame, after submitting
+
     bool initRenderPipeline();
     void terminateRenderPipeline();
+    wgpu::RenderPipeline createPipelineVariant(const PipelineVariants::Key& key,
+                                               const std::vector<wgpu::ConstantEntry>& constants);
+    // Cheapest variant that renders the materials of a scene pipeline as configured, see scenePipelineIndex
+    PipelineVariants::Key sceneVariantKey(uint32_t pipelineIndex) const;
+    void selectPipelineVariant();  // called in onFrame, before encoding the scene
+    uint32_t scenePipelineIndex(uint32_t material) const;
 
     bool initTexture();
     void terminateTexture();
 
     bool initGeometry();
     void terminateGeometry();
+    // Load a texture of a material once, materials referring to the same file share its layer
+    // The layer is filled progressively by m_textureStreamer, see updateTextureStreaming.
+    uint32_t loadMaterialTexture(const std::filesystem::path& path);
+    // Layers of m_materials[material] as given to the shader, only once they are resident
+    glm::uvec4 materialLayers(uint32_t material) const;
+    void updateTextureStreaming();  // called in onFrame, uploads the next levels and refreshes the object uniforms
+    void updateVirtualTextures();   // called in onFrame, uploads the pages asked for by the last feedback read back
 
     bool initUniforms();
     void terminateUniforms();
@@ -62,14 +145,79 @@ private:
 
     void updateDragInertia();
 
-    bool initGui();                                      // called in onInit
-    void terminateGui();                                 // called in onFinish
-    void updateGui(wgpu::RenderPassEncoder renderPass);  // called in onFrame
+    void requestRedraw();     // called whenever something visible changes
+    bool needsRedraw() const;  // in on-demand mode, whether the frame must be rendered
+    bool isMinimized() const;
+
+    bool initGui();                                       // called in onInit
+    void terminateGui();                                  // called in onFinish
+    void updateGui();                                     // called in onFrame, builds the UI of the frame
+    bool initGuiOverlay();                                // called in onInit
+    void terminateGuiOverlay();                           // called in onFinish
+    void encodeGuiOverlay(wgpu::CommandEncoder encoder);  // called in onFrame, renders the cached overlay if outdated
+    void drawGui(wgpu::RenderPassEncoder renderPass);     // called in onFrame, draws the GUI or its cached overlay
 
     bool initLightingUniforms();       // called in onInit()
     void terminateLightingUniforms();  // called in onFinish()
     void updateLightingUniforms();     // called when GUI is tweaked
 
+    bool initShadowMaps();                                // called in onInit()
+    void terminateShadowMaps();                           // called in onFinish()
+    void updateShadowMatrices();                          // called when the lighting uniforms changed
+    void encodeShadowMaps(wgpu::CommandEncoder encoder);  // called in onFrame, renders the outdated maps
+    void encodeShadowDraws(wgpu::RenderPassEncoder renderPass, uint32_t map);
+
+    bool initLights();       // called in onInit()
+    void terminateLights();  // called in onFinish()
+    void generateLights();   // called when the light count or the scene layout changes
+    void updateLights();     // called in onFrame, moves the lights and assigns them to clusters
+
+    bool initScene();       // called in onInit() and when the replica count changes
+    void terminateScene();  // called in onFinish()
+    bool updateScene();     // called in onFrame, refits the BVH when objects moved, false if the scene is lost
+    void cullScene();       // called in onFrame, fills m_visibleObjects
+    void queueSceneDraws();  // called in onFrame, sorts the visible objects into m_renderQueue
+
+    // The scene is drawn in the color pass, after an optional depth prepass
+    enum class ScenePass
+    {
+        Depth,
+        Color,
+    };
+
+    bool initCommandRecording();       // called in onInit()
+    void terminateCommandRecording();  // called in onFinish()
+    // Record the draws of the visible objects, directly in the pass or through bundles recorded in parallel
+    void encodeScene(wgpu::RenderPassEncoder renderPass, ScenePass pass);
+    void setSceneViewport(wgpu::RenderPassEncoder renderPass);
+    size_t queuedItemCount(ScenePass pass) const;  // items of m_renderQueue drawn by a pass
+    // Record the first `itemCount` items of m_renderQueue into the bundles of `pass`
+    void recordSceneBundles(ScenePass pass, size_t itemCount, bool parallel);
+    wgpu::RenderBundle recordSceneBundle(ScenePass pass,
+                                         const RenderQueue::Item* items,
+                                         size_t itemCount,
+                                         RenderQueue::Counters& counters);
+    void releaseSceneBundles(ScenePass pass);
+    void releaseSceneBundles();
+    void invalidateSceneBundles();  // called whenever something recorded in the bundles changes
+    // State is only set when the pipeline or the material of the sort keys changes
+    template <typename Encoder>
+    RenderQueue::Counters encodeObjectDraws(Encoder& encoder,
+                                            ScenePass pass,
+                                            const RenderQueue::Item* items,
+                                            size_t itemCount);
+
+    void updateRenderPipeline();  // called in onFrame, rebuilds the pipelines when the shader or settings changed
+
+    void configureBenchmarkRun();  // called when a benchmark run starts
+    void updateBenchmark();        // called at the end of onFrame
+
+    void configureLightBenchmarkRun();  // called when a light benchmark run starts
+    void updateLightBenchmark();        // called at the end of onFrame
+
+    void updateHeadless();     // called in onFrame, requests the captures of the headless run and reports it
+    void requestScreenshot();  // of the next frame, saved under screenshots/
+
 private:
     // (Just aliases to make notations lighter)
     using mat4x4 = glm::mat4x4;
@@ -100,11 +248,258 @@ private:
         float hardness;
         float kd;
         float ks;
+        uint32_t lightCount;  // point and spot lights, assigned to clusters
+
+        // Froxel grid of the clustered lights, see LightClusterer
+        vec2 viewportSize;
+        float sliceScale;
+        float sliceBias;
+        glm::uvec4 gridSize;
+        float cameraNear;
+        float cameraFar;
+
+        float normalMapStrength;
+        float shadowBias;  // depth offset of the shadow map comparisons
 
-        float _pad[1];
+        // From world space to the clip space of the shadow map of each directional light, see ShadowMaps
+        std::array<mat4x4, 2> shadowMatrices;
     };
     static_assert(sizeof(LightingUniforms) % 16 == 0);
 
+    /**
+     * Per-object uniforms, bound to group 1 with a dynamic offset
+     */
+    struct ObjectUniforms
+    {
+        mat4x4 modelMatrix;
+        glm::uvec4 materialLayers;  // layers of the base color and of the normal map, then their finest resident mips
+        glm::uvec4 virtualTexture;  // base color too large for the layers, see VirtualTextures::shaderParams
+        vec4 baseColor;             // diffuse color used without base color texture, and opacity of the material
+    };
+    static_assert(sizeof(ObjectUniforms) % 16 == 0);
+
+    // An instance of a submesh placed in the scene
+    struct SceneObject
+    {
+        uint32_t submesh;
+        vec3 position;
+        float angle;
+        BoundingBox worldBounds;
+    };
+
+    struct SceneState
+    {
+        // The loaded model is replicated on a grid of replicas x replicas
+        int replicas          = 1;
+        int builtReplicas     = 1;  // of the last scene that could be built
+        bool animate          = false;
+        bool cullingEnabled   = true;
+        bool rebuildRequested = false;
+
+        // Statistics of the last frame
+        float refitMicroseconds = 0.0f;
+        int bvhRebuilds         = 0;
+    };
+
+    struct RecordingState
+    {
+        bool parallel   = false;
+        bool supported  = false;  // Whether the device may be used from several threads
+        int threadCount = 1;
+
+        // Statistics of the last frame
+        float encodeMicroseconds = 0.0f;
+        uint32_t bundleCount     = 0;
+    };
+
+    // Bundles drawing the visible objects in one of the scene passes
+    struct SceneBundles
+    {
+        std::vector<WGPURenderBundle> bundles;
+        bool valid = false;
+
+        RenderQueue::Counters counters;  // commands recorded in the bundles
+
+        // What the bundles were recorded against: by object, the key of its draw without depth plus one, or zero
+        // when not recorded, so that the order of the draws, which follows the view, does not matter
+        std::vector<uint64_t> recordedKeys;
+        size_t recordedCount = 0;
+        wgpu::TextureFormat colorFormat = wgpu::TextureFormat::Undefined;
+        wgpu::TextureFormat depthFormat = wgpu::TextureFormat::Undefined;
+    };
+
+    // Bundles recorded once and replayed every frame until the scene changes
+    struct BundleCacheState
+    {
+        bool enabled = true;
+
+        // Statistics
+        uint32_t replayCount     = 0;
+        uint32_t recordCount     = 0;
+        float recordMicroseconds = 0.0f;
+    };
+
+    // A material of the model, with the layers of its textures in m_materialTextures
+    struct Material
+    {
+        uint32_t baseColorLayer = TextureArrayPool::kInvalidLayer;
+        uint32_t normalLayer    = TextureArrayPool::kInvalidLayer;
+        uint32_t virtualTexture = VirtualTextures::kInvalid;  // instead of baseColorLayer, in m_virtualTextures
+        vec3 diffuse            = vec3(1.0f);
+        float opacity           = 1.0f;
+    };
+
+    // Color pipelines of the scene, each material is drawn by the one matching its textures and opacity
+    static constexpr uint32_t kScenePipelineWithoutNormalMap = 1;
+    static constexpr uint32_t kScenePipelineTransparent      = 2;
+    static constexpr uint32_t kScenePipelineCount            = 4;
+
+    // Features used by the material of the scene
+    struct MaterialState
+    {
+        bool normalMap = true;
+        bool specular  = true;
+    };
+
+    struct ShadingState
+    {
+        int directionalLights = 2;
+        bool gammaCorrection  = true;
+    };
+
+    struct ShadowState
+    {
+        bool enabled = true;
+    };
+
+    struct DepthPrepassState
+    {
+        bool enabled      = false;
+        bool showOverdraw = false;
+    };
+
+    struct BenchmarkState
+    {
+        bool active             = false;
+        uint32_t draws          = 0;
+        bool bundleCacheEnabled = true;  // restored after the runs, which encode every frame
+        // Threads used by each run, 0 standing for direct recording in the render pass
+        std::vector<int> threadCounts;
+        std::vector<double> encodeMicroseconds;
+
+        size_t run                     = 0;
+        int frame                      = 0;
+        double accumulatedMicroseconds = 0.0;
+    };
+
+    // Model matrix of a scene object, relative to the scene root (m_uniforms.modelMatrix)
+    mat4x4 computeObjectTransform(const SceneObject& object) const;
+
+    struct UpscaleUniforms
+    {
+        vec2 uvScale;
+        vec2 texelSize;
+        float sharpness;
+
+        float _pad[3];
+    };
+    static_assert(sizeof(UpscaleUniforms) % 16 == 0);
+
+    struct DynamicResolutionState
+    {
+        bool enabled    = false;
+        float sharpness = 0.25f;
+
+        // Size of the region of the scene targets that is rendered
+        uint32_t renderWidth  = 0;
+        uint32_t renderHeight = 0;
+
+        uint32_t gpuSamples = 0;  // GPU timing samples already fed to the controller
+    };
+
+    // Time between a submit and the completion of its work, an upper bound of the GPU time of the frame
+    struct GpuTimingState
+    {
+        bool pending       = false;
+        float milliseconds = 0.0f;
+        uint32_t samples   = 0;
+    };
+
+    struct LightState
+    {
+        int count          = 64;
+        float spotFraction = 0.25f;  // share of the lights that are spot lights
+        bool animate       = true;
+        bool regenerate    = true;
+    };
+
+    struct LightBenchmarkState
+    {
+        bool active = false;
+        std::vector<int> lightCounts;
+        std::vector<double> gpuMilliseconds;
+        std::vector<double> assignMicroseconds;
+
+        size_t run                           = 0;
+        int frame                            = 0;
+        double accumulatedGpuMilliseconds    = 0.0;
+        double accumulatedAssignMicroseconds = 0.0;
+        uint32_t gpuSamples                  = 0;
+        uint32_t lastGpuSample               = 0;
+    };
+
+    struct HeadlessState
+    {
+        bool active = false;  // frames are rendered to `target` instead of the swap chain
+        RenderTargetPool::Target target;
+        int frames = 0;
+        int frame  = 0;
+        std::chrono::steady_clock::time_point frameStart;
+        // From the start of a frame to the start of the next
+        std::vector<double> milliseconds;
+        std::vector<double> captureMilliseconds;  // of the captured frames
+    };
+
+    struct GuiOverlayState
+    {
+        bool cached   = false;
+        int loadLines = 0;  // static text added to the GUI, to measure heavy layouts
+
+        // Size of the frame the overlay was rendered for
+        uint32_t width  = 0;
+        uint32_t height = 0;
+
+        // Statistics of the last frame
+        float drawMicroseconds = 0.0f;  // CPU time of rendering the GUI, or of compositing its overlay
+
+        // Frame intervals as of the last refresh of the GUI figures, see GuiCache::text()
+        std::array<float, FramePacer::kHistorySize> intervals {};
+        int intervalsOffset = 0;
+        float intervalsMax  = 0.0f;
+    };
+
+    struct ResizeState
+    {
+        bool pending = false;
+
+        // Statistics
+        uint32_t events      = 0;
+        uint32_t applied     = 0;
+        uint32_t allocations = 0;  // render targets allocated when applying resizes
+    };
+
+    struct RedrawState
+    {
+        bool onDemand = false;
+        // Frames left to render before idling, ImGui needs a few frames to settle after an input
+        int pendingFrames = 1;
+
+        // Statistics
+        uint32_t renderedFrames  = 0;
+        uint32_t idleWakeups     = 0;
+        uint32_t acquireFailures = 0;  // consecutive failures to get the surface texture
+    };
+
     struct CameraState
     {
         vec2 angles = {0.8f, 0.5f};
@@ -132,29 +527,92 @@ private:
     wgpu::Device m_device                 = nullptr;
     wgpu::Queue m_queue                   = nullptr;
     wgpu::TextureFormat m_swapChainFormat = wgpu::TextureFormat::Undefined;
+    uint32_t m_surfaceWidth               = 0;  // 0 while the surface is not configured
+    uint32_t m_surfaceHeight              = 0;
     // Keep the error callback alive
     std::unique_ptr<wgpu::ErrorCallback> m_errorCallbackHandle;
 
+    // Device memory accounting, declared before the pools that allocate through it
+    GpuMemoryTracker m_gpuMemory;
+    // Every write to buffers and textures goes through its staging ring, flushed before the frame is submitted
+    UploadManager m_uploads;
+
+    // Frame pacing
+    std::vector<wgpu::PresentMode> m_presentModes;  // supported by the surface
+    wgpu::PresentMode m_presentMode = wgpu::PresentMode::Fifo;
+    bool m_presentModeChanged       = false;
+    FramePacer m_framePacer;
+
     // Depth Buffer
     wgpu::TextureFormat m_depthTextureFormat = wgpu::TextureFormat::Depth24Plus;
-    wgpu::Texture m_depthTexture             = nullptr;
-    wgpu::TextureView m_depthTextureView     = nullptr;
+    RenderTargetPool::Target m_depthTarget;
+
+    // Screen sized targets
+    RenderTargetPool m_renderTargets;
+    ResizeState m_resize;
+
+    // Frame readback, for screenshots and the headless mode
+    FrameCapture m_frameCapture;
+    HeadlessState m_headless;
+    uint32_t m_screenshots = 0;
+    FrameRecorder m_recorder;  // requests its frames from m_frameCapture
+    FrameRecorder::Format m_recordFormat = FrameRecorder::Format::Rle;
+    // Without the CopySrc usage on the swap chain, captured frames are rendered to a target then drawn to it
+    bool m_surfaceCopySrc = false;
+    RenderTargetPool::Target m_frameCopyTarget;
+    wgpu::Buffer m_frameCopyUniformBuffer = nullptr;
+    wgpu::BindGroup m_frameCopyBindGroup  = nullptr;
+
+    // Dynamic resolution, the scene is rendered in its own targets then upscaled to the swap chain
+    RenderTargetPool::Target m_sceneColorTarget;
+    RenderTargetPool::Target m_sceneDepthTarget;
+    wgpu::ShaderModule m_upscaleShaderModule       = nullptr;
+    wgpu::BindGroupLayout m_upscaleBindGroupLayout = nullptr;
+    wgpu::RenderPipeline m_upscalePipeline         = nullptr;
+    wgpu::Sampler m_upscaleSampler                 = nullptr;
+    wgpu::Buffer m_upscaleUniformBuffer            = nullptr;
+    wgpu::BindGroup m_upscaleBindGroup             = nullptr;
+    ResolutionController m_resolution;
+    DynamicResolutionState m_dynamicResolution;
+    GpuTimingState m_gpuTiming;
+    std::unique_ptr<wgpu::QueueWorkDoneCallback> m_workDoneCallbackHandle;
 
     // Render Pipeline
     wgpu::BindGroupLayout m_bindGroupLayout = nullptr;
     wgpu::ShaderModule m_shaderModule       = nullptr;
-    wgpu::RenderPipeline m_pipeline         = nullptr;
-
-    // Texture
-    wgpu::Sampler m_sampler                  = nullptr;
-    wgpu::Texture m_baseColorTexture         = nullptr;
-    wgpu::TextureView m_baseColorTextureView = nullptr;
-    wgpu::Texture m_normalTexture            = nullptr;
-    wgpu::TextureView m_normalTextureView    = nullptr;
+    wgpu::PipelineLayout m_pipelineLayout   = nullptr;
+    wgpu::RenderPipeline m_depthPipeline    = nullptr;
+    PipelineVariants m_pipelineVariants;
+    // Variants selected for the frame, owned by m_pipelineVariants and indexed by scenePipelineIndex
+    std::array<wgpu::RenderPipeline, kScenePipelineCount> m_scenePipelines = {};
+    MaterialState m_material;
+    ShadingState m_shading;
+    DepthPrepassState m_depthPrepass;
+    bool m_pipelineOutdated = false;
+
+    // Shader sources and hot reload, which also watches the included files
+    ShaderPreprocessor m_shaderPreprocessor;
+    std::filesystem::path m_shaderPath = "resources/shader/sample.wgsl";
+    double m_lastShaderCheckTime       = 0.0;
+
+    // Texture, the materials are drawn with the same bind group and only differ by their layers
+    wgpu::Sampler m_sampler = nullptr;
+    TextureArrayPool m_materialTextures;
+    TextureStreamer m_textureStreamer;
+    VirtualTextures m_virtualTextures;  // for base color images larger than the layers
+    uint32_t m_maxMaterialLayers = 1;  // negotiated with the adapter
+    std::vector<Material> m_materials;
+    std::unordered_map<std::string, uint32_t> m_materialTextureLayers;  // by path, see loadMaterialTexture
+    uint32_t m_materialTextureReuses = 0;
 
     // Geometry
-    wgpu::Buffer m_vertexBuffer = nullptr;
-    int m_vertexCount           = 0;
+    // Split into as many vertex buffers as the buffer size limit of the device requires
+    std::filesystem::path m_modelPath;
+    std::vector<wgpu::Buffer> m_vertexBuffers;
+    uint64_t m_maxVertexBufferSize = 0;  // negotiated with the adapter, or smaller when asked on the command line
+    size_t m_vertexCount           = 0;
+    std::vector<ResourceManager::Submesh> m_submeshes;
+    BoundingBox m_modelBounds;
 
     // Uniforms
     wgpu::Buffer m_uniformBuffer = nullptr;
@@ -165,9 +623,75 @@ private:
     LightingUniforms m_lightingUniforms;
     bool m_lightingUniformsChanged = true;
 
+    // Clustered lights, bound to group 2
+    wgpu::BindGroupLayout m_lightBindGroupLayout = nullptr;
+    wgpu::BindGroup m_lightBindGroup             = nullptr;
+    wgpu::Buffer m_lightBuffer                   = nullptr;
+    wgpu::Buffer m_clusterBuffer                 = nullptr;
+    wgpu::Buffer m_lightIndexBuffer              = nullptr;
+    std::vector<LightClusterer::Light> m_lights;
+    std::vector<vec4> m_lightOrbits;  // center of the circle followed by each light, phase
+    LightClusterer m_clusterer;
+    LightState m_lightState;
+    LightBenchmarkState m_lightBenchmark;
+
+    // Shadow maps of the directional lights, one layer each, kept until a light or the geometry changes
+    wgpu::BindGroupLayout m_shadowBindGroupLayout = nullptr;
+    wgpu::BindGroup m_shadowBindGroup             = nullptr;
+    wgpu::PipelineLayout m_shadowPipelineLayout   = nullptr;
+    std::array<wgpu::RenderPipeline, ShadowMaps::kMapCount> m_shadowPipelines {};
+    wgpu::Texture m_shadowTexture       = nullptr;
+    wgpu::TextureView m_shadowArrayView = nullptr;  // sampled by the scene shader
+    std::array<wgpu::TextureView, ShadowMaps::kMapCount> m_shadowLayerViews {};
+    wgpu::Sampler m_shadowSampler = nullptr;
+    ShadowMaps m_shadowMaps;
+    ShadowState m_shadow;
+
     // Bind Group
     wgpu::BindGroup m_bindGroup = nullptr;
 
+    // Scene objects and culling
+    wgpu::BindGroupLayout m_objectBindGroupLayout = nullptr;
+    wgpu::BindGroup m_objectBindGroup             = nullptr;
+    wgpu::Buffer m_objectUniformBuffer            = nullptr;
+    uint32_t m_objectUniformStride                = 0;
+    uint32_t m_maxObjectCount                     = 0;
+    std::vector<SceneObject> m_sceneObjects;
+    std::vector<uint8_t> m_objectUniformData;
+    std::vector<uint32_t> m_visibleObjects;
+    RenderQueue m_renderQueue;
+    std::array<RenderQueue::Counters, 2> m_drawCounters;  // indexed by ScenePass
+    Bvh m_bvh;
+    FrustumCuller m_culler;
+    SceneState m_scene;
+
+    // Command recording
+    std::unique_ptr<ThreadPool> m_threadPool;
+    std::array<SceneBundles, 2> m_sceneBundles;  // indexed by ScenePass
+    RecordingState m_recording;
+    BundleCacheState m_bundleCache;
+    BenchmarkState m_benchmark;
+
+    RedrawState m_redraw;
+
+    // Time to the first frame and to the streamed textures, measured from the start of onInit
+    struct StartupState
+    {
+        std::chrono::steady_clock::time_point startTime;
+        float firstFrameMilliseconds = 0.0f;
+        float texturesMilliseconds   = 0.0f;  // once every level the frames asked for is resident
+    };
+    StartupState m_startup;
+
+    // GUI overlay, rendered into its own target and kept until the draw data of the GUI changes
+    wgpu::ShaderModule m_guiOverlayShaderModule       = nullptr;
+    wgpu::BindGroupLayout m_guiOverlayBindGroupLayout = nullptr;
+    wgpu::RenderPipeline m_guiOverlayPipeline         = nullptr;
+    wgpu::BindGroup m_guiOverlayBindGroup             = nullptr;
+    RenderTargetPool::Target m_guiOverlayTarget;
+    GuiCache m_guiCache;
+    GuiOverlayState m_guiOverlay;
+
     CameraState m_cameraState;
     DragState m_drag;
 };
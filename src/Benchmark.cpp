@@ -0,0 +1,104 @@
+#include "Benchmark.h"
+#include "Bvh.h"
+#include "FrustumCuller.h"
+
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#define GLM_FORCE_LEFT_HANDED
+#include <glm/ext.hpp>
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+constexpr float PI = 3.14159265358979323846f;
+
+using Clock = std::chrono::steady_clock;
+
+static float elapsedMilliseconds(Clock::time_point startTime)
+{
+    return std::chrono::duration<float, std::milli>(Clock::now() - startTime).count();
+}
+
+int Benchmark::runCulling(size_t objectCount)
+{
+    constexpr int frameCount     = 120;
+    constexpr float worldExtent  = 500.0f;
+    constexpr float movedPercent = 1.0f;
+
+    // Random boxes scattered in a cube
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> position(-worldExtent, worldExtent);
+    std::uniform_real_distribution<float> size(0.5f, 4.0f);
+    std::vector<BoundingBox> objectBounds(objectCount);
+    for (BoundingBox& box : objectBounds)
+    {
+        glm::vec3 center = {position(rng), position(rng), position(rng)};
+        glm::vec3 extent = glm::vec3(size(rng), size(rng), size(rng)) * 0.5f;
+        box.min          = center - extent;
+        box.max          = center + extent;
+    }
+
+    Bvh bvh;
+    Clock::time_point startTime = Clock::now();
+    bvh.build(objectBounds);
+    float buildMs = elapsedMilliseconds(startTime);
+
+    // Move a fraction of the objects and refit
+    size_t movedCount = static_cast<size_t>(objectCount * movedPercent / 100.0f);
+    std::uniform_int_distribution<size_t> pick(0, objectCount > 0 ? objectCount - 1 : 0);
+    std::uniform_real_distribution<float> jitter(-2.0f, 2.0f);
+    startTime = Clock::now();
+    for (size_t i = 0; i < movedCount; ++i)
+    {
+        size_t object     = pick(rng);
+        glm::vec3 offset  = {jitter(rng), jitter(rng), jitter(rng)};
+        BoundingBox& box  = objectBounds[object];
+        box.min += offset;
+        box.max += offset;
+        bvh.updateObject(static_cast<uint32_t>(object), box);
+    }
+    bvh.refit();
+    float refitMs = elapsedMilliseconds(startTime);
+
+    // Orbit the camera inside the cloud of objects
+    FrustumCuller culler;
+    std::vector<uint32_t> visibleObjects;
+    glm::mat4x4 projection = glm::perspective(45 * PI / 180, 16.0f / 9.0f, 0.1f, worldExtent);
+    double bvhMicroseconds = 0.0, bruteForceMicroseconds = 0.0;
+    uint64_t visibleSum = 0, nodesSum = 0;
+    for (int frame = 0; frame < frameCount; ++frame)
+    {
+        float angle            = 2 * PI * frame / frameCount;
+        glm::vec3 eye          = glm::vec3(std::cos(angle), std::sin(angle), 0.3f) * (0.5f * worldExtent);
+        glm::mat4x4 view       = glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0, 0, 1));
+        culler.setViewProjection(projection * view);
+
+        culler.cull(bvh, visibleObjects);
+        bvhMicroseconds += culler.stats().microseconds;
+        visibleSum += culler.stats().visible;
+        nodesSum += culler.stats().nodesVisited;
+
+        culler.cullBruteForce(objectBounds, visibleObjects);
+        bruteForceMicroseconds += culler.stats().microseconds;
+    }
+
+    std::cout << "{\n"
+              << "  \"benchmark\": \"culling\",\n"
+              << "  \"objects\": " << objectCount << ",\n"
+              << "  \"bvhNodes\": " << bvh.nodes().size() << ",\n"
+              << "  \"bvhCost\": " << bvh.cost() << ",\n"
+              << "  \"buildMs\": " << buildMs << ",\n"
+              << "  \"refitObjects\": " << movedCount << ",\n"
+              << "  \"refitMs\": " << refitMs << ",\n"
+              << "  \"frames\": " << frameCount << ",\n"
+              << "  \"averageVisible\": " << visibleSum / frameCount << ",\n"
+              << "  \"averageCulled\": " << objectCount - visibleSum / frameCount << ",\n"
+              << "  \"averageNodesVisited\": " << nodesSum / frameCount << ",\n"
+              << "  \"bvhCullMicroseconds\": " << bvhMicroseconds / frameCount << ",\n"
+              << "  \"bruteForceCullMicroseconds\": " << bruteForceMicroseconds / frameCount << "\n"
+              << "}" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+
+/**
+ * Stand-alone benchmarks that can be run from the command line without
+ * opening a window. Results are printed to stdout as JSON.
+ */
+class Benchmark
+{
+public:
+    // Build a BVH over `objectCount` random boxes and time culling along an orbiting camera
+    static int runCulling(size_t objectCount);
+};
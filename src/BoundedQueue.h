@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+/**
+ * Fixed capacity queue that any number of threads push to and pop from
+ * without locking, after Dmitry Vyukov's bounded MPMC queue. Each cell has a
+ * sequence number telling whether it is ready to be written or read at a
+ * given position, and threads claim positions with a compare-and-swap.
+ * Neither operation waits: pushing to a full queue or popping from an empty
+ * one returns false, and what to do then is up to the caller.
+ */
+template <typename T>
+class BoundedQueue
+{
+public:
+    // Rounded up to a power of two
+    explicit BoundedQueue(size_t capacity)
+    {
+        size_t cellCount = 1;
+        while (cellCount < capacity)
+        {
+            cellCount *= 2;
+        }
+        m_cells = std::make_unique<Cell[]>(cellCount);
+        m_mask  = cellCount - 1;
+        for (size_t i = 0; i < cellCount; ++i)
+        {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(const BoundedQueue&)            = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    // `value` is left untouched when the queue is full
+    bool tryPush(T& value)
+    {
+        size_t position = m_pushPosition.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell& cell        = m_cells[position & m_mask];
+            size_t sequence   = cell.sequence.load(std::memory_order_acquire);
+            ptrdiff_t pending = static_cast<ptrdiff_t>(sequence) - static_cast<ptrdiff_t>(position);
+            if (pending == 0)
+            {
+                if (m_pushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    cell.value = std::move(value);
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (pending < 0)
+            {
+                // The cell still holds the value pushed one lap earlier
+                return false;
+            }
+            else
+            {
+                position = m_pushPosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool tryPop(T& value)
+    {
+        size_t position = m_popPosition.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell& cell        = m_cells[position & m_mask];
+            size_t sequence   = cell.sequence.load(std::memory_order_acquire);
+            ptrdiff_t pending = static_cast<ptrdiff_t>(sequence) - static_cast<ptrdiff_t>(position + 1);
+            if (pending == 0)
+            {
+                if (m_popPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    value = std::move(cell.value);
+                    cell.sequence.store(position + m_mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (pending < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = m_popPosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    size_t capacity() const
+    {
+        return m_mask + 1;
+    }
+    // Only a hint while other threads push or pop
+    size_t size() const
+    {
+        size_t pushed = m_pushPosition.load(std::memory_order_relaxed);
+        size_t popped = m_popPosition.load(std::memory_order_relaxed);
+        return pushed > popped ? pushed - popped : 0;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence {0};
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+    size_t m_mask = 0;
+    std::atomic<size_t> m_pushPosition {0};
+    std::atomic<size_t> m_popPosition {0};
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <limits>
+
+/**
+ * An axis-aligned bounding box. A default constructed box is empty and
+ * becomes valid as soon as a point or another box is added to it.
+ */
+struct BoundingBox
+{
+    glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+    bool isEmpty() const
+    {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    void extend(const glm::vec3& point)
+    {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void extend(const BoundingBox& box)
+    {
+        min = glm::min(min, box.min);
+        max = glm::max(max, box.max);
+    }
+
+    glm::vec3 center() const
+    {
+        return 0.5f * (min + max);
+    }
+
+    // Half the size of the box along each axis
+    glm::vec3 extent() const
+    {
+        return 0.5f * (max - min);
+    }
+
+    float surfaceArea() const
+    {
+        if (isEmpty())
+            return 0.0f;
+        glm::vec3 d = max - min;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    // The axis-aligned box enclosing this box once transformed by `transform`
+    // (Arvo's method: only the absolute value of the linear part matters for the extent)
+    BoundingBox transformed(const glm::mat4x4& transform) const
+    {
+        if (isEmpty())
+            return *this;
+        glm::vec3 c = glm::vec3(transform * glm::vec4(center(), 1.0f));
+        glm::vec3 e = extent();
+        glm::vec3 newExtent =
+            glm::abs(glm::vec3(transform[0])) * e.x + glm::abs(glm::vec3(transform[1])) * e.y
+            + glm::abs(glm::vec3(transform[2])) * e.z;
+        BoundingBox box;
+        box.min = c - newExtent;
+        box.max = c + newExtent;
+        return box;
+    }
+};
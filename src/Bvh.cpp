@@ -0,0 +1,319 @@
+#include "Bvh.h"
+
+#include <algorithm>
+#include <array>
+#include <numeric>
+
+constexpr uint32_t kInvalidNode = ~0u;
+constexpr uint32_t kBinCount    = 12;
+// Leaves are never larger than this, whatever the SAH says
+constexpr uint32_t kMaxLeafSize = 8;
+// Cost of visiting an inner node relative to testing one object
+constexpr float kTraversalCost = 1.0f;
+// Rebuild once refitting has made the tree this much more expensive than when built
+constexpr float kRebuildCostRatio = 1.5f;
+
+void Bvh::build(const std::vector<BoundingBox>& objectBounds)
+{
+    clear();
+    uint32_t objectCount = static_cast<uint32_t>(objectBounds.size());
+    if (objectCount == 0)
+        return;
+
+    m_slotObjects.resize(objectCount);
+    std::iota(m_slotObjects.begin(), m_slotObjects.end(), 0);
+
+    std::vector<glm::vec3> centroids(objectCount);
+    for (uint32_t i = 0; i < objectCount; ++i)
+    {
+        centroids[i] = objectBounds[i].center();
+    }
+
+    // A binary tree with N leaves has at most 2N - 1 nodes
+    m_nodes.reserve(2 * objectCount - 1);
+    m_slotRanges.reserve(2 * objectCount - 1);
+    m_parents.reserve(2 * objectCount - 1);
+    m_slotLeaves.resize(objectCount);
+
+    m_nodes.emplace_back();
+    m_slotRanges.push_back({0, objectCount});
+    m_parents.push_back(kInvalidNode);
+
+    // Leaf slots keep their bounds next to each other for the traversal
+    m_slotBounds = objectBounds;
+    subdivide(0, 0, objectCount, centroids);
+
+    for (uint32_t slot = 0; slot < objectCount; ++slot)
+    {
+        m_slotBounds[slot] = objectBounds[m_slotObjects[slot]];
+    }
+    m_objectSlots.resize(objectCount);
+    for (uint32_t slot = 0; slot < objectCount; ++slot)
+    {
+        m_objectSlots[m_slotObjects[slot]] = slot;
+    }
+
+    m_leafDirty.assign(m_nodes.size(), false);
+    m_builtCost = computeCost();
+    m_cost      = m_builtCost;
+}
+
+void Bvh::updateObject(uint32_t object, const BoundingBox& bounds)
+{
+    uint32_t slot       = m_objectSlots[object];
+    m_slotBounds[slot]  = bounds;
+    uint32_t leafIndex  = m_slotLeaves[slot];
+    if (!m_leafDirty[leafIndex])
+    {
+        m_leafDirty[leafIndex] = true;
+        m_dirtyLeaves.push_back(leafIndex);
+    }
+}
+
+void Bvh::refit()
+{
+    if (m_dirtyLeaves.empty())
+        return;
+
+    // When a large part of the scene moved, a linear sweep beats walking many paths
+    if (m_dirtyLeaves.size() * 8 > m_nodes.size())
+    {
+        refitAll();
+    }
+    else
+    {
+        for (uint32_t leafIndex : m_dirtyLeaves)
+        {
+            updateNodeBounds(leafIndex);
+            uint32_t parent = m_parents[leafIndex];
+            while (parent != kInvalidNode)
+            {
+                Node previous = m_nodes[parent];
+                updateNodeBounds(parent);
+                const Node& node = m_nodes[parent];
+                // Nothing above changes if this node did not change
+                if (node.boundsMin == previous.boundsMin && node.boundsMax == previous.boundsMax)
+                    break;
+                parent = m_parents[parent];
+            }
+        }
+        m_cost = computeCost();
+    }
+
+    for (uint32_t leafIndex : m_dirtyLeaves)
+    {
+        m_leafDirty[leafIndex] = false;
+    }
+    m_dirtyLeaves.clear();
+}
+
+bool Bvh::needsRebuild() const
+{
+    return m_cost > m_builtCost * kRebuildCostRatio;
+}
+
+void Bvh::clear()
+{
+    m_nodes.clear();
+    m_slotRanges.clear();
+    m_parents.clear();
+    m_slotObjects.clear();
+    m_slotBounds.clear();
+    m_objectSlots.clear();
+    m_slotLeaves.clear();
+    m_dirtyLeaves.clear();
+    m_leafDirty.clear();
+    m_builtCost = 0.0f;
+    m_cost      = 0.0f;
+}
+
+void Bvh::subdivide(uint32_t nodeIndex, uint32_t first, uint32_t count, const std::vector<glm::vec3>& centroids)
+{
+    // Bounds of the node and of the centroids it contains
+    BoundingBox bounds;
+    BoundingBox centroidBounds;
+    for (uint32_t slot = first; slot < first + count; ++slot)
+    {
+        uint32_t object = m_slotObjects[slot];
+        bounds.extend(m_slotBounds[object]);
+        centroidBounds.extend(centroids[object]);
+    }
+    m_nodes[nodeIndex].boundsMin = bounds.min;
+    m_nodes[nodeIndex].boundsMax = bounds.max;
+
+    auto makeLeaf = [&]()
+    {
+        m_nodes[nodeIndex].leftFirst = first;
+        m_nodes[nodeIndex].count     = count;
+        for (uint32_t slot = first; slot < first + count; ++slot)
+        {
+            m_slotLeaves[slot] = nodeIndex;
+        }
+    };
+
+    if (count == 1)
+    {
+        makeLeaf();
+        return;
+    }
+
+    // Find the best split plane among the bin boundaries of all three axes
+    struct Bin
+    {
+        BoundingBox bounds;
+        uint32_t count = 0;
+    };
+
+    float bestCost    = std::numeric_limits<float>::max();
+    int bestAxis      = -1;
+    uint32_t bestSplit = 0;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        float axisMin = centroidBounds.min[axis];
+        float axisMax = centroidBounds.max[axis];
+        if (axisMax - axisMin <= 1e-6f)
+            continue;
+
+        std::array<Bin, kBinCount> bins;
+        float scale = kBinCount / (axisMax - axisMin);
+        for (uint32_t slot = first; slot < first + count; ++slot)
+        {
+            uint32_t object = m_slotObjects[slot];
+            uint32_t b      = std::min(kBinCount - 1, static_cast<uint32_t>((centroids[object][axis] - axisMin) * scale));
+            bins[b].count++;
+            bins[b].bounds.extend(m_slotBounds[object]);
+        }
+
+        // Sweep from both ends to get the cost of every split in linear time
+        std::array<float, kBinCount - 1> leftArea, rightArea;
+        std::array<uint32_t, kBinCount - 1> leftCount, rightCount;
+        BoundingBox leftBox, rightBox;
+        uint32_t leftSum = 0, rightSum = 0;
+        for (uint32_t i = 0; i < kBinCount - 1; ++i)
+        {
+            leftSum += bins[i].count;
+            leftCount[i] = leftSum;
+            leftBox.extend(bins[i].bounds);
+            leftArea[i] = leftBox.surfaceArea();
+
+            rightSum += bins[kBinCount - 1 - i].count;
+            rightCount[kBinCount - 2 - i] = rightSum;
+            rightBox.extend(bins[kBinCount - 1 - i].bounds);
+            rightArea[kBinCount - 2 - i] = rightBox.surfaceArea();
+        }
+
+        for (uint32_t i = 0; i < kBinCount - 1; ++i)
+        {
+            if (leftCount[i] == 0 || rightCount[i] == 0)
+                continue;
+            float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+            if (cost < bestCost)
+            {
+                bestCost  = cost;
+                bestAxis  = axis;
+                bestSplit = i;
+            }
+        }
+    }
+
+    float leafCost = count * bounds.surfaceArea();
+    float splitCost = kTraversalCost * bounds.surfaceArea() + bestCost;
+    if (count <= kMaxLeafSize && (bestAxis < 0 || splitCost >= leafCost))
+    {
+        makeLeaf();
+        return;
+    }
+
+    // Partition the slots around the chosen plane
+    uint32_t leftCount = count / 2;
+    if (bestAxis >= 0)
+    {
+        float axisMin = centroidBounds.min[bestAxis];
+        float scale   = kBinCount / (centroidBounds.max[bestAxis] - axisMin);
+        auto middle   = std::partition(m_slotObjects.begin() + first,
+                                     m_slotObjects.begin() + first + count,
+                                     [&](uint32_t object)
+                                     {
+                                         uint32_t b = std::min(
+                                             kBinCount - 1,
+                                             static_cast<uint32_t>((centroids[object][bestAxis] - axisMin) * scale));
+                                         return b <= bestSplit;
+                                     });
+        leftCount = static_cast<uint32_t>(middle - (m_slotObjects.begin() + first));
+    }
+    if (leftCount == 0 || leftCount == count)
+    {
+        // All centroids coincide: split in the middle to bound the leaf size
+        leftCount = count / 2;
+    }
+
+    uint32_t leftChild = static_cast<uint32_t>(m_nodes.size());
+    m_nodes.emplace_back();
+    m_nodes.emplace_back();
+    m_slotRanges.push_back({first, leftCount});
+    m_slotRanges.push_back({first + leftCount, count - leftCount});
+    m_parents.push_back(nodeIndex);
+    m_parents.push_back(nodeIndex);
+    m_nodes[nodeIndex].leftFirst = leftChild;
+    m_nodes[nodeIndex].count     = 0;
+
+    subdivide(leftChild, first, leftCount, centroids);
+    subdivide(leftChild + 1, first + leftCount, count - leftCount, centroids);
+}
+
+void Bvh::updateNodeBounds(uint32_t nodeIndex)
+{
+    Node& node = m_nodes[nodeIndex];
+    BoundingBox bounds;
+    if (node.isLeaf())
+    {
+        for (uint32_t slot = node.leftFirst; slot < node.leftFirst + node.count; ++slot)
+        {
+            bounds.extend(m_slotBounds[slot]);
+        }
+    }
+    else
+    {
+        const Node& left  = m_nodes[node.leftFirst];
+        const Node& right = m_nodes[node.leftFirst + 1];
+        bounds.min        = glm::min(left.boundsMin, right.boundsMin);
+        bounds.max        = glm::max(left.boundsMax, right.boundsMax);
+    }
+    node.boundsMin = bounds.min;
+    node.boundsMax = bounds.max;
+}
+
+void Bvh::refitAll()
+{
+    // Children always come after their parent
+    for (size_t i = m_nodes.size(); i-- > 0;)
+    {
+        updateNodeBounds(static_cast<uint32_t>(i));
+    }
+    m_cost = computeCost();
+}
+
+float Bvh::computeCost() const
+{
+    if (m_nodes.empty())
+        return 0.0f;
+
+    auto area = [](const Node& node)
+    {
+        BoundingBox box;
+        box.min = node.boundsMin;
+        box.max = node.boundsMax;
+        return box.surfaceArea();
+    };
+
+    float rootArea = area(m_nodes[0]);
+    if (rootArea <= 0.0f)
+        return 0.0f;
+
+    float cost = 0.0f;
+    for (const Node& node : m_nodes)
+    {
+        cost += area(node) * (node.isLeaf() ? static_cast<float>(node.count) : kTraversalCost);
+    }
+    return cost / rootArea;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "BoundingBox.h"
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * A bounding volume hierarchy over a set of object bounds, built with a
+ * binned surface area heuristic (SAH) and flattened into a single array.
+ * Children are allocated after their parent and the two siblings are stored
+ * next to each other, so that traversals walk forward in memory and a
+ * bottom-up refit is a single reverse sweep.
+ */
+class Bvh
+{
+public:
+    struct Node
+    {
+        glm::vec3 boundsMin;
+        uint32_t leftFirst;  // Index of the left child (right is leftFirst + 1), or first slot of a leaf
+        glm::vec3 boundsMax;
+        uint32_t count;  // Number of objects in a leaf, 0 for inner nodes
+
+        bool isLeaf() const
+        {
+            return count > 0;
+        }
+    };
+    static_assert(sizeof(Node) == 32);
+
+    // Range of leaf slots covered by a node and all of its descendants
+    struct SlotRange
+    {
+        uint32_t first;
+        uint32_t count;
+    };
+
+    // Build the hierarchy from scratch
+    void build(const std::vector<BoundingBox>& objectBounds);
+
+    // Change the bounds of an object. The hierarchy is updated by the next call to refit()
+    void updateObject(uint32_t object, const BoundingBox& bounds);
+
+    // Propagate the bounds changed by updateObject() up to the root
+    void refit();
+
+    // Whether the refitted tree has degraded enough that a full build is worth it
+    bool needsRebuild() const;
+
+    void clear();
+
+    const std::vector<Node>& nodes() const
+    {
+        return m_nodes;
+    }
+
+    const std::vector<SlotRange>& slotRanges() const
+    {
+        return m_slotRanges;
+    }
+
+    // Object index stored in each leaf slot
+    const std::vector<uint32_t>& slotObjects() const
+    {
+        return m_slotObjects;
+    }
+
+    // Object bounds stored in leaf order, so that leaves read contiguous memory
+    const std::vector<BoundingBox>& slotBounds() const
+    {
+        return m_slotBounds;
+    }
+
+    size_t objectCount() const
+    {
+        return m_slotObjects.size();
+    }
+
+    // SAH cost of the tree, relative to the surface area of the root
+    float cost() const
+    {
+        return m_cost;
+    }
+
+private:
+    void subdivide(uint32_t nodeIndex, uint32_t first, uint32_t count, const std::vector<glm::vec3>& centroids);
+    void updateNodeBounds(uint32_t nodeIndex);
+    void refitAll();
+    float computeCost() const;
+
+private:
+    std::vector<Node> m_nodes;
+    std::vector<SlotRange> m_slotRanges;
+    std::vector<uint32_t> m_parents;
+
+    std::vector<uint32_t> m_slotObjects;
+    std::vector<BoundingBox> m_slotBounds;
+    std::vector<uint32_t> m_objectSlots;  // Inverse of m_slotObjects
+    std::vector<uint32_t> m_slotLeaves;   // Leaf node owning each slot
+
+    std::vector<uint32_t> m_dirtyLeaves;
+    std::vector<bool> m_leafDirty;
+
+    float m_builtCost = 0.0f;
+    float m_cost      = 0.0f;
+};
@@ -0,0 +1,343 @@
+#include "FrameCapture.h"
+
+#include <stb_image_write.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+using namespace wgpu;
+
+namespace
+{
+    // Of the bytesPerRow of texture to buffer copies
+    constexpr uint32_t kRowAlignment  = 256;
+    constexpr uint32_t kBytesPerTexel = 4;
+}  // namespace
+
+void FrameCapture::init(Device device, GpuMemoryTracker* memory)
+{
+    m_device   = device;
+    m_memory   = memory;
+    m_frame    = 0;
+    m_stats    = Stats();
+    m_stopping = false;
+    m_worker   = std::thread([this]() { workerLoop(); });
+}
+
+void FrameCapture::terminate()
+{
+    // Let the copies in flight reach the background thread, which empties its queue before stopping
+    while (hasSlotIn(SlotState::Mapping))
+    {
+        pollDevice();
+    }
+    update();
+    if (m_worker.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wakeCondition.notify_all();
+        m_worker.join();
+    }
+    update();
+
+    for (Slot& slot : m_slots)
+    {
+        if (slot.buffer)
+            m_memory->destroy(slot.buffer);
+        slot = Slot();
+    }
+    m_requests.clear();
+    m_jobs.clear();
+    m_releasedSlots.clear();
+    m_results.clear();
+    m_encodingJobs = 0;
+}
+
+void FrameCapture::request(const std::filesystem::path& path)
+{
+    m_requests.push_back({path, nullptr});
+    ++m_stats.requested;
+}
+
+void FrameCapture::request(FrameHandler handler)
+{
+    m_requests.push_back({{}, std::move(handler)});
+    ++m_stats.requested;
+}
+
+bool FrameCapture::pending() const
+{
+    return !m_requests.empty();
+}
+
+bool FrameCapture::busy() const
+{
+    return pending() || inFlight() > 0;
+}
+
+uint32_t FrameCapture::inFlight() const
+{
+    // Slots being copied out are counted with the jobs
+    auto copies = std::count_if(m_slots.begin(),
+                                m_slots.end(),
+                                [](const Slot& slot)
+                                { return slot.state != SlotState::Free && slot.state != SlotState::Encoding; });
+    return static_cast<uint32_t>(copies) + m_encodingJobs;
+}
+
+void FrameCapture::encodeCopy(CommandEncoder encoder, Texture texture)
+{
+    if (m_requests.empty())
+        return;
+
+    auto free = std::find_if(
+        m_slots.begin(), m_slots.end(), [](const Slot& slot) { return slot.state == SlotState::Free; });
+    if (free == m_slots.end())
+    {
+        ++m_stats.deferred;
+        return;
+    }
+    Slot& slot   = *free;
+    slot.request = std::move(m_requests.front());
+    m_requests.pop_front();
+
+    TextureFormat format = texture.getFormat();
+    if (format != TextureFormat::RGBA8Unorm && format != TextureFormat::RGBA8UnormSrgb
+        && format != TextureFormat::BGRA8Unorm && format != TextureFormat::BGRA8UnormSrgb)
+    {
+        std::cerr << "Cannot capture frames of texture format " << format << std::endl;
+        ++m_stats.failures;
+        return;
+    }
+
+    slot.width    = texture.getWidth();
+    slot.height   = texture.getHeight();
+    slot.rowBytes = (slot.width * kBytesPerTexel + kRowAlignment - 1) / kRowAlignment * kRowAlignment;
+    slot.bgra     = format == TextureFormat::BGRA8Unorm || format == TextureFormat::BGRA8UnormSrgb;
+
+    // Buffers follow the size of the frames
+    uint64_t size = uint64_t(slot.rowBytes) * slot.height;
+    if (slot.buffer && slot.size != size)
+        m_memory->destroy(slot.buffer);
+    if (!slot.buffer)
+    {
+        BufferDescriptor bufferDesc;
+        bufferDesc.label            = "Frame readback";
+        bufferDesc.size             = size;
+        bufferDesc.usage            = BufferUsage::CopyDst | BufferUsage::MapRead;
+        bufferDesc.mappedAtCreation = false;
+
+        slot.buffer = m_memory->createBuffer(m_device, bufferDesc, GpuMemoryTracker::Category::Staging);
+        slot.size   = size;
+        if (!slot.buffer)
+        {
+            ++m_stats.failures;
+            return;
+        }
+    }
+
+    ImageCopyTexture source;
+    source.texture  = texture;
+    source.mipLevel = 0;
+    source.origin   = {0, 0, 0};
+    source.aspect   = TextureAspect::All;
+
+    ImageCopyBuffer destination;
+    destination.buffer              = slot.buffer;
+    destination.layout.offset       = 0;
+    destination.layout.bytesPerRow  = slot.rowBytes;
+    destination.layout.rowsPerImage = slot.height;
+
+    encoder.copyTextureToBuffer(source, destination, {slot.width, slot.height, 1});
+    slot.copyFrame = m_frame;
+    slot.state     = SlotState::Copied;
+    ++m_stats.copied;
+}
+
+void FrameCapture::onSubmitted()
+{
+    for (Slot& slot : m_slots)
+    {
+        if (slot.state != SlotState::Copied)
+            continue;
+
+        slot.state       = SlotState::Mapping;
+        slot.mapCallback = slot.buffer.mapAsync(MapMode::Read,
+                                                0,
+                                                slot.size,
+                                                [this, &slot](BufferMapAsyncStatus status)
+                                                {
+                                                    if (status != BufferMapAsyncStatus::Success)
+                                                    {
+                                                        std::cerr << "Cannot map frame readback (status " << status
+                                                                  << ")" << std::endl;
+                                                        ++m_stats.failures;
+                                                        slot.state = SlotState::Free;
+                                                        return;
+                                                    }
+                                                    slot.state            = SlotState::Mapped;
+                                                    m_stats.latencyFrames = m_frame - slot.copyFrame;
+                                                });
+    }
+}
+
+void FrameCapture::update()
+{
+    ++m_frame;
+    // Mappings only complete while the device is polled, which the render loop does not do while idle
+    if (hasSlotIn(SlotState::Mapping))
+        pollDevice();
+
+    std::vector<uint32_t> releasedSlots;
+    std::vector<Result> results;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        releasedSlots.swap(m_releasedSlots);
+        results.swap(m_results);
+    }
+    for (uint32_t index : releasedSlots)
+    {
+        m_slots[index].buffer.unmap();
+        m_slots[index].state = SlotState::Free;
+    }
+    for (const Result& result : results)
+    {
+        --m_encodingJobs;
+        if (result.handedOver)
+        {
+            ++m_stats.handedOver;
+            continue;
+        }
+        if (result.ok)
+            ++m_stats.saved;
+        else
+            ++m_stats.failures;
+        m_stats.encodeMilliseconds = result.milliseconds;
+    }
+
+    bool queued = false;
+    for (uint32_t index = 0; index < kSlotCount; ++index)
+    {
+        Slot& slot = m_slots[index];
+        if (slot.state != SlotState::Mapped)
+            continue;
+
+        Job job;
+        job.slot     = index;
+        job.texels   = static_cast<const unsigned char*>(slot.buffer.getConstMappedRange(0, slot.size));
+        job.width    = slot.width;
+        job.height   = slot.height;
+        job.rowBytes = slot.rowBytes;
+        job.bgra     = slot.bgra;
+        job.request  = std::move(slot.request);
+        slot.state   = SlotState::Encoding;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.push_back(std::move(job));
+        }
+        ++m_encodingJobs;
+        queued = true;
+    }
+    if (queued)
+        m_wakeCondition.notify_one();
+}
+
+bool FrameCapture::hasSlotIn(SlotState state) const
+{
+    return std::any_of(m_slots.begin(), m_slots.end(), [state](const Slot& slot) { return slot.state == state; });
+}
+
+void FrameCapture::pollDevice()
+{
+#if defined(WEBGPU_BACKEND_DAWN)
+    m_device.tick();
+#elif defined(WEBGPU_BACKEND_WGPU)
+    m_device.poll(false);
+#endif
+}
+
+void FrameCapture::workerLoop()
+{
+    while (true)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeCondition.wait(lock, [this]() { return m_stopping || !m_jobs.empty(); });
+            if (m_jobs.empty())
+                return;
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+
+        // Copy the rows out first, so that the buffer can be unmapped and reused during the encoding
+        auto startTime          = std::chrono::steady_clock::now();
+        uint32_t packedRowBytes = job.width * kBytesPerTexel;
+        Frame frame;
+        frame.width  = job.width;
+        frame.height = job.height;
+        frame.pixels.resize(size_t(packedRowBytes) * job.height);
+        for (uint32_t row = 0; row < job.height; ++row)
+        {
+            std::memcpy(frame.pixels.data() + size_t(row) * packedRowBytes,
+                        job.texels + size_t(row) * job.rowBytes,
+                        packedRowBytes);
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_releasedSlots.push_back(job.slot);
+        }
+
+        if (job.bgra)
+        {
+            for (size_t i = 0; i < frame.pixels.size(); i += kBytesPerTexel)
+            {
+                std::swap(frame.pixels[i], frame.pixels[i + 2]);
+            }
+        }
+        Result result;
+        if (job.request.handler)
+        {
+            job.request.handler(frame);
+            result.ok         = true;
+            result.handedOver = true;
+        }
+        else
+        {
+            result.ok = writePng(job.request.path, frame.pixels, frame.width, frame.height);
+        }
+        result.milliseconds =
+            std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_results.push_back(result);
+    }
+}
+
+bool FrameCapture::writePng(const std::filesystem::path& path,
+                            const std::vector<unsigned char>& pixels,
+                            uint32_t width,
+                            uint32_t height)
+{
+    std::error_code error;
+    if (path.has_parent_path())
+        std::filesystem::create_directories(path.parent_path(), error);
+
+    int stride = static_cast<int>(width * kBytesPerTexel);
+    if (!stbi_write_png(path.string().c_str(),
+                        static_cast<int>(width),
+                        static_cast<int>(height),
+                        static_cast<int>(kBytesPerTexel),
+                        pixels.data(),
+                        stride))
+    {
+        std::cerr << "Cannot write " << path << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "GpuMemoryTracker.h"
+
+#include <webgpu/webgpu.hpp>
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Saves rendered frames to PNG files without making the frames wait for the
+ * GPU. A frame to capture is copied into one of a few readback buffers at the
+ * end of its command encoder, and the buffer is mapped asynchronously, which
+ * completes a few frames later while rendering goes on. The mapped rows are
+ * then handed to a background thread that removes their padding, reorders
+ * BGRA texels to RGBA and encodes the PNG file. A buffer is unmapped and
+ * reused as soon as its rows are copied out, before the encoding.
+ *
+ * Requests made while every buffer is in use wait for a later frame. Instead
+ * of a file, a request may name a handler, which is given the pixels on the
+ * background thread and takes over from there, e.g. FrameRecorder.
+ */
+class FrameCapture
+{
+public:
+    struct Stats
+    {
+        uint32_t requested       = 0;
+        uint32_t copied          = 0;  // frames copied to a readback buffer
+        uint32_t saved           = 0;
+        uint32_t handedOver      = 0;     // frames given to the handler of their request
+        uint32_t failures        = 0;     // mappings, formats or files that failed
+        uint32_t deferred        = 0;     // frames at which a request found every readback buffer in use
+        uint32_t latencyFrames   = 0;     // between the copy and the mapping of the last capture
+        float encodeMilliseconds = 0.0f;  // of the last PNG, spent by the background thread
+    };
+
+    // RGBA texels, rows without padding
+    struct Frame
+    {
+        std::vector<unsigned char> pixels;
+        uint32_t width  = 0;
+        uint32_t height = 0;
+    };
+    // Called on the background thread, which waits for it, so it should hand the frame over and return
+    using FrameHandler = std::function<void(Frame& frame)>;
+
+    // Readback buffers are allocated through `memory`, which must outlive this
+    void init(wgpu::Device device, GpuMemoryTracker* memory);
+    // Saves the captures in flight first
+    void terminate();
+
+    // Save the next frame given to encodeCopy() to the PNG file at `path`, whose directory is created if needed
+    void request(const std::filesystem::path& path);
+    // Give the next frame given to encodeCopy() to `handler` instead
+    void request(FrameHandler handler);
+    // Whether a requested frame is not copied yet
+    bool pending() const;
+    // Whether a requested frame is not saved yet
+    bool busy() const;
+    // Copies not yet saved or handed over, as of the last update()
+    uint32_t inFlight() const;
+
+    // Copy `texture` for the oldest request, if any; it needs the CopySrc usage and an RGBA8 or BGRA8 format
+    void encodeCopy(wgpu::CommandEncoder encoder, wgpu::Texture texture);
+    // To be called once the command buffer of encodeCopy() is submitted, maps the copy
+    void onSubmitted();
+    // Once per frame: hand the mapped copies to the background thread, and unmap those it is done with
+    void update();
+
+    const Stats& stats() const
+    {
+        return m_stats;
+    }
+
+    static bool writePng(const std::filesystem::path& path,
+                         const std::vector<unsigned char>& pixels,
+                         uint32_t width,
+                         uint32_t height);
+
+private:
+    struct Request
+    {
+        std::filesystem::path path;
+        FrameHandler handler;  // when set, `path` is not used
+    };
+
+    enum class SlotState
+    {
+        Free,
+        Copied,
+        Mapping,
+        Mapped,
+        Encoding,  // rows being copied out by the background thread
+    };
+
+    struct Slot
+    {
+        wgpu::Buffer buffer = nullptr;
+        uint64_t size       = 0;
+        uint32_t width      = 0;
+        uint32_t height     = 0;
+        uint32_t rowBytes   = 0;  // padded to the 256-byte alignment of texture to buffer copies
+        bool bgra           = false;
+        Request request;
+        uint32_t copyFrame = 0;
+        SlotState state    = SlotState::Free;
+        std::unique_ptr<wgpu::BufferMapCallback> mapCallback;
+    };
+
+    struct Job
+    {
+        uint32_t slot               = 0;
+        const unsigned char* texels = nullptr;  // mapped range of the slot
+        uint32_t width              = 0;
+        uint32_t height             = 0;
+        uint32_t rowBytes           = 0;
+        bool bgra                   = false;
+        Request request;
+    };
+
+    struct Result
+    {
+        bool ok            = false;
+        bool handedOver    = false;
+        float milliseconds = 0.0f;
+    };
+
+    bool hasSlotIn(SlotState state) const;
+    void pollDevice();
+    void workerLoop();
+
+private:
+    static constexpr uint32_t kSlotCount = 3;
+
+    wgpu::Device m_device      = nullptr;
+    GpuMemoryTracker* m_memory = nullptr;
+    std::array<Slot, kSlotCount> m_slots;
+    std::deque<Request> m_requests;
+    uint32_t m_frame        = 0;  // update() calls
+    uint32_t m_encodingJobs = 0;  // handed to the background thread, without a result yet
+    Stats m_stats;
+
+    // Shared with the background thread
+    std::thread m_worker;
+    std::mutex m_mutex;
+    std::condition_variable m_wakeCondition;
+    std::deque<Job> m_jobs;
+    std::vector<uint32_t> m_releasedSlots;  // whose rows were copied out
+    std::vector<Result> m_results;
+    bool m_stopping = false;
+};
@@ -0,0 +1,95 @@
+#include "FramePacer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+using Seconds = std::chrono::duration<double>;
+
+void FramePacer::setTargetFps(double fps)
+{
+    m_targetFps   = std::max(fps, 0.0);
+    m_hasDeadline = false;
+}
+
+void FramePacer::waitForNextFrame()
+{
+    m_stats.waitMilliseconds = 0.0f;
+    m_stats.spinMilliseconds = 0.0f;
+    if (m_targetFps <= 0.0)
+        return;
+
+    Clock::duration period      = std::chrono::duration_cast<Clock::duration>(Seconds(1.0 / m_targetFps));
+    Clock::time_point startTime = Clock::now();
+    if (!m_hasDeadline || startTime - m_deadline > period)
+    {
+        // Do not try to catch up with frames that are more than a period late
+        m_deadline    = startTime;
+        m_hasDeadline = true;
+    }
+
+    auto margin                = std::chrono::duration_cast<Clock::duration>(Seconds(m_sleepOvershootSeconds));
+    Clock::time_point wakeTime = m_deadline - margin;
+    if (wakeTime > startTime)
+    {
+        std::this_thread::sleep_until(wakeTime);
+
+        // Grow the margin as soon as the thread wakes up late, shrink it slowly otherwise
+        double overshoot = std::clamp(Seconds(Clock::now() - wakeTime).count(), 0.0, 0.004);
+        if (overshoot > m_sleepOvershootSeconds)
+            m_sleepOvershootSeconds = overshoot;
+        else
+            m_sleepOvershootSeconds = 0.99 * m_sleepOvershootSeconds + 0.01 * overshoot;
+    }
+
+    Clock::time_point spinStartTime = Clock::now();
+    while (Clock::now() < m_deadline)
+    {
+        std::this_thread::yield();
+    }
+
+    Clock::time_point endTime = Clock::now();
+    m_stats.waitMilliseconds  = static_cast<float>(Seconds(endTime - startTime).count() * 1000.0);
+    m_stats.spinMilliseconds  = static_cast<float>(Seconds(endTime - spinStartTime).count() * 1000.0);
+
+    m_deadline += period;
+}
+
+void FramePacer::onPresent()
+{
+    Clock::time_point now = Clock::now();
+    if (m_hasPresented)
+    {
+        m_history[m_historyNext] = static_cast<float>(Seconds(now - m_lastPresent).count() * 1000.0);
+        m_historyNext            = (m_historyNext + 1) % kHistorySize;
+        m_historyCount           = std::min(m_historyCount + 1, kHistorySize);
+        updateStats();
+    }
+    m_lastPresent  = now;
+    m_hasPresented = true;
+}
+
+void FramePacer::updateStats()
+{
+    float sum = 0.0f, minimum = m_history[0], maximum = m_history[0];
+    for (int i = 0; i < m_historyCount; ++i)
+    {
+        sum += m_history[i];
+        minimum = std::min(minimum, m_history[i]);
+        maximum = std::max(maximum, m_history[i]);
+    }
+    float average = sum / m_historyCount;
+
+    float variance = 0.0f;
+    for (int i = 0; i < m_historyCount; ++i)
+    {
+        variance += (m_history[i] - average) * (m_history[i] - average);
+    }
+    variance /= m_historyCount;
+
+    m_stats.fps                 = average > 0.0f ? 1000.0f / average : 0.0f;
+    m_stats.averageMilliseconds = average;
+    m_stats.minMilliseconds     = minimum;
+    m_stats.maxMilliseconds     = maximum;
+    m_stats.jitterMilliseconds  = std::sqrt(variance);
+}
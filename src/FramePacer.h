@@ -0,0 +1,81 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+/**
+ * Limits the frame rate to a target and measures the intervals between
+ * consecutive presents. Waiting happens at the beginning of the frame, before
+ * input is polled, so that the wait does not add to the input latency.
+ * The wait sleeps for most of the remaining time then spins for the last part,
+ * whose length is adapted to how late the OS wakes the thread up.
+ */
+class FramePacer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr int kHistorySize = 120;
+
+    struct Stats
+    {
+        // Over the last kHistorySize presents
+        float fps                 = 0.0f;
+        float averageMilliseconds = 0.0f;
+        float minMilliseconds     = 0.0f;
+        float maxMilliseconds     = 0.0f;
+        float jitterMilliseconds  = 0.0f;  // standard deviation of the intervals
+
+        // Of the last frame
+        float waitMilliseconds = 0.0f;
+        float spinMilliseconds = 0.0f;
+    };
+
+    // A target of 0 disables the limiter
+    void setTargetFps(double fps);
+    double targetFps() const
+    {
+        return m_targetFps;
+    }
+
+    // Block until the next frame is due, called at the beginning of each frame
+    void waitForNextFrame();
+
+    // Record the time of a present, called right after presenting
+    void onPresent();
+
+    const Stats& stats() const
+    {
+        return m_stats;
+    }
+
+    // Present-to-present intervals in milliseconds, oldest first when read from historyOffset()
+    const float* history() const
+    {
+        return m_history.data();
+    }
+    int historyOffset() const
+    {
+        return m_historyNext;
+    }
+
+private:
+    void updateStats();
+
+private:
+    double m_targetFps = 0.0;
+    Clock::time_point m_deadline;
+    bool m_hasDeadline = false;
+
+    // How late sleeping threads have recently been woken up
+    double m_sleepOvershootSeconds = 0.001;
+
+    Clock::time_point m_lastPresent;
+    bool m_hasPresented = false;
+    std::array<float, kHistorySize> m_history {};
+    int m_historyNext  = 0;
+    int m_historyCount = 0;
+
+    Stats m_stats;
+};
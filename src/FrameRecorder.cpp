@@ -0,0 +1,282 @@
+#include "FrameRecorder.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+namespace
+{
+    constexpr char kRleMagic[4]    = {'F', 'R', 'L', 'E'};
+    constexpr uint32_t kRleVersion = 1;
+    // Longest packets of the run-length encoding
+    constexpr size_t kMaxLiteral = 128;
+    constexpr size_t kMaxRun     = 129;
+
+    constexpr size_t kBytesPerTexel = 4;
+
+    void writeUint32(std::ofstream& file, uint32_t value)
+    {
+        file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    // Texels are compared as 32-bit words
+    uint32_t loadTexel(const unsigned char* texels, size_t index)
+    {
+        uint32_t value;
+        std::memcpy(&value, texels + index * kBytesPerTexel, kBytesPerTexel);
+        return value;
+    }
+}  // namespace
+
+void FrameRecorder::init(uint32_t queueFrames)
+{
+    m_queue    = std::make_unique<BoundedQueue<Item>>(queueFrames);
+    m_stopping = false;
+    // Mostly compression, a few threads keep up without taking the cores the frames need
+    uint32_t threadCount = std::clamp(std::thread::hardware_concurrency() / 4, 1u, 4u);
+    for (uint32_t i = 0; i < threadCount; ++i)
+    {
+        m_encoders.emplace_back([this]() { encoderLoop(); });
+    }
+
+    m_stats                = Stats();
+    m_stats.queueCapacity  = static_cast<uint32_t>(m_queue->capacity());
+    m_stats.encoderThreads = threadCount;
+    m_rateStart            = std::chrono::steady_clock::now();
+    m_rateBytes            = 0;
+}
+
+void FrameRecorder::terminate()
+{
+    stop();
+    m_stopping = true;
+    m_wakeCondition.notify_all();
+    for (std::thread& encoder : m_encoders)
+    {
+        encoder.join();
+    }
+    m_encoders.clear();
+    m_queue.reset();
+}
+
+bool FrameRecorder::start(const std::filesystem::path& directory, Format format)
+{
+    stop();
+
+    // Named after the start time, so that recordings are never mixed
+    auto now          = std::chrono::system_clock::now().time_since_epoch();
+    long long seconds = std::chrono::duration_cast<std::chrono::seconds>(now).count();
+    std::string name  = "recording-" + std::to_string(seconds) + "-" + std::to_string(++m_recordings);
+
+    auto session       = std::make_shared<Session>();
+    session->directory = directory / name;
+    session->format    = format;
+    std::error_code error;
+    std::filesystem::create_directories(session->directory, error);
+    if (error)
+    {
+        std::cerr << "Cannot create " << session->directory << ": " << error.message() << std::endl;
+        return false;
+    }
+    if (format == Format::Rle)
+    {
+        session->file.open(session->directory / "frames.rle", std::ios::binary);
+        if (!session->file)
+        {
+            std::cerr << "Cannot write " << session->directory / "frames.rle" << std::endl;
+            return false;
+        }
+        session->file.write(kRleMagic, sizeof(kRleMagic));
+        writeUint32(session->file, kRleVersion);
+    }
+
+    m_session          = session;
+    m_sessionDirectory = session->directory;
+    m_frameNumber      = 0;
+    m_frameInterval    = 1;
+    std::cout << "Recording to " << m_sessionDirectory << std::endl;
+    return true;
+}
+
+void FrameRecorder::stop()
+{
+    if (!m_session)
+        return;
+
+    // The session closes once the encoders are done with its last frame
+    m_session.reset();
+    std::cout << "Recording stopped after " << m_frameNumber << " frames" << std::endl;
+}
+
+void FrameRecorder::setOverflow(Overflow overflow)
+{
+    m_overflow      = overflow;
+    m_frameInterval = 1;
+}
+
+void FrameRecorder::captureFrame(FrameCapture& capture)
+{
+    if (!m_session)
+        return;
+
+    uint32_t frameNumber = m_frameNumber++;
+    if (frameNumber % m_frameInterval != 0)
+    {
+        ++m_stats.throttled;
+        return;
+    }
+
+    // Room for the frame once the copies ahead of it have reached the queue as well
+    size_t occupied   = m_queue->size() + capture.inFlight();
+    bool readbackFull = capture.pending();
+    if (readbackFull || occupied >= m_queue->capacity())
+    {
+        if (readbackFull)
+            ++m_stats.droppedReadback;
+        else
+            ++m_queueDrops;
+        if (m_overflow == Overflow::Throttle)
+            m_frameInterval = std::min(m_frameInterval * 2, kMaxFrameInterval);
+        return;
+    }
+    // Back towards the full frame rate once the encoders have caught up
+    if (m_frameInterval > 1 && occupied == 0)
+        m_frameInterval /= 2;
+
+    std::shared_ptr<Session> session = m_session;
+    capture.request([this, session, frameNumber](FrameCapture::Frame& frame) { push(session, frameNumber, frame); });
+    ++m_stats.requested;
+}
+
+void FrameRecorder::update()
+{
+    if (!m_queue)
+        return;
+
+    m_stats.queueDepth    = static_cast<uint32_t>(m_queue->size());
+    m_stats.written       = m_written;
+    m_stats.failures      = m_failures;
+    m_stats.droppedQueue  = m_queueDrops + m_discarded;
+    m_stats.frameInterval = m_frameInterval;
+    m_stats.bytesWritten  = m_bytesWritten;
+
+    auto now      = std::chrono::steady_clock::now();
+    float seconds = std::chrono::duration<float>(now - m_rateStart).count();
+    if (seconds >= 1.0f)
+    {
+        m_stats.megabytesPerSecond = (m_stats.bytesWritten - m_rateBytes) / (1024.0f * 1024.0f) / seconds;
+        m_rateBytes                = m_stats.bytesWritten;
+        m_rateStart                = now;
+    }
+}
+
+void FrameRecorder::push(const std::shared_ptr<Session>& session, uint32_t frameNumber, FrameCapture::Frame& frame)
+{
+    Item item;
+    item.session     = session;
+    item.frameNumber = frameNumber;
+    item.frame       = std::move(frame);
+    if (!m_queue->tryPush(item))
+    {
+        // More frames were in flight than captureFrame() counted, e.g. screenshots
+        ++m_discarded;
+        return;
+    }
+    m_wakeCondition.notify_one();
+}
+
+void FrameRecorder::encoderLoop()
+{
+    Item item;
+    std::vector<unsigned char> encoded;
+    while (true)
+    {
+        if (m_queue->tryPop(item))
+        {
+            if (write(item, encoded))
+                ++m_written;
+            else
+                ++m_failures;
+            // Let go of the pixels and the session
+            item = Item();
+            continue;
+        }
+        if (m_stopping)
+            return;
+
+        // A push between the failed pop and the wait is only noticed after the timeout
+        std::unique_lock<std::mutex> lock(m_wakeMutex);
+        m_wakeCondition.wait_for(lock, std::chrono::milliseconds(5));
+    }
+}
+
+bool FrameRecorder::write(Item& item, std::vector<unsigned char>& encoded)
+{
+    Session& session                 = *item.session;
+    const FrameCapture::Frame& frame = item.frame;
+    if (session.format == Format::Png)
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "frame-%06u.png", item.frameNumber);
+        std::filesystem::path path = session.directory / name;
+        if (!FrameCapture::writePng(path, frame.pixels, frame.width, frame.height))
+            return false;
+
+        std::error_code error;
+        uintmax_t size = std::filesystem::file_size(path, error);
+        if (!error)
+            m_bytesWritten += size;
+        return true;
+    }
+
+    // Encoded outside of the lock, only the writes of the records are serialized
+    encodeRle(frame.pixels, encoded);
+    std::lock_guard<std::mutex> lock(session.fileMutex);
+    writeUint32(session.file, item.frameNumber);
+    writeUint32(session.file, frame.width);
+    writeUint32(session.file, frame.height);
+    writeUint32(session.file, static_cast<uint32_t>(encoded.size()));
+    session.file.write(reinterpret_cast<const char*>(encoded.data()), encoded.size());
+    if (!session.file)
+        return false;
+    m_bytesWritten += 4 * sizeof(uint32_t) + encoded.size();
+    return true;
+}
+
+void FrameRecorder::encodeRle(const std::vector<unsigned char>& pixels, std::vector<unsigned char>& encoded)
+{
+    const unsigned char* texels = pixels.data();
+    size_t count                = pixels.size() / kBytesPerTexel;
+
+    encoded.clear();
+    encoded.reserve(pixels.size() + count / kMaxLiteral + 1);
+    size_t i = 0;
+    while (i < count)
+    {
+        size_t run = 1;
+        while (i + run < count && run < kMaxRun && loadTexel(texels, i + run) == loadTexel(texels, i))
+        {
+            ++run;
+        }
+        if (run > 1)
+        {
+            encoded.push_back(static_cast<unsigned char>(run + 126));
+            encoded.insert(encoded.end(), texels + i * kBytesPerTexel, texels + (i + 1) * kBytesPerTexel);
+            i += run;
+            continue;
+        }
+
+        // Literal texels, up to where a run starts
+        size_t literal = 1;
+        while (i + literal < count && literal < kMaxLiteral
+               && (i + literal + 1 == count || loadTexel(texels, i + literal) != loadTexel(texels, i + literal + 1)))
+        {
+            ++literal;
+        }
+        encoded.push_back(static_cast<unsigned char>(literal - 1));
+        encoded.insert(encoded.end(), texels + i * kBytesPerTexel, texels + (i + literal) * kBytesPerTexel);
+        i += literal;
+    }
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include "BoundedQueue.h"
+#include "FrameCapture.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Records every rendered frame to disk, on top of the readback of a
+ * FrameCapture. Each frame is requested with a handler that moves its pixels
+ * into a bounded lock-free queue, drained by a few encoder threads that write
+ * either one PNG file per frame or run-length encoded frames appended to a
+ * single file. Frames are numbered from the start of the recording and keep
+ * their number on disk, so frames that were not recorded show as gaps.
+ *
+ * The frame loop never waits for the recording. When the queue or the
+ * readback buffers have no room left for a frame, the frame is either dropped
+ * or, with Overflow::Throttle, the recorder also halves its frame rate until
+ * the queue empties again. Both are counted.
+ *
+ * Run-length encoded recordings start with the bytes "FRLE" and a uint32
+ * version, then hold one record per frame, in the order they were encoded:
+ * uint32 frame number, width, height and byte count, then the encoded RGBA
+ * texels. These are packets of a control byte c followed by c + 1 literal
+ * texels when c < 128, or by one texel repeated c - 126 times otherwise.
+ * Integers are in the byte order of the machine.
+ */
+class FrameRecorder
+{
+public:
+    enum class Format
+    {
+        Png,
+        Rle,
+    };
+
+    enum class Overflow
+    {
+        Drop,
+        Throttle,
+    };
+
+    struct Stats
+    {
+        uint32_t queueDepth      = 0;  // frames waiting for an encoder
+        uint32_t queueCapacity   = 0;
+        uint32_t encoderThreads  = 0;
+        uint32_t requested       = 0;  // frames given to the readback
+        uint32_t written         = 0;
+        uint32_t droppedReadback = 0;  // frames skipped while a previous one waited for a readback buffer
+        uint32_t droppedQueue    = 0;  // frames skipped or discarded because the queue was full
+        uint32_t throttled       = 0;  // frames skipped by the reduced frame rate
+        uint32_t failures        = 0;  // frames that could not be written
+        uint32_t frameInterval   = 1;  // 1 in this many frames is recorded
+        uint64_t bytesWritten    = 0;
+        float megabytesPerSecond = 0.0f;  // written over the last second or so
+    };
+
+    // Starts the encoder threads, the queue holds this many frames
+    void init(uint32_t queueFrames = 8);
+    // Writes the frames still queued first, after the FrameCapture that frames were requested from is terminated
+    void terminate();
+
+    // Start recording the next frames into a new directory under `directory`
+    bool start(const std::filesystem::path& directory, Format format);
+    // Frames already requested are still written
+    void stop();
+    bool recording() const
+    {
+        return m_session != nullptr;
+    }
+    const std::filesystem::path& sessionDirectory() const
+    {
+        return m_sessionDirectory;
+    }
+
+    Overflow overflow() const
+    {
+        return m_overflow;
+    }
+    void setOverflow(Overflow overflow);
+
+    // Once per rendered frame while recording, before capture.encodeCopy(): request the frame unless it is dropped
+    void captureFrame(FrameCapture& capture);
+    // Once per frame: refresh the statistics
+    void update();
+
+    const Stats& stats() const
+    {
+        return m_stats;
+    }
+
+private:
+    // Output of one recording, shared with the frames in flight so that it closes after the last one
+    struct Session
+    {
+        std::filesystem::path directory;
+        Format format = Format::Rle;
+        std::mutex fileMutex;
+        std::ofstream file;  // of the run-length encoded frames
+    };
+
+    struct Item
+    {
+        std::shared_ptr<Session> session;
+        uint32_t frameNumber = 0;
+        FrameCapture::Frame frame;
+    };
+
+    void push(const std::shared_ptr<Session>& session, uint32_t frameNumber, FrameCapture::Frame& frame);
+    void encoderLoop();
+    // `encoded` is a buffer of the encoder thread, reused from frame to frame
+    bool write(Item& item, std::vector<unsigned char>& encoded);
+    static void encodeRle(const std::vector<unsigned char>& pixels, std::vector<unsigned char>& encoded);
+
+private:
+    static constexpr uint32_t kMaxFrameInterval = 8;
+
+    std::shared_ptr<Session> m_session;
+    std::filesystem::path m_sessionDirectory;
+    Overflow m_overflow      = Overflow::Drop;
+    uint32_t m_frameNumber   = 0;  // rendered frames since the start of the recording
+    uint32_t m_frameInterval = 1;
+    uint32_t m_recordings    = 0;
+    uint32_t m_queueDrops    = 0;  // frames not requested because the queue was full
+    Stats m_stats;
+    std::chrono::steady_clock::time_point m_rateStart;
+    uint64_t m_rateBytes = 0;
+
+    // Shared with the encoder threads and the background thread of the capture
+    std::unique_ptr<BoundedQueue<Item>> m_queue;
+    std::vector<std::thread> m_encoders;
+    std::mutex m_wakeMutex;  // only to sleep on m_wakeCondition while the queue is empty
+    std::condition_variable m_wakeCondition;
+    std::atomic<bool> m_stopping {false};
+    std::atomic<uint32_t> m_written {0};
+    std::atomic<uint32_t> m_discarded {0};  // handed over but not pushed, the queue was full
+    std::atomic<uint32_t> m_failures {0};
+    std::atomic<uint64_t> m_bytesWritten {0};
+};
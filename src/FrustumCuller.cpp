@@ -0,0 +1,194 @@
+#include "FrustumCuller.h"
+
+#include <chrono>
+#include <cmath>
+
+#if defined(__AVX__)
+    #include <immintrin.h>
+    #define FRUSTUM_CULLER_AVX
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+    #include <xmmintrin.h>
+    #define FRUSTUM_CULLER_SSE
+#endif
+
+void FrustumCuller::setViewProjection(const glm::mat4x4& viewProjection)
+{
+    // Rows of the matrix (glm is column major)
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+    }
+
+    // Gribb/Hartmann extraction, with the near plane at z = 0 in clip space
+    glm::vec4 planes[6] = {
+        rows[3] + rows[0],  // left
+        rows[3] - rows[0],  // right
+        rows[3] + rows[1],  // bottom
+        rows[3] - rows[1],  // top
+        rows[2],            // near
+        rows[3] - rows[2],  // far
+    };
+
+    for (int i = 0; i < kPlaneCount; ++i)
+    {
+        glm::vec4 plane = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        if (i < 6)
+        {
+            float length = glm::length(glm::vec3(planes[i]));
+            plane        = length > 0.0f ? planes[i] / length : plane;
+        }
+        m_planeX[i]    = plane.x;
+        m_planeY[i]    = plane.y;
+        m_planeZ[i]    = plane.z;
+        m_planeW[i]    = plane.w;
+        m_absPlaneX[i] = std::abs(plane.x);
+        m_absPlaneY[i] = std::abs(plane.y);
+        m_absPlaneZ[i] = std::abs(plane.z);
+    }
+}
+
+FrustumCuller::Visibility FrustumCuller::classify(const BoundingBox& box) const
+{
+    return classify(box.min, box.max);
+}
+
+FrustumCuller::Visibility FrustumCuller::classify(const glm::vec3& boxMin, const glm::vec3& boxMax) const
+{
+    // For each plane, d is the signed distance of the center and r the
+    // projected half size of the box: the box is outside if d + r < 0
+    // and fully inside if d - r >= 0.
+    glm::vec3 c = 0.5f * (boxMin + boxMax);
+    glm::vec3 e = 0.5f * (boxMax - boxMin);
+
+#if defined(FRUSTUM_CULLER_AVX)
+    __m256 cx = _mm256_set1_ps(c.x);
+    __m256 cy = _mm256_set1_ps(c.y);
+    __m256 cz = _mm256_set1_ps(c.z);
+    __m256 ex = _mm256_set1_ps(e.x);
+    __m256 ey = _mm256_set1_ps(e.y);
+    __m256 ez = _mm256_set1_ps(e.z);
+
+    __m256 d = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(m_planeX), cx), _mm256_mul_ps(_mm256_load_ps(m_planeY), cy)),
+        _mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(m_planeZ), cz), _mm256_load_ps(m_planeW)));
+    __m256 r = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(m_absPlaneX), ex), _mm256_mul_ps(_mm256_load_ps(m_absPlaneY), ey)),
+        _mm256_mul_ps(_mm256_load_ps(m_absPlaneZ), ez));
+
+    __m256 zero      = _mm256_setzero_ps();
+    int outsideMask  = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_add_ps(d, r), zero, _CMP_LT_OQ));
+    int straddleMask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_sub_ps(d, r), zero, _CMP_LT_OQ));
+#elif defined(FRUSTUM_CULLER_SSE)
+    __m128 cx = _mm_set1_ps(c.x);
+    __m128 cy = _mm_set1_ps(c.y);
+    __m128 cz = _mm_set1_ps(c.z);
+    __m128 ex = _mm_set1_ps(e.x);
+    __m128 ey = _mm_set1_ps(e.y);
+    __m128 ez = _mm_set1_ps(e.z);
+
+    __m128 zero      = _mm_setzero_ps();
+    int outsideMask  = 0;
+    int straddleMask = 0;
+    for (int i = 0; i < kPlaneCount; i += 4)
+    {
+        __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(m_planeX + i), cx), _mm_mul_ps(_mm_load_ps(m_planeY + i), cy)),
+                              _mm_add_ps(_mm_mul_ps(_mm_load_ps(m_planeZ + i), cz), _mm_load_ps(m_planeW + i)));
+        __m128 r = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(_mm_load_ps(m_absPlaneX + i), ex), _mm_mul_ps(_mm_load_ps(m_absPlaneY + i), ey)),
+            _mm_mul_ps(_mm_load_ps(m_absPlaneZ + i), ez));
+        outsideMask |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(d, r), zero));
+        straddleMask |= _mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(d, r), zero));
+    }
+#else
+    int outsideMask  = 0;
+    int straddleMask = 0;
+    for (int i = 0; i < kPlaneCount; ++i)
+    {
+        float d = m_planeX[i] * c.x + m_planeY[i] * c.y + m_planeZ[i] * c.z + m_planeW[i];
+        float r = m_absPlaneX[i] * e.x + m_absPlaneY[i] * e.y + m_absPlaneZ[i] * e.z;
+        outsideMask |= (d + r < 0.0f) ? 1 : 0;
+        straddleMask |= (d - r < 0.0f) ? 1 : 0;
+    }
+#endif
+
+    if (outsideMask != 0)
+        return Visibility::Outside;
+    return straddleMask != 0 ? Visibility::Intersecting : Visibility::Inside;
+}
+
+void FrustumCuller::cull(const Bvh& bvh, std::vector<uint32_t>& visibleObjects)
+{
+    auto startTime = std::chrono::steady_clock::now();
+
+    visibleObjects.clear();
+    m_stats = Stats();
+
+    const std::vector<Bvh::Node>& nodes           = bvh.nodes();
+    const std::vector<uint32_t>& slotObjects      = bvh.slotObjects();
+    const std::vector<BoundingBox>& slotBounds    = bvh.slotBounds();
+    const std::vector<Bvh::SlotRange>& slotRanges = bvh.slotRanges();
+
+    if (!nodes.empty())
+    {
+        m_stack.clear();
+        m_stack.push_back(0);
+        while (!m_stack.empty())
+        {
+            uint32_t nodeIndex = m_stack.back();
+            m_stack.pop_back();
+            const Bvh::Node& node = nodes[nodeIndex];
+            ++m_stats.nodesVisited;
+
+            Visibility visibility = classify(node.boundsMin, node.boundsMax);
+            if (visibility == Visibility::Outside)
+                continue;
+
+            if (visibility == Visibility::Inside)
+            {
+                // The whole subtree is visible, its objects occupy a contiguous range of slots
+                const Bvh::SlotRange& range = slotRanges[nodeIndex];
+                visibleObjects.insert(visibleObjects.end(),
+                                      slotObjects.begin() + range.first,
+                                      slotObjects.begin() + range.first + range.count);
+            }
+            else if (node.isLeaf())
+            {
+                for (uint32_t slot = node.leftFirst; slot < node.leftFirst + node.count; ++slot)
+                {
+                    if (classify(slotBounds[slot]) != Visibility::Outside)
+                        visibleObjects.push_back(slotObjects[slot]);
+                }
+            }
+            else
+            {
+                m_stack.push_back(node.leftFirst + 1);
+                m_stack.push_back(node.leftFirst);
+            }
+        }
+    }
+
+    m_stats.visible = static_cast<uint32_t>(visibleObjects.size());
+    m_stats.culled  = static_cast<uint32_t>(bvh.objectCount()) - m_stats.visible;
+    m_stats.microseconds =
+        std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void FrustumCuller::cullBruteForce(const std::vector<BoundingBox>& objectBounds, std::vector<uint32_t>& visibleObjects)
+{
+    auto startTime = std::chrono::steady_clock::now();
+
+    visibleObjects.clear();
+    m_stats = Stats();
+
+    for (uint32_t i = 0; i < static_cast<uint32_t>(objectBounds.size()); ++i)
+    {
+        if (classify(objectBounds[i]) != Visibility::Outside)
+            visibleObjects.push_back(i);
+    }
+
+    m_stats.visible = static_cast<uint32_t>(visibleObjects.size());
+    m_stats.culled  = static_cast<uint32_t>(objectBounds.size()) - m_stats.visible;
+    m_stats.microseconds =
+        std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - startTime).count();
+}
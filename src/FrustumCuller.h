@@ -0,0 +1,66 @@
+#pragma once
+
+#include "BoundingBox.h"
+#include "Bvh.h"
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Tests bounding boxes against the six planes of a view frustum.
+ * The planes are stored as a structure of arrays padded to eight entries so
+ * that a box is tested against all of them at once with SSE (two batches of
+ * four planes) or AVX (one batch of eight planes) when available.
+ */
+class FrustumCuller
+{
+public:
+    enum class Visibility
+    {
+        Outside,
+        Intersecting,
+        Inside,
+    };
+
+    struct Stats
+    {
+        uint32_t visible      = 0;
+        uint32_t culled       = 0;
+        uint32_t nodesVisited = 0;
+        float microseconds    = 0.0f;
+    };
+
+    // Extract the frustum planes from a view-projection matrix whose depth range is [0, 1]
+    void setViewProjection(const glm::mat4x4& viewProjection);
+
+    Visibility classify(const BoundingBox& box) const;
+
+    // Replace the content of `visibleObjects` by the objects of `bvh` that are not fully outside
+    void cull(const Bvh& bvh, std::vector<uint32_t>& visibleObjects);
+
+    // Same result as cull(), testing every object without the hierarchy (used as a reference)
+    void cullBruteForce(const std::vector<BoundingBox>& objectBounds, std::vector<uint32_t>& visibleObjects);
+
+    const Stats& stats() const
+    {
+        return m_stats;
+    }
+
+private:
+    Visibility classify(const glm::vec3& boxMin, const glm::vec3& boxMax) const;
+
+private:
+    static constexpr int kPlaneCount = 8;  // 6 planes, padded with planes that contain everything
+
+    alignas(32) float m_planeX[kPlaneCount];
+    alignas(32) float m_planeY[kPlaneCount];
+    alignas(32) float m_planeZ[kPlaneCount];
+    alignas(32) float m_planeW[kPlaneCount];
+    // Absolute values of the plane normals, used to project the box extent
+    alignas(32) float m_absPlaneX[kPlaneCount];
+    alignas(32) float m_absPlaneY[kPlaneCount];
+    alignas(32) float m_absPlaneZ[kPlaneCount];
+
+    Stats m_stats;
+    std::vector<uint32_t> m_stack;
+};
@@ -0,0 +1,214 @@
+#include "GpuMemoryTracker.h"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace wgpu;
+
+namespace
+{
+    constexpr double kMebibyte = 1024.0 * 1024.0;
+
+    uint32_t bytesPerTexel(TextureFormat format)
+    {
+        switch (format)
+        {
+            case TextureFormat::R8Unorm:
+            case TextureFormat::Stencil8:
+                return 1;
+            case TextureFormat::RG8Unorm:
+            case TextureFormat::R16Float:
+            case TextureFormat::Depth16Unorm:
+                return 2;
+            case TextureFormat::RGBA16Float:
+            case TextureFormat::RG32Float:
+            case TextureFormat::Depth32FloatStencil8:
+                return 8;
+            case TextureFormat::RGBA32Float:
+                return 16;
+            default:
+                // 8-bit RGBA and BGRA, 32-bit single channels and 24-bit depth with or without stencil
+                return 4;
+        }
+    }
+}  // namespace
+
+void GpuMemoryTracker::setBudget(uint64_t bytes)
+{
+    m_budget = bytes;
+}
+
+bool GpuMemoryTracker::fits(uint64_t bytes)
+{
+    if (m_budget == 0 || m_stats.bytes + bytes <= m_budget)
+        return true;
+    ++m_stats.refusals;
+    return false;
+}
+
+Buffer GpuMemoryTracker::createBuffer(Device device, const BufferDescriptor& desc, Category category)
+{
+    Buffer buffer = device.createBuffer(desc);
+    if (buffer)
+    {
+        Allocation allocation;
+        allocation.label    = desc.label ? desc.label : "Buffer";
+        allocation.category = category;
+        allocation.bytes    = desc.size;
+        add(buffer, std::move(allocation));
+    }
+    return buffer;
+}
+
+Texture GpuMemoryTracker::createTexture(Device device, const TextureDescriptor& desc, Category category)
+{
+    Texture texture = device.createTexture(desc);
+    if (texture)
+    {
+        Allocation allocation;
+        allocation.label    = desc.label ? desc.label : "Texture";
+        allocation.category = category;
+        allocation.bytes    = textureBytes(desc);
+        add(texture, std::move(allocation));
+    }
+    return texture;
+}
+
+void GpuMemoryTracker::destroy(Buffer& buffer)
+{
+    if (!buffer)
+        return;
+    untrack(buffer);
+    buffer.destroy();
+    buffer.release();
+    buffer = nullptr;
+}
+
+void GpuMemoryTracker::destroy(Texture& texture)
+{
+    if (!texture)
+        return;
+    untrack(texture);
+    texture.destroy();
+    texture.release();
+    texture = nullptr;
+}
+
+void GpuMemoryTracker::track(const void* key, uint64_t bytes, Category category, const std::string& label)
+{
+    untrack(key);
+    Allocation allocation;
+    allocation.label    = label;
+    allocation.category = category;
+    allocation.bytes    = bytes;
+    add(key, std::move(allocation));
+}
+
+void GpuMemoryTracker::untrack(const void* key)
+{
+    auto it = m_allocations.find(key);
+    if (it == m_allocations.end())
+        return;
+
+    CategoryStats& category = m_categories[static_cast<size_t>(it->second.category)];
+    category.bytes -= it->second.bytes;
+    --category.allocations;
+    m_stats.bytes -= it->second.bytes;
+    --m_stats.allocations;
+    m_allocations.erase(it);
+}
+
+uint64_t GpuMemoryTracker::textureBytes(const TextureDescriptor& desc)
+{
+    // Array layers are the depth of 2D textures
+    uint64_t bytes = 0;
+    for (uint32_t level = 0; level < desc.mipLevelCount; ++level)
+    {
+        uint64_t width  = std::max(desc.size.width >> level, 1u);
+        uint64_t height = std::max(desc.size.height >> level, 1u);
+        uint64_t depth  = desc.dimension == TextureDimension::_3D ? std::max(desc.size.depthOrArrayLayers >> level, 1u)
+                                                                  : desc.size.depthOrArrayLayers;
+        bytes += width * height * depth * bytesPerTexel(desc.format);
+    }
+    return bytes * desc.sampleCount;
+}
+
+const char* GpuMemoryTracker::categoryName(Category category)
+{
+    switch (category)
+    {
+        case Category::Geometry:
+            return "geometry";
+        case Category::Uniforms:
+            return "uniforms";
+        case Category::Storage:
+            return "storage";
+        case Category::Textures:
+            return "textures";
+        case Category::RenderTargets:
+            return "renderTargets";
+        case Category::ShadowMaps:
+            return "shadowMaps";
+        case Category::Gui:
+            return "gui";
+        case Category::Staging:
+            return "staging";
+        default:
+            return "unknown";
+    }
+}
+
+std::vector<GpuMemoryTracker::Allocation> GpuMemoryTracker::largest(size_t count) const
+{
+    std::vector<Allocation> allocations;
+    allocations.reserve(m_allocations.size());
+    for (const auto& [key, allocation] : m_allocations)
+    {
+        allocations.push_back(allocation);
+    }
+    count = std::min(count, allocations.size());
+    std::partial_sort(allocations.begin(),
+                      allocations.begin() + count,
+                      allocations.end(),
+                      [](const Allocation& a, const Allocation& b)
+                      {
+                          return a.bytes > b.bytes;
+                      });
+    allocations.resize(count);
+    return allocations;
+}
+
+void GpuMemoryTracker::writeJson(std::ostream& out) const
+{
+    out << "{\"budgetBytes\": " << m_budget << ", \"bytes\": " << m_stats.bytes
+        << ", \"peakBytes\": " << m_stats.peakBytes << ", \"budgetWarnings\": " << m_stats.budgetWarnings
+        << ", \"categories\": {";
+    for (size_t index = 0; index < m_categories.size(); ++index)
+    {
+        const CategoryStats& category = m_categories[index];
+        out << (index > 0 ? ", " : "") << "\"" << categoryName(static_cast<Category>(index))
+            << "\": {\"bytes\": " << category.bytes << ", \"peakBytes\": " << category.peakBytes
+            << ", \"allocations\": " << category.allocations << "}";
+    }
+    out << "}}";
+}
+
+void GpuMemoryTracker::add(const void* key, Allocation allocation)
+{
+    CategoryStats& category = m_categories[static_cast<size_t>(allocation.category)];
+    category.bytes += allocation.bytes;
+    category.peakBytes = std::max(category.peakBytes, category.bytes);
+    ++category.allocations;
+    m_stats.bytes += allocation.bytes;
+    m_stats.peakBytes = std::max(m_stats.peakBytes, m_stats.bytes);
+    ++m_stats.allocations;
+
+    if (m_budget > 0 && m_stats.bytes > m_budget)
+    {
+        ++m_stats.budgetWarnings;
+        std::cerr << "GPU memory budget exceeded by " << allocation.label << " (" << categoryName(allocation.category)
+                  << ", " << allocation.bytes / kMebibyte << " MiB): " << m_stats.bytes / kMebibyte << " of "
+                  << m_budget / kMebibyte << " MiB" << std::endl;
+    }
+    m_allocations[key] = std::move(allocation);
+}
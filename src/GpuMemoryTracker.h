@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <webgpu/webgpu.hpp>
+
+/**
+ * Accounts for the device memory of the buffers and textures of the
+ * application. Resources are created and destroyed through the tracker,
+ * which records their size, category and label, and keeps running totals
+ * and high-water marks per category. Memory allocated out of its reach, e.g.
+ * by the ImGui backend, is reported with track(). Sizes are estimated from
+ * the descriptors, drivers may add alignment and metadata on top.
+ *
+ * A budget can be set: allocations going over it are still made, since the
+ * application cannot run without them, but each one is reported as a
+ * warning. Caches and pools that can do without memory ask fits() first.
+ */
+class GpuMemoryTracker
+{
+public:
+    enum class Category
+    {
+        Geometry,
+        Uniforms,
+        Storage,
+        Textures,
+        RenderTargets,
+        ShadowMaps,
+        Gui,
+        Staging,
+        Count,
+    };
+
+    struct Allocation
+    {
+        std::string label;
+        Category category = Category::Geometry;
+        uint64_t bytes    = 0;
+    };
+
+    struct CategoryStats
+    {
+        uint64_t bytes       = 0;
+        uint64_t peakBytes   = 0;
+        uint32_t allocations = 0;
+    };
+
+    struct Stats
+    {
+        uint64_t bytes          = 0;
+        uint64_t peakBytes      = 0;
+        uint32_t allocations    = 0;
+        uint32_t budgetWarnings = 0;  // allocations made over the budget
+        uint32_t refusals       = 0;  // calls to fits() that answered no
+    };
+
+    // 0 for no budget
+    void setBudget(uint64_t bytes);
+    uint64_t budget() const
+    {
+        return m_budget;
+    }
+    // Whether `bytes` more would keep the tracked memory within the budget, counted as a refusal otherwise
+    bool fits(uint64_t bytes);
+
+    wgpu::Buffer createBuffer(wgpu::Device device, const wgpu::BufferDescriptor& desc, Category category);
+    wgpu::Texture createTexture(wgpu::Device device, const wgpu::TextureDescriptor& desc, Category category);
+    // Stop tracking, destroy and release
+    void destroy(wgpu::Buffer& buffer);
+    void destroy(wgpu::Texture& texture);
+
+    // Memory allocated elsewhere, identified by any address; tracking a key again replaces its size
+    void track(const void* key, uint64_t bytes, Category category, const std::string& label);
+    void untrack(const void* key);
+
+    // Size of a texture with all its mip levels and layers
+    static uint64_t textureBytes(const wgpu::TextureDescriptor& desc);
+    static const char* categoryName(Category category);
+
+    const Stats& stats() const
+    {
+        return m_stats;
+    }
+    const CategoryStats& categoryStats(Category category) const
+    {
+        return m_categories[static_cast<size_t>(category)];
+    }
+    // The `count` largest allocations, largest first
+    std::vector<Allocation> largest(size_t count) const;
+
+    // A JSON object with the totals and the categories, for the benchmark reports
+    void writeJson(std::ostream& out) const;
+
+private:
+    void add(const void* key, Allocation allocation);
+
+private:
+    uint64_t m_budget = 0;
+    std::unordered_map<const void*, Allocation> m_allocations;
+    std::array<CategoryStats, static_cast<size_t>(Category::Count)> m_categories;
+    Stats m_stats;
+};
@@ -0,0 +1,107 @@
+#include "GuiCache.h"
+
+#include <imgui.h>
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+    constexpr uint64_t kPrime = 1099511628211ull;
+
+    // FNV-1a over 64-bit words rather than bytes, the draw data easily weighs a few hundred kilobytes
+    void hashBytes(uint64_t& hash, const void* data, size_t size)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        size_t offset              = 0;
+        for (; offset + sizeof(uint64_t) <= size; offset += sizeof(uint64_t))
+        {
+            uint64_t word;
+            std::memcpy(&word, bytes + offset, sizeof(word));
+            hash = (hash ^ word) * kPrime;
+        }
+        for (; offset < size; ++offset)
+        {
+            hash = (hash ^ bytes[offset]) * kPrime;
+        }
+    }
+
+    template <typename T>
+    void hashValue(uint64_t& hash, const T& value)
+    {
+        hashBytes(hash, &value, sizeof(value));
+    }
+}  // namespace
+
+void GuiCache::invalidate()
+{
+    m_valid = false;
+}
+
+bool GuiCache::update(const ImDrawData& drawData)
+{
+    auto startTime = std::chrono::steady_clock::now();
+    uint64_t hash  = signature(drawData);
+    m_stats.hashMicroseconds =
+        std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - startTime).count();
+
+    if (m_valid && hash == m_signature)
+    {
+        ++m_stats.reuses;
+        return false;
+    }
+    m_signature = hash;
+    m_valid     = true;
+    ++m_stats.renders;
+    return true;
+}
+
+void GuiCache::beginFrame(bool throttled)
+{
+    auto now     = std::chrono::steady_clock::now();
+    m_refreshing = !throttled || now - m_lastRefresh >= kRefreshInterval;
+    if (m_refreshing)
+        m_lastRefresh = now;
+}
+
+void GuiCache::text(const char* format, ...)
+{
+    std::string& text = m_texts[ImGui::GetID(format)];
+    if (m_refreshing || text.empty())
+    {
+        char buffer[256];
+        va_list args;
+        va_start(args, format);
+        std::vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+        text = buffer;
+    }
+    ImGui::TextUnformatted(text.c_str());
+}
+
+uint64_t GuiCache::signature(const ImDrawData& drawData)
+{
+    uint64_t hash = 14695981039346656037ull;
+    hashValue(hash, drawData.DisplayPos);
+    hashValue(hash, drawData.DisplaySize);
+    hashValue(hash, drawData.FramebufferScale);
+    for (int list = 0; list < drawData.CmdListsCount; ++list)
+    {
+        const ImDrawList* drawList = drawData.CmdLists[list];
+        hashBytes(hash, drawList->VtxBuffer.Data, drawList->VtxBuffer.Size * sizeof(ImDrawVert));
+        hashBytes(hash, drawList->IdxBuffer.Data, drawList->IdxBuffer.Size * sizeof(ImDrawIdx));
+        for (const ImDrawCmd& command : drawList->CmdBuffer)
+        {
+            // Fields one by one, the padding of the structure is not initialized
+            hashValue(hash, command.ClipRect);
+            hashValue(hash, command.GetTexID());
+            hashValue(hash, command.VtxOffset);
+            hashValue(hash, command.IdxOffset);
+            hashValue(hash, command.ElemCount);
+            hashValue(hash, command.UserCallback);
+            hashValue(hash, command.UserCallbackData);
+        }
+    }
+    return hash;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <imgui.h>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+/**
+ * Decides when the GUI overlay must be rendered again. The draw data of each
+ * frame is reduced to a signature of its geometry, clip rectangles, textures
+ * and callbacks, and the overlay rendered last is reused as long as the
+ * signature does not change. Hashing costs a fraction of uploading and
+ * drawing the data, but anything animated in the GUI (a plot, a counter)
+ * changes the signature at every frame. The content of the textures shown by
+ * the GUI is not part of the signature.
+ *
+ * Figures that change at every frame, e.g. timings and frame counters, are
+ * shown through text(). While the overlay is cached they are only formatted
+ * again a few times per second, and repeated as they were in between, so
+ * that the overlay is reused at the other frames.
+ */
+class GuiCache
+{
+public:
+    struct Stats
+    {
+        uint32_t renders       = 0;
+        uint32_t reuses        = 0;
+        float hashMicroseconds = 0.0f;  // of the last frame
+    };
+
+    // Have the overlay rendered at the next update, e.g. when its target was reallocated
+    void invalidate();
+
+    // Whether the draw data differs from the one of the overlay, which is considered up to date afterwards
+    bool update(const ImDrawData& drawData);
+
+    const Stats& stats() const
+    {
+        return m_stats;
+    }
+
+    // Once per frame before the GUI is built, figures are refreshed at every frame unless `throttled`
+    void beginFrame(bool throttled);
+    // Whether figures are refreshed at this frame, e.g. to take a snapshot of a plot
+    bool refreshing() const
+    {
+        return m_refreshing;
+    }
+    // ImGui::Text() of figures that change at every frame, the format must be unique within its window
+    void text(const char* format, ...) IM_FMTARGS(2);
+
+    static uint64_t signature(const ImDrawData& drawData);
+
+private:
+    static constexpr std::chrono::milliseconds kRefreshInterval {250};
+
+    uint64_t m_signature = 0;
+    bool m_valid         = false;
+    Stats m_stats;
+
+    bool m_refreshing = true;
+    std::chrono::steady_clock::time_point m_lastRefresh;
+    std::unordered_map<ImGuiID, std::string> m_texts;  // as last refreshed, by ID of their format
+};
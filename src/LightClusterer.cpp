@@ -0,0 +1,244 @@
+#include "LightClusterer.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+
+#if defined(__AVX__)
+    #include <immintrin.h>
+    #define LIGHT_CLUSTERER_AVX
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+    #include <xmmintrin.h>
+    #define LIGHT_CLUSTERER_SSE
+#endif
+
+static_assert(LightClusterer::kGridX % 8 == 0, "rows of froxels are tested by batches of eight");
+
+void LightClusterer::setProjection(const glm::mat4x4& projection, float cameraNear, float cameraFar)
+{
+    m_scaleX     = projection[0][0];
+    m_scaleY     = projection[1][1];
+    m_cameraNear = cameraNear;
+    m_cameraFar  = cameraFar;
+
+    // Slice k covers [kClusterNear * ratio^k, kClusterNear * ratio^(k+1)], except for the first one that starts at
+    // the near plane and the last one that ends at the far plane
+    float logRange = std::log(cameraFar / kClusterNear);
+    m_sliceScale   = static_cast<float>(kGridZ) / logRange;
+    m_sliceBias    = static_cast<float>(kGridZ) * std::log(kClusterNear) / logRange;
+
+    auto sliceDepth = [&](uint32_t k)
+    {
+        if (k == 0)
+            return cameraNear;
+        if (k == kGridZ)
+            return cameraFar;
+        return kClusterNear * std::pow(cameraFar / kClusterNear, static_cast<float>(k) / kGridZ);
+    };
+
+    m_froxelMinX.resize(kClusterCount);
+    m_froxelMinY.resize(kClusterCount);
+    m_froxelMinZ.resize(kClusterCount);
+    m_froxelMaxX.resize(kClusterCount);
+    m_froxelMaxY.resize(kClusterCount);
+    m_froxelMaxZ.resize(kClusterCount);
+
+    for (uint32_t z = 0; z < kGridZ; ++z)
+    {
+        float zNear = sliceDepth(z);
+        float zFar  = sliceDepth(z + 1);
+        for (uint32_t y = 0; y < kGridY; ++y)
+        {
+            // Row 0 is at the top of the screen, where y is 1 in normalized device coordinates
+            float top    = 1.0f - 2.0f * y / kGridY;
+            float bottom = 1.0f - 2.0f * (y + 1) / kGridY;
+            for (uint32_t x = 0; x < kGridX; ++x)
+            {
+                float left  = -1.0f + 2.0f * x / kGridX;
+                float right = -1.0f + 2.0f * (x + 1) / kGridX;
+
+                // The sides of a froxel are planes through the eye, its extent is reached at one of the slice ends
+                uint32_t i      = (z * kGridY + y) * kGridX + x;
+                m_froxelMinX[i] = std::min(left * zNear, left * zFar) / m_scaleX;
+                m_froxelMaxX[i] = std::max(right * zNear, right * zFar) / m_scaleX;
+                m_froxelMinY[i] = std::min(bottom * zNear, bottom * zFar) / m_scaleY;
+                m_froxelMaxY[i] = std::max(top * zNear, top * zFar) / m_scaleY;
+                m_froxelMinZ[i] = zNear;
+                m_froxelMaxZ[i] = zFar;
+            }
+        }
+    }
+}
+
+uint32_t LightClusterer::slice(float viewDepth) const
+{
+    float k = std::floor(std::log(std::max(viewDepth, 1e-6f)) * m_sliceScale - m_sliceBias);
+    return static_cast<uint32_t>(std::clamp(k, 0.0f, static_cast<float>(kGridZ - 1)));
+}
+
+uint32_t LightClusterer::testRow(uint32_t first, const glm::vec3& center, float radius) const
+{
+    // Squared distance from the center of the sphere to the box, compared to the squared radius
+    uint32_t mask = 0;
+#if defined(LIGHT_CLUSTERER_AVX)
+    __m256 cx   = _mm256_set1_ps(center.x);
+    __m256 cy   = _mm256_set1_ps(center.y);
+    __m256 cz   = _mm256_set1_ps(center.z);
+    __m256 r2   = _mm256_set1_ps(radius * radius);
+    __m256 zero = _mm256_setzero_ps();
+    for (uint32_t x = 0; x < kGridX; x += 8)
+    {
+        const uint32_t i = first + x;
+        __m256 dx        = _mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(&m_froxelMinX[i]), cx),
+                                  _mm256_sub_ps(cx, _mm256_loadu_ps(&m_froxelMaxX[i])));
+        __m256 dy        = _mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(&m_froxelMinY[i]), cy),
+                                  _mm256_sub_ps(cy, _mm256_loadu_ps(&m_froxelMaxY[i])));
+        __m256 dz        = _mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(&m_froxelMinZ[i]), cz),
+                                  _mm256_sub_ps(cz, _mm256_loadu_ps(&m_froxelMaxZ[i])));
+        dx               = _mm256_max_ps(dx, zero);
+        dy               = _mm256_max_ps(dy, zero);
+        dz               = _mm256_max_ps(dz, zero);
+        __m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+        mask |= static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(d2, r2, _CMP_LE_OQ))) << x;
+    }
+#elif defined(LIGHT_CLUSTERER_SSE)
+    __m128 cx   = _mm_set1_ps(center.x);
+    __m128 cy   = _mm_set1_ps(center.y);
+    __m128 cz   = _mm_set1_ps(center.z);
+    __m128 r2   = _mm_set1_ps(radius * radius);
+    __m128 zero = _mm_setzero_ps();
+    for (uint32_t x = 0; x < kGridX; x += 4)
+    {
+        const uint32_t i = first + x;
+        __m128 dx =
+            _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&m_froxelMinX[i]), cx), _mm_sub_ps(cx, _mm_loadu_ps(&m_froxelMaxX[i])));
+        __m128 dy =
+            _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&m_froxelMinY[i]), cy), _mm_sub_ps(cy, _mm_loadu_ps(&m_froxelMaxY[i])));
+        __m128 dz =
+            _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&m_froxelMinZ[i]), cz), _mm_sub_ps(cz, _mm_loadu_ps(&m_froxelMaxZ[i])));
+        dx        = _mm_max_ps(dx, zero);
+        dy        = _mm_max_ps(dy, zero);
+        dz        = _mm_max_ps(dz, zero);
+        __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        mask |= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(d2, r2))) << x;
+    }
+#else
+    for (uint32_t x = 0; x < kGridX; ++x)
+    {
+        const uint32_t i = first + x;
+        float dx         = std::max(0.0f, std::max(m_froxelMinX[i] - center.x, center.x - m_froxelMaxX[i]));
+        float dy         = std::max(0.0f, std::max(m_froxelMinY[i] - center.y, center.y - m_froxelMaxY[i]));
+        float dz         = std::max(0.0f, std::max(m_froxelMinZ[i] - center.z, center.z - m_froxelMaxZ[i]));
+        if (dx * dx + dy * dy + dz * dz <= radius * radius)
+            mask |= 1u << x;
+    }
+#endif
+    return mask;
+}
+
+void LightClusterer::assign(const std::vector<Light>& lights, const glm::mat4x4& view)
+{
+    auto startTime = std::chrono::steady_clock::now();
+
+    m_stats        = Stats();
+    m_stats.lights = static_cast<uint32_t>(std::min<size_t>(lights.size(), kMaxLights));
+    m_pairClusters.clear();
+    m_pairLights.clear();
+
+    if (!m_froxelMinX.empty())
+    {
+        for (uint32_t lightIndex = 0; lightIndex < m_stats.lights; ++lightIndex)
+        {
+            const Light& light = lights[lightIndex];
+            float radius       = light.positionRange.w;
+            glm::vec3 center   = glm::vec3(view * glm::vec4(glm::vec3(light.positionRange), 1.0f));
+            if (radius <= 0.0f || center.z + radius < m_cameraNear || center.z - radius > m_cameraFar)
+                continue;
+
+            uint32_t z0 = slice(center.z - radius);
+            uint32_t z1 = slice(center.z + radius);
+
+            // Tiles covered by the projection of the bounding box of the sphere, whose extremes are at its corners
+            uint32_t x0 = 0, x1 = kGridX - 1;
+            uint32_t y0 = 0, y1 = kGridY - 1;
+            if (center.z - radius > m_cameraNear)
+            {
+                float minX = FLT_MAX, maxX = -FLT_MAX, minY = FLT_MAX, maxY = -FLT_MAX;
+                for (float depth : {center.z - radius, center.z + radius})
+                {
+                    for (float sign : {-1.0f, 1.0f})
+                    {
+                        float ndcX = (center.x + sign * radius) * m_scaleX / depth;
+                        float ndcY = (center.y + sign * radius) * m_scaleY / depth;
+                        minX       = std::min(minX, ndcX);
+                        maxX       = std::max(maxX, ndcX);
+                        minY       = std::min(minY, ndcY);
+                        maxY       = std::max(maxY, ndcY);
+                    }
+                }
+                if (maxX < -1.0f || minX > 1.0f || maxY < -1.0f || minY > 1.0f)
+                    continue;
+
+                auto tile = [](float t, uint32_t count)
+                {
+                    return static_cast<uint32_t>(std::clamp(t * count, 0.0f, static_cast<float>(count - 1)));
+                };
+                x0 = tile(0.5f * (minX + 1.0f), kGridX);
+                x1 = tile(0.5f * (maxX + 1.0f), kGridX);
+                y0 = tile(0.5f * (1.0f - maxY), kGridY);
+                y1 = tile(0.5f * (1.0f - minY), kGridY);
+            }
+            uint32_t rangeMask = ((1u << (x1 + 1)) - 1) & ~((1u << x0) - 1);
+
+            for (uint32_t z = z0; z <= z1; ++z)
+            {
+                for (uint32_t y = y0; y <= y1; ++y)
+                {
+                    uint32_t first = (z * kGridY + y) * kGridX;
+                    uint32_t mask  = testRow(first, center, radius) & rangeMask;
+                    while (mask != 0)
+                    {
+                        uint32_t x = 0;
+                        while ((mask & (1u << x)) == 0)
+                            ++x;
+                        mask &= mask - 1;
+                        m_pairClusters.push_back(first + x);
+                        m_pairLights.push_back(lightIndex);
+                    }
+                }
+            }
+        }
+    }
+
+    // Counting sort of the overlaps by cluster, the lights of a cluster staying in increasing order
+    m_clusters.assign(kClusterCount, Cluster{0, 0});
+    for (uint32_t cluster : m_pairClusters)
+    {
+        ++m_clusters[cluster].count;
+    }
+    uint32_t offset = 0;
+    for (Cluster& cluster : m_clusters)
+    {
+        cluster.offset = offset;
+        uint32_t count = std::min(cluster.count, kMaxLightIndices - offset);
+        m_stats.dropped += cluster.count - count;
+        m_stats.maxPerCluster = std::max(m_stats.maxPerCluster, count);
+        cluster.count         = count;
+        offset += count;
+    }
+    m_stats.indices = offset;
+
+    m_lightIndices.resize(offset);
+    m_clusterFill.assign(kClusterCount, 0);
+    for (size_t i = 0; i < m_pairClusters.size(); ++i)
+    {
+        const Cluster& cluster = m_clusters[m_pairClusters[i]];
+        uint32_t& fill         = m_clusterFill[m_pairClusters[i]];
+        if (fill < cluster.count)
+            m_lightIndices[cluster.offset + fill++] = m_pairLights[i];
+    }
+
+    m_stats.microseconds =
+        std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - startTime).count();
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Assigns point and spot lights to the cells ("froxels") of a grid that
+ * divides the view frustum into screen space tiles and depth slices. The
+ * slices are exponentially distributed in view depth so that froxels are
+ * roughly cubic. Each light is tested against the froxels overlapped by the
+ * screen space bounds of its sphere of influence, a row of froxels at a time
+ * with SSE or AVX when available. The shader finds the froxel of a fragment
+ * from its position and only loops over the lights listed for it.
+ */
+class LightClusterer
+{
+public:
+    static constexpr uint32_t kGridX           = 16;
+    static constexpr uint32_t kGridY           = 9;
+    static constexpr uint32_t kGridZ           = 24;
+    static constexpr uint32_t kClusterCount    = kGridX * kGridY * kGridZ;
+    static constexpr uint32_t kMaxLights       = 1024;
+    static constexpr uint32_t kMaxLightIndices = kClusterCount * 64;
+    static constexpr float kClusterNear        = 0.1f;  // end of the first slice, which starts at the camera
+
+    /**
+     * A light as stored in the storage buffer read by the shader
+     */
+    struct Light
+    {
+        glm::vec4 positionRange;      // world position, distance at which the light fades out
+        glm::vec4 colorIntensity;     // color, intensity
+        glm::vec4 directionCosOuter;  // spot axis, cosine of the outer cone angle (-2 for point lights)
+        glm::vec4 cosInner;           // cosine of the inner cone angle (-1 for point lights)
+    };
+    static_assert(sizeof(Light) % 16 == 0);
+
+    // Range of lightIndices() holding the lights of a froxel
+    struct Cluster
+    {
+        uint32_t offset;
+        uint32_t count;
+    };
+
+    struct Stats
+    {
+        uint32_t lights        = 0;
+        uint32_t indices       = 0;
+        uint32_t maxPerCluster = 0;
+        uint32_t dropped       = 0;  // assignments that did not fit in kMaxLightIndices
+        float microseconds     = 0.0f;
+    };
+
+    // Compute the bounds of the froxels for a perspective projection, when it changes
+    void setProjection(const glm::mat4x4& projection, float cameraNear, float cameraFar);
+
+    // Fill the clusters with the lights overlapping them
+    void assign(const std::vector<Light>& lights, const glm::mat4x4& view);
+
+    const std::vector<Cluster>& clusters() const
+    {
+        return m_clusters;
+    }
+    const std::vector<uint32_t>& lightIndices() const
+    {
+        return m_lightIndices;
+    }
+
+    // The slice of a view depth z is floor(log(z) * sliceScale - sliceBias)
+    float sliceScale() const
+    {
+        return m_sliceScale;
+    }
+    float sliceBias() const
+    {
+        return m_sliceBias;
+    }
+
+    const Stats& stats() const
+    {
+        return m_stats;
+    }
+
+private:
+    uint32_t slice(float viewDepth) const;
+    // Bit i is set when the sphere overlaps the froxel i of the row starting at `first`
+    uint32_t testRow(uint32_t first, const glm::vec3& center, float radius) const;
+
+private:
+    float m_scaleX     = 1.0f;  // projection[0][0]
+    float m_scaleY     = 1.0f;  // projection[1][1]
+    float m_cameraNear = 0.01f;
+    float m_cameraFar  = 100.0f;
+    float m_sliceScale = 0.0f;
+    float m_sliceBias  = 0.0f;
+
+    // View space bounds of the froxels, x varying fastest
+    std::vector<float> m_froxelMinX, m_froxelMinY, m_froxelMinZ;
+    std::vector<float> m_froxelMaxX, m_froxelMaxY, m_froxelMaxZ;
+
+    // Light/froxel overlaps, sorted by froxel into m_lightIndices
+    std::vector<uint32_t> m_pairClusters;
+    std::vector<uint32_t> m_pairLights;
+    std::vector<uint32_t> m_clusterFill;
+
+    std::vector<Cluster> m_clusters;
+    std::vector<uint32_t> m_lightIndices;
+    Stats m_stats;
+};
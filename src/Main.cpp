@@ -1,9 +1,82 @@
 #include "Application.h"
+#include "Benchmark.h"
 
-int main()
+#include <cctype>
+#include <cstdlib>
+#include <string>
+
+// Consume the number following argv[i] if there is one, or return the default value
+static unsigned long long readCount(int argc, char* argv[], int& i, unsigned long long defaultValue)
+{
+    if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0])))
+        return std::strtoull(argv[++i], nullptr, 10);
+    return defaultValue;
+}
+
+int main(int argc, char* argv[])
 {
+    Application::Options options;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--benchmark-culling")
+        {
+            return Benchmark::runCulling(readCount(argc, argv, i, 1000000));
+        }
+        else if (arg == "--benchmark-encoding")
+        {
+            options.benchmarkEncodingDraws = static_cast<uint32_t>(readCount(argc, argv, i, 10000));
+        }
+        else if (arg == "--present-mode" && i + 1 < argc)
+        {
+            options.presentMode = argv[++i];
+        }
+        else if (arg == "--fps")
+        {
+            options.targetFps = static_cast<double>(readCount(argc, argv, i, 60));
+        }
+        else if (arg == "--on-demand")
+        {
+            options.onDemand = true;
+        }
+        else if (arg == "--dynamic-resolution")
+        {
+            options.dynamicResolutionMilliseconds = static_cast<float>(readCount(argc, argv, i, 16));
+        }
+        else if (arg == "--benchmark-lights")
+        {
+            options.benchmarkLightsMax = static_cast<uint32_t>(readCount(argc, argv, i, 1024));
+        }
+        else if (arg == "--gui-cache")
+        {
+            options.guiCache = true;
+        }
+        else if (arg == "--gpu-budget")
+        {
+            options.gpuBudgetMegabytes = static_cast<uint32_t>(readCount(argc, argv, i, 512));
+        }
+        else if (arg == "--model" && i + 1 < argc)
+        {
+            options.modelPath = argv[++i];
+        }
+        else if (arg == "--vertex-chunk")
+        {
+            options.vertexChunkMegabytes = static_cast<uint32_t>(readCount(argc, argv, i, 64));
+        }
+        else if (arg == "--headless")
+        {
+            options.headlessFrames = static_cast<uint32_t>(readCount(argc, argv, i, 300));
+        }
+        else if (arg == "--record")
+        {
+            options.recordFormat = "rle";
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                options.recordFormat = argv[++i];
+        }
+    }
+
     Application app;
-    if (!app.onInit())
+    if (!app.onInit(options))
         return 1;
 
     while (app.isRunning())
@@ -0,0 +1,74 @@
+#include "PipelineVariants.h"
+
+#include <chrono>
+#include <iostream>
+#include <utility>
+
+using namespace wgpu;
+
+uint32_t PipelineVariants::Key::packed() const
+{
+    return directionalLights | (normalMap ? 1u << 8 : 0u) | (specular ? 1u << 9 : 0u)
+           | (gammaCorrection ? 1u << 10 : 0u) | (overdraw ? 1u << 11 : 0u) | (depthEqual ? 1u << 12 : 0u)
+           | (shadows ? 1u << 13 : 0u) | (blend ? 1u << 14 : 0u);
+}
+
+void PipelineVariants::setBuilder(Builder builder)
+{
+    m_builder = std::move(builder);
+}
+
+RenderPipeline PipelineVariants::get(const Key& key)
+{
+    uint32_t packedKey = key.packed();
+    auto it            = m_pipelines.find(packedKey);
+    if (it != m_pipelines.end())
+    {
+        ++m_stats.hits;
+        return it->second;
+    }
+
+    auto startTime          = std::chrono::steady_clock::now();
+    RenderPipeline pipeline = m_builder(key, constants(key));
+    m_stats.lastCompileMilliseconds =
+        std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    m_stats.compileMilliseconds += m_stats.lastCompileMilliseconds;
+    std::cout << "Pipeline variant 0x" << std::hex << packedKey << std::dec << ": " << pipeline << " ("
+              << m_stats.lastCompileMilliseconds << " ms)" << std::endl;
+
+    // A failed compilation is kept as well, so that it is not attempted again every frame
+    m_pipelines[packedKey] = pipeline;
+    m_stats.variants       = static_cast<uint32_t>(m_pipelines.size());
+    return pipeline;
+}
+
+void PipelineVariants::clear()
+{
+    for (auto& [packedKey, pipeline] : m_pipelines)
+    {
+        if (pipeline)
+            pipeline.release();
+    }
+    m_pipelines.clear();
+    m_stats.variants = 0;
+}
+
+std::vector<ConstantEntry> PipelineVariants::constants(const Key& key)
+{
+    // Names of the override declarations of sample.wgsl
+    std::vector<std::pair<const char*, double>> values = {
+        {"directionalLightCount", static_cast<double>(key.directionalLights)},
+        {"useNormalMap", key.normalMap ? 1.0 : 0.0},
+        {"useSpecular", key.specular ? 1.0 : 0.0},
+        {"gammaCorrection", key.gammaCorrection ? 1.0 : 0.0},
+        {"useShadows", key.shadows ? 1.0 : 0.0},
+    };
+
+    std::vector<ConstantEntry> entries(values.size());
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        entries[i].key   = values[i].first;
+        entries[i].value = values[i].second;
+    }
+    return entries;
+}
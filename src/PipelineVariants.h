@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <webgpu/webgpu.hpp>
+
+/**
+ * Render pipelines of the scene shader, specialized by its override
+ * constants. Features that a material does not use are compiled out of the
+ * variant that draws it, so that it only pays for what it needs. A variant
+ * is compiled the first time its key is requested, then reused until the
+ * cache is cleared, e.g. when the shader is reloaded.
+ */
+class PipelineVariants
+{
+public:
+    struct Key
+    {
+        // Shader features, set through override constants
+        uint32_t directionalLights = 2;
+        bool normalMap             = true;
+        bool specular              = true;
+        bool gammaCorrection       = true;
+        bool shadows               = true;
+
+        // Fixed function states, which depend on the passes rather than on the material
+        bool overdraw   = false;  // additive shading of every fragment
+        bool depthEqual = false;  // after a depth prepass
+        bool blend      = false;  // alpha blending without depth writes, for transparent materials
+
+        uint32_t packed() const;
+    };
+
+    struct Stats
+    {
+        uint32_t variants             = 0;
+        uint32_t hits                 = 0;
+        float compileMilliseconds     = 0.0f;  // total time spent creating pipelines
+        float lastCompileMilliseconds = 0.0f;
+    };
+
+    // Creates the pipeline of a key, given the override constants of its features
+    using Builder =
+        std::function<wgpu::RenderPipeline(const Key& key, const std::vector<wgpu::ConstantEntry>& constants)>;
+
+    void setBuilder(Builder builder);
+
+    // The pipeline of a key, compiled on first use
+    wgpu::RenderPipeline get(const Key& key);
+
+    // Release all the variants, they get compiled again when requested
+    void clear();
+
+    const Stats& stats() const
+    {
+        return m_stats;
+    }
+
+private:
+    static std::vector<wgpu::ConstantEntry> constants(const Key& key);
+
+private:
+    Builder m_builder;
+    std::unordered_map<uint32_t, wgpu::RenderPipeline> m_pipelines;
+    Stats m_stats;
+};
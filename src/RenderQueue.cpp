@@ -0,0 +1,143 @@
+#include "RenderQueue.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+
+namespace
+{
+    constexpr uint32_t kDigitBits   = 8;
+    constexpr uint32_t kDigitCount  = 64 / kDigitBits;
+    constexpr uint32_t kBucketCount = 1u << kDigitBits;
+
+    constexpr uint32_t kPhaseShift   = 63;
+    constexpr uint64_t kDepthMax     = (1ull << RenderQueue::kDepthBits) - 1;
+    constexpr uint32_t kPipelineMask = (1u << RenderQueue::kPipelineBits) - 1;
+    constexpr uint32_t kMaterialMask = (1u << RenderQueue::kMaterialBits) - 1;
+
+    // Opaque: phase | pipeline | material | depth, from the most significant bit
+    constexpr uint32_t kOpaquePipelineShift = kPhaseShift - RenderQueue::kPipelineBits;
+    constexpr uint32_t kOpaqueMaterialShift = kOpaquePipelineShift - RenderQueue::kMaterialBits;
+    constexpr uint32_t kOpaqueDepthShift    = kOpaqueMaterialShift - RenderQueue::kDepthBits;
+
+    // Transparent: phase | inverted depth | pipeline | material
+    constexpr uint32_t kTransparentDepthShift    = kPhaseShift - RenderQueue::kDepthBits;
+    constexpr uint32_t kTransparentPipelineShift = kTransparentDepthShift - RenderQueue::kPipelineBits;
+    constexpr uint32_t kTransparentMaterialShift = kTransparentPipelineShift - RenderQueue::kMaterialBits;
+}  // namespace
+
+RenderQueue::Counters& RenderQueue::Counters::operator+=(const Counters& other)
+{
+    draws += other.draws;
+    pipelineChanges += other.pipelineChanges;
+    materialChanges += other.materialChanges;
+    vertexBufferChanges += other.vertexBufferChanges;
+    return *this;
+}
+
+uint64_t RenderQueue::makeKey(Phase phase, uint32_t pipeline, uint32_t material, float depth)
+{
+    uint64_t quantizedDepth = static_cast<uint64_t>(std::clamp(depth, 0.0f, 1.0f) * kDepthMax);
+    uint64_t key            = static_cast<uint64_t>(phase) << kPhaseShift;
+    if (phase == Phase::Opaque)
+    {
+        key |= static_cast<uint64_t>(pipeline & kPipelineMask) << kOpaquePipelineShift;
+        key |= static_cast<uint64_t>(material & kMaterialMask) << kOpaqueMaterialShift;
+        key |= quantizedDepth << kOpaqueDepthShift;
+    }
+    else
+    {
+        key |= (kDepthMax - quantizedDepth) << kTransparentDepthShift;
+        key |= static_cast<uint64_t>(pipeline & kPipelineMask) << kTransparentPipelineShift;
+        key |= static_cast<uint64_t>(material & kMaterialMask) << kTransparentMaterialShift;
+    }
+    return key;
+}
+
+RenderQueue::Phase RenderQueue::phase(uint64_t key)
+{
+    return static_cast<Phase>(key >> kPhaseShift);
+}
+
+uint32_t RenderQueue::pipeline(uint64_t key)
+{
+    uint32_t shift = phase(key) == Phase::Opaque ? kOpaquePipelineShift : kTransparentPipelineShift;
+    return static_cast<uint32_t>(key >> shift) & kPipelineMask;
+}
+
+uint32_t RenderQueue::material(uint64_t key)
+{
+    uint32_t shift = phase(key) == Phase::Opaque ? kOpaqueMaterialShift : kTransparentMaterialShift;
+    return static_cast<uint32_t>(key >> shift) & kMaterialMask;
+}
+
+uint64_t RenderQueue::withoutDepth(uint64_t key)
+{
+    uint32_t shift = phase(key) == Phase::Opaque ? kOpaqueDepthShift : kTransparentDepthShift;
+    return key & ~(kDepthMax << shift);
+}
+
+void RenderQueue::clear()
+{
+    m_items.clear();
+    m_stats.items       = 0;
+    m_stats.opaqueItems = 0;
+}
+
+void RenderQueue::push(uint64_t key, uint32_t object)
+{
+    m_items.push_back({key, object});
+}
+
+void RenderQueue::sort()
+{
+    auto startTime = std::chrono::steady_clock::now();
+    size_t count   = m_items.size();
+
+    // The histograms of all the digits are gathered in a single read of the keys
+    std::array<std::array<uint32_t, kBucketCount>, kDigitCount> histograms {};
+    for (const Item& item : m_items)
+    {
+        for (uint32_t digit = 0; digit < kDigitCount; ++digit)
+        {
+            ++histograms[digit][(item.key >> (digit * kDigitBits)) & (kBucketCount - 1)];
+        }
+    }
+
+    // Each pass is stable, so that draws with the same key keep the order in which they were pushed
+    m_scratch.resize(count);
+    m_stats.radixPasses = 0;
+    for (uint32_t digit = 0; digit < kDigitCount; ++digit)
+    {
+        std::array<uint32_t, kBucketCount>& histogram = histograms[digit];
+        uint32_t shift                                = digit * kDigitBits;
+        if (count == 0 || histogram[(m_items[0].key >> shift) & (kBucketCount - 1)] == count)
+            continue;
+
+        uint32_t offset = 0;
+        for (uint32_t& bucket : histogram)
+        {
+            uint32_t bucketCount = bucket;
+            bucket               = offset;
+            offset += bucketCount;
+        }
+        for (const Item& item : m_items)
+        {
+            m_scratch[histogram[(item.key >> shift) & (kBucketCount - 1)]++] = item;
+        }
+        m_items.swap(m_scratch);
+        ++m_stats.radixPasses;
+    }
+
+    m_stats.items       = static_cast<uint32_t>(count);
+    m_stats.opaqueItems = static_cast<uint32_t>(
+        std::partition_point(m_items.begin(),
+                             m_items.end(),
+                             [](const Item& item)
+                             {
+                                 return phase(item.key) == Phase::Opaque;
+                             })
+        - m_items.begin());
+    m_stats.sortMicroseconds =
+        std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - startTime).count();
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Draws of a frame, ordered by 64-bit sort keys so that the draws sharing a
+ * pipeline and a material are consecutive and state only changes on key
+ * transitions. Opaque draws come first, front to back so that the depth test
+ * rejects hidden fragments early, then transparent draws, back to front so
+ * that they blend correctly. Keys are sorted with a least significant digit
+ * radix sort, which skips the digits shared by all the keys.
+ */
+class RenderQueue
+{
+public:
+    enum class Phase : uint32_t
+    {
+        Opaque      = 0,
+        Transparent = 1,
+    };
+
+    static constexpr uint32_t kPipelineBits = 4;
+    static constexpr uint32_t kMaterialBits = 16;
+    static constexpr uint32_t kDepthBits    = 24;
+
+    struct Item
+    {
+        uint64_t key;
+        uint32_t object;
+
+        bool operator==(const Item& other) const
+        {
+            return key == other.key && object == other.object;
+        }
+    };
+
+    // Commands emitted while encoding a range of the queue
+    struct Counters
+    {
+        uint32_t draws               = 0;
+        uint32_t pipelineChanges     = 0;
+        uint32_t materialChanges     = 0;
+        uint32_t vertexBufferChanges = 0;  // chunks of the geometry
+
+        Counters& operator+=(const Counters& other);
+    };
+
+    struct Stats
+    {
+        uint32_t items         = 0;
+        uint32_t opaqueItems   = 0;
+        uint32_t radixPasses   = 0;  // digits that were not shared by all the keys
+        float sortMicroseconds = 0.0f;
+    };
+
+    // Opaque keys are ordered by pipeline, material then depth, transparent keys by decreasing depth first
+    // The depth is normalized to [0, 1], pipeline and material are truncated to their number of bits.
+    static uint64_t makeKey(Phase phase, uint32_t pipeline, uint32_t material, float depth);
+    static Phase phase(uint64_t key);
+    static uint32_t pipeline(uint64_t key);
+    static uint32_t material(uint64_t key);
+    // The same key with its depth cleared, which only depends on the draw state and not on the view
+    static uint64_t withoutDepth(uint64_t key);
+
+    void clear();
+    void push(uint64_t key, uint32_t object);
+    void sort();
+
+    // Sorted by sort(), the items of the opaque phase come first
+    const std::vector<Item>& items() const
+    {
+        return m_items;
+    }
+    size_t opaqueCount() const
+    {
+        return m_stats.opaqueItems;
+    }
+
+    const Stats& stats() const
+    {
+        return m_stats;
+    }
+
+private:
+    std::vector<Item> m_items;
+    std::vector<Item> m_scratch;  // destination of the odd radix passes
+    Stats m_stats;
+};
@@ -0,0 +1,112 @@
+#include "RenderTargetPool.h"
+
+#include <iterator>
+
+using namespace wgpu;
+
+void RenderTargetPool::init(Device device, GpuMemoryTracker* memory)
+{
+    m_device = device;
+    m_memory = memory;
+}
+
+void RenderTargetPool::terminate()
+{
+    for (Target& target : m_pooled)
+    {
+        destroy(target);
+    }
+    m_pooled.clear();
+    m_stats.pooled = 0;
+}
+
+RenderTargetPool::Target RenderTargetPool::acquire(uint32_t width,
+                                                   uint32_t height,
+                                                   TextureFormat format,
+                                                   TextureUsageFlags usage,
+                                                   bool exactSize,
+                                                   const char* label)
+{
+    if (!exactSize)
+    {
+        width  = (width + kBucketSize - 1) / kBucketSize * kBucketSize;
+        height = (height + kBucketSize - 1) / kBucketSize * kBucketSize;
+    }
+
+    // Most recently released first, it is the most likely to be asked for again
+    for (auto it = m_pooled.rbegin(); it != m_pooled.rend(); ++it)
+    {
+        if (it->width == width && it->height == height && it->format == format && it->usage == usage)
+        {
+            Target target = *it;
+            m_pooled.erase(std::next(it).base());
+            m_stats.pooled = static_cast<uint32_t>(m_pooled.size());
+            ++m_stats.reuses;
+            return target;
+        }
+    }
+
+    Target target;
+    target.width  = width;
+    target.height = height;
+    target.format = format;
+    target.usage  = usage;
+
+    TextureDescriptor textureDesc;
+    textureDesc.label           = label;
+    textureDesc.dimension       = TextureDimension::_2D;
+    textureDesc.format          = format;
+    textureDesc.mipLevelCount   = 1;
+    textureDesc.sampleCount     = 1;
+    textureDesc.size            = {width, height, 1};
+    textureDesc.usage           = usage;
+    textureDesc.viewFormatCount = 0;
+    textureDesc.viewFormats     = nullptr;
+
+    // Pooled targets are only a cache, they are the first to go when memory runs short
+    while (!m_pooled.empty() && !m_memory->fits(GpuMemoryTracker::textureBytes(textureDesc)))
+    {
+        destroy(m_pooled.front());
+        m_pooled.erase(m_pooled.begin());
+        m_stats.pooled = static_cast<uint32_t>(m_pooled.size());
+        ++m_stats.evictions;
+    }
+    target.texture = m_memory->createTexture(m_device, textureDesc, GpuMemoryTracker::Category::RenderTargets);
+
+    TextureViewDescriptor viewDesc;
+    viewDesc.label           = label;
+    viewDesc.aspect          = TextureAspect::All;
+    viewDesc.baseArrayLayer  = 0;
+    viewDesc.arrayLayerCount = 1;
+    viewDesc.baseMipLevel    = 0;
+    viewDesc.mipLevelCount   = 1;
+    viewDesc.dimension       = TextureViewDimension::_2D;
+    viewDesc.format          = format;
+    target.view              = target.texture.createView(viewDesc);
+
+    ++m_stats.allocations;
+    return target;
+}
+
+void RenderTargetPool::release(Target& target)
+{
+    if (!target.texture)
+        return;
+
+    if (m_pooled.size() == kMaxPooledTargets)
+    {
+        destroy(m_pooled.front());
+        m_pooled.erase(m_pooled.begin());
+        ++m_stats.evictions;
+    }
+    m_pooled.push_back(target);
+    m_stats.pooled = static_cast<uint32_t>(m_pooled.size());
+
+    target = Target();
+}
+
+void RenderTargetPool::destroy(Target& target)
+{
+    target.view.release();
+    m_memory->destroy(target.texture);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "GpuMemoryTracker.h"
+
+#include <cstdint>
+#include <vector>
+#include <webgpu/webgpu.hpp>
+
+/**
+ * Keeps released render targets around so that they can be handed out again
+ * instead of allocating new textures, e.g. when a window shrinks then grows
+ * back. Targets attached next to the swap chain texture must have its exact
+ * size, other targets may be rounded up to a bucket size and rendered to a
+ * sub-rectangle, which lets close sizes share the same texture.
+ */
+class RenderTargetPool
+{
+public:
+    struct Target
+    {
+        wgpu::Texture texture  = nullptr;
+        wgpu::TextureView view = nullptr;
+        // Size of the texture, which may be larger than requested when not exact
+        uint32_t width                = 0;
+        uint32_t height               = 0;
+        wgpu::TextureFormat format    = wgpu::TextureFormat::Undefined;
+        wgpu::TextureUsageFlags usage = wgpu::TextureUsage::None;
+    };
+
+    struct Stats
+    {
+        uint32_t allocations = 0;
+        uint32_t reuses      = 0;
+        uint32_t evictions   = 0;
+        uint32_t pooled      = 0;  // targets currently waiting to be reused
+    };
+
+    // Targets are allocated through `memory`, which must outlive the pool
+    void init(wgpu::Device device, GpuMemoryTracker* memory);
+    // Destroy the pooled targets, those still acquired must have been released before
+    void terminate();
+
+    Target acquire(uint32_t width,
+                   uint32_t height,
+                   wgpu::TextureFormat format,
+                   wgpu::TextureUsageFlags usage,
+                   bool exactSize,
+                   const char* label);
+    // Give a target back to the pool and reset it
+    void release(Target& target);
+
+    const Stats& stats() const
+    {
+        return m_stats;
+    }
+
+private:
+    void destroy(Target& target);
+
+private:
+    static constexpr uint32_t kBucketSize     = 128;
+    static constexpr size_t kMaxPooledTargets = 8;
+
+    wgpu::Device m_device      = nullptr;
+    GpuMemoryTracker* m_memory = nullptr;
+    std::vector<Target> m_pooled;  // least recently released first
+    Stats m_stats;
+};
@@ -0,0 +1,47 @@
+#include "ResolutionController.h"
+
+#include <algorithm>
+#include <cmath>
+
+void ResolutionController::reset()
+{
+    m_scale               = m_settings.maxScale;
+    m_averageMilliseconds = 0.0f;
+    m_cooldown            = 0;
+}
+
+float ResolutionController::update(float frameMilliseconds)
+{
+    if (m_averageMilliseconds <= 0.0f)
+        m_averageMilliseconds = frameMilliseconds;
+    else
+        m_averageMilliseconds += m_settings.smoothing * (frameMilliseconds - m_averageMilliseconds);
+
+    float scale = std::clamp(m_scale, m_settings.minScale, m_settings.maxScale);
+    if (m_cooldown > 0)
+    {
+        --m_cooldown;
+    }
+    else if (m_averageMilliseconds > 0.0f)
+    {
+        float target     = m_settings.targetMilliseconds;
+        bool overBudget  = m_averageMilliseconds > target;
+        bool hasHeadroom = m_averageMilliseconds < target * (1.0f - m_settings.deadband);
+        if (overBudget || hasHeadroom)
+        {
+            // Aim at the middle of the deadband rather than at its edge, so that the next measure lands in it
+            float aim     = target * (1.0f - 0.5f * m_settings.deadband);
+            float desired = scale * std::sqrt(aim / m_averageMilliseconds);
+            desired       = std::clamp(desired, scale - m_settings.maxStep, scale + m_settings.maxStep);
+            scale         = std::clamp(desired, m_settings.minScale, m_settings.maxScale);
+        }
+    }
+
+    if (scale != m_scale)
+    {
+        m_scale    = scale;
+        m_cooldown = m_settings.cooldownFrames;
+        ++m_adjustments;
+    }
+    return m_scale;
+}
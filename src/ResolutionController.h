@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Picks the resolution scale of the scene from measured frame times.
+ * The cost of a frame is assumed to grow with the number of pixels, i.e.
+ * with the square of the scale, which gives the scale that would hit the
+ * target. To avoid oscillations, the scale only goes down when over budget
+ * and up when below the budget by more than a deadband, by bounded steps,
+ * and waits for a few frames after each change so that the measures reflect
+ * the new scale before deciding again.
+ */
+class ResolutionController
+{
+public:
+    struct Settings
+    {
+        float targetMilliseconds = 16.0f;
+        float minScale           = 0.5f;
+        float maxScale           = 1.0f;
+        float deadband           = 0.15f;  // relative headroom needed before raising the scale
+        float maxStep            = 0.05f;  // largest change of scale per adjustment
+        int cooldownFrames       = 15;
+        float smoothing          = 0.1f;  // weight of a new measure in the running average
+    };
+
+    Settings& settings()
+    {
+        return m_settings;
+    }
+
+    // Go back to the maximum scale and forget the measures
+    void reset();
+
+    // Feed the time of the last frame and return the scale to use
+    float update(float frameMilliseconds);
+
+    float scale() const
+    {
+        return m_scale;
+    }
+    float averageMilliseconds() const
+    {
+        return m_averageMilliseconds;
+    }
+    uint32_t adjustments() const
+    {
+        return m_adjustments;
+    }
+
+private:
+    Settings m_settings;
+
+    float m_scale               = 1.0f;
+    float m_averageMilliseconds = 0.0f;
+    int m_cooldown              = 0;
+    uint32_t m_adjustments      = 0;
+};
@@ -3,28 +3,26 @@
 #include <stb_image.h>
 #include <tiny_obj_loader.h>
 
-#include <cstring>
+#include <algorithm>
 #include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
 
 using namespace wgpu;
 
-ShaderModule ResourceManager::loadShaderModule(const path& path, Device device)
+ShaderModule ResourceManager::loadShaderModule(const path& path, Device device, ShaderPreprocessor& preprocessor)
 {
-    std::ifstream file(path);
-    if (!file.is_open())
+    std::shared_ptr<const ShaderPreprocessor::Result> source = preprocessor.preprocess(path);
+    if (!source->ok)
     {
         return nullptr;
     }
-    file.seekg(0, std::ios::end);
-    size_t size = file.tellg();
-    std::string shaderSource(size, ' ');
-    file.seekg(0);
-    file.read(shaderSource.data(), size);
 
     ShaderModuleWGSLDescriptor shaderCodeDesc;
     shaderCodeDesc.chain.next  = nullptr;
     shaderCodeDesc.chain.sType = SType::ShaderModuleWGSLDescriptor;
-    shaderCodeDesc.code        = shaderSource.c_str();
+    shaderCodeDesc.code        = source->source.c_str();
     ShaderModuleDescriptor shaderDesc;
     shaderDesc.nextInChain = &shaderCodeDesc.chain;
 #ifdef WEBGPU_BACKEND_WGPU
@@ -32,20 +30,45 @@ ShaderModule ResourceManager::loadShaderModule(const path& path, Device device)
     shaderDesc.hints     = nullptr;
 #endif
 
-    return device.createShaderModule(shaderDesc);
+    // Catch the compilation errors, which refer to the lines of the expanded source
+    device.pushErrorScope(ErrorFilter::Validation);
+    ShaderModule shaderModule = device.createShaderModule(shaderDesc);
+    auto* context             = new std::shared_ptr<const ShaderPreprocessor::Result>(source);
+    wgpuDevicePopErrorScope(
+        device,
+        [](WGPUErrorType type, char const* message, void* userdata)
+        {
+            auto* result = static_cast<std::shared_ptr<const ShaderPreprocessor::Result>*>(userdata);
+            if (type != WGPUErrorType_NoError && message)
+                std::cerr << "Shader error: " << (*result)->remapMessage(message) << std::endl;
+            delete result;
+        },
+        context);
+
+    return shaderModule;
 }
 
-bool ResourceManager::loadGeometryFromObj(const path& path, std::vector<VertexAttributes>& vertexData)
+bool ResourceManager::loadGeometryFromObj(const path& path,
+                                          std::vector<VertexAttributes>& vertexData,
+                                          std::vector<Submesh>* submeshes,
+                                          std::vector<Material>* materials)
 {
     tinyobj::attrib_t attrib;
     std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
+    std::vector<tinyobj::material_t> objMaterials;
 
     std::string warn;
     std::string err;
 
-    // Call the core loading procedure of TinyOBJLoader
-    bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, path.string().c_str());
+    // Call the core loading procedure of TinyOBJLoader, the .mtl library is next to the .obj file
+    std::string baseDirectory = path.parent_path().string() + "/";
+    bool ret                  = tinyobj::LoadObj(&attrib,
+                                                 &shapes,
+                                                 &objMaterials,
+                                                 &warn,
+                                                 &err,
+                                                 path.string().c_str(),
+                                                 baseDirectory.c_str());
 
     // Check errors
     if (!warn.empty())
@@ -63,31 +86,118 @@ bool ResourceManager::loadGeometryFromObj(const path& path, std::vector<VertexAt
         return false;
     }
 
-    // Filling in vertexData:
+    // Faces without material, or with an unknown one, use a default material appended after the others
+    uint32_t defaultMaterial = static_cast<uint32_t>(objMaterials.size());
+    bool usesDefault         = false;
+    auto faceMaterial        = [&](const tinyobj::shape_t& shape, size_t face)
+    {
+        int id = face < shape.mesh.material_ids.size() ? shape.mesh.material_ids[face] : -1;
+        if (id < 0 || id >= static_cast<int>(objMaterials.size()))
+        {
+            usesDefault = true;
+            return defaultMaterial;
+        }
+        return static_cast<uint32_t>(id);
+    };
+
+    // Filling in vertexData, one contiguous range per shape and material:
     vertexData.clear();
+    if (submeshes)
+    {
+        submeshes->clear();
+    }
     for (const auto& shape : shapes)
     {
-        size_t offset = vertexData.size();
-        vertexData.resize(offset + shape.mesh.indices.size());
+        // Faces are triangles, LoadObj triangulates the polygons; they are bucketed by material in a single pass
+        size_t faceCount = shape.mesh.indices.size() / 3;
+        std::map<uint32_t, std::vector<size_t>> facesByMaterial;
+        for (size_t face = 0; face < faceCount; ++face)
+        {
+            facesByMaterial[faceMaterial(shape, face)].push_back(face);
+        }
 
-        for (size_t i = 0; i < shape.mesh.indices.size(); ++i)
+        for (const auto& [material, faces] : facesByMaterial)
         {
-            const tinyobj::index_t& idx = shape.mesh.indices[i];
+            size_t offset = vertexData.size();
+            for (size_t face : faces)
+            {
+                for (size_t corner = 0; corner < 3; ++corner)
+                {
+                    const tinyobj::index_t& idx = shape.mesh.indices[3 * face + corner];
+                    VertexAttributes vertex;
+
+                    vertex.position = {attrib.vertices[3 * idx.vertex_index + 0],
+                                       -attrib.vertices[3 * idx.vertex_index + 2],
+                                       attrib.vertices[3 * idx.vertex_index + 1]};
+
+                    vertex.normal = {attrib.normals[3 * idx.normal_index + 0],
+                                     -attrib.normals[3 * idx.normal_index + 2],
+                                     attrib.normals[3 * idx.normal_index + 1]};
+
+                    vertex.color = {attrib.colors[3 * idx.vertex_index + 0],
+                                    attrib.colors[3 * idx.vertex_index + 1],
+                                    attrib.colors[3 * idx.vertex_index + 2]};
 
-            vertexData[offset + i].position = {attrib.vertices[3 * idx.vertex_index + 0],
-                                               -attrib.vertices[3 * idx.vertex_index + 2],
-                                               attrib.vertices[3 * idx.vertex_index + 1]};
+                    vertex.uv = {attrib.texcoords[2 * idx.texcoord_index + 0],
+                                 1 - attrib.texcoords[2 * idx.texcoord_index + 1]};
 
-            vertexData[offset + i].normal = {attrib.normals[3 * idx.normal_index + 0],
-                                             -attrib.normals[3 * idx.normal_index + 2],
-                                             attrib.normals[3 * idx.normal_index + 1]};
+                    vertexData.push_back(vertex);
+                }
+            }
+
+            if (submeshes)
+            {
+                Submesh submesh;
+                submesh.name = shape.name;
+                if (facesByMaterial.size() > 1 && material != defaultMaterial)
+                {
+                    submesh.name += "/" + objMaterials[material].name;
+                }
+                submesh.firstVertex = static_cast<uint32_t>(offset);
+                submesh.vertexCount = static_cast<uint32_t>(vertexData.size() - offset);
+                submesh.material    = material;
+                for (size_t i = offset; i < vertexData.size(); ++i)
+                {
+                    submesh.bounds.extend(vertexData[i].position);
+                }
+                submeshes->push_back(std::move(submesh));
+            }
+        }
+    }
 
-            vertexData[offset + i].color = {attrib.colors[3 * idx.vertex_index + 0],
-                                            attrib.colors[3 * idx.vertex_index + 1],
-                                            attrib.colors[3 * idx.vertex_index + 2]};
+    if (materials)
+    {
+        materials->clear();
+        for (const tinyobj::material_t& objMaterial : objMaterials)
+        {
+            Material material;
+            material.name      = objMaterial.name;
+            material.diffuse   = {objMaterial.diffuse[0], objMaterial.diffuse[1], objMaterial.diffuse[2]};
+            material.specular  = {objMaterial.specular[0], objMaterial.specular[1], objMaterial.specular[2]};
+            material.shininess = objMaterial.shininess;
+            material.opacity   = objMaterial.dissolve;
+            if (!objMaterial.diffuse_texname.empty())
+            {
+                material.diffuseTexture = path.parent_path() / objMaterial.diffuse_texname;
+            }
+            // Exporters write normal maps as bump maps as often as with the dedicated statement
+            bool bumpAsNormal                = objMaterial.normal_texname.empty();
+            const std::string& normalTexture = bumpAsNormal ? objMaterial.bump_texname : objMaterial.normal_texname;
+            if (!normalTexture.empty())
+            {
+                const tinyobj::texture_option_t& options =
+                    bumpAsNormal ? objMaterial.bump_texopt : objMaterial.normal_texopt;
 
-            vertexData[offset + i].uv = {attrib.texcoords[2 * idx.texcoord_index + 0],
-                                         1 - attrib.texcoords[2 * idx.texcoord_index + 1]};
+                material.normalTexture  = path.parent_path() / normalTexture;
+                material.normalStrength = options.bump_multiplier;
+            }
+            materials->push_back(std::move(material));
+        }
+        if (usesDefault)
+        {
+            Material material;
+            material.name = "default";
+            materials->push_back(std::move(material));
         }
     }
 
@@ -96,19 +206,87 @@ bool ResourceManager::loadGeometryFromObj(const path& path, std::vector<VertexAt
     return true;
 }
 
-// Auxiliary function for loadTexture
-static void writeMipMaps(Device device,
+uint32_t ResourceManager::splitIntoChunks(const std::vector<VertexAttributes>& vertexData,
+                                         uint32_t chunkVertices,
+                                         std::vector<Submesh>& submeshes)
+{
+    // Whole triangles only, a draw cannot span two vertex buffers
+    chunkVertices = std::max(chunkVertices / 3 * 3, 3u);
+
+    std::vector<Submesh> pieces;
+    pieces.reserve(submeshes.size());
+    for (Submesh& submesh : submeshes)
+    {
+        uint32_t first = submesh.firstVertex;
+        uint32_t end   = submesh.firstVertex + submesh.vertexCount;
+        if (first / chunkVertices == (end - 1) / chunkVertices)
+        {
+            submesh.chunk = first / chunkVertices;
+            submesh.firstVertex -= submesh.chunk * chunkVertices;
+            pieces.push_back(std::move(submesh));
+            continue;
+        }
+
+        for (uint32_t part = 0; first < end; ++part)
+        {
+            Submesh piece;
+            piece.chunk       = first / chunkVertices;
+            piece.name        = submesh.name + "#" + std::to_string(part);
+            piece.material    = submesh.material;
+            piece.firstVertex = first - piece.chunk * chunkVertices;
+            piece.vertexCount = std::min(end, (piece.chunk + 1) * chunkVertices) - first;
+            for (uint32_t i = first; i < first + piece.vertexCount; ++i)
+            {
+                piece.bounds.extend(vertexData[i].position);
+            }
+            first += piece.vertexCount;
+            pieces.push_back(std::move(piece));
+        }
+    }
+    submeshes = std::move(pieces);
+
+    return static_cast<uint32_t>((vertexData.size() + chunkVertices - 1) / chunkVertices);
+}
+
+// Auxiliary function for writeMipMaps and loadTextureLevels, averages 2x2 blocks of 8-bit RGBA pixels
+static std::vector<unsigned char> downsample(const std::vector<unsigned char>& previousLevelPixels,
+                                             uint32_t previousWidth,
+                                             uint32_t width,
+                                             uint32_t height)
+{
+    std::vector<unsigned char> pixels(4 * width * height);
+    for (uint32_t i = 0; i < width; ++i)
+    {
+        for (uint32_t j = 0; j < height; ++j)
+        {
+            unsigned char* p = &pixels[4 * (j * width + i)];
+            // Get the corresponding 4 pixels from the previous level
+            const unsigned char* p00 = &previousLevelPixels[4 * ((2 * j + 0) * previousWidth + (2 * i + 0))];
+            const unsigned char* p01 = &previousLevelPixels[4 * ((2 * j + 0) * previousWidth + (2 * i + 1))];
+            const unsigned char* p10 = &previousLevelPixels[4 * ((2 * j + 1) * previousWidth + (2 * i + 0))];
+            const unsigned char* p11 = &previousLevelPixels[4 * ((2 * j + 1) * previousWidth + (2 * i + 1))];
+            // Average
+            p[0] = (p00[0] + p01[0] + p10[0] + p11[0]) / 4;
+            p[1] = (p00[1] + p01[1] + p10[1] + p11[1]) / 4;
+            p[2] = (p00[2] + p01[2] + p10[2] + p11[2]) / 4;
+            p[3] = (p00[3] + p01[3] + p10[3] + p11[3]) / 4;
+        }
+    }
+    return pixels;
+}
+
+// Auxiliary function for loadTexture and loadTextureLayer
+static void writeMipMaps(UploadManager& uploads,
                          Texture texture,
                          Extent3D textureSize,
                          uint32_t mipLevelCount,
-                         const unsigned char* pixelData)
+                         const unsigned char* pixelData,
+                         uint32_t layer = 0)
 {
-    Queue queue = device.getQueue();
-
     // Arguments telling which part of the texture we upload to
     ImageCopyTexture destination;
     destination.texture = texture;
-    destination.origin  = {0, 0, 0};
+    destination.origin  = {0, 0, layer};
     destination.aspect  = TextureAspect::All;
 
     // Arguments telling how the C++ side pixel memory is laid out
@@ -122,52 +300,31 @@ static void writeMipMaps(Device device,
     for (uint32_t level = 0; level < mipLevelCount; ++level)
     {
         // Pixel data for the current level
-        std::vector<unsigned char> pixels(4 * mipLevelSize.width * mipLevelSize.height);
+        std::vector<unsigned char> pixels;
         if (level == 0)
         {
             // We cannot really avoid this copy since we need this
             // in previousLevelPixels at the next iteration
-            memcpy(pixels.data(), pixelData, pixels.size());
+            pixels.assign(pixelData, pixelData + 4 * mipLevelSize.width * mipLevelSize.height);
         }
         else
         {
             // Create mip level data
-            for (uint32_t i = 0; i < mipLevelSize.width; ++i)
-            {
-                for (uint32_t j = 0; j < mipLevelSize.height; ++j)
-                {
-                    unsigned char* p = &pixels[4 * (j * mipLevelSize.width + i)];
-                    // Get the corresponding 4 pixels from the previous level
-                    unsigned char* p00 =
-                        &previousLevelPixels[4 * ((2 * j + 0) * previousMipLevelSize.width + (2 * i + 0))];
-                    unsigned char* p01 =
-                        &previousLevelPixels[4 * ((2 * j + 0) * previousMipLevelSize.width + (2 * i + 1))];
-                    unsigned char* p10 =
-                        &previousLevelPixels[4 * ((2 * j + 1) * previousMipLevelSize.width + (2 * i + 0))];
-                    unsigned char* p11 =
-                        &previousLevelPixels[4 * ((2 * j + 1) * previousMipLevelSize.width + (2 * i + 1))];
-                    // Average
-                    p[0] = (p00[0] + p01[0] + p10[0] + p11[0]) / 4;
-                    p[1] = (p00[1] + p01[1] + p10[1] + p11[1]) / 4;
-                    p[2] = (p00[2] + p01[2] + p10[2] + p11[2]) / 4;
-                    p[3] = (p00[3] + p01[3] + p10[3] + p11[3]) / 4;
-                }
-            }
+            pixels = downsample(
+                previousLevelPixels, previousMipLevelSize.width, mipLevelSize.width, mipLevelSize.height);
         }
 
         // Upload data to the GPU texture
         destination.mipLevel = level;
         source.bytesPerRow   = 4 * mipLevelSize.width;
         source.rowsPerImage  = mipLevelSize.height;
-        queue.writeTexture(destination, pixels.data(), pixels.size(), source, mipLevelSize);
+        uploads.writeTexture(destination, pixels.data(), source, mipLevelSize);
 
         previousLevelPixels  = std::move(pixels);
         previousMipLevelSize = mipLevelSize;
         mipLevelSize.width /= 2;
         mipLevelSize.height /= 2;
     }
-
-    queue.release();
 }
 
 // Equivalent of std::bit_width that is available from C++20 onward
@@ -184,7 +341,11 @@ static uint32_t bit_width(uint32_t m)
     }
 }
 
-Texture ResourceManager::loadTexture(const path& path, Device device, TextureView* pTextureView)
+Texture ResourceManager::loadTexture(const path& path,
+                                     Device device,
+                                     GpuMemoryTracker& memory,
+                                     UploadManager& uploads,
+                                     TextureView* pTextureView)
 {
     int width, height, channels;
     unsigned char* pixelData = stbi_load(path.string().c_str(), &width, &height, &channels, 4 /* force 4 channels */);
@@ -203,10 +364,10 @@ Texture ResourceManager::loadTexture(const path& path, Device device, TextureVie
     textureDesc.usage           = TextureUsage::TextureBinding | TextureUsage::CopyDst;
     textureDesc.viewFormatCount = 0;
     textureDesc.viewFormats     = nullptr;
-    Texture texture             = device.createTexture(textureDesc);
+    Texture texture             = memory.createTexture(device, textureDesc, GpuMemoryTracker::Category::Textures);
 
     // Upload data to the GPU texture
-    writeMipMaps(device, texture, textureDesc.size, textureDesc.mipLevelCount, pixelData);
+    writeMipMaps(uploads, texture, textureDesc.size, textureDesc.mipLevelCount, pixelData);
 
     stbi_image_free(pixelData);
     // (Do not use data after this)
@@ -227,6 +388,144 @@ Texture ResourceManager::loadTexture(const path& path, Device device, TextureVie
     return texture;
 }
 
+// Auxiliary function for loadTextureLayer, bilinear resampling of 8-bit RGBA pixels
+static std::vector<unsigned char> resample(const unsigned char* pixelData,
+                                          uint32_t width,
+                                          uint32_t height,
+                                          uint32_t newWidth,
+                                          uint32_t newHeight)
+{
+    std::vector<unsigned char> pixels(4 * newWidth * newHeight);
+    for (uint32_t j = 0; j < newHeight; ++j)
+    {
+        float y     = std::max((j + 0.5f) * height / newHeight - 0.5f, 0.0f);
+        uint32_t y0 = std::min(static_cast<uint32_t>(y), height - 1);
+        uint32_t y1 = std::min(y0 + 1, height - 1);
+        float ty    = y - y0;
+        for (uint32_t i = 0; i < newWidth; ++i)
+        {
+            float x     = std::max((i + 0.5f) * width / newWidth - 0.5f, 0.0f);
+            uint32_t x0 = std::min(static_cast<uint32_t>(x), width - 1);
+            uint32_t x1 = std::min(x0 + 1, width - 1);
+            float tx    = x - x0;
+
+            const unsigned char* p00 = &pixelData[4 * (y0 * width + x0)];
+            const unsigned char* p01 = &pixelData[4 * (y0 * width + x1)];
+            const unsigned char* p10 = &pixelData[4 * (y1 * width + x0)];
+            const unsigned char* p11 = &pixelData[4 * (y1 * width + x1)];
+            unsigned char* p         = &pixels[4 * (j * newWidth + i)];
+            for (uint32_t c = 0; c < 4; ++c)
+            {
+                float top    = (1 - tx) * p00[c] + tx * p01[c];
+                float bottom = (1 - tx) * p10[c] + tx * p11[c];
+                p[c]         = static_cast<unsigned char>((1 - ty) * top + ty * bottom + 0.5f);
+            }
+        }
+    }
+    return pixels;
+}
+
+uint32_t ResourceManager::loadTextureLayer(const path& path, TextureArrayPool& pool, UploadManager& uploads)
+{
+    int width, height, channels;
+    unsigned char* pixelData = stbi_load(path.string().c_str(), &width, &height, &channels, 4 /* force 4 channels */);
+    if (nullptr == pixelData)
+        return TextureArrayPool::kInvalidLayer;
+
+    uint32_t layer = pool.allocate();
+    if (layer != TextureArrayPool::kInvalidLayer)
+    {
+        // Every layer has the size of the array
+        Extent3D size = {pool.width(), pool.height(), 1};
+        if (static_cast<uint32_t>(width) == size.width && static_cast<uint32_t>(height) == size.height)
+        {
+            writeMipMaps(uploads, pool.texture(), size, pool.mipLevelCount(), pixelData, layer);
+        }
+        else
+        {
+            std::cout << "Resampling " << path << " from " << width << "x" << height << " to " << size.width << "x"
+                      << size.height << std::endl;
+            std::vector<unsigned char> pixels = resample(pixelData, width, height, size.width, size.height);
+            writeMipMaps(uploads, pool.texture(), size, pool.mipLevelCount(), pixels.data(), layer);
+        }
+    }
+
+    stbi_image_free(pixelData);
+    return layer;
+}
+
+bool ResourceManager::loadTextureLevels(const path& path,
+                                        uint32_t width,
+                                        uint32_t height,
+                                        uint32_t mipLevelCount,
+                                        std::vector<std::vector<unsigned char>>& levels)
+{
+    levels.clear();
+    bool loaded = loadTextureLevels(path,
+                                    width,
+                                    height,
+                                    mipLevelCount,
+                                    [&levels](uint32_t /* level */, std::vector<unsigned char> pixels)
+                                    {
+                                        levels.push_back(std::move(pixels));
+                                        return true;
+                                    });
+    if (!loaded)
+        levels.clear();
+    return loaded;
+}
+
+bool ResourceManager::loadTextureLevels(const path& path,
+                                        uint32_t width,
+                                        uint32_t height,
+                                        uint32_t mipLevelCount,
+                                        const LevelConsumer& consumer)
+{
+    int imageWidth, imageHeight, channels;
+    unsigned char* pixelData =
+        stbi_load(path.string().c_str(), &imageWidth, &imageHeight, &channels, 4 /* force 4 channels */);
+    if (nullptr == pixelData)
+        return false;
+
+    std::vector<unsigned char> pixels;
+    if (static_cast<uint32_t>(imageWidth) == width && static_cast<uint32_t>(imageHeight) == height)
+    {
+        pixels.assign(pixelData, pixelData + 4 * width * height);
+    }
+    else
+    {
+        pixels = resample(pixelData, imageWidth, imageHeight, width, height);
+    }
+    stbi_image_free(pixelData);
+
+    for (uint32_t level = 0; level < mipLevelCount; ++level)
+    {
+        // The next level is computed before this one is handed over
+        std::vector<unsigned char> nextPixels;
+        if (level + 1 < mipLevelCount)
+        {
+            nextPixels = downsample(pixels,
+                                    std::max(width >> level, 1u),
+                                    std::max(width >> (level + 1), 1u),
+                                    std::max(height >> (level + 1), 1u));
+        }
+        if (!consumer(level, std::move(pixels)))
+            return false;
+        pixels = std::move(nextPixels);
+    }
+    return true;
+}
+
+bool ResourceManager::imageSize(const path& path, uint32_t& width, uint32_t& height)
+{
+    int imageWidth, imageHeight, channels;
+    if (!stbi_info(path.string().c_str(), &imageWidth, &imageHeight, &channels))
+        return false;
+    width  = static_cast<uint32_t>(imageWidth);
+    height = static_cast<uint32_t>(imageHeight);
+    return true;
+}
+
 glm::mat3x3 ResourceManager::computeTBN(const VertexAttributes corners[3], const vec3& expectedN)
 {
     // What we call e in the figure
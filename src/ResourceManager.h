@@ -1,9 +1,17 @@
 #pragma once
 
+#include "BoundingBox.h"
+#include "GpuMemoryTracker.h"
+#include "ShaderPreprocessor.h"
+#include "TextureArrayPool.h"
+#include "UploadManager.h"
+
 #include <glm/glm.hpp>
 #include <webgpu/webgpu.hpp>
 
 #include <filesystem>
+#include <functional>
+#include <string>
 #include <vector>
 
 class ResourceManager
@@ -31,15 +39,86 @@ public:
         vec2 uv;
     };
 
-    // Load a shader from a WGSL file into a new shader module
-    static wgpu::ShaderModule loadShaderModule(const path& path, wgpu::Device device);
+    /**
+     * A material of an OBJ file, as described by its .mtl library. Texture
+     * paths are resolved relative to the OBJ file and left empty when unset.
+     */
+    struct Material
+    {
+        std::string name;
+        vec3 diffuse    = vec3(1.0f);  // Kd
+        vec3 specular   = vec3(0.0f);  // Ks
+        float shininess = 0.0f;        // Ns
+        float opacity   = 1.0f;        // d, the material is transparent below 1
+        path diffuseTexture;           // map_Kd
+        path normalTexture;            // map_Bump, bump or norm
+        float normalStrength = 1.0f;   // -bm option of the normal map
+    };
+
+    /**
+     * A contiguous range of the vertex data loaded from the faces of one shape
+     * of an OBJ file that use the same material, with its bounds computed at
+     * load time. Once the data is split by splitIntoChunks(), the range is
+     * relative to the chunk that holds it.
+     */
+    struct Submesh
+    {
+        std::string name;
+        uint32_t firstVertex = 0;
+        uint32_t vertexCount = 0;
+        uint32_t material    = 0;  // index in the materials loaded along with the submesh
+        uint32_t chunk       = 0;  // vertex buffer holding the range
+        BoundingBox bounds;
+    };
+
+    // Load a shader from a WGSL file into a new shader module, after expanding its directives
+    // Compilation errors are reported with the lines of the original files.
+    static wgpu::ShaderModule loadShaderModule(const path& path, wgpu::Device device, ShaderPreprocessor& preprocessor);
 
     // Load an 3D mesh from a standard .obj file into a vertex data buffer
-    static bool loadGeometryFromObj(const path& path, std::vector<VertexAttributes>& vertexData);
+    // If `submeshes` is provided, it receives the vertex range and bounds of each shape and material used by the
+    // shape, and `materials` the materials of the .mtl library, plus a default one for faces without material.
+    static bool loadGeometryFromObj(const path& path,
+                                    std::vector<VertexAttributes>& vertexData,
+                                    std::vector<Submesh>* submeshes = nullptr,
+                                    std::vector<Material>* materials = nullptr);
+
+    // Split the vertex data into chunks of `chunkVertices` vertices, a multiple of 3, that each fit in a buffer
+    // Submeshes crossing the end of a chunk are cut into pieces with their own bounds. Returns the chunk count.
+    static uint32_t splitIntoChunks(const std::vector<VertexAttributes>& vertexData,
+                                    uint32_t chunkVertices,
+                                    std::vector<Submesh>& submeshes);
+
+    // Load an image from a standard image file into a new texture object, allocated through `memory`
+    // The mip levels are sent through `uploads`. NB: The texture must be destroyed after use, with memory.destroy()
+    static wgpu::Texture loadTexture(const path& path,
+                                     wgpu::Device device,
+                                     GpuMemoryTracker& memory,
+                                     UploadManager& uploads,
+                                     wgpu::TextureView* pTextureView = nullptr);
+
+    // Load an image into a new layer of a texture array, resampled to the size of the array if needed
+    // Returns the layer, or TextureArrayPool::kInvalidLayer when loading failed or the pool is full.
+    static uint32_t loadTextureLayer(const path& path, TextureArrayPool& pool, UploadManager& uploads);
+
+    // Decode an image resampled to width x height and compute its mip levels, without touching the GPU
+    // This is the part of loadTextureLayer that may run on any thread, the uploads are left to the caller.
+    static bool loadTextureLevels(const path& path,
+                                  uint32_t width,
+                                  uint32_t height,
+                                  uint32_t mipLevelCount,
+                                  std::vector<std::vector<unsigned char>>& levels);
+    // Same, handing the levels to `consumer` one at a time from the finest, so that at most two are held at once
+    // Stops and returns false at the first level the consumer returns false for.
+    using LevelConsumer = std::function<bool(uint32_t level, std::vector<unsigned char> pixels)>;
+    static bool loadTextureLevels(const path& path,
+                                  uint32_t width,
+                                  uint32_t height,
+                                  uint32_t mipLevelCount,
+                                  const LevelConsumer& consumer);
 
-    // Load an image from a standard image file into a new texture object
-    // NB: The texture must be destroyed after use
-    static wgpu::Texture loadTexture(const path& path, wgpu::Device device, wgpu::TextureView* pTextureView = nullptr);
+    // Size of an image, read from its header without decoding it
+    static bool imageSize(const path& path, uint32_t& width, uint32_t& height);
 
 private:
     // Compute the TBN local to a triangle face from its corners and return it as
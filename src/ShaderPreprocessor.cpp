@@ -0,0 +1,445 @@
+#include "ShaderPreprocessor.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <sstream>
+
+using file_time_type = std::filesystem::file_time_type;
+
+// Key of a file in the caches, so that two spellings of the same path share their entries
+static std::string normalized(const std::filesystem::path& file)
+{
+    return file.lexically_normal().generic_string();
+}
+
+static file_time_type writeTime(const std::filesystem::path& file)
+{
+    std::error_code error;
+    file_time_type time = std::filesystem::last_write_time(file, error);
+    return error ? file_time_type::min() : time;
+}
+
+static std::vector<std::string> splitLines(const std::string& text)
+{
+    std::vector<std::string> lines;
+    std::istringstream stream(text);
+    std::string line;
+    while (std::getline(stream, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        lines.push_back(std::move(line));
+    }
+    return lines;
+}
+
+static std::string trimmed(const std::string& text)
+{
+    size_t first = text.find_first_not_of(" \t");
+    if (first == std::string::npos)
+        return {};
+    size_t last = text.find_last_not_of(" \t");
+    return text.substr(first, last - first + 1);
+}
+
+std::string ShaderPreprocessor::Result::remapMessage(const std::string& message) const
+{
+    // Both "wgsl:12:5" (naga) and ":12:5" (tint) locations
+    static const std::regex location("(wgsl)?:([0-9]+):([0-9]+)");
+
+    std::string remapped;
+    auto last = message.cbegin();
+    for (std::sregex_iterator it(message.begin(), message.end(), location), end; it != end; ++it)
+    {
+        const std::smatch& match = *it;
+        size_t line              = std::stoul(match[2].str());
+        remapped.append(last, match[0].first);
+        if (line >= 1 && line <= lines.size())
+        {
+            const LineOrigin& origin = lines[line - 1];
+            remapped += files[origin.file] + ":" + std::to_string(origin.line) + ":" + match[3].str();
+        }
+        else
+        {
+            remapped += match[0].str();
+        }
+        last = match[0].second;
+    }
+    remapped.append(last, message.cend());
+    return remapped;
+}
+
+void ShaderPreprocessor::define(const std::string& name, const std::string& value)
+{
+    m_defines[name] = value;
+}
+
+void ShaderPreprocessor::undefine(const std::string& name)
+{
+    m_defines.erase(name);
+}
+
+void ShaderPreprocessor::setGenerated(const std::string& name, const std::string& source)
+{
+    m_generated[name] = source;
+}
+
+std::shared_ptr<const ShaderPreprocessor::Result> ShaderPreprocessor::preprocess(const path& file)
+{
+    uint64_t key = hashKey(file);
+    auto it      = m_cache.find(key);
+    if (it != m_cache.end() && isUpToDate(it->second.dependencies))
+    {
+        ++m_stats.cacheHits;
+        return it->second.result;
+    }
+
+    // Entries of the same file expanded with other definitions are outdated as well
+    std::string root = normalized(file);
+    for (auto entry = m_cache.begin(); entry != m_cache.end();)
+    {
+        if (entry->second.root == root && !isUpToDate(entry->second.dependencies))
+            entry = m_cache.erase(entry);
+        else
+            ++entry;
+    }
+
+    auto result = std::make_shared<Result>();
+    Expansion expansion;
+    expansion.result  = result.get();
+    expansion.defines = m_defines;
+    result->ok        = expandFile(file, expansion);
+    ++m_stats.expansions;
+    if (!result->ok)
+        std::cerr << "Could not preprocess " << file << ": " << result->error << std::endl;
+
+    // Failures are cached as well, until one of the files is fixed
+    m_cache[key] = {root, std::move(expansion.dependencies), result};
+    return result;
+}
+
+bool ShaderPreprocessor::hasChanged(const path& file) const
+{
+    std::string root = normalized(file);
+    for (const auto& [key, entry] : m_cache)
+    {
+        if (entry.root == root && !isUpToDate(entry.dependencies))
+            return true;
+    }
+    return false;
+}
+
+const ShaderPreprocessor::SourceFile* ShaderPreprocessor::readFile(const path& file)
+{
+    std::string key     = normalized(file);
+    file_time_type time = writeTime(file);
+    auto it             = m_files.find(key);
+    if (it != m_files.end() && it->second.writeTime == time)
+        return &it->second;
+
+    std::ifstream stream(file);
+    if (!stream.is_open())
+        return nullptr;
+    std::stringstream content;
+    content << stream.rdbuf();
+    ++m_stats.fileReads;
+
+    SourceFile& source = m_files[key];
+    source.writeTime   = time;
+    source.lines       = splitLines(content.str());
+    return &source;
+}
+
+bool ShaderPreprocessor::expandFile(const path& file, Expansion& expansion)
+{
+    if (!expansion.included.insert(normalized(file)).second)
+        return true;
+
+    const SourceFile* source = readFile(file);
+    expansion.dependencies.emplace_back(file, source ? source->writeTime : writeTime(file));
+    if (!source)
+    {
+        expansion.result->error = "could not open " + file.generic_string();
+        return false;
+    }
+
+    // Copied, as the lines of an included file may be read again while expanding them
+    std::vector<std::string> lines = source->lines;
+    uint32_t fileIndex             = static_cast<uint32_t>(expansion.result->files.size());
+    expansion.result->files.push_back(file.generic_string());
+    return expandLines(lines, fileIndex, file.parent_path(), expansion);
+}
+
+bool ShaderPreprocessor::expandGenerated(const std::string& name, Expansion& expansion)
+{
+    if (!expansion.included.insert("<" + name + ">").second)
+        return true;
+
+    auto it = m_generated.find(name);
+    if (it == m_generated.end())
+    {
+        expansion.result->error = "no generated declaration named " + name;
+        return false;
+    }
+
+    uint32_t fileIndex = static_cast<uint32_t>(expansion.result->files.size());
+    expansion.result->files.push_back("<" + name + ">");
+    return expandLines(splitLines(it->second), fileIndex, {}, expansion);
+}
+
+bool ShaderPreprocessor::expandLines(const std::vector<std::string>& lines,
+                                     uint32_t fileIndex,
+                                     const path& directory,
+                                     Expansion& expansion)
+{
+    Result& result = *expansion.result;
+
+    // Nesting of #ifdef blocks, a line is kept when all of them are active
+    struct Condition
+    {
+        bool parentActive;
+        bool value;
+        bool inElse;
+    };
+    std::vector<Condition> conditions;
+    bool active = true;
+
+    for (size_t i = 0; i < lines.size(); ++i)
+    {
+        const std::string& line = lines[i];
+        auto fail               = [&](const std::string& message)
+        {
+            result.error = result.files[fileIndex] + ":" + std::to_string(i + 1) + ": " + message;
+            return false;
+        };
+
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos || line[start] != '#')
+        {
+            if (active)
+            {
+                result.source += substitute(line, expansion.defines);
+                result.source += '\n';
+                result.lines.push_back({fileIndex, static_cast<uint32_t>(i + 1)});
+            }
+            continue;
+        }
+
+        std::istringstream stream(line.substr(start + 1));
+        std::string directive;
+        stream >> directive;
+        std::string argument;
+        std::getline(stream, argument);
+        argument = trimmed(argument);
+
+        if (directive == "ifdef" || directive == "ifndef")
+        {
+            bool defined = expansion.defines.count(argument) > 0;
+            conditions.push_back({active, directive == "ifdef" ? defined : !defined, false});
+            active = active && conditions.back().value;
+        }
+        else if (directive == "else")
+        {
+            if (conditions.empty() || conditions.back().inElse)
+                return fail("#else without #ifdef");
+            conditions.back().inElse = true;
+            active                   = conditions.back().parentActive && !conditions.back().value;
+        }
+        else if (directive == "endif")
+        {
+            if (conditions.empty())
+                return fail("#endif without #ifdef");
+            active = conditions.back().parentActive;
+            conditions.pop_back();
+        }
+        else if (!active)
+        {
+            continue;
+        }
+        else if (directive == "define" || directive == "undef")
+        {
+            size_t nameEnd   = argument.find_first_of(" \t");
+            std::string name = argument.substr(0, nameEnd);
+            if (name.empty())
+                return fail("#" + directive + " without a name");
+            if (directive == "undef")
+                expansion.defines.erase(name);
+            else
+                expansion.defines[name] = nameEnd == std::string::npos ? "" : trimmed(argument.substr(nameEnd));
+        }
+        else if (directive == "include")
+        {
+            if (argument.size() < 2)
+                return fail("#include without a file");
+            std::string name = argument.substr(1, argument.size() - 2);
+            bool expanded;
+            if (argument.front() == '"' && argument.back() == '"')
+                expanded = expandFile(directory / name, expansion);
+            else if (argument.front() == '<' && argument.back() == '>')
+                expanded = expandGenerated(name, expansion);
+            else
+                return fail("expected #include \"file\" or #include <Name>");
+            if (!expanded)
+            {
+                // Tell where the failing include comes from
+                result.error += "\n  included from " + result.files[fileIndex] + ":" + std::to_string(i + 1);
+                return false;
+            }
+        }
+        else
+        {
+            return fail("unknown directive #" + directive);
+        }
+    }
+
+    if (!conditions.empty())
+    {
+        result.error = result.files[fileIndex] + ": missing #endif";
+        return false;
+    }
+    return true;
+}
+
+std::string ShaderPreprocessor::substitute(const std::string& line, const std::map<std::string, std::string>& defines)
+{
+    if (defines.empty())
+        return line;
+
+    // Replace whole identifiers only
+    std::string output;
+    output.reserve(line.size());
+    size_t i = 0;
+    while (i < line.size())
+    {
+        unsigned char c = static_cast<unsigned char>(line[i]);
+        if (!std::isalpha(c) && c != '_')
+        {
+            // Digits are skipped along with the suffix of literals like 1u or 2e3f
+            size_t end = i + 1;
+            if (std::isdigit(c))
+            {
+                while (end < line.size() && (std::isalnum(static_cast<unsigned char>(line[end])) || line[end] == '.'))
+                    ++end;
+            }
+            output.append(line, i, end - i);
+            i = end;
+            continue;
+        }
+
+        size_t end = i + 1;
+        while (end < line.size() && (std::isalnum(static_cast<unsigned char>(line[end])) || line[end] == '_'))
+            ++end;
+        std::string identifier = line.substr(i, end - i);
+        auto it                = defines.find(identifier);
+        output += it != defines.end() ? it->second : identifier;
+        i = end;
+    }
+    return output;
+}
+
+bool ShaderPreprocessor::isUpToDate(const Dependencies& dependencies)
+{
+    return std::all_of(dependencies.begin(),
+                       dependencies.end(),
+                       [](const auto& dependency) { return writeTime(dependency.first) == dependency.second; });
+}
+
+uint64_t ShaderPreprocessor::hashKey(const path& file) const
+{
+    // FNV-1a over the file name and everything that may change its expansion
+    uint64_t hash = 14695981039346656037ull;
+    auto add      = [&hash](const std::string& text)
+    {
+        for (char c : text)
+        {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 1099511628211ull;
+        }
+        // Separator, so that ("ab", "c") and ("a", "bc") differ
+        hash ^= 0xff;
+        hash *= 1099511628211ull;
+    };
+
+    add(normalized(file));
+    for (const auto& [name, value] : m_defines)
+    {
+        add(name);
+        add(value);
+    }
+    for (const auto& [name, source] : m_generated)
+    {
+        add(name);
+        add(source);
+    }
+    return hash;
+}
+
+WgslStruct::WgslStruct(std::string name, size_t size) : m_name(std::move(name)), m_size(size) {}
+
+WgslStruct& WgslStruct::field(const std::string& name, const std::string& type, size_t offset)
+{
+    auto [size, alignment] = layout(type);
+    if (size == 0)
+    {
+        if (m_error.empty())
+            m_error = "unsupported type " + type + " for field " + name;
+        return *this;
+    }
+
+    size_t wgslOffset = (m_end + alignment - 1) / alignment * alignment;
+    if (wgslOffset != offset && m_error.empty())
+    {
+        m_error = "field " + name + " is at offset " + std::to_string(offset) + " in C++ but "
+                  + std::to_string(wgslOffset) + " in WGSL";
+    }
+    m_end       = wgslOffset + size;
+    m_alignment = std::max(m_alignment, alignment);
+    m_fields += "\t" + name + ": " + type + ",\n";
+    return *this;
+}
+
+std::string WgslStruct::declaration() const
+{
+    std::string error = m_error;
+    size_t wgslSize   = (m_end + m_alignment - 1) / m_alignment * m_alignment;
+    if (error.empty() && wgslSize != m_size)
+        error = "size is " + std::to_string(m_size) + " in C++ but " + std::to_string(wgslSize) + " in WGSL";
+    if (!error.empty())
+    {
+        std::cerr << "Cannot generate the WGSL declaration of " << m_name << ": " << error << std::endl;
+        return {};
+    }
+
+    return "// Generated from the C++ declaration of " + m_name + "\nstruct " + m_name + "\n{\n" + m_fields + "};\n";
+}
+
+std::pair<size_t, size_t> WgslStruct::layout(const std::string& type)
+{
+    // Size and alignment of the host-shareable types, see the memory layout section of the WGSL specification
+    static const std::map<std::string, std::pair<size_t, size_t>> types = {
+        {"f32", {4, 4}},       {"u32", {4, 4}},       {"i32", {4, 4}},       {"vec2f", {8, 8}},
+        {"vec2u", {8, 8}},     {"vec2i", {8, 8}},     {"vec3f", {12, 16}},   {"vec3u", {12, 16}},
+        {"vec3i", {12, 16}},   {"vec4f", {16, 16}},   {"vec4u", {16, 16}},   {"vec4i", {16, 16}},
+        {"mat3x3f", {48, 16}}, {"mat4x4f", {64, 16}},
+    };
+
+    auto it = types.find(type);
+    if (it != types.end())
+        return it->second;
+
+    // Fixed size arrays, e.g. array<vec4f, 2>
+    size_t comma = type.rfind(',');
+    if (type.rfind("array<", 0) == 0 && type.back() == '>' && comma != std::string::npos)
+    {
+        auto [size, alignment] = layout(trimmed(type.substr(6, comma - 6)));
+        size_t count           = std::strtoul(type.c_str() + comma + 1, nullptr, 10);
+        size_t stride          = (size + alignment - 1) / alignment * alignment;
+        if (size != 0 && count != 0)
+            return {stride * count, alignment};
+    }
+    return {0, 0};
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Expands the directives of WGSL sources before they are compiled:
+ *   #include "file.wgsl"   the content of a file, relative to the including one
+ *   #include <Name>        a declaration generated on the C++ side, see setGenerated()
+ *   #define NAME [value]   replaces the identifier NAME in the following lines
+ *   #undef, #ifdef, #ifndef, #else, #endif
+ * Each file is included at most once, as WGSL does not allow declaring
+ * twice. The expanded source is cached by a hash of the file and of the
+ * definitions, and reused as long as none of the files it was expanded from
+ * changed. The origin of every line is kept to map compiler messages back
+ * to the original files.
+ */
+class ShaderPreprocessor
+{
+public:
+    using path = std::filesystem::path;
+
+    // Line of an original file, counted from 1
+    struct LineOrigin
+    {
+        uint32_t file;
+        uint32_t line;
+    };
+
+    struct Result
+    {
+        bool ok = false;
+        std::string source;
+        std::string error;
+        std::vector<std::string> files;  // paths of the files, or <Name> for generated declarations
+        std::vector<LineOrigin> lines;   // origin of each line of the expanded source
+
+        // Replace the line:column locations of the expanded source by those of the original files
+        std::string remapMessage(const std::string& message) const;
+    };
+
+    struct Stats
+    {
+        uint32_t expansions = 0;
+        uint32_t cacheHits  = 0;
+        uint32_t fileReads  = 0;
+    };
+
+    // Definitions given to every file, before its own #define directives
+    void define(const std::string& name, const std::string& value = "");
+    void undefine(const std::string& name);
+
+    // Register the source of a declaration included with #include <name>
+    void setGenerated(const std::string& name, const std::string& source);
+
+    // The expanded source of a file, from the cache when possible
+    std::shared_ptr<const Result> preprocess(const path& file);
+
+    // Whether a file or one of its includes was modified since it was last preprocessed
+    bool hasChanged(const path& file) const;
+
+    const Stats& stats() const
+    {
+        return m_stats;
+    }
+
+private:
+    using Dependencies = std::vector<std::pair<path, std::filesystem::file_time_type>>;
+
+    struct SourceFile
+    {
+        std::filesystem::file_time_type writeTime;
+        std::vector<std::string> lines;
+    };
+
+    struct CacheEntry
+    {
+        path root;
+        Dependencies dependencies;
+        std::shared_ptr<const Result> result;
+    };
+
+    // State of the expansion of one root file
+    struct Expansion
+    {
+        Result* result = nullptr;
+        std::map<std::string, std::string> defines;
+        std::set<std::string> included;
+        Dependencies dependencies;
+    };
+
+    const SourceFile* readFile(const path& file);
+    bool expandFile(const path& file, Expansion& expansion);
+    bool expandGenerated(const std::string& name, Expansion& expansion);
+    bool expandLines(const std::vector<std::string>& lines,
+                     uint32_t fileIndex,
+                     const path& directory,
+                     Expansion& expansion);
+    static std::string substitute(const std::string& line, const std::map<std::string, std::string>& defines);
+    static bool isUpToDate(const Dependencies& dependencies);
+    uint64_t hashKey(const path& file) const;
+
+private:
+    std::map<std::string, std::string> m_defines;
+    std::map<std::string, std::string> m_generated;
+    std::unordered_map<std::string, SourceFile> m_files;
+    std::unordered_map<uint64_t, CacheEntry> m_cache;
+    Stats m_stats;
+};
+
+/**
+ * Declaration of a WGSL struct that mirrors a C++ one, to be registered with
+ * ShaderPreprocessor::setGenerated() instead of being written again by hand
+ * in every shader. The offset of each field is checked against the layout
+ * rules of WGSL, so that a C++ struct edited without its fields here is
+ * reported when the declaration is generated. Explicit padding members of
+ * the C++ struct are simply not listed.
+ */
+class WgslStruct
+{
+public:
+    WgslStruct(std::string name, size_t size);
+
+    // Add a field, e.g. field("viewMatrix", "mat4x4f", offsetof(MyUniforms, viewMatrix))
+    WgslStruct& field(const std::string& name, const std::string& type, size_t offset);
+
+    // The WGSL source of the declaration, or an empty string if the layouts differ
+    std::string declaration() const;
+
+private:
+    // Size and alignment of a WGSL type, both 0 if the type is not supported
+    static std::pair<size_t, size_t> layout(const std::string& type);
+
+private:
+    std::string m_name;
+    size_t m_size      = 0;
+    size_t m_end       = 0;  // end of the last field in the WGSL layout
+    size_t m_alignment = 1;
+    std::string m_fields;
+    std::string m_error;
+};
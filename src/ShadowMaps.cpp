@@ -0,0 +1,73 @@
+#include "ShadowMaps.h"
+
+#include <glm/ext.hpp>
+
+#include <cmath>
+
+void ShadowMaps::invalidate()
+{
+    for (Map& map : m_maps)
+    {
+        map.valid   = false;
+        map.pending = true;
+    }
+}
+
+bool ShadowMaps::update(uint32_t map, const glm::vec3& lightDirection, const BoundingBox& sceneBounds)
+{
+    Map& shadowMap = m_maps[map];
+    bool unchanged = shadowMap.valid && shadowMap.lightDirection == lightDirection
+                     && shadowMap.sceneBounds.min == sceneBounds.min && shadowMap.sceneBounds.max == sceneBounds.max;
+    if (unchanged || sceneBounds.isEmpty() || glm::length(lightDirection) == 0.0f)
+        return false;
+
+    shadowMap.lightDirection = lightDirection;
+    shadowMap.sceneBounds    = sceneBounds;
+    shadowMap.viewProjection = fitViewProjection(lightDirection, sceneBounds);
+    shadowMap.valid          = true;
+    shadowMap.pending        = true;
+    return true;
+}
+
+bool ShadowMaps::shouldRender(uint32_t map)
+{
+    Map& shadowMap = m_maps[map];
+    if (!shadowMap.valid)
+        return false;
+    if (!shadowMap.pending)
+    {
+        // In use and up to date with the matrices
+        ++m_stats.skippedPasses;
+        return false;
+    }
+    shadowMap.pending = false;
+    ++m_stats.renderedPasses;
+    return true;
+}
+
+glm::mat4x4 ShadowMaps::fitViewProjection(const glm::vec3& lightDirection, const BoundingBox& bounds)
+{
+    // Look at the center of the box from the light, only the orientation of the view matters
+    glm::vec3 towardLight = glm::normalize(lightDirection);
+    glm::vec3 up          = std::abs(towardLight.z) > 0.99f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(0.0f, 0.0f, 1.0f);
+    glm::vec3 center      = bounds.center();
+    glm::mat4x4 view      = glm::lookAtLH(center + towardLight, center, up);
+
+    // Bounds of the corners of the box in light space
+    BoundingBox lightBounds;
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        glm::vec3 point = glm::vec3(corner & 1 ? bounds.max.x : bounds.min.x,
+                                    corner & 2 ? bounds.max.y : bounds.min.y,
+                                    corner & 4 ? bounds.max.z : bounds.min.z);
+        lightBounds.extend(glm::vec3(view * glm::vec4(point, 1.0f)));
+    }
+
+    glm::mat4x4 projection = glm::orthoLH_ZO(lightBounds.min.x,
+                                             lightBounds.max.x,
+                                             lightBounds.min.y,
+                                             lightBounds.max.y,
+                                             lightBounds.min.z,
+                                             lightBounds.max.z);
+    return projection * view;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "BoundingBox.h"
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+
+/**
+ * Bookkeeping of the shadow maps of the directional lights. Rendering a map
+ * draws the whole scene, so maps are kept from frame to frame and only
+ * rendered again when their light turned or the geometry of the scene
+ * changed. Each light projection is an orthographic box fitted around the
+ * bounds of the scene as seen from the light, which is tight enough for the
+ * compact scenes of this viewer and never needs to follow the camera.
+ */
+class ShadowMaps
+{
+public:
+    static constexpr uint32_t kMapCount   = 2;  // one per directional light of the lighting uniforms
+    static constexpr uint32_t kResolution = 2048;
+
+    struct Stats
+    {
+        uint32_t renderedPasses = 0;
+        uint32_t skippedPasses  = 0;  // maps in use that were reused as is
+    };
+
+    // Forget the content of all the maps, e.g. when the scene geometry or the shader changed
+    void invalidate();
+
+    // Fit the projection of a map again if its light or the scene bounds changed since it was rendered
+    // Returns true when the projection changed.
+    bool update(uint32_t map, const glm::vec3& lightDirection, const BoundingBox& sceneBounds);
+
+    // Whether a map in use must be rendered this frame, it is considered up to date afterwards
+    bool shouldRender(uint32_t map);
+
+    // From world space to the clip space of the light of a map
+    const glm::mat4x4& viewProjection(uint32_t map) const
+    {
+        return m_maps[map].viewProjection;
+    }
+
+    const Stats& stats() const
+    {
+        return m_stats;
+    }
+
+    // Orthographic projection along a light direction (pointing toward the light) enclosing a box
+    static glm::mat4x4 fitViewProjection(const glm::vec3& lightDirection, const BoundingBox& bounds);
+
+private:
+    struct Map
+    {
+        // What the projection was fitted to
+        glm::vec3 lightDirection = glm::vec3(0.0f);
+        BoundingBox sceneBounds;
+        glm::mat4x4 viewProjection = glm::mat4x4(1.0f);
+
+        bool valid   = false;  // whether the projection was fitted
+        bool pending = true;   // whether the map must be rendered
+    };
+
+    std::array<Map, kMapCount> m_maps;
+    Stats m_stats;
+};
@@ -0,0 +1,175 @@
+#include "TextureArrayPool.h"
+
+#include <algorithm>
+
+using namespace wgpu;
+
+namespace
+{
+    constexpr uint64_t kBytesPerTexel = 4;
+}  // namespace
+
+bool TextureArrayPool::init(Device device,
+                            uint32_t width,
+                            uint32_t height,
+                            TextureFormat format,
+                            uint32_t maxLayers,
+                            const char* label,
+                            GpuMemoryTracker* memory,
+                            UploadManager* uploads)
+{
+    m_device    = device;
+    m_memory    = memory;
+    m_uploads   = uploads;
+    m_width     = width;
+    m_height    = height;
+    m_format    = format;
+    m_maxLayers = maxLayers;
+    m_label     = label;
+
+    // Full mip chain, down to 1x1
+    m_mipLevelCount = 1;
+    while ((std::max(width, height) >> m_mipLevelCount) > 0)
+    {
+        ++m_mipLevelCount;
+    }
+
+    m_stats = Stats();
+    for (uint32_t level = 0; level < m_mipLevelCount; ++level)
+    {
+        m_stats.layerBytes += kBytesPerTexel * std::max(width >> level, 1u) * std::max(height >> level, 1u);
+    }
+
+    m_stats.capacityLayers = std::min(kInitialLayers, maxLayers);
+    createTexture(m_stats.capacityLayers, m_texture, m_view);
+    return m_texture != nullptr;
+}
+
+void TextureArrayPool::terminate()
+{
+    if (m_view)
+        m_view.release();
+    m_memory->destroy(m_texture);
+    m_view = nullptr;
+    m_freeLayers.clear();
+    m_nextLayer = 0;
+}
+
+uint32_t TextureArrayPool::allocate()
+{
+    uint32_t layer;
+    if (!m_freeLayers.empty())
+    {
+        layer = m_freeLayers.back();
+        m_freeLayers.pop_back();
+    }
+    else
+    {
+        if (m_nextLayer == m_stats.capacityLayers && !grow())
+            return kInvalidLayer;
+        layer = m_nextLayer++;
+    }
+    ++m_stats.usedLayers;
+    return layer;
+}
+
+void TextureArrayPool::free(uint32_t layer)
+{
+    if (layer >= m_nextLayer)
+        return;
+    m_freeLayers.push_back(layer);
+    --m_stats.usedLayers;
+}
+
+float TextureArrayPool::occupancy() const
+{
+    if (m_stats.capacityLayers == 0)
+        return 0.0f;
+    return static_cast<float>(m_stats.usedLayers) / m_stats.capacityLayers;
+}
+
+uint64_t TextureArrayPool::wastedBytes() const
+{
+    return (m_stats.capacityLayers - m_stats.usedLayers) * m_stats.layerBytes;
+}
+
+bool TextureArrayPool::grow()
+{
+    if (m_stats.capacityLayers >= m_maxLayers)
+        return false;
+    uint32_t layers = std::min(2 * m_stats.capacityLayers, m_maxLayers);
+
+    // The new array is allocated while the previous one is still alive
+    if (!m_memory->fits(layers * m_stats.layerBytes))
+        return false;
+
+    Texture texture  = nullptr;
+    TextureView view = nullptr;
+    createTexture(layers, texture, view);
+    if (!texture)
+        return false;
+
+    // Copy every layer handed out so far, mip level by mip level, including the uploads still to be submitted
+    m_uploads->submit();
+    CommandEncoderDescriptor encoderDesc;
+    encoderDesc.label      = "Texture array growth";
+    CommandEncoder encoder = m_device.createCommandEncoder(encoderDesc);
+    for (uint32_t level = 0; level < m_mipLevelCount; ++level)
+    {
+        ImageCopyTexture source;
+        source.texture  = m_texture;
+        source.mipLevel = level;
+        source.origin   = {0, 0, 0};
+        source.aspect   = TextureAspect::All;
+
+        ImageCopyTexture destination = source;
+        destination.texture          = texture;
+
+        Extent3D size = {std::max(m_width >> level, 1u), std::max(m_height >> level, 1u), m_nextLayer};
+        encoder.copyTextureToTexture(source, destination, size);
+    }
+    CommandBufferDescriptor commandBufferDesc;
+    commandBufferDesc.label = "Texture array growth";
+    CommandBuffer command   = encoder.finish(commandBufferDesc);
+    encoder.release();
+    Queue queue = m_device.getQueue();
+    queue.submit(command);
+    command.release();
+    queue.release();
+
+    // Destroying the previous texture waits for the submitted copy
+    m_view.release();
+    m_memory->destroy(m_texture);
+    m_texture = texture;
+    m_view    = view;
+
+    m_stats.capacityLayers = layers;
+    ++m_stats.growths;
+    return true;
+}
+
+void TextureArrayPool::createTexture(uint32_t layers, Texture& texture, TextureView& view) const
+{
+    TextureDescriptor textureDesc;
+    textureDesc.label           = m_label;
+    textureDesc.dimension       = TextureDimension::_2D;
+    textureDesc.format          = m_format;
+    textureDesc.mipLevelCount   = m_mipLevelCount;
+    textureDesc.sampleCount     = 1;
+    textureDesc.size            = {m_width, m_height, layers};
+    textureDesc.usage           = TextureUsage::TextureBinding | TextureUsage::CopyDst | TextureUsage::CopySrc;
+    textureDesc.viewFormatCount = 0;
+    textureDesc.viewFormats     = nullptr;
+    texture                     = m_memory->createTexture(m_device, textureDesc, GpuMemoryTracker::Category::Textures);
+
+    TextureViewDescriptor viewDesc;
+    viewDesc.label           = m_label;
+    viewDesc.aspect          = TextureAspect::All;
+    viewDesc.baseArrayLayer  = 0;
+    viewDesc.arrayLayerCount = layers;
+    viewDesc.baseMipLevel    = 0;
+    viewDesc.mipLevelCount   = m_mipLevelCount;
+    viewDesc.dimension       = TextureViewDimension::_2DArray;
+    viewDesc.format          = m_format;
+    view                     = texture.createView(viewDesc);
+}
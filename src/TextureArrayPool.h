@@ -0,0 +1,107 @@
+#pragma once
+
+#include "GpuMemoryTracker.h"
+#include "UploadManager.h"
+
+#include <cstdint>
+#include <vector>
+#include <webgpu/webgpu.hpp>
+
+/**
+ * Packs textures of the same size and format into the layers of a single
+ * texture array, so that draws using different textures share one bind group
+ * and only differ by the layer index they sample. The array starts small and
+ * doubles its layer count when full, copying the layers in use, up to the
+ * limit negotiated with the device. Growing replaces the texture and its view,
+ * so bind groups referencing the view must be created once loading is done.
+ */
+class TextureArrayPool
+{
+public:
+    static constexpr uint32_t kInvalidLayer = UINT32_MAX;
+
+    struct Stats
+    {
+        uint32_t usedLayers     = 0;
+        uint32_t capacityLayers = 0;  // layers of the current array
+        uint32_t growths        = 0;
+        uint64_t layerBytes     = 0;  // including the mip levels
+    };
+
+    // Layers hold 8-bit RGBA texels, with a full mip chain
+    // The array is allocated through `memory`, and does not grow beyond its budget. Copies to the layers recorded by
+    // `uploads` are submitted before growing, so that they reach the array being copied.
+    bool init(wgpu::Device device,
+              uint32_t width,
+              uint32_t height,
+              wgpu::TextureFormat format,
+              uint32_t maxLayers,
+              const char* label,
+              GpuMemoryTracker* memory,
+              UploadManager* uploads);
+    void terminate();
+
+    // Reserve a layer, growing the array when it is full
+    // Returns kInvalidLayer once the pool holds maxLayers layers, or when growing would exceed the memory budget.
+    uint32_t allocate();
+    // Give a layer back, its content is overwritten by the next texture allocated there
+    void free(uint32_t layer);
+
+    wgpu::Texture texture() const
+    {
+        return m_texture;
+    }
+    wgpu::TextureView view() const
+    {
+        return m_view;
+    }
+    uint32_t width() const
+    {
+        return m_width;
+    }
+    uint32_t height() const
+    {
+        return m_height;
+    }
+    uint32_t mipLevelCount() const
+    {
+        return m_mipLevelCount;
+    }
+    uint32_t maxLayers() const
+    {
+        return m_maxLayers;
+    }
+
+    // Share of the layers of the array holding a texture
+    float occupancy() const;
+    // Memory of the layers allocated but not holding any texture
+    uint64_t wastedBytes() const;
+
+    const Stats& stats() const
+    {
+        return m_stats;
+    }
+
+private:
+    // Replace the array by one with more layers, keeping the content of the current one
+    bool grow();
+    void createTexture(uint32_t layers, wgpu::Texture& texture, wgpu::TextureView& view) const;
+
+private:
+    static constexpr uint32_t kInitialLayers = 2;
+
+    wgpu::Device m_device        = nullptr;
+    GpuMemoryTracker* m_memory   = nullptr;
+    UploadManager* m_uploads     = nullptr;
+    wgpu::Texture m_texture      = nullptr;
+    wgpu::TextureView m_view     = nullptr;
+    wgpu::TextureFormat m_format = wgpu::TextureFormat::Undefined;
+    const char* m_label          = nullptr;
+    uint32_t m_width             = 0;
+    uint32_t m_height            = 0;
+    uint32_t m_mipLevelCount     = 0;
+    uint32_t m_maxLayers         = 0;
+    std::vector<uint32_t> m_freeLayers;  // below the capacity, released by free()
+    uint32_t m_nextLayer = 0;            // first layer never allocated
+    Stats m_stats;
+};
@@ -0,0 +1,236 @@
+#include "TextureStreamer.h"
+#include "ResourceManager.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+using namespace wgpu;
+
+void TextureStreamer::init(TextureArrayPool* pool, UploadManager* uploads)
+{
+    m_pool          = pool;
+    m_uploads       = uploads;
+    m_width         = pool->width();
+    m_height        = pool->height();
+    m_mipLevelCount = pool->mipLevelCount();
+    m_stopping      = false;
+    m_worker        = std::thread([this]() { workerLoop(); });
+}
+
+void TextureStreamer::terminate()
+{
+    if (m_worker.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wakeCondition.notify_all();
+        m_worker.join();
+    }
+    m_decodeQueue.clear();
+    m_decodedImages.clear();
+    m_layers.clear();
+    m_stats = Stats();
+}
+
+void TextureStreamer::request(const std::filesystem::path& path, uint32_t layer)
+{
+    if (layer >= m_layers.size())
+    {
+        m_layers.resize(layer + 1);
+    }
+    m_layers[layer]               = Layer();
+    m_layers[layer].path          = path;
+    m_layers[layer].residentLevel = m_mipLevelCount;
+    m_layers[layer].requested     = true;
+    ++m_stats.requests;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_decodeQueue.push_back({layer, path});
+    }
+    m_wakeCondition.notify_one();
+}
+
+void TextureStreamer::setScreenSize(uint32_t layer, float pixels)
+{
+    if (layer < m_layers.size())
+    {
+        m_layers[layer].screenPixels = std::max(m_layers[layer].screenPixels, pixels);
+    }
+}
+
+bool TextureStreamer::update()
+{
+    m_stats.frameUploads = 0;
+    m_stats.frameBytes   = 0;
+
+    // Take the images decoded since the last frame, and have the largest on screen decoded next
+    std::vector<DecodedImage> decodedImages;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        decodedImages.swap(m_decodedImages);
+        std::sort(m_decodeQueue.begin(),
+                  m_decodeQueue.end(),
+                  [this](const DecodeRequest& a, const DecodeRequest& b)
+                  {
+                      return m_layers[a.layer].screenPixels < m_layers[b.layer].screenPixels;
+                  });
+    }
+    for (DecodedImage& image : decodedImages)
+    {
+        Layer& layer = m_layers[image.layer];
+        m_stats.decodeMilliseconds += image.milliseconds;
+        if (!image.ok)
+        {
+            std::cerr << "Could not load texture " << layer.path << "!" << std::endl;
+            layer.failed = true;
+            ++m_stats.failures;
+            continue;
+        }
+        layer.decoded = true;
+        layer.levels  = std::move(image.levels);
+        ++m_stats.decoded;
+    }
+
+    // One level at a time, first the base levels of every texture, coarsest first, then the finer levels of the
+    // textures that are the largest on screen; a level larger than the budget is uploaded alone
+    bool changed       = false;
+    uint32_t baseLevel = this->baseLevel();
+    while (true)
+    {
+        uint32_t best   = UINT32_MAX;
+        bool bestIsBase = false;
+        for (uint32_t index = 0; index < static_cast<uint32_t>(m_layers.size()); ++index)
+        {
+            const Layer& layer = m_layers[index];
+            if (!layer.decoded || layer.residentLevel == 0 || layer.residentLevel <= targetLevel(layer))
+                continue;
+
+            bool isBase = layer.residentLevel > baseLevel;
+            if (best == UINT32_MAX || (isBase && !bestIsBase)
+                || (isBase && bestIsBase && layer.residentLevel > m_layers[best].residentLevel)
+                || (!isBase && !bestIsBase && layer.screenPixels > m_layers[best].screenPixels))
+            {
+                best       = index;
+                bestIsBase = isBase;
+            }
+        }
+        if (best == UINT32_MAX)
+            break;
+
+        uint32_t level = m_layers[best].residentLevel - 1;
+        uint64_t bytes = m_layers[best].levels[level].size();
+        if (m_stats.frameUploads > 0 && bytes > m_uploads->remainingBudget())
+            break;
+        uploadLevel(best, level);
+        changed = true;
+    }
+
+    // Sizes are those of the frame being drawn, they are set again by the next one
+    for (Layer& layer : m_layers)
+    {
+        layer.screenPixels = 0.0f;
+    }
+    return changed;
+}
+
+uint32_t TextureStreamer::residentLevel(uint32_t layer) const
+{
+    if (layer >= m_layers.size() || !m_layers[layer].requested)
+        return m_mipLevelCount;
+    return m_layers[layer].residentLevel;
+}
+
+bool TextureStreamer::busy() const
+{
+    for (const Layer& layer : m_layers)
+    {
+        if (layer.requested && !layer.failed && (!layer.decoded || layer.residentLevel > targetLevel(layer)))
+            return true;
+    }
+    return false;
+}
+
+void TextureStreamer::workerLoop()
+{
+    while (true)
+    {
+        DecodeRequest request;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeCondition.wait(lock, [this]() { return m_stopping || !m_decodeQueue.empty(); });
+            if (m_stopping)
+                return;
+            request = std::move(m_decodeQueue.back());
+            m_decodeQueue.pop_back();
+        }
+
+        auto startTime = std::chrono::steady_clock::now();
+        DecodedImage image;
+        image.layer = request.layer;
+        image.ok    = ResourceManager::loadTextureLevels(
+            request.path, m_width, m_height, m_mipLevelCount, image.levels);
+        image.milliseconds =
+            std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_decodedImages.push_back(std::move(image));
+    }
+}
+
+uint32_t TextureStreamer::baseLevel() const
+{
+    uint32_t size  = std::max(m_width, m_height);
+    uint32_t level = 0;
+    while (level + 1 < m_mipLevelCount && (size >> level) > kBaseLevelSize)
+    {
+        ++level;
+    }
+    return level;
+}
+
+uint32_t TextureStreamer::targetLevel(const Layer& layer) const
+{
+    if (layer.screenPixels <= 0.0f)
+        return baseLevel();
+
+    // About one texel per pixel, the texture being assumed to cover the object once
+    float level = std::floor(std::log2(std::max(m_width, m_height) / layer.screenPixels));
+    return std::min(static_cast<uint32_t>(std::max(level, 0.0f)), baseLevel());
+}
+
+void TextureStreamer::uploadLevel(uint32_t layerIndex, uint32_t level)
+{
+    Layer& layer = m_layers[layerIndex];
+
+    ImageCopyTexture destination;
+    destination.texture  = m_pool->texture();
+    destination.mipLevel = level;
+    destination.origin   = {0, 0, layerIndex};
+    destination.aspect   = TextureAspect::All;
+
+    Extent3D size = {std::max(m_width >> level, 1u), std::max(m_height >> level, 1u), 1};
+    TextureDataLayout source;
+    source.offset       = 0;
+    source.bytesPerRow  = 4 * size.width;
+    source.rowsPerImage = size.height;
+
+    const std::vector<unsigned char>& pixels = layer.levels[level];
+    m_uploads->writeTexture(destination, pixels.data(), source, size);
+
+    layer.residentLevel = level;
+    ++m_stats.frameUploads;
+    m_stats.frameBytes += pixels.size();
+    m_stats.uploadedBytes += pixels.size();
+    if (level == 0)
+    {
+        // Nothing left to upload, the CPU copy can go
+        layer.levels.clear();
+        layer.levels.shrink_to_fit();
+        ++m_stats.completeLayers;
+    }
+}
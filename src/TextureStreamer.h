@@ -0,0 +1,118 @@
+#pragma once
+
+#include "TextureArrayPool.h"
+#include "UploadManager.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <webgpu/webgpu.hpp>
+
+/**
+ * Fills the layers of a TextureArrayPool progressively, so that the first
+ * frames do not wait for the textures. Images are decoded and mip-mapped by a
+ * background thread, then their levels are uploaded from the smallest to the
+ * largest, within the frame budget of the UploadManager. The smallest levels
+ * of every texture come first; finer levels follow for the textures that
+ * cover the most of the screen, and only down to the level their screen size
+ * calls for.
+ * Until a level is uploaded, sampling is clamped to the finest resident one.
+ */
+class TextureStreamer
+{
+public:
+    struct Stats
+    {
+        uint32_t requests        = 0;
+        uint32_t decoded         = 0;  // images ready to upload, or uploaded
+        uint32_t failures        = 0;  // images that could not be loaded
+        uint32_t completeLayers  = 0;  // layers with all their levels resident
+        uint32_t frameUploads    = 0;  // levels uploaded by the last update()
+        uint64_t frameBytes      = 0;
+        uint64_t uploadedBytes   = 0;
+        float decodeMilliseconds = 0.0f;  // spent by the background thread
+    };
+
+    // Layers are allocated by the caller from `pool`, which must outlive the streamer, as must `uploads`
+    void init(TextureArrayPool* pool, UploadManager* uploads);
+    void terminate();
+
+    // Queue the image at `path` for a layer of the pool, which is not resident until its smallest levels are uploaded
+    void request(const std::filesystem::path& path, uint32_t layer);
+    // Screen size in pixels of an object sampling the layer in this frame, the largest one counts
+    void setScreenSize(uint32_t layer, float pixels);
+
+    // Upload the next levels within what is left of the upload budget, and forget the screen sizes of the frame
+    // Returns true when the resident levels of a layer changed.
+    bool update();
+
+    // Finest mip level uploaded for the layer, TextureArrayPool::mipLevelCount() while none is
+    uint32_t residentLevel(uint32_t layer) const;
+    bool isResident(uint32_t layer) const
+    {
+        return residentLevel(layer) < m_pool->mipLevelCount();
+    }
+    // Whether some requested level is still to be decoded or uploaded
+    bool busy() const;
+
+    const Stats& stats() const
+    {
+        return m_stats;
+    }
+
+private:
+    struct Layer
+    {
+        std::filesystem::path path;
+        uint32_t residentLevel = UINT32_MAX;  // set to the level count by request()
+        float screenPixels     = 0.0f;
+        bool requested         = false;
+        bool decoded           = false;
+        bool failed            = false;
+        std::vector<std::vector<unsigned char>> levels;  // released once all of them are resident
+    };
+
+    struct DecodeRequest
+    {
+        uint32_t layer;
+        std::filesystem::path path;
+    };
+
+    struct DecodedImage
+    {
+        uint32_t layer = 0;
+        bool ok        = false;
+        std::vector<std::vector<unsigned char>> levels;
+        float milliseconds = 0.0f;
+    };
+
+    void workerLoop();
+    // Coarsest level larger than kBaseLevelSize
+    uint32_t baseLevel() const;
+    // Level the layer should be refined to, given its screen size
+    uint32_t targetLevel(const Layer& layer) const;
+    void uploadLevel(uint32_t layerIndex, uint32_t level);
+
+private:
+    // Levels up to this size are uploaded for every texture, visible or not
+    static constexpr uint32_t kBaseLevelSize = 64;
+
+    TextureArrayPool* m_pool = nullptr;
+    UploadManager* m_uploads = nullptr;
+    std::vector<Layer> m_layers;
+    Stats m_stats;
+
+    // Shared with the background thread
+    std::thread m_worker;
+    std::mutex m_mutex;
+    std::condition_variable m_wakeCondition;
+    std::vector<DecodeRequest> m_decodeQueue;  // sorted so that the largest on screen is decoded first
+    std::vector<DecodedImage> m_decodedImages;
+    uint32_t m_width         = 0;
+    uint32_t m_height        = 0;
+    uint32_t m_mipLevelCount = 0;
+    bool m_stopping          = false;
+};
@@ -0,0 +1,95 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(uint32_t workerCount)
+{
+    m_workers.reserve(workerCount);
+    for (uint32_t i = 0; i < workerCount; ++i)
+    {
+        m_workers.emplace_back([this]() { workerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wakeCondition.notify_all();
+    for (std::thread& worker : m_workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::parallelFor(uint32_t count, const std::function<void(uint32_t)>& task)
+{
+    if (count == 0)
+        return;
+
+    if (m_workers.empty() || count == 1)
+    {
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            task(i);
+        }
+        return;
+    }
+
+    uint32_t generation;
+    {
+        // A worker that woke up late for the previous call may still be in runTasks(), the counters are reset once
+        // it has left, and those entering afterwards see the new generation
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_doneCondition.wait(lock, [this]() { return m_activeWorkers == 0; });
+        generation = ++m_generation;
+        m_task.store(&task);
+        m_taskCount.store(count);
+        m_remainingTasks.store(count);
+        m_nextTask.store(uint64_t(generation) << 32);
+    }
+    m_wakeCondition.notify_all();
+
+    runTasks(generation);
+
+    // Workers still in runTasks() would claim iterations of the next call while its counters are reset
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_doneCondition.wait(lock, [this]() { return m_remainingTasks.load() == 0 && m_activeWorkers == 0; });
+    m_task.store(nullptr);
+}
+
+void ThreadPool::workerLoop()
+{
+    uint32_t seenGeneration = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeCondition.wait(lock, [&]() { return m_stopping || m_generation != seenGeneration; });
+            if (m_stopping)
+                return;
+            seenGeneration = m_generation;
+            ++m_activeWorkers;
+        }
+        runTasks(seenGeneration);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_activeWorkers == 0)
+            m_doneCondition.notify_one();
+    }
+}
+
+void ThreadPool::runTasks(uint32_t generation)
+{
+    // Iterations are handed out one at a time, so uneven tasks balance themselves; the generation is compared in
+    // the same word, so that an iteration is never claimed for a call that is not the current one
+    uint64_t next = m_nextTask.load();
+    while ((next >> 32) == generation && static_cast<uint32_t>(next) < m_taskCount.load())
+    {
+        if (!m_nextTask.compare_exchange_weak(next, next + 1))
+            continue;
+        (*m_task.load())(static_cast<uint32_t>(next));
+        m_remainingTasks.fetch_sub(1);
+        next = m_nextTask.load();
+    }
+}
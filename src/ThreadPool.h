@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed set of worker threads that execute the iterations of a parallel
+ * loop. The calling thread takes part in the loop, so a pool created with
+ * N threads runs N + 1 iterations concurrently.
+ */
+class ThreadPool
+{
+public:
+    explicit ThreadPool(uint32_t workerCount);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&)            = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Number of threads taking part in a parallelFor, including the caller
+    uint32_t concurrency() const
+    {
+        return static_cast<uint32_t>(m_workers.size()) + 1;
+    }
+
+    // Call task(i) for every i in [0, count) and return once all calls are done
+    void parallelFor(uint32_t count, const std::function<void(uint32_t)>& task);
+
+private:
+    void workerLoop();
+    // Claims iterations while the call of `generation` is the current one
+    void runTasks(uint32_t generation);
+
+private:
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeCondition;
+    std::condition_variable m_doneCondition;
+
+    // Read by the workers without holding the mutex
+    std::atomic<const std::function<void(uint32_t)>*> m_task {nullptr};
+    std::atomic<uint32_t> m_taskCount {0};
+    std::atomic<uint64_t> m_nextTask {0};  // generation of the call in the high bits, next iteration in the low ones
+    std::atomic<uint32_t> m_remainingTasks {0};
+
+    uint32_t m_generation    = 0;
+    uint32_t m_activeWorkers = 0;  // inside runTasks(), counted under the mutex
+    bool m_stopping          = false;
+};
@@ -0,0 +1,273 @@
+#include "UploadManager.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace wgpu;
+
+namespace
+{
+    // Of the bytesPerRow of buffer to texture copies
+    constexpr uint64_t kRowAlignment  = 256;
+    constexpr uint64_t kBytesPerTexel = 4;
+
+    uint64_t alignUp(uint64_t value, uint64_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}  // namespace
+
+void UploadManager::init(Device device, GpuMemoryTracker* memory, uint64_t stagingBufferSize)
+{
+    m_device      = device;
+    m_queue       = device.getQueue();
+    m_memory      = memory;
+    m_stagingSize = alignUp(stagingBufferSize, kRowAlignment);
+    m_stats       = Stats();
+    m_rateStart   = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < kInitialStagingBuffers; ++i)
+    {
+        addStagingBuffer();
+    }
+}
+
+void UploadManager::terminate()
+{
+    if (m_encoder)
+    {
+        m_encoder.release();
+        m_encoder = nullptr;
+    }
+    // Destroying a buffer aborts its pending mapping, whose callback must still be alive then
+    for (std::unique_ptr<StagingBuffer>& staging : m_ring)
+    {
+        m_memory->destroy(staging->buffer);
+    }
+    m_ring.clear();
+    m_current       = 0;
+    m_pendingCopies = 0;
+    m_pendingBytes  = 0;
+    if (m_queue)
+    {
+        m_queue.release();
+        m_queue = nullptr;
+    }
+}
+
+void UploadManager::writeBuffer(Buffer buffer, uint64_t offset, const void* data, uint64_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    while (size > 0)
+    {
+        uint64_t chunk = std::min(size, m_stagingSize);
+        Region region  = allocate(chunk, 4);
+        if (!region.staging)
+        {
+            // After the copies recorded so far, which the queue write would otherwise overtake
+            submit();
+            m_queue.writeBuffer(buffer, offset, bytes, size);
+            ++m_stats.directWrites;
+            m_pendingBytes += size;
+            return;
+        }
+        std::memcpy(region.staging->mapped + region.offset, bytes, chunk);
+        encoder().copyBufferToBuffer(region.staging->buffer, region.offset, buffer, offset, chunk);
+        ++m_pendingCopies;
+        m_pendingBytes += chunk;
+
+        bytes += chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+}
+
+void UploadManager::writeTexture(const ImageCopyTexture& destination,
+                                 const void* data,
+                                 const TextureDataLayout& layout,
+                                 const Extent3D& size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data) + layout.offset;
+    uint64_t rowBytes          = kBytesPerTexel * size.width;
+    uint64_t stagingRowBytes   = alignUp(rowBytes, kRowAlignment);
+    uint32_t maxRows           = static_cast<uint32_t>(std::max<uint64_t>(m_stagingSize / stagingRowBytes, 1));
+    for (uint32_t z = 0; z < size.depthOrArrayLayers; ++z)
+    {
+        // As many rows per copy as fit in a staging buffer
+        for (uint32_t firstRow = 0; firstRow < size.height;)
+        {
+            uint32_t rows               = std::min(size.height - firstRow, maxRows);
+            const unsigned char* source = bytes + (uint64_t(z) * layout.rowsPerImage + firstRow) * layout.bytesPerRow;
+            Extent3D chunkSize          = {size.width, rows, 1};
+
+            ImageCopyTexture chunkDestination = destination;
+            chunkDestination.origin.y += firstRow;
+            chunkDestination.origin.z += z;
+
+            Region region = allocate(stagingRowBytes * rows, kRowAlignment);
+            if (!region.staging)
+            {
+                submit();
+                TextureDataLayout chunkLayout = layout;
+                chunkLayout.offset            = 0;
+                chunkLayout.rowsPerImage      = rows;
+                m_queue.writeTexture(
+                    chunkDestination, source, uint64_t(rows) * layout.bytesPerRow, chunkLayout, chunkSize);
+                ++m_stats.directWrites;
+                m_pendingBytes += rows * rowBytes;
+                firstRow += rows;
+                continue;
+            }
+            for (uint32_t row = 0; row < rows; ++row)
+            {
+                std::memcpy(region.staging->mapped + region.offset + row * stagingRowBytes,
+                            source + uint64_t(row) * layout.bytesPerRow,
+                            rowBytes);
+            }
+
+            ImageCopyBuffer chunkSource;
+            chunkSource.buffer              = region.staging->buffer;
+            chunkSource.layout.offset       = region.offset;
+            chunkSource.layout.bytesPerRow  = static_cast<uint32_t>(stagingRowBytes);
+            chunkSource.layout.rowsPerImage = rows;
+            encoder().copyBufferToTexture(chunkSource, chunkDestination, chunkSize);
+            ++m_pendingCopies;
+            m_pendingBytes += rows * rowBytes;
+            firstRow += rows;
+        }
+    }
+}
+
+void UploadManager::flush()
+{
+    submit();
+
+    m_stats.frameCopies = m_pendingCopies;
+    m_stats.frameBytes  = m_pendingBytes;
+    m_stats.totalBytes += m_pendingBytes;
+    m_rateBytes += m_pendingBytes;
+    m_pendingCopies = 0;
+    m_pendingBytes  = 0;
+
+    auto now      = std::chrono::steady_clock::now();
+    float seconds = std::chrono::duration<float>(now - m_rateStart).count();
+    if (seconds >= 1.0f)
+    {
+        m_stats.megabytesPerSecond = m_rateBytes / (1024.0f * 1024.0f) / seconds;
+        m_rateBytes                = 0;
+        m_rateStart                = now;
+    }
+}
+
+void UploadManager::setFrameBudget(uint64_t bytes)
+{
+    m_frameBudget = bytes;
+}
+
+uint64_t UploadManager::remainingBudget() const
+{
+    return m_pendingBytes < m_frameBudget ? m_frameBudget - m_pendingBytes : 0;
+}
+
+UploadManager::Region UploadManager::allocate(uint64_t size, uint64_t alignment)
+{
+    // From the buffer filled last, so that a frame uses as few of them as possible
+    for (uint32_t i = 0; i < static_cast<uint32_t>(m_ring.size()); ++i)
+    {
+        uint32_t index         = (m_current + i) % static_cast<uint32_t>(m_ring.size());
+        StagingBuffer& staging = *m_ring[index];
+        if (!staging.mapped)
+            continue;
+        uint64_t offset = alignUp(staging.used, alignment);
+        if (offset + size <= m_stagingSize)
+        {
+            staging.used = offset + size;
+            m_current    = index;
+            return {&staging, offset};
+        }
+    }
+
+    // Every buffer is full or still in flight
+    ++m_stats.stalls;
+    StagingBuffer* staging = addStagingBuffer();
+    if (!staging)
+        return {};
+    m_current     = static_cast<uint32_t>(m_ring.size()) - 1;
+    staging->used = size;
+    return {staging, 0};
+}
+
+UploadManager::StagingBuffer* UploadManager::addStagingBuffer()
+{
+    if (m_ring.size() >= kMaxStagingBuffers || !m_memory->fits(m_stagingSize))
+        return nullptr;
+
+    BufferDescriptor bufferDesc;
+    bufferDesc.label            = "Staging";
+    bufferDesc.size             = m_stagingSize;
+    bufferDesc.usage            = BufferUsage::MapWrite | BufferUsage::CopySrc;
+    bufferDesc.mappedAtCreation = true;
+    Buffer buffer               = m_memory->createBuffer(m_device, bufferDesc, GpuMemoryTracker::Category::Staging);
+    if (!buffer)
+        return nullptr;
+
+    auto staging    = std::make_unique<StagingBuffer>();
+    staging->buffer = buffer;
+    staging->mapped = static_cast<unsigned char*>(buffer.getMappedRange(0, m_stagingSize));
+    m_ring.push_back(std::move(staging));
+    m_stats.stagingBuffers = static_cast<uint32_t>(m_ring.size());
+    return m_ring.back().get();
+}
+
+CommandEncoder UploadManager::encoder()
+{
+    if (!m_encoder)
+    {
+        CommandEncoderDescriptor encoderDesc;
+        encoderDesc.label = "Uploads";
+        m_encoder         = m_device.createCommandEncoder(encoderDesc);
+    }
+    return m_encoder;
+}
+
+void UploadManager::submit()
+{
+    if (!m_encoder)
+        return;
+
+    // Copies may only read from unmapped buffers
+    std::vector<StagingBuffer*> submitted;
+    for (std::unique_ptr<StagingBuffer>& staging : m_ring)
+    {
+        if (staging->mapped && staging->used > 0)
+        {
+            staging->buffer.unmap();
+            staging->mapped = nullptr;
+            submitted.push_back(staging.get());
+        }
+    }
+
+    CommandBufferDescriptor commandBufferDesc;
+    commandBufferDesc.label = "Uploads";
+    CommandBuffer command   = m_encoder.finish(commandBufferDesc);
+    m_encoder.release();
+    m_encoder = nullptr;
+    m_queue.submit(command);
+    command.release();
+    ++m_stats.submits;
+
+    // Back in the ring once the copies are done
+    for (StagingBuffer* staging : submitted)
+    {
+        staging->mapCallback = staging->buffer.mapAsync(MapMode::Write,
+                                                        0,
+                                                        m_stagingSize,
+                                                        [this, staging](BufferMapAsyncStatus status)
+                                                        {
+                                                            if (status != BufferMapAsyncStatus::Success)
+                                                                return;
+                                                            staging->mapped = static_cast<unsigned char*>(
+                                                                staging->buffer.getMappedRange(0, m_stagingSize));
+                                                            staging->used = 0;
+                                                        });
+    }
+}
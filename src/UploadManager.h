@@ -0,0 +1,111 @@
+#pragma once
+
+#include "GpuMemoryTracker.h"
+
+#include <webgpu/webgpu.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * Single path for the data sent from the CPU to buffers and textures. Data is
+ * copied into a ring of staging buffers that stay mapped between uses, and
+ * the copies to their destinations are recorded into one command encoder,
+ * submitted by flush() once per frame ahead of the frame's own commands. Once
+ * submitted, a staging buffer is mapped again asynchronously and returns to
+ * the ring. The ring grows when every buffer is in flight, up to a limit past
+ * which uploads fall back to the writes of the queue.
+ *
+ * Uploads that cannot wait, e.g. uniforms, are always made. Those that can be
+ * spread over frames, like texture streaming, ask remainingBudget() first, so
+ * that the bytes uploaded per frame stay within a budget.
+ */
+class UploadManager
+{
+public:
+    struct Stats
+    {
+        uint32_t frameCopies     = 0;  // copies submitted by the last flush()
+        uint64_t frameBytes      = 0;
+        uint64_t totalBytes      = 0;
+        uint32_t submits         = 0;
+        uint32_t stagingBuffers  = 0;
+        uint32_t stalls          = 0;     // allocations that found no mapped staging buffer with room left
+        uint32_t directWrites    = 0;     // uploads made by the queue because no staging buffer could be added
+        float megabytesPerSecond = 0.0f;  // over the last second or so
+    };
+
+    // Staging buffers are allocated through `memory`, which must outlive the manager
+    void init(wgpu::Device device, GpuMemoryTracker* memory, uint64_t stagingBufferSize = 4 * 1024 * 1024);
+    void terminate();
+
+    // Same as the writes of the queue, the data is copied before returning
+    // Sizes and offsets of buffer writes must be multiples of 4, data larger than a staging buffer is split.
+    void writeBuffer(wgpu::Buffer buffer, uint64_t offset, const void* data, uint64_t size);
+    // Rows are repacked to the 256-byte alignment of buffer to texture copies, 4-byte texel formats only
+    void writeTexture(const wgpu::ImageCopyTexture& destination,
+                      const void* data,
+                      const wgpu::TextureDataLayout& layout,
+                      const wgpu::Extent3D& size);
+
+    // Submit the copies recorded so far, to be called before submitting commands that read their destinations
+    // The staging buffers they used are mapped again asynchronously, polled with the other callbacks of the device.
+    void submit();
+    // Submit, and close the statistics and the budget of the frame, once per frame
+    void flush();
+
+    uint64_t frameBudget() const
+    {
+        return m_frameBudget;
+    }
+    void setFrameBudget(uint64_t bytes);
+    // Bytes that may still be uploaded before the next flush() without going over the budget
+    uint64_t remainingBudget() const;
+
+    const Stats& stats() const
+    {
+        return m_stats;
+    }
+
+private:
+    struct StagingBuffer
+    {
+        wgpu::Buffer buffer   = nullptr;
+        unsigned char* mapped = nullptr;  // null while in flight
+        uint64_t used         = 0;
+        std::unique_ptr<wgpu::BufferMapCallback> mapCallback;
+    };
+
+    struct Region
+    {
+        StagingBuffer* staging = nullptr;
+        uint64_t offset        = 0;
+    };
+
+    // Room for `size` bytes at `alignment` in a mapped staging buffer, adding one to the ring if needed
+    Region allocate(uint64_t size, uint64_t alignment);
+    StagingBuffer* addStagingBuffer();
+    wgpu::CommandEncoder encoder();
+
+private:
+    static constexpr uint32_t kInitialStagingBuffers = 3;
+    static constexpr uint32_t kMaxStagingBuffers     = 16;
+
+    wgpu::Device m_device          = nullptr;
+    wgpu::Queue m_queue            = nullptr;
+    GpuMemoryTracker* m_memory     = nullptr;
+    uint64_t m_stagingSize         = 0;
+    uint64_t m_frameBudget         = 4 * 1024 * 1024;
+    wgpu::CommandEncoder m_encoder = nullptr;  // created by the first copy after a submit
+    // Owned through pointers that the map callbacks keep
+    std::vector<std::unique_ptr<StagingBuffer>> m_ring;
+    uint32_t m_current = 0;  // where the search for room starts
+
+    uint32_t m_pendingCopies = 0;
+    uint64_t m_pendingBytes  = 0;
+    std::chrono::steady_clock::time_point m_rateStart;
+    uint64_t m_rateBytes = 0;
+    Stats m_stats;
+};
@@ -0,0 +1,532 @@
+#include "VirtualTextures.h"
+#include "ResourceManager.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+
+using namespace wgpu;
+
+namespace
+{
+    constexpr uint64_t kNoTile = UINT64_MAX;
+
+    // Page table texel, as read by the shader: slot column, slot row, level of the cached page, and whether it is set
+    uint32_t pageTableEntry(uint32_t slotX, uint32_t slotY, uint32_t level)
+    {
+        return slotX | (slotY << 8) | (level << 16) | (1u << 24);
+    }
+}  // namespace
+
+bool VirtualTextures::init(Device device, GpuMemoryTracker* memory, UploadManager* uploads)
+{
+    m_device  = device;
+    m_memory  = memory;
+    m_uploads = uploads;
+    m_slots.assign(kCacheSlots * kCacheSlots, Slot());
+    m_stats = Stats();
+
+    TextureDescriptor textureDesc;
+    textureDesc.label           = "Virtual texture cache";
+    textureDesc.dimension       = TextureDimension::_2D;
+    textureDesc.format          = TextureFormat::RGBA8Unorm;
+    textureDesc.mipLevelCount   = 1;
+    textureDesc.sampleCount     = 1;
+    textureDesc.size            = {kCacheSize, kCacheSize, 1};
+    textureDesc.usage           = TextureUsage::TextureBinding | TextureUsage::CopyDst;
+    textureDesc.viewFormatCount = 0;
+    textureDesc.viewFormats     = nullptr;
+    m_cache                     = m_memory->createTexture(m_device, textureDesc, GpuMemoryTracker::Category::Textures);
+
+    // Zero texels are unset entries, until a page is uploaded
+    textureDesc.label         = "Virtual texture page tables";
+    textureDesc.format        = TextureFormat::RGBA8Uint;
+    textureDesc.mipLevelCount = kMaxLevels;
+    textureDesc.size          = {kMaxPages, kMaxPages, kMaxTextures};
+    m_pageTable               = m_memory->createTexture(m_device, textureDesc, GpuMemoryTracker::Category::Textures);
+    if (!m_cache || !m_pageTable)
+        return false;
+
+    TextureViewDescriptor viewDesc;
+    viewDesc.label           = "Virtual texture cache";
+    viewDesc.aspect          = TextureAspect::All;
+    viewDesc.baseArrayLayer  = 0;
+    viewDesc.arrayLayerCount = 1;
+    viewDesc.baseMipLevel    = 0;
+    viewDesc.mipLevelCount   = 1;
+    viewDesc.dimension       = TextureViewDimension::_2D;
+    viewDesc.format          = TextureFormat::RGBA8Unorm;
+    m_cacheView              = m_cache.createView(viewDesc);
+
+    viewDesc.label           = "Virtual texture page tables";
+    viewDesc.arrayLayerCount = kMaxTextures;
+    viewDesc.mipLevelCount   = kMaxLevels;
+    viewDesc.dimension       = TextureViewDimension::_2DArray;
+    viewDesc.format          = TextureFormat::RGBA8Uint;
+    m_pageTableView          = m_pageTable.createView(viewDesc);
+
+    BufferDescriptor bufferDesc;
+    bufferDesc.label            = "Virtual texture feedback";
+    bufferDesc.size             = feedbackBytes();
+    bufferDesc.usage            = BufferUsage::Storage | BufferUsage::CopySrc | BufferUsage::CopyDst;
+    bufferDesc.mappedAtCreation = false;
+    m_feedbackBuffer            = m_memory->createBuffer(m_device, bufferDesc, GpuMemoryTracker::Category::Storage);
+
+    bufferDesc.label = "Virtual texture feedback readback";
+    bufferDesc.usage = BufferUsage::MapRead | BufferUsage::CopyDst;
+    m_readbackBuffer = m_memory->createBuffer(m_device, bufferDesc, GpuMemoryTracker::Category::Storage);
+    m_readbackState  = ReadbackState::Idle;
+    return m_feedbackBuffer && m_readbackBuffer;
+}
+
+void VirtualTextures::terminate()
+{
+    // Destroying the readback buffer aborts a pending mapping, whose callback must still be alive then
+    if (m_readbackState == ReadbackState::Mapped)
+        m_readbackBuffer.unmap();
+    m_memory->destroy(m_readbackBuffer);
+    m_memory->destroy(m_feedbackBuffer);
+    m_mapCallback.reset();
+    m_readbackState = ReadbackState::Idle;
+
+    if (m_pageTableView)
+        m_pageTableView.release();
+    if (m_cacheView)
+        m_cacheView.release();
+    m_pageTableView = nullptr;
+    m_cacheView     = nullptr;
+    m_memory->destroy(m_pageTable);
+    m_memory->destroy(m_cache);
+
+    // Waits for the images still being cut, then removes their tile stores
+    for (Texture& texture : m_textures)
+    {
+        if (texture.loading.valid())
+            texture.loading.wait();
+        texture.tileStore.close();
+        std::error_code error;
+        std::filesystem::remove(texture.tileStorePath, error);
+    }
+    m_textures.clear();
+    m_slots.clear();
+    m_residentTiles.clear();
+    m_requestedTiles.clear();
+}
+
+uint32_t VirtualTextures::load(const std::filesystem::path& path)
+{
+    for (uint32_t index = 0; index < static_cast<uint32_t>(m_textures.size()); ++index)
+    {
+        if (m_textures[index].path == path)
+            return index;
+    }
+    uint32_t width, height;
+    if (m_textures.size() >= kMaxTextures || !ResourceManager::imageSize(path, width, height))
+        return kInvalid;
+
+    // A power of two of pages per side, so that each level has half the pages of the previous one
+    Texture texture;
+    texture.path = path;
+    while (texture.pagesX < kMaxPages && texture.pagesX * kTileSize < width)
+    {
+        texture.pagesX *= 2;
+    }
+    while (texture.pagesY < kMaxPages && texture.pagesY * kTileSize < height)
+    {
+        texture.pagesY *= 2;
+    }
+    while ((std::max(texture.pagesX, texture.pagesY) >> texture.levelCount) > 0)
+    {
+        ++texture.levelCount;
+    }
+
+    // Named after the time, so that instances of the application do not share tile stores
+    std::error_code error;
+    auto now              = std::chrono::system_clock::now().time_since_epoch().count();
+    std::string name      = "virtual-texture-" + std::to_string(now) + "-" + std::to_string(m_textures.size());
+    texture.tileStorePath = std::filesystem::temp_directory_path(error) / (name + ".tiles");
+
+    std::filesystem::path tileStorePath = texture.tileStorePath;
+    uint32_t pagesX                     = texture.pagesX;
+    uint32_t pagesY                     = texture.pagesY;
+    uint32_t levelCount                 = texture.levelCount;
+    texture.loading                     = std::async(std::launch::async,
+                                 [path, tileStorePath, pagesX, pagesY, levelCount]()
+                                 { return cutTiles(path, tileStorePath, pagesX, pagesY, levelCount); });
+    m_textures.push_back(std::move(texture));
+    m_stats.textures = static_cast<uint32_t>(m_textures.size());
+    return m_stats.textures - 1;
+}
+
+glm::uvec4 VirtualTextures::shaderParams(uint32_t texture) const
+{
+    if (texture >= m_textures.size())
+        return glm::uvec4(kInvalid, 0, 0, 0);
+    const Texture& t = m_textures[texture];
+    return glm::uvec4(texture, t.pagesX, t.pagesY, t.levelCount);
+}
+
+void VirtualTextures::encodeFeedback(CommandEncoder encoder)
+{
+    if (m_textures.empty() || m_readbackState != ReadbackState::Idle)
+        return;
+    encoder.copyBufferToBuffer(m_feedbackBuffer, 0, m_readbackBuffer, 0, feedbackBytes());
+    encoder.clearBuffer(m_feedbackBuffer, 0, feedbackBytes());
+    m_readbackState = ReadbackState::Copied;
+}
+
+void VirtualTextures::onSubmitted()
+{
+    if (m_readbackState != ReadbackState::Copied)
+        return;
+    m_readbackState = ReadbackState::Mapping;
+    m_mapCallback   = m_readbackBuffer.mapAsync(MapMode::Read,
+                                              0,
+                                              feedbackBytes(),
+                                              [this](BufferMapAsyncStatus status)
+                                              {
+                                                  m_readbackState = status == BufferMapAsyncStatus::Success
+                                                                        ? ReadbackState::Mapped
+                                                                        : ReadbackState::Idle;
+                                              });
+}
+
+bool VirtualTextures::update()
+{
+    m_stats.frameUploads = 0;
+
+    // Images decoded since the last frame, their coarsest page is pinned so that lookups always find one
+    for (uint32_t index = 0; index < static_cast<uint32_t>(m_textures.size()); ++index)
+    {
+        Texture& texture = m_textures[index];
+        if (texture.ready || texture.failed
+            || texture.loading.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            continue;
+
+        if (texture.loading.get())
+            texture.tileStore.open(texture.tileStorePath, std::ios::binary);
+        if (!texture.tileStore)
+        {
+            std::cerr << "Could not load virtual texture " << texture.path << "!" << std::endl;
+            texture.failed = true;
+            std::error_code error;
+            std::filesystem::remove(texture.tileStorePath, error);
+            continue;
+        }
+        texture.ready = true;
+        uint32_t slot = allocateSlot();
+        if (slot == kInvalid)
+            continue;
+        if (uploadTile(tileKey(index, texture.levelCount - 1, 0, 0), slot))
+            m_slots[slot].pinned = true;
+    }
+
+    // Map callbacks only run while the device is polled, which the application does not do when idle
+    if (m_readbackState == ReadbackState::Mapping)
+    {
+#if defined(WEBGPU_BACKEND_DAWN)
+        m_device.tick();
+#elif defined(WEBGPU_BACKEND_WGPU)
+        m_device.poll(false);
+#endif
+    }
+    if (m_readbackState == ReadbackState::Mapped)
+    {
+        readFeedback();
+    }
+
+    // Missing pages, coarsest first so that the fallback of the finer ones improves along the way
+    size_t next = 0;
+    while (next < m_requestedTiles.size() && m_stats.frameUploads < m_maxUploadsPerFrame
+           && (m_stats.frameUploads == 0 || kSlotBytes <= m_uploads->remainingBudget()))
+    {
+        uint64_t tile = m_requestedTiles[next];
+        if (m_residentTiles.count(tile) > 0)
+        {
+            ++next;
+            continue;
+        }
+        uint32_t slot = allocateSlot();
+        if (slot == kInvalid)
+        {
+            // Every slot holds a page of the last feedback, the others are drawn from coarser levels
+            next = m_requestedTiles.size();
+            break;
+        }
+        uploadTile(tile, slot);
+        ++next;
+    }
+    m_requestedTiles.erase(m_requestedTiles.begin(), m_requestedTiles.begin() + next);
+
+    bool changed = false;
+    for (uint32_t index = 0; index < static_cast<uint32_t>(m_textures.size()); ++index)
+    {
+        if (m_textures[index].pageTableChanged)
+        {
+            writePageTable(index);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+bool VirtualTextures::busy() const
+{
+    for (const Texture& texture : m_textures)
+    {
+        if (!texture.ready && !texture.failed)
+            return true;
+    }
+    return !m_requestedTiles.empty();
+}
+
+void VirtualTextures::setMaxUploadsPerFrame(uint32_t count)
+{
+    m_maxUploadsPerFrame = std::max(count, 1u);
+}
+
+uint64_t VirtualTextures::tileKey(uint32_t texture, uint32_t level, uint32_t x, uint32_t y)
+{
+    return (uint64_t(texture) << 56) | (uint64_t(level) << 48) | (uint64_t(y) << 24) | x;
+}
+
+uint64_t VirtualTextures::storedTileIndex(uint32_t pagesX, uint32_t pagesY, uint32_t level, uint32_t x, uint32_t y)
+{
+    uint64_t index = 0;
+    for (uint32_t l = 0; l < level; ++l)
+    {
+        index += uint64_t(std::max(pagesX >> l, 1u)) * std::max(pagesY >> l, 1u);
+    }
+    return index + uint64_t(y) * std::max(pagesX >> level, 1u) + x;
+}
+
+bool VirtualTextures::cutTiles(const std::filesystem::path& path,
+                               const std::filesystem::path& tileStorePath,
+                               uint32_t pagesX,
+                               uint32_t pagesY,
+                               uint32_t levelCount)
+{
+    std::ofstream tileStore(tileStorePath, std::ios::binary | std::ios::trunc);
+    if (!tileStore)
+        return false;
+
+    // Levels are cut one at a time in the order of storedTileIndex(), only the level being cut is kept
+    std::vector<unsigned char> pixels(kSlotBytes);
+    bool loaded = ResourceManager::loadTextureLevels(
+        path,
+        pagesX * kTileSize,
+        pagesY * kTileSize,
+        levelCount,
+        [&](uint32_t level, std::vector<unsigned char> image)
+        {
+            for (uint32_t y = 0; y < std::max(pagesY >> level, 1u); ++y)
+            {
+                for (uint32_t x = 0; x < std::max(pagesX >> level, 1u); ++x)
+                {
+                    cutTile(image, pagesX, pagesY, level, x, y, pixels.data());
+                    tileStore.write(reinterpret_cast<const char*>(pixels.data()), kSlotBytes);
+                }
+            }
+            return static_cast<bool>(tileStore);
+        });
+    tileStore.close();
+    return loaded && tileStore;
+}
+
+void VirtualTextures::cutTile(const std::vector<unsigned char>& image,
+                              uint32_t pagesX,
+                              uint32_t pagesY,
+                              uint32_t level,
+                              uint32_t x,
+                              uint32_t y,
+                              unsigned char* pixels)
+{
+    uint64_t width  = std::max((pagesX * kTileSize) >> level, 1u);
+    uint64_t height = std::max((pagesY * kTileSize) >> level, 1u);
+    uint64_t spanX  = std::max(pagesX >> level, 1u) * kTileSize;
+    uint64_t spanY  = std::max(pagesY >> level, 1u) * kTileSize;
+    for (uint32_t j = 0; j < kSlotSize; ++j)
+    {
+        // Shifted by a whole span to stay positive in the border
+        uint64_t sourceY = (spanY + y * kTileSize + j - kBorder) * height / spanY % height;
+        for (uint32_t i = 0; i < kSlotSize; ++i)
+        {
+            uint64_t sourceX = (spanX + x * kTileSize + i - kBorder) * width / spanX % width;
+            std::copy_n(&image[4 * (sourceY * width + sourceX)], 4, &pixels[4 * (j * kSlotSize + i)]);
+        }
+    }
+}
+
+uint32_t VirtualTextures::levelOffset(uint32_t level)
+{
+    uint32_t offset = 0;
+    for (uint32_t l = 0; l < level; ++l)
+    {
+        offset += (kMaxPages >> l) * (kMaxPages >> l);
+    }
+    return offset;
+}
+
+void VirtualTextures::readFeedback()
+{
+    const uint32_t* words = static_cast<const uint32_t*>(m_readbackBuffer.getConstMappedRange(0, feedbackBytes()));
+    ++m_feedbackFrame;
+    m_requestedTiles.clear();
+    m_stats.requestedTiles = 0;
+    for (uint32_t index = 0; index < static_cast<uint32_t>(m_textures.size()); ++index)
+    {
+        const Texture& texture = m_textures[index];
+        if (!texture.ready)
+            continue;
+        for (uint32_t level = 0; level < texture.levelCount; ++level)
+        {
+            const uint32_t* levelWords = words + index * kFeedbackWords + levelOffset(level);
+            uint32_t stride            = kMaxPages >> level;
+            uint32_t pagesX            = std::max(texture.pagesX >> level, 1u);
+            uint32_t pagesY            = std::max(texture.pagesY >> level, 1u);
+            for (uint32_t y = 0; y < pagesY; ++y)
+            {
+                for (uint32_t x = 0; x < pagesX; ++x)
+                {
+                    if (levelWords[y * stride + x] == 0)
+                        continue;
+                    ++m_stats.requestedTiles;
+                    uint64_t tile = tileKey(index, level, x, y);
+                    auto it       = m_residentTiles.find(tile);
+                    if (it != m_residentTiles.end())
+                    {
+                        m_slots[it->second].lastUsed = m_feedbackFrame;
+                    }
+                    else
+                    {
+                        m_requestedTiles.push_back(tile);
+                    }
+                }
+            }
+        }
+    }
+    m_readbackBuffer.unmap();
+    m_readbackState = ReadbackState::Idle;
+    ++m_stats.readbacks;
+
+    std::stable_sort(m_requestedTiles.begin(),
+                     m_requestedTiles.end(),
+                     [](uint64_t a, uint64_t b)
+                     {
+                         return ((a >> 48) & 0xff) > ((b >> 48) & 0xff);
+                     });
+}
+
+uint32_t VirtualTextures::allocateSlot()
+{
+    uint32_t best = kInvalid;
+    for (uint32_t slot = 0; slot < static_cast<uint32_t>(m_slots.size()); ++slot)
+    {
+        const Slot& candidate = m_slots[slot];
+        if (candidate.tile == kNoTile)
+            return slot;
+        if (candidate.pinned || candidate.lastUsed >= m_feedbackFrame)
+            continue;
+        if (best == kInvalid || candidate.lastUsed < m_slots[best].lastUsed)
+            best = slot;
+    }
+    if (best == kInvalid)
+        return kInvalid;
+
+    uint64_t tile = m_slots[best].tile;
+    m_residentTiles.erase(tile);
+    m_textures[tile >> 56].pageTableChanged = true;
+    m_slots[best]                           = Slot();
+    m_stats.residentTiles                   = static_cast<uint32_t>(m_residentTiles.size());
+    ++m_stats.evictions;
+    return best;
+}
+
+bool VirtualTextures::uploadTile(uint64_t tile, uint32_t slot)
+{
+    uint32_t textureIndex = static_cast<uint32_t>(tile >> 56);
+    uint32_t level        = static_cast<uint32_t>((tile >> 48) & 0xff);
+    uint32_t y            = static_cast<uint32_t>((tile >> 24) & 0xffffff);
+    uint32_t x            = static_cast<uint32_t>(tile & 0xffffff);
+    Texture& texture      = m_textures[textureIndex];
+
+    // The page was cut with its border when the image was loaded
+    uint64_t offset = storedTileIndex(texture.pagesX, texture.pagesY, level, x, y) * kSlotBytes;
+    std::vector<unsigned char> pixels(kSlotBytes);
+    texture.tileStore.seekg(static_cast<std::streamoff>(offset));
+    texture.tileStore.read(reinterpret_cast<char*>(pixels.data()), kSlotBytes);
+    if (!texture.tileStore)
+    {
+        std::cerr << "Could not read a page of virtual texture " << texture.path << "!" << std::endl;
+        texture.tileStore.clear();
+        return false;
+    }
+
+    ImageCopyTexture destination;
+    destination.texture  = m_cache;
+    destination.mipLevel = 0;
+    destination.origin   = {(slot % kCacheSlots) * kSlotSize, (slot / kCacheSlots) * kSlotSize, 0};
+    destination.aspect   = TextureAspect::All;
+
+    TextureDataLayout source;
+    source.offset       = 0;
+    source.bytesPerRow  = 4 * kSlotSize;
+    source.rowsPerImage = kSlotSize;
+    m_uploads->writeTexture(destination, pixels.data(), source, {kSlotSize, kSlotSize, 1});
+
+    m_slots[slot].tile       = tile;
+    m_slots[slot].lastUsed   = m_feedbackFrame;
+    m_slots[slot].pinned     = false;
+    m_residentTiles[tile]    = slot;
+    texture.pageTableChanged = true;
+    m_stats.residentTiles    = static_cast<uint32_t>(m_residentTiles.size());
+    ++m_stats.frameUploads;
+    ++m_stats.uploads;
+    return true;
+}
+
+void VirtualTextures::writePageTable(uint32_t textureIndex)
+{
+    Texture& texture = m_textures[textureIndex];
+
+    // From the coarsest level, so that missing pages can take the entry of their parent
+    std::vector<uint32_t> entries;
+    std::vector<uint32_t> parentEntries;
+    for (uint32_t level = texture.levelCount; level-- > 0;)
+    {
+        uint32_t stride = kMaxPages >> level;
+        uint32_t pagesX = std::max(texture.pagesX >> level, 1u);
+        uint32_t pagesY = std::max(texture.pagesY >> level, 1u);
+        entries.assign(stride * stride, 0);
+        for (uint32_t y = 0; y < pagesY; ++y)
+        {
+            for (uint32_t x = 0; x < pagesX; ++x)
+            {
+                auto it = m_residentTiles.find(tileKey(textureIndex, level, x, y));
+                if (it != m_residentTiles.end())
+                {
+                    entries[y * stride + x] = pageTableEntry(it->second % kCacheSlots, it->second / kCacheSlots, level);
+                }
+                else if (!parentEntries.empty())
+                {
+                    entries[y * stride + x] = parentEntries[(y / 2) * (stride / 2) + x / 2];
+                }
+            }
+        }
+
+        ImageCopyTexture destination;
+        destination.texture  = m_pageTable;
+        destination.mipLevel = level;
+        destination.origin   = {0, 0, textureIndex};
+        destination.aspect   = TextureAspect::All;
+
+        TextureDataLayout source;
+        source.offset       = 0;
+        source.bytesPerRow  = 4 * stride;
+        source.rowsPerImage = stride;
+        m_uploads->writeTexture(destination, entries.data(), source, {stride, stride, 1});
+        parentEntries.swap(entries);
+    }
+    texture.pageTableChanged = false;
+}
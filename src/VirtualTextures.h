@@ -0,0 +1,194 @@
+#pragma once
+
+#include "GpuMemoryTracker.h"
+#include "UploadManager.h"
+
+#include <glm/glm.hpp>
+#include <webgpu/webgpu.hpp>
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Samples images larger than the texture size limit through a fixed amount of
+ * memory. Each image and its mip levels are cut into square tiles, the pages,
+ * when the image is loaded. The pages are written to a tile store, a file per
+ * image, and the decoded image is dropped. Pages are read back one at a time
+ * and copied on demand into the slots of a single cache texture.
+ * Slots have a border of texels taken from the neighbouring pages, so that
+ * bilinear filtering does not bleed across unrelated tiles. A page table per
+ * image, one texel per page and one mip level per image level, tells the
+ * shader where each page is cached; missing pages point to the slot of their
+ * finest resident ancestor, so something is always drawn.
+ *
+ * Shaders mark the pages they would like to sample in a feedback buffer,
+ * which is copied back to the CPU once per frame while no copy is in flight.
+ * update() then uploads the missing pages, coarser levels first and a bounded
+ * number per frame, and evicts the pages that were not requested for the
+ * longest time. The coarsest page of each image is never evicted.
+ */
+class VirtualTextures
+{
+public:
+    static constexpr uint32_t kInvalid    = UINT32_MAX;
+    static constexpr uint32_t kTileSize   = 128;  // texels of a page, without border
+    static constexpr uint32_t kBorder     = 4;
+    static constexpr uint32_t kSlotSize   = kTileSize + 2 * kBorder;
+    static constexpr uint32_t kCacheSize  = 2048;  // texels per side of the cache texture
+    static constexpr uint32_t kCacheSlots = kCacheSize / kSlotSize;  // per side
+    // Pages per side of the finest level, larger images are downsampled to that
+    static constexpr uint32_t kMaxPages    = 128;
+    static constexpr uint32_t kMaxLevels   = 8;  // log2(kMaxPages) + 1
+    static constexpr uint32_t kMaxTextures = 4;
+    // Feedback words of one texture, one per page of each level of a kMaxPages x kMaxPages page table
+    static constexpr uint32_t kFeedbackWords = (4 * kMaxPages * kMaxPages - 1) / 3;
+
+    struct Stats
+    {
+        uint32_t textures       = 0;
+        uint32_t residentTiles  = 0;
+        uint32_t capacity       = kCacheSlots * kCacheSlots;
+        uint32_t requestedTiles = 0;  // pages marked by the last feedback read back
+        uint32_t frameUploads   = 0;  // pages uploaded by the last update()
+        uint32_t uploads        = 0;
+        uint32_t evictions      = 0;
+        uint32_t readbacks      = 0;
+    };
+
+    // The cache, page tables and feedback buffers are allocated once, through `memory` which must outlive this
+    // Pages and page tables are sent through `uploads`, within its budget.
+    bool init(wgpu::Device device, GpuMemoryTracker* memory, UploadManager* uploads);
+    void terminate();
+
+    // Register the image at `path`, decoded in the background; loading the same path again returns the same index
+    // Returns kInvalid when the image cannot be read or kMaxTextures are already loaded.
+    uint32_t load(const std::filesystem::path& path);
+
+    // (index, pages across, pages down, levels) for the object uniforms, (kInvalid, 0, 0, 0) for kInvalid
+    glm::uvec4 shaderParams(uint32_t texture) const;
+
+    // Copy the feedback of the frame for reading back and clear it, unless the previous copy is still in flight
+    void encodeFeedback(wgpu::CommandEncoder encoder);
+    // To be called once the command buffer of encodeFeedback() is submitted, maps the copy
+    void onSubmitted();
+
+    // Take the decoded images and the feedback read back, upload missing pages and update the page tables
+    // Returns true when a page table changed.
+    bool update();
+
+    // Whether some image is still decoding or some requested page is not resident
+    bool busy() const;
+
+    uint32_t maxUploadsPerFrame() const
+    {
+        return m_maxUploadsPerFrame;
+    }
+    void setMaxUploadsPerFrame(uint32_t count);
+
+    wgpu::TextureView cacheView() const
+    {
+        return m_cacheView;
+    }
+    wgpu::TextureView pageTableView() const
+    {
+        return m_pageTableView;
+    }
+    wgpu::Buffer feedbackBuffer() const
+    {
+        return m_feedbackBuffer;
+    }
+    static uint64_t feedbackBytes()
+    {
+        return uint64_t(kMaxTextures) * kFeedbackWords * sizeof(uint32_t);
+    }
+
+    const Stats& stats() const
+    {
+        return m_stats;
+    }
+
+private:
+    // Of a page with its border, as stored and uploaded
+    static constexpr uint64_t kSlotBytes = 4 * kSlotSize * kSlotSize;
+
+    struct Texture
+    {
+        std::filesystem::path path;
+        uint32_t pagesX     = 1;
+        uint32_t pagesY     = 1;
+        uint32_t levelCount = 1;
+        std::future<bool> loading;            // cutting the pages into the tile store
+        std::filesystem::path tileStorePath;  // pages of each level from the finest, in rows
+        std::ifstream tileStore;              // open once loaded
+        bool ready            = false;
+        bool failed           = false;
+        bool pageTableChanged = false;
+    };
+
+    struct Slot
+    {
+        uint64_t tile     = UINT64_MAX;  // tileKey() of the cached page
+        uint64_t lastUsed = 0;           // feedback readback that last asked for it
+        bool pinned       = false;
+    };
+
+    enum class ReadbackState
+    {
+        Idle,
+        Copied,
+        Mapping,
+        Mapped,
+    };
+
+    static uint64_t tileKey(uint32_t texture, uint32_t level, uint32_t x, uint32_t y);
+    // Position of a page in the tile store of its texture
+    static uint64_t storedTileIndex(uint32_t pagesX, uint32_t pagesY, uint32_t level, uint32_t x, uint32_t y);
+    // Decode the image and write its pages to the tile store, on a background thread
+    static bool cutTiles(const std::filesystem::path& path,
+                         const std::filesystem::path& tileStorePath,
+                         uint32_t pagesX,
+                         uint32_t pagesY,
+                         uint32_t levelCount);
+    // Texels of a page and of its border, wrapping around the image; levels smaller than a page are stretched
+    static void cutTile(const std::vector<unsigned char>& image,
+                        uint32_t pagesX,
+                        uint32_t pagesY,
+                        uint32_t level,
+                        uint32_t x,
+                        uint32_t y,
+                        unsigned char* pixels);
+    // Offset of the feedback words of a level, within those of a texture
+    static uint32_t levelOffset(uint32_t level);
+    void readFeedback();
+    // A free slot, or the least recently used one that was not requested by the last feedback
+    uint32_t allocateSlot();
+    bool uploadTile(uint64_t tile, uint32_t slot);
+    void writePageTable(uint32_t texture);
+
+private:
+    wgpu::Device m_device         = nullptr;
+    GpuMemoryTracker* m_memory    = nullptr;
+    UploadManager* m_uploads      = nullptr;
+    uint32_t m_maxUploadsPerFrame = 8;
+    std::vector<Texture> m_textures;
+    Stats m_stats;
+
+    wgpu::Texture m_cache             = nullptr;
+    wgpu::TextureView m_cacheView     = nullptr;
+    wgpu::Texture m_pageTable         = nullptr;  // one layer per texture
+    wgpu::TextureView m_pageTableView = nullptr;
+    std::vector<Slot> m_slots;
+    std::unordered_map<uint64_t, uint32_t> m_residentTiles;  // tileKey() to slot
+    std::vector<uint64_t> m_requestedTiles;                  // missing pages of the last feedback, coarsest first
+
+    wgpu::Buffer m_feedbackBuffer = nullptr;
+    wgpu::Buffer m_readbackBuffer = nullptr;
+    ReadbackState m_readbackState = ReadbackState::Idle;
+    std::unique_ptr<wgpu::BufferMapCallback> m_mapCallback;
+    uint64_t m_feedbackFrame = 0;  // readbacks done
+};
@@ -16,6 +16,9 @@
 
 // CHANGELOG
 // (minor and older changes stripped away, please see git history for details)
+//  2026-10-18: Report the size of the font texture in ImGui_ImplWGPU_FrameStats, for memory accounting.
+//  2026-10-18: Bounded the image bind groups with a least recently used cache. Added ImGui_ImplWGPU_InvalidateImage() and ImGui_ImplWGPU_InvalidateAllImages().
+//  2026-10-18: Write draw lists straight into ring allocated regions of persistent buffers, grown geometrically. Added ImGui_ImplWGPU_GetFrameStats().
 //  2024-01-22: Added configurable PipelineMultisampleState struct. (#7240)
 //  2024-01-22: (Breaking) ImGui_ImplWGPU_Init() now takes a ImGui_ImplWGPU_InitInfo structure instead of variety of parameters, allowing for easier further changes.
 //  2024-01-22: Fixed pipeline layout leak. (#7245)
@@ -39,6 +42,7 @@
 #ifndef IMGUI_DISABLE
 #include "imgui_impl_wgpu.h"
 #include <limits.h>
+#include <string.h>
 #include <webgpu/webgpu.h>
 
 // Dear ImGui prototypes from imgui_internal.h
@@ -46,6 +50,14 @@ extern ImGuiID ImHashData(const void* data_p, size_t data_size, ImU32 seed = 0);
 #define MEMALIGN(_SIZE,_ALIGN)        (((_SIZE) + ((_ALIGN) - 1)) & ~((_ALIGN) - 1))    // Memory align (copied from IM_ALIGN() macro).
 
 // WebGPU data
+struct ImageBindGroupEntry
+{
+    ImGuiID             Key;                            // Hash of the texture view and of the image generation it was created in
+    WGPUTextureView     TextureView;
+    WGPUBindGroup       BindGroup;
+    unsigned int        LastUsedFrame;
+};
+
 struct RenderResources
 {
     WGPUTexture         FontTexture = nullptr;          // Font texture
@@ -53,19 +65,30 @@ struct RenderResources
     WGPUSampler         Sampler = nullptr;              // Sampler for the font texture
     WGPUBuffer          Uniforms = nullptr;             // Shader uniforms
     WGPUBindGroup       CommonBindGroup = nullptr;      // Resources bind-group to bind the common resources to pipeline
-    ImGuiStorage        ImageBindGroups;                // Resources bind-group to bind the font/image resources to pipeline (this is a key->value map)
+    ImGuiStorage        ImageBindGroups;                // Index + 1 in ImageBindGroupEntries of the bind-group of each user image (this is a key->value map)
+    ImVector<ImageBindGroupEntry> ImageBindGroupEntries; // Resources bind-groups to bind the user images to pipeline, at most MaxImageBindGroups unless all are used by the frame
     WGPUBindGroup       ImageBindGroup = nullptr;       // Default font-resource of Dear ImGui
     WGPUBindGroupLayout ImageBindGroupLayout = nullptr; // Cache layout used for the image bind group. Avoids allocating unnecessary JS objects when working with WebASM
 };
 
+// A persistent buffer in which each frame writes its data after the one of the previous frame, wrapping around at
+// the end. The regions of the last NumFramesInFlight frames are kept, older ones are recycled.
+struct RingBuffer
+{
+    WGPUBuffer  Buffer = nullptr;
+    uint64_t    Capacity = 0;               // In bytes
+    uint64_t    Head = 0;                   // Start of the next region
+    uint64_t    Used = 0;                   // Bytes held by the frames in flight, including the gaps left by wrapping
+    uint64_t*   FrameUsed = nullptr;        // Bytes held by each frame in flight
+};
+
+// Regions of the ring buffers written for the current frame
 struct FrameResources
 {
-    WGPUBuffer  IndexBuffer;
-    WGPUBuffer  VertexBuffer;
-    ImDrawIdx*  IndexBufferHost;
-    ImDrawVert* VertexBufferHost;
-    int         IndexBufferSize;
-    int         VertexBufferSize;
+    uint64_t    VertexOffset = 0;
+    uint64_t    VertexSize = 0;
+    uint64_t    IndexOffset = 0;
+    uint64_t    IndexSize = 0;
 };
 
 struct Uniforms
@@ -84,9 +107,14 @@ struct ImGui_ImplWGPU_Data
     WGPURenderPipeline      pipelineState = nullptr;
 
     RenderResources         renderResources;
-    FrameResources*         pFrameResources = nullptr;
+    RingBuffer              vertexRing;
+    RingBuffer              indexRing;
+    FrameResources          frameResources;
     unsigned int            numFramesInFlight = 0;
     unsigned int            frameIndex = UINT_MAX;
+    unsigned int            imageGeneration = 0;    // Incremented by ImGui_ImplWGPU_InvalidateAllImages(), tags the keys of the image bind-groups
+    ImGui_ImplWGPU_FrameStats frameStats;
+    int                     totalReallocations = 0;
 };
 
 // Backend data stored in io.BackendRendererUserData to allow support for multiple Dear ImGui contexts
@@ -154,18 +182,6 @@ fn main(in: VertexOutput) -> @location(0) vec4<f32> {
 }
 )";
 
-static void SafeRelease(ImDrawIdx*& res)
-{
-    if (res)
-        delete[] res;
-    res = nullptr;
-}
-static void SafeRelease(ImDrawVert*& res)
-{
-    if (res)
-        delete[] res;
-    res = nullptr;
-}
 static void SafeRelease(WGPUBindGroupLayout& res)
 {
     if (res)
@@ -230,14 +246,94 @@ static void SafeRelease(RenderResources& res)
     SafeRelease(res.CommonBindGroup);
     SafeRelease(res.ImageBindGroup);
     SafeRelease(res.ImageBindGroupLayout);
+    for (ImageBindGroupEntry& entry : res.ImageBindGroupEntries)
+        SafeRelease(entry.BindGroup);
+    res.ImageBindGroupEntries.clear();
+    res.ImageBindGroups.Clear();
 };
 
-static void SafeRelease(FrameResources& res)
+static void SafeRelease(RingBuffer& res, unsigned int num_frames_in_flight)
+{
+    SafeRelease(res.Buffer);
+    res.Capacity = 0;
+    res.Head = 0;
+    res.Used = 0;
+    memset(res.FrameUsed, 0, num_frames_in_flight * sizeof(uint64_t));
+}
+
+// Retire the region written NumFramesInFlight frames ago, which the GPU is done with
+static void ImGui_ImplWGPU_RingBeginFrame(RingBuffer& ring, unsigned int frame_slot)
+{
+    ring.Used -= ring.FrameUsed[frame_slot];
+    ring.FrameUsed[frame_slot] = 0;
+}
+
+// Allocate a region of the ring for the current frame, growing the buffer when the frames in flight leave no room
+static bool ImGui_ImplWGPU_RingAllocate(RingBuffer& ring, unsigned int frame_slot, uint64_t size, uint64_t min_capacity, WGPUBufferUsageFlags usage, const char* label, uint64_t* offset)
+{
+    ImGui_ImplWGPU_Data* bd = ImGui_ImplWGPU_GetBackendData();
+    size = MEMALIGN(size, 4);
+
+    // A region does not wrap around, the end of the buffer is skipped instead
+    uint64_t start = ring.Head;
+    uint64_t taken = size;
+    if (start + size > ring.Capacity)
+    {
+        taken += ring.Capacity - start;
+        start = 0;
+    }
+
+    if (ring.Buffer == nullptr || ring.Used + taken > ring.Capacity)
+    {
+        // Double the capacity until several frames of this size fit. The frames in flight keep the previous buffer
+        // alive until the GPU is done with it, so it is released but not destroyed.
+        uint64_t capacity = ring.Capacity > 0 ? ring.Capacity * 2 : MEMALIGN(min_capacity, 4);
+        while (capacity < size * bd->numFramesInFlight)
+            capacity *= 2;
+        SafeRelease(ring, bd->numFramesInFlight);
+
+        WGPUBufferDescriptor desc =
+        {
+            nullptr,
+            label,
+            WGPUBufferUsage_CopyDst | usage,
+            capacity,
+            false
+        };
+        ring.Buffer = wgpuDeviceCreateBuffer(bd->wgpuDevice, &desc);
+        if (!ring.Buffer)
+            return false;
+        ring.Capacity = capacity;
+        bd->frameStats.Reallocations++;
+        bd->totalReallocations++;
+
+        start = 0;
+        taken = size;
+    }
+
+    ring.Head = start + size;
+    ring.Used += taken;
+    ring.FrameUsed[frame_slot] += taken;
+    *offset = start;
+    return true;
+}
+
+// Write data straight from its source, without gathering it in an intermediate copy first
+static void ImGui_ImplWGPU_WriteRegion(WGPUBuffer buffer, uint64_t offset, const void* data, uint64_t size)
 {
-    SafeRelease(res.IndexBuffer);
-    SafeRelease(res.VertexBuffer);
-    SafeRelease(res.IndexBufferHost);
-    SafeRelease(res.VertexBufferHost);
+    ImGui_ImplWGPU_Data* bd = ImGui_ImplWGPU_GetBackendData();
+
+    // Writes must be multiples of 4 bytes, the last bytes of an odd count of 16-bit indices go through a padded copy
+    uint64_t aligned_size = size & ~(uint64_t)3;
+    if (aligned_size > 0)
+        wgpuQueueWriteBuffer(bd->defaultQueue, buffer, offset, data, aligned_size);
+    if (aligned_size < size)
+    {
+        unsigned char tail[4] = {};
+        memcpy(tail, (const unsigned char*)data + aligned_size, size - aligned_size);
+        wgpuQueueWriteBuffer(bd->defaultQueue, buffer, offset + aligned_size, tail, sizeof(tail));
+    }
+    bd->frameStats.UploadedBytes += size;
 }
 
 static WGPUProgrammableStageDescriptor ImGui_ImplWGPU_CreateShaderModule(const char* wgsl_source)
@@ -269,6 +365,83 @@ static WGPUBindGroup ImGui_ImplWGPU_CreateImageBindGroup(WGPUBindGroupLayout lay
     return wgpuDeviceCreateBindGroup(bd->wgpuDevice, &image_bg_descriptor);
 }
 
+static ImGuiID ImGui_ImplWGPU_ImageKey(ImTextureID tex_id)
+{
+    ImGui_ImplWGPU_Data* bd = ImGui_ImplWGPU_GetBackendData();
+    return ImHashData(&tex_id, sizeof(tex_id), bd->imageGeneration);
+}
+
+// Release a cached image bind-group. Passes already encoded hold their own reference to it.
+static void ImGui_ImplWGPU_RemoveImageBindGroup(int index)
+{
+    ImGui_ImplWGPU_Data* bd = ImGui_ImplWGPU_GetBackendData();
+    RenderResources& res = bd->renderResources;
+    ImageBindGroupEntry& entry = res.ImageBindGroupEntries[index];
+    SafeRelease(entry.BindGroup);
+    for (ImGuiStoragePair* it = res.ImageBindGroups.Data.begin(); it != res.ImageBindGroups.Data.end(); it++)
+        if (it->key == entry.Key)
+        {
+            res.ImageBindGroups.Data.erase(it);
+            break;
+        }
+
+    // Move the last entry in the hole
+    int last = res.ImageBindGroupEntries.Size - 1;
+    if (index != last)
+    {
+        entry = res.ImageBindGroupEntries[last];
+        res.ImageBindGroups.SetInt(entry.Key, index + 1);
+    }
+    res.ImageBindGroupEntries.pop_back();
+}
+
+// Bind-group of a user image, created on first use. Beyond MaxImageBindGroups, the least recently used one that the
+// current frame does not use is evicted first.
+static WGPUBindGroup ImGui_ImplWGPU_GetImageBindGroup(ImTextureID tex_id)
+{
+    ImGui_ImplWGPU_Data* bd = ImGui_ImplWGPU_GetBackendData();
+    RenderResources& res = bd->renderResources;
+    if ((WGPUTextureView)tex_id == res.FontTextureView)
+        return res.ImageBindGroup;
+
+    ImGuiID key = ImGui_ImplWGPU_ImageKey(tex_id);
+    int index = res.ImageBindGroups.GetInt(key) - 1;
+    if (index >= 0 && res.ImageBindGroupEntries[index].TextureView == (WGPUTextureView)tex_id)
+    {
+        bd->frameStats.ImageBindGroupHits++;
+        res.ImageBindGroupEntries[index].LastUsedFrame = bd->frameIndex;
+        return res.ImageBindGroupEntries[index].BindGroup;
+    }
+    bd->frameStats.ImageBindGroupMisses++;
+    if (index >= 0)
+        ImGui_ImplWGPU_RemoveImageBindGroup(index); // Hash collision
+
+    if (res.ImageBindGroupEntries.Size >= bd->initInfo.MaxImageBindGroups)
+    {
+        int oldest = -1;
+        for (int i = 0; i < res.ImageBindGroupEntries.Size; i++)
+        {
+            const ImageBindGroupEntry& entry = res.ImageBindGroupEntries[i];
+            if (entry.LastUsedFrame != bd->frameIndex && (oldest < 0 || bd->frameIndex - entry.LastUsedFrame > bd->frameIndex - res.ImageBindGroupEntries[oldest].LastUsedFrame))
+                oldest = i;
+        }
+        if (oldest >= 0)
+        {
+            ImGui_ImplWGPU_RemoveImageBindGroup(oldest);
+            bd->frameStats.ImageBindGroupEvictions++;
+        }
+    }
+
+    ImageBindGroupEntry entry;
+    entry.Key = key;
+    entry.TextureView = (WGPUTextureView)tex_id;
+    entry.BindGroup = ImGui_ImplWGPU_CreateImageBindGroup(res.ImageBindGroupLayout, entry.TextureView);
+    entry.LastUsedFrame = bd->frameIndex;
+    res.ImageBindGroupEntries.push_back(entry);
+    res.ImageBindGroups.SetInt(key, res.ImageBindGroupEntries.Size);
+    return entry.BindGroup;
+}
+
 static void ImGui_ImplWGPU_SetupRenderState(ImDrawData* draw_data, WGPURenderPassEncoder ctx, FrameResources* fr)
 {
     ImGui_ImplWGPU_Data* bd = ImGui_ImplWGPU_GetBackendData();
@@ -325,8 +498,8 @@ static void ImGui_ImplWGPU_SetupRenderState(ImDrawData* draw_data, WGPURenderPas
     wgpuRenderPassEncoderSetViewport(ctx, 0, 0, draw_data->FramebufferScale.x * draw_data->DisplaySize.x, draw_data->FramebufferScale.y * draw_data->DisplaySize.y, 0, 1);
 
     // Bind shader and vertex buffers
-    wgpuRenderPassEncoderSetVertexBuffer(ctx, 0, fr->VertexBuffer, 0, fr->VertexBufferSize * sizeof(ImDrawVert));
-    wgpuRenderPassEncoderSetIndexBuffer(ctx, fr->IndexBuffer, sizeof(ImDrawIdx) == 2 ? WGPUIndexFormat_Uint16 : WGPUIndexFormat_Uint32, 0, fr->IndexBufferSize * sizeof(ImDrawIdx));
+    wgpuRenderPassEncoderSetVertexBuffer(ctx, 0, bd->vertexRing.Buffer, fr->VertexOffset, fr->VertexSize);
+    wgpuRenderPassEncoderSetIndexBuffer(ctx, bd->indexRing.Buffer, sizeof(ImDrawIdx) == 2 ? WGPUIndexFormat_Uint16 : WGPUIndexFormat_Uint32, fr->IndexOffset, fr->IndexSize);
     wgpuRenderPassEncoderSetPipeline(ctx, bd->pipelineState);
     wgpuRenderPassEncoderSetBindGroup(ctx, 0, bd->renderResources.CommonBindGroup, 0, nullptr);
 
@@ -346,79 +519,51 @@ void ImGui_ImplWGPU_RenderDrawData(ImDrawData* draw_data, WGPURenderPassEncoder
         return;
 
     // FIXME: Assuming that this only gets called once per frame!
-    // If not, we can't just re-allocate the IB or VB, we'll have to do a proper allocator.
+    // The regions of the ring buffers are recycled after NumFramesInFlight calls.
     ImGui_ImplWGPU_Data* bd = ImGui_ImplWGPU_GetBackendData();
     bd->frameIndex = bd->frameIndex + 1;
-    FrameResources* fr = &bd->pFrameResources[bd->frameIndex % bd->numFramesInFlight];
-
-    // Create and grow vertex/index buffers if needed
-    if (fr->VertexBuffer == nullptr || fr->VertexBufferSize < draw_data->TotalVtxCount)
-    {
-        if (fr->VertexBuffer)
-        {
-            wgpuBufferDestroy(fr->VertexBuffer);
-            wgpuBufferRelease(fr->VertexBuffer);
-        }
-        SafeRelease(fr->VertexBufferHost);
-        fr->VertexBufferSize = draw_data->TotalVtxCount + 5000;
-
-        WGPUBufferDescriptor vb_desc =
-        {
-            nullptr,
-            "Dear ImGui Vertex buffer",
-            WGPUBufferUsage_CopyDst | WGPUBufferUsage_Vertex,
-            MEMALIGN(fr->VertexBufferSize * sizeof(ImDrawVert), 4),
-            false
-        };
-        fr->VertexBuffer = wgpuDeviceCreateBuffer(bd->wgpuDevice, &vb_desc);
-        if (!fr->VertexBuffer)
-            return;
-
-        fr->VertexBufferHost = new ImDrawVert[fr->VertexBufferSize];
-    }
-    if (fr->IndexBuffer == nullptr || fr->IndexBufferSize < draw_data->TotalIdxCount)
-    {
-        if (fr->IndexBuffer)
-        {
-            wgpuBufferDestroy(fr->IndexBuffer);
-            wgpuBufferRelease(fr->IndexBuffer);
-        }
-        SafeRelease(fr->IndexBufferHost);
-        fr->IndexBufferSize = draw_data->TotalIdxCount + 10000;
-
-        WGPUBufferDescriptor ib_desc =
-        {
-            nullptr,
-            "Dear ImGui Index buffer",
-            WGPUBufferUsage_CopyDst | WGPUBufferUsage_Index,
-            MEMALIGN(fr->IndexBufferSize * sizeof(ImDrawIdx), 4),
-            false
-        };
-        fr->IndexBuffer = wgpuDeviceCreateBuffer(bd->wgpuDevice, &ib_desc);
-        if (!fr->IndexBuffer)
-            return;
-
-        fr->IndexBufferHost = new ImDrawIdx[fr->IndexBufferSize];
-    }
+    unsigned int frame_slot = bd->frameIndex % bd->numFramesInFlight;
+    FrameResources* fr = &bd->frameResources;
+    bd->frameStats.UploadedBytes = 0;
+    bd->frameStats.Reallocations = 0;
+    ImGui_ImplWGPU_RingBeginFrame(bd->vertexRing, frame_slot);
+    ImGui_ImplWGPU_RingBeginFrame(bd->indexRing, frame_slot);
+
+    // The indices of each draw list start at a multiple of 4 bytes, as required by wgpuQueueWriteBuffer()
+    static_assert(sizeof(ImDrawVert) % 4 == 0, "Vertices are written at offsets that must be multiples of 4 bytes");
+    uint64_t idx_size = 0;
+    for (int n = 0; n < draw_data->CmdListsCount; n++)
+        idx_size += MEMALIGN(draw_data->CmdLists[n]->IdxBuffer.Size * sizeof(ImDrawIdx), 4);
+    fr->VertexSize = MEMALIGN(draw_data->TotalVtxCount * sizeof(ImDrawVert), 4);
+    fr->IndexSize = idx_size;
+    if (fr->VertexSize == 0 || fr->IndexSize == 0)
+        return;
+    if (!ImGui_ImplWGPU_RingAllocate(bd->vertexRing, frame_slot, fr->VertexSize, 5000 * sizeof(ImDrawVert), WGPUBufferUsage_Vertex, "Dear ImGui Vertex buffer", &fr->VertexOffset))
+        return;
+    if (!ImGui_ImplWGPU_RingAllocate(bd->indexRing, frame_slot, fr->IndexSize, 10000 * sizeof(ImDrawIdx), WGPUBufferUsage_Index, "Dear ImGui Index buffer", &fr->IndexOffset))
+        return;
 
-    // Upload vertex/index data into a single contiguous GPU buffer
-    ImDrawVert* vtx_dst = (ImDrawVert*)fr->VertexBufferHost;
-    ImDrawIdx* idx_dst = (ImDrawIdx*)fr->IndexBufferHost;
+    // Upload each draw list into the regions of the frame
+    uint64_t vtx_write_offset = fr->VertexOffset;
+    uint64_t idx_write_offset = fr->IndexOffset;
     for (int n = 0; n < draw_data->CmdListsCount; n++)
     {
         const ImDrawList* cmd_list = draw_data->CmdLists[n];
-        memcpy(vtx_dst, cmd_list->VtxBuffer.Data, cmd_list->VtxBuffer.Size * sizeof(ImDrawVert));
-        memcpy(idx_dst, cmd_list->IdxBuffer.Data, cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx));
-        vtx_dst += cmd_list->VtxBuffer.Size;
-        idx_dst += cmd_list->IdxBuffer.Size;
+        uint64_t vtx_list_size = cmd_list->VtxBuffer.Size * sizeof(ImDrawVert);
+        uint64_t idx_list_size = cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx);
+        ImGui_ImplWGPU_WriteRegion(bd->vertexRing.Buffer, vtx_write_offset, cmd_list->VtxBuffer.Data, vtx_list_size);
+        ImGui_ImplWGPU_WriteRegion(bd->indexRing.Buffer, idx_write_offset, cmd_list->IdxBuffer.Data, idx_list_size);
+        vtx_write_offset += vtx_list_size;
+        idx_write_offset += MEMALIGN(idx_list_size, 4);
     }
-    int64_t vb_write_size = MEMALIGN((char*)vtx_dst - (char*)fr->VertexBufferHost, 4);
-    int64_t ib_write_size = MEMALIGN((char*)idx_dst - (char*)fr->IndexBufferHost, 4);
-    wgpuQueueWriteBuffer(bd->defaultQueue, fr->VertexBuffer, 0, fr->VertexBufferHost, vb_write_size);
-    wgpuQueueWriteBuffer(bd->defaultQueue, fr->IndexBuffer,  0, fr->IndexBufferHost,  ib_write_size);
+    bd->frameStats.VertexCapacity = bd->vertexRing.Capacity;
+    bd->frameStats.IndexCapacity = bd->indexRing.Capacity;
+    bd->frameStats.TotalReallocations = bd->totalReallocations;
+    bd->frameStats.ImageBindGroups = bd->renderResources.ImageBindGroupEntries.Size;
 
     // Setup desired render state
     ImGui_ImplWGPU_SetupRenderState(draw_data, pass_encoder, fr);
+    WGPUBindGroup bound_image_bind_group = nullptr;
 
     // Render command lists
     // (Because we merged all buffers into a single one, we maintain our own offset into them)
@@ -440,22 +585,16 @@ void ImGui_ImplWGPU_RenderDrawData(ImDrawData* draw_data, WGPURenderPassEncoder
                     ImGui_ImplWGPU_SetupRenderState(draw_data, pass_encoder, fr);
                 else
                     pcmd->UserCallback(cmd_list, pcmd);
+                bound_image_bind_group = nullptr;
             }
             else
             {
-                // Bind custom texture
-                ImTextureID tex_id = pcmd->GetTexID();
-                ImGuiID tex_id_hash = ImHashData(&tex_id, sizeof(tex_id));
-                auto bind_group = bd->renderResources.ImageBindGroups.GetVoidPtr(tex_id_hash);
-                if (bind_group)
+                // Bind custom texture, unless the previous command already did
+                WGPUBindGroup image_bind_group = ImGui_ImplWGPU_GetImageBindGroup(pcmd->GetTexID());
+                if (image_bind_group != bound_image_bind_group)
                 {
-                    wgpuRenderPassEncoderSetBindGroup(pass_encoder, 1, (WGPUBindGroup)bind_group, 0, nullptr);
-                }
-                else
-                {
-                    WGPUBindGroup image_bind_group = ImGui_ImplWGPU_CreateImageBindGroup(bd->renderResources.ImageBindGroupLayout, (WGPUTextureView)tex_id);
-                    bd->renderResources.ImageBindGroups.SetVoidPtr(tex_id_hash, image_bind_group);
                     wgpuRenderPassEncoderSetBindGroup(pass_encoder, 1, image_bind_group, 0, nullptr);
+                    bound_image_bind_group = image_bind_group;
                 }
 
                 // Project scissor/clipping rectangles into framebuffer space
@@ -475,7 +614,7 @@ void ImGui_ImplWGPU_RenderDrawData(ImDrawData* draw_data, WGPURenderPassEncoder
                 wgpuRenderPassEncoderDrawIndexed(pass_encoder, pcmd->ElemCount, 1, pcmd->IdxOffset + global_idx_offset, pcmd->VtxOffset + global_vtx_offset, 0);
             }
         }
-        global_idx_offset += cmd_list->IdxBuffer.Size;
+        global_idx_offset += (int)(MEMALIGN(cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx), 4) / sizeof(ImDrawIdx));
         global_vtx_offset += cmd_list->VtxBuffer.Size;
     }
 }
@@ -502,6 +641,7 @@ static void ImGui_ImplWGPU_CreateFontsTexture()
         tex_desc.mipLevelCount = 1;
         tex_desc.usage = WGPUTextureUsage_CopyDst | WGPUTextureUsage_TextureBinding;
         bd->renderResources.FontTexture = wgpuDeviceCreateTexture(bd->wgpuDevice, &tex_desc);
+        bd->frameStats.FontTextureBytes = (size_t)width * height * 4;
 
         WGPUTextureViewDescriptor tex_view_desc = {};
         tex_view_desc.format = WGPUTextureFormat_RGBA8Unorm;
@@ -695,7 +835,6 @@ bool ImGui_ImplWGPU_CreateDeviceObjects()
     WGPUBindGroup image_bind_group = ImGui_ImplWGPU_CreateImageBindGroup(bg_layouts[1], bd->renderResources.FontTextureView);
     bd->renderResources.ImageBindGroup = image_bind_group;
     bd->renderResources.ImageBindGroupLayout = bg_layouts[1];
-    bd->renderResources.ImageBindGroups.SetVoidPtr(ImHashData(&bd->renderResources.FontTextureView, sizeof(ImTextureID)), image_bind_group);
 
     SafeRelease(vertex_shader_desc.module);
     SafeRelease(pixel_shader_desc.module);
@@ -717,8 +856,8 @@ void ImGui_ImplWGPU_InvalidateDeviceObjects()
     ImGuiIO& io = ImGui::GetIO();
     io.Fonts->SetTexID(0); // We copied g_pFontTextureView to io.Fonts->TexID so let's clear that as well.
 
-    for (unsigned int i = 0; i < bd->numFramesInFlight; i++)
-        SafeRelease(bd->pFrameResources[i]);
+    SafeRelease(bd->vertexRing, bd->numFramesInFlight);
+    SafeRelease(bd->indexRing, bd->numFramesInFlight);
 }
 
 bool ImGui_ImplWGPU_Init(ImGui_ImplWGPU_InitInfo* init_info)
@@ -746,22 +885,14 @@ bool ImGui_ImplWGPU_Init(ImGui_ImplWGPU_InitInfo* init_info)
     bd->renderResources.Sampler = nullptr;
     bd->renderResources.Uniforms = nullptr;
     bd->renderResources.CommonBindGroup = nullptr;
-    bd->renderResources.ImageBindGroups.Data.reserve(100);
+    bd->renderResources.ImageBindGroups.Data.reserve(init_info->MaxImageBindGroups);
+    bd->renderResources.ImageBindGroupEntries.reserve(init_info->MaxImageBindGroups);
     bd->renderResources.ImageBindGroup = nullptr;
     bd->renderResources.ImageBindGroupLayout = nullptr;
 
-    // Create buffers with a default size (they will later be grown as needed)
-    bd->pFrameResources = new FrameResources[bd->numFramesInFlight];
-    for (unsigned int i = 0; i < bd->numFramesInFlight; i++)
-    {
-        FrameResources* fr = &bd->pFrameResources[i];
-        fr->IndexBuffer = nullptr;
-        fr->VertexBuffer = nullptr;
-        fr->IndexBufferHost = nullptr;
-        fr->VertexBufferHost = nullptr;
-        fr->IndexBufferSize = 10000;
-        fr->VertexBufferSize = 5000;
-    }
+    // The ring buffers are created by the first frame, then grown as needed
+    bd->vertexRing.FrameUsed = new uint64_t[bd->numFramesInFlight]();
+    bd->indexRing.FrameUsed = new uint64_t[bd->numFramesInFlight]();
 
     return true;
 }
@@ -773,8 +904,10 @@ void ImGui_ImplWGPU_Shutdown()
     ImGuiIO& io = ImGui::GetIO();
 
     ImGui_ImplWGPU_InvalidateDeviceObjects();
-    delete[] bd->pFrameResources;
-    bd->pFrameResources = nullptr;
+    delete[] bd->vertexRing.FrameUsed;
+    delete[] bd->indexRing.FrameUsed;
+    bd->vertexRing.FrameUsed = nullptr;
+    bd->indexRing.FrameUsed = nullptr;
     wgpuQueueRelease(bd->defaultQueue);
     bd->wgpuDevice = nullptr;
     bd->numFramesInFlight = 0;
@@ -786,6 +919,30 @@ void ImGui_ImplWGPU_Shutdown()
     IM_DELETE(bd);
 }
 
+void ImGui_ImplWGPU_InvalidateImage(ImTextureID tex_id)
+{
+    ImGui_ImplWGPU_Data* bd = ImGui_ImplWGPU_GetBackendData();
+    RenderResources& res = bd->renderResources;
+    // Entries of previous generations may still reference the view as well
+    for (int i = res.ImageBindGroupEntries.Size - 1; i >= 0; i--)
+        if (res.ImageBindGroupEntries[i].TextureView == (WGPUTextureView)tex_id)
+            ImGui_ImplWGPU_RemoveImageBindGroup(i);
+}
+
+void ImGui_ImplWGPU_InvalidateAllImages()
+{
+    // The bind-groups of the previous generation can no longer be found, they are evicted as soon as they are the
+    // least recently used ones
+    ImGui_ImplWGPU_Data* bd = ImGui_ImplWGPU_GetBackendData();
+    bd->imageGeneration++;
+}
+
+ImGui_ImplWGPU_FrameStats ImGui_ImplWGPU_GetFrameStats()
+{
+    ImGui_ImplWGPU_Data* bd = ImGui_ImplWGPU_GetBackendData();
+    return bd ? bd->frameStats : ImGui_ImplWGPU_FrameStats();
+}
+
 void ImGui_ImplWGPU_NewFrame()
 {
     ImGui_ImplWGPU_Data* bd = ImGui_ImplWGPU_GetBackendData();
@@ -28,6 +28,7 @@ struct ImGui_ImplWGPU_InitInfo
     WGPUTextureFormat       RenderTargetFormat = WGPUTextureFormat_Undefined;
     WGPUTextureFormat       DepthStencilFormat = WGPUTextureFormat_Undefined;
     WGPUMultisampleState    PipelineMultisampleState = {};
+    int                     MaxImageBindGroups = 64;    // Bind-groups of user images kept, the least recently used ones are released beyond
 
     ImGui_ImplWGPU_InitInfo()
     {
@@ -37,11 +38,32 @@ struct ImGui_ImplWGPU_InitInfo
     }
 };
 
+// Upload statistics of the last call to ImGui_ImplWGPU_RenderDrawData()
+struct ImGui_ImplWGPU_FrameStats
+{
+    size_t                  UploadedBytes = 0;      // Vertex and index data written to the GPU
+    int                     Reallocations = 0;      // Buffers grown during the frame
+    int                     TotalReallocations = 0;
+    size_t                  VertexCapacity = 0;     // In bytes
+    size_t                  IndexCapacity = 0;
+    int                     ImageBindGroups = 0;        // Cached bind-groups of user images
+    int                     ImageBindGroupHits = 0;     // Counted since initialization, like the misses and evictions
+    int                     ImageBindGroupMisses = 0;
+    int                     ImageBindGroupEvictions = 0;
+    size_t                  FontTextureBytes = 0;       // Atlas uploaded by ImGui_ImplWGPU_CreateFontsTexture()
+};
+
 // Follow "Getting Started" link and check examples/ folder to learn about using backends!
 IMGUI_IMPL_API bool ImGui_ImplWGPU_Init(ImGui_ImplWGPU_InitInfo* init_info);
 IMGUI_IMPL_API void ImGui_ImplWGPU_Shutdown();
 IMGUI_IMPL_API void ImGui_ImplWGPU_NewFrame();
 IMGUI_IMPL_API void ImGui_ImplWGPU_RenderDrawData(ImDrawData* draw_data, WGPURenderPassEncoder pass_encoder);
+IMGUI_IMPL_API ImGui_ImplWGPU_FrameStats ImGui_ImplWGPU_GetFrameStats();
+
+// Call before releasing a texture view used as ImTextureID, so that a view created later at the same address does not
+// get its stale bind-group. After recreating all the user textures at once, prefer invalidating all of them.
+IMGUI_IMPL_API void ImGui_ImplWGPU_InvalidateImage(ImTextureID tex_id);
+IMGUI_IMPL_API void ImGui_ImplWGPU_InvalidateAllImages();
 
 // Use if you want to reset your rendering device without losing Dear ImGui state.
 IMGUI_IMPL_API void ImGui_ImplWGPU_InvalidateDeviceObjects();